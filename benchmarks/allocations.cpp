@@ -0,0 +1,270 @@
+/**********************************************************************
+File name: allocations.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "dragonstash/backend/in_memory.hpp"
+#include "dragonstash/fs.hpp"
+#include "dragonstash/request_arena.hpp"
+
+/* Count the calls into the global allocator per request for the metadata
+ * requests (lookup, getattr, opendir, readdir, readdirplus), with the request
+ * arenas disabled and enabled, once with the backend connected and once with
+ * it disconnected (which leaves only the cache in the request path).
+ *
+ * Every request runs in its own RequestScope, like it does when dispatched
+ * by the FUSE session. Cleanup requests (forget) are not counted.
+ *
+ * Usage: bench-allocations [requests per operation]
+ */
+
+static std::atomic<std::uint64_t> global_allocations(0);
+
+void *operator new(std::size_t size)
+{
+    global_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *result = std::malloc(size > 0 ? size : 1)) {
+        return result;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static constexpr unsigned FILES = 64;
+
+/**
+ * Reply sink standing in for the FUSE kernel channel; one per request.
+ */
+struct BenchRequest {
+    Dragonstash::Filesystem *fs;
+    int error;
+    fuse_ino_t ino;
+};
+
+static BenchRequest &sink(fuse_req_t req)
+{
+    return *reinterpret_cast<BenchRequest*>(req);
+}
+
+static void install_reply_sink()
+{
+    Fuse::backend.req_userdata = [](fuse_req_t req) -> void* {
+        return sink(req).fs;
+    };
+    Fuse::backend.req_ctx = [](fuse_req_t) -> const fuse_ctx* {
+        return nullptr;
+    };
+    Fuse::backend.reply_none = [](fuse_req_t) {};
+    Fuse::backend.reply_err = [](fuse_req_t req, int error) {
+        sink(req).error = error;
+        return 0;
+    };
+    Fuse::backend.reply_entry = [](fuse_req_t req, const fuse_entry_param *e) {
+        sink(req).ino = e->ino;
+        return 0;
+    };
+    Fuse::backend.reply_attr = [](fuse_req_t, const struct stat *, double) {
+        return 0;
+    };
+    Fuse::backend.reply_open = [](fuse_req_t, const fuse_file_info *) {
+        return 0;
+    };
+    Fuse::backend.reply_buf = [](fuse_req_t, const char *, size_t) {
+        return 0;
+    };
+}
+
+static Fuse::Request request(BenchRequest &req)
+{
+    return Fuse::Request(reinterpret_cast<fuse_req_t>(&req));
+}
+
+struct Tree {
+    ino_t dir;
+    std::vector<std::string> names;
+    std::vector<ino_t> files;
+};
+
+static Tree warm_up(Dragonstash::Filesystem &fs)
+{
+    Tree tree;
+    BenchRequest req{&fs};
+    fs.lookup(request(req), Dragonstash::ROOT_INO, "dir");
+    tree.dir = req.ino;
+
+    BenchRequest open_req{&fs};
+    fuse_file_info fi{};
+    fs.opendir(request(open_req), tree.dir, &fi);
+    for (unsigned i = 0; i < FILES; ++i) {
+        tree.names.push_back("file" + std::to_string(i));
+        BenchRequest file_req{&fs};
+        fs.lookup(request(file_req), tree.dir, tree.names.back());
+        tree.files.push_back(file_req.ino);
+    }
+    return tree;
+}
+
+/**
+ * Run @a op @a n times, each in its own request scope, and return the mean
+ * number of global allocations per run. @a cleanup runs after each request,
+ * outside of the count.
+ */
+static double allocations_per_request(unsigned n,
+                                      const std::function<void()> &op,
+                                      const std::function<void()> &cleanup)
+{
+    std::uint64_t total = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        const std::uint64_t before = global_allocations.load(std::memory_order_relaxed);
+        {
+            const Dragonstash::RequestScope scope;
+            op();
+        }
+        total += global_allocations.load(std::memory_order_relaxed) - before;
+        if (cleanup) {
+            const Dragonstash::RequestScope scope;
+            cleanup();
+        }
+    }
+    return static_cast<double>(total) / n;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned n = argc > 1 ? std::atoi(argv[1]) : 1000;
+
+    char cachedir_template[] = "/tmp/dragonstash-bench-XXXXXX";
+    if (!mkdtemp(cachedir_template)) {
+        std::cerr << "failed to create cache directory" << std::endl;
+        return 1;
+    }
+    const std::filesystem::path cachedir(cachedir_template);
+
+    install_reply_sink();
+    {
+        using namespace Dragonstash::Backend::InMemory;
+        Dragonstash::Backend::InMemoryFilesystem backend;
+        auto &dir = backend.emplace<Directory>("dir");
+        for (unsigned i = 0; i < FILES; ++i) {
+            dir.emplace<File>("file" + std::to_string(i));
+        }
+
+        Dragonstash::Cache cache(cachedir);
+        Dragonstash::Filesystem fs(cache, backend);
+        const Tree tree = warm_up(fs);
+
+        unsigned next = 0;
+        const auto lookup = [&]() {
+            BenchRequest req{&fs};
+            fs.lookup(request(req), tree.dir, tree.names[next++ % FILES]);
+        };
+        const auto forget_one = [&]() {
+            BenchRequest req{&fs};
+            fs.forget(request(req), tree.files[(next - 1) % FILES], 1);
+        };
+        const auto getattr = [&]() {
+            BenchRequest req{&fs};
+            fs.getattr(request(req), tree.files[next++ % FILES], nullptr);
+        };
+        const auto opendir = [&]() {
+            BenchRequest req{&fs};
+            fuse_file_info fi{};
+            fs.opendir(request(req), tree.dir, &fi);
+        };
+        const auto readdir = [&]() {
+            BenchRequest req{&fs};
+            fs.readdir(request(req), tree.dir, 1 << 16, 0, nullptr);
+        };
+        const auto readdirplus = [&]() {
+            BenchRequest req{&fs};
+            fs.readdirplus(request(req), tree.dir, 1 << 16, 0, nullptr);
+        };
+        const auto forget_all = [&]() {
+            for (ino_t ino: tree.files) {
+                BenchRequest req{&fs};
+                fs.forget(request(req), ino, 1);
+            }
+        };
+
+        struct Operation {
+            const char *name;
+            std::function<void()> op;
+            std::function<void()> cleanup;
+        };
+        const Operation operations[] = {
+            {"lookup", lookup, forget_one},
+            {"getattr", getattr, nullptr},
+            {"opendir", opendir, nullptr},
+            {"readdir", readdir, nullptr},
+            {"readdirplus", readdirplus, forget_all},
+        };
+
+        std::cout << "global allocations per request" << std::endl;
+        std::cout << std::setw(12) << "request" << std::setw(10) << "backend"
+                  << std::setw(14) << "no arenas" << std::setw(14) << "arenas"
+                  << std::endl;
+        for (bool connected: {true, false}) {
+            backend.set_connected(connected);
+            for (const auto &operation: operations) {
+                double counts[2];
+                for (bool arenas: {false, true}) {
+                    Dragonstash::set_request_arenas(arenas);
+                    // one round to let caches and arenas settle
+                    (void)allocations_per_request(n, operation.op, operation.cleanup);
+                    counts[arenas] = allocations_per_request(n, operation.op,
+                                                             operation.cleanup);
+                }
+                std::cout << std::fixed << std::setprecision(2)
+                          << std::setw(12) << operation.name
+                          << std::setw(10) << (connected ? "online" : "offline")
+                          << std::setw(14) << counts[0]
+                          << std::setw(14) << counts[1] << std::endl;
+            }
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(cachedir, ec);
+    return 0;
+}
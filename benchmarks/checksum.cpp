@@ -0,0 +1,69 @@
+/**********************************************************************
+File name: checksum.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dragonstash/cache/common.hpp"
+#include "dragonstash/cache/checksum.hpp"
+
+using Dragonstash::CACHE_PAGE_SIZE;
+
+/* Checksum 1 GiB worth of cache blocks with each implementation and report
+ * the throughput. */
+
+template <typename F>
+static double measure(const std::vector<unsigned char> &buf, F &&impl)
+{
+    static constexpr unsigned rounds = 1024;
+    // volatile keeps the loop from being optimised out
+    volatile std::uint32_t sink = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < rounds; ++i) {
+        for (std::size_t off = 0; off < buf.size(); off += CACHE_PAGE_SIZE) {
+            sink = sink ^ impl(0, buf.data() + off, CACHE_PAGE_SIZE);
+        }
+    }
+    const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return static_cast<double>(buf.size()) * rounds / dt.count() / 1e9;
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    std::vector<unsigned char> buf(1 << 20);
+    for (auto &b: buf) {
+        b = static_cast<unsigned char>(rng());
+    }
+
+    std::cout << "portable:    " << measure(buf, Dragonstash::crc32c_portable)
+              << " GB/s" << std::endl;
+    std::cout << "crc32c:      " << measure(buf, Dragonstash::crc32c)
+              << " GB/s (" << (Dragonstash::crc32c_accelerated() ? "sse4.2" : "portable")
+              << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,135 @@
+/**********************************************************************
+File name: compression.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dragonstash/cache/compression.hpp"
+
+using Dragonstash::Compression;
+using Dragonstash::COMPRESSION_EXTENT_SIZE;
+
+/* Compress and decompress 64 MiB of log-like text and of random data with
+ * each supported algorithm and report ratio and throughput, as well as the
+ * cost of the entropy probe which keeps the random data away from the
+ * compressor. */
+
+static constexpr std::size_t TOTAL = 64 << 20;
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void run(const char *name, Compression algorithm, const std::vector<std::byte> &data)
+{
+    std::vector<std::byte> compressed(data.size());
+    std::vector<std::size_t> sizes;
+    std::uint64_t stored = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t off = 0; off < data.size(); off += COMPRESSION_EXTENT_SIZE) {
+        auto result = Dragonstash::compress(algorithm, data.data() + off,
+                                            COMPRESSION_EXTENT_SIZE,
+                                            compressed.data() + off,
+                                            COMPRESSION_EXTENT_SIZE);
+        sizes.push_back(result ? *result : 0);
+        stored += sizes.back() ? sizes.back() : COMPRESSION_EXTENT_SIZE;
+    }
+    const double compress_time = seconds_since(t0);
+
+    std::vector<std::byte> plain(COMPRESSION_EXTENT_SIZE);
+    std::uint64_t decompressed = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] > 0) {
+            auto result = Dragonstash::decompress(
+                        algorithm, compressed.data() + i * COMPRESSION_EXTENT_SIZE,
+                        sizes[i], plain.data(), plain.size());
+            decompressed += result ? *result : 0;
+        }
+    }
+    const double decompress_time = seconds_since(t0);
+
+    std::cout << name << ": ratio " << static_cast<double>(data.size()) / stored
+              << ", compression " << data.size() / compress_time / 1e6 << " MB/s";
+    if (decompressed > 0) {
+        std::cout << ", decompression " << decompressed / decompress_time / 1e6 << " MB/s";
+    }
+    std::cout << std::endl;
+}
+
+static void probe(const char *name, const std::vector<std::byte> &data)
+{
+    std::size_t skipped = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t off = 0; off < data.size(); off += COMPRESSION_EXTENT_SIZE) {
+        if (Dragonstash::sample_entropy(data.data() + off, COMPRESSION_EXTENT_SIZE)
+                > Dragonstash::COMPRESSION_ENTROPY_LIMIT) {
+            skipped += COMPRESSION_EXTENT_SIZE;
+        }
+    }
+    const double time = seconds_since(t0);
+    std::cout << name << ": entropy probe " << data.size() / time / 1e9 << " GB/s, "
+              << 100.0 * skipped / data.size() << "% skipped" << std::endl;
+}
+
+int main()
+{
+    std::vector<std::byte> text;
+    text.reserve(TOTAL);
+    std::mt19937 rng(1);
+    while (text.size() < TOTAL) {
+        const std::string line = "2020-01-01T00:00:" + std::to_string(rng() % 60)
+                + " host" + std::to_string(rng() % 8) + " dragonstash[" + std::to_string(rng() % 32768)
+                + "]: fetched " + std::to_string(rng() % 1000000) + " bytes\n";
+        for (char ch: line) {
+            text.push_back(static_cast<std::byte>(ch));
+        }
+    }
+    text.resize(TOTAL);
+
+    std::vector<std::byte> random(TOTAL);
+    for (auto &b: random) {
+        b = static_cast<std::byte>(rng());
+    }
+
+    probe("text", text);
+    probe("random", random);
+
+    for (auto [name, algorithm]: {std::make_pair("lz4", Compression::LZ4),
+                                  std::make_pair("zstd", Compression::ZSTD)}) {
+        if (!Dragonstash::compression_available(algorithm)) {
+            std::cout << name << ": not supported by this build" << std::endl;
+            continue;
+        }
+        run((std::string(name) + " text").c_str(), algorithm, text);
+        run((std::string(name) + " random").c_str(), algorithm, random);
+    }
+    return 0;
+}
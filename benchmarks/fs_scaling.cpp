@@ -0,0 +1,359 @@
+/**********************************************************************
+File name: fs_scaling.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dragonstash/backend/in_memory.hpp"
+#include "dragonstash/fs.hpp"
+#include "dragonstash/profiled_mutex.hpp"
+
+/* Issue a mix of lookup, getattr, readdirplus (+ forget) and open/read/release
+ * requests from a growing number of threads directly against a Filesystem on
+ * top of an in-memory backend and report throughput and latency percentiles
+ * per thread count. If lock profiling is requested, the contention of each
+ * lock site is printed below every step.
+ *
+ * Usage: bench-fs-scaling [seconds per step] [max threads] [profile locks]
+ */
+
+static constexpr unsigned DIRS = 16;
+static constexpr unsigned FILES_PER_DIR = 64;
+static constexpr std::size_t FILE_SIZE = 64 << 10;
+static constexpr std::size_t READ_SIZE = 4096;
+
+enum class Op {
+    LOOKUP,
+    GETATTR,
+    READDIRPLUS,
+    READ,
+    COUNT,
+};
+
+static const char *const OP_NAMES[] = {"lookup", "getattr", "readdirplus", "read"};
+
+/**
+ * Reply sink standing in for the FUSE kernel channel; one per request.
+ */
+struct BenchRequest {
+    Dragonstash::Filesystem *fs;
+    int error;
+    fuse_ino_t ino;
+    fuse_file_info fi;
+    std::size_t size;
+    // entries handed out by readdirplus, which need to be forgotten
+    std::size_t entries;
+};
+
+static BenchRequest &sink(fuse_req_t req)
+{
+    return *reinterpret_cast<BenchRequest*>(req);
+}
+
+static void install_reply_sink()
+{
+    Fuse::backend.req_userdata = [](fuse_req_t req) -> void* {
+        return sink(req).fs;
+    };
+    Fuse::backend.req_ctx = [](fuse_req_t) -> const fuse_ctx* {
+        return nullptr;
+    };
+    Fuse::backend.reply_none = [](fuse_req_t) {};
+    Fuse::backend.reply_err = [](fuse_req_t req, int error) {
+        sink(req).error = error;
+        return 0;
+    };
+    Fuse::backend.reply_entry = [](fuse_req_t req, const fuse_entry_param *e) {
+        sink(req).ino = e->ino;
+        return 0;
+    };
+    Fuse::backend.reply_attr = [](fuse_req_t req, const struct stat *, double) {
+        sink(req).error = 0;
+        return 0;
+    };
+    Fuse::backend.reply_open = [](fuse_req_t req, const fuse_file_info *fi) {
+        sink(req).fi = *fi;
+        return 0;
+    };
+    Fuse::backend.reply_buf = [](fuse_req_t req, const char *, size_t size) {
+        sink(req).size = size;
+        return 0;
+    };
+}
+
+struct Tree {
+    std::vector<ino_t> dirs;
+    std::vector<std::string> names;
+    std::vector<ino_t> files;
+};
+
+struct ThreadResult {
+    std::vector<std::uint32_t> latencies_ns[static_cast<int>(Op::COUNT)];
+    std::uint64_t errors = 0;
+};
+
+static Fuse::Request request(BenchRequest &req)
+{
+    return Fuse::Request(reinterpret_cast<fuse_req_t>(&req));
+}
+
+static void populate(Dragonstash::Backend::InMemoryFilesystem &backend)
+{
+    using namespace Dragonstash::Backend::InMemory;
+    std::basic_string<std::byte> data(FILE_SIZE, std::byte('x'));
+    for (unsigned d = 0; d < DIRS; ++d) {
+        auto &dir = backend.emplace<Directory>("dir" + std::to_string(d));
+        for (unsigned f = 0; f < FILES_PER_DIR; ++f) {
+            auto &file = dir.emplace<File>("file" + std::to_string(f));
+            file.data() = data;
+            file.attr().size = FILE_SIZE;
+        }
+    }
+}
+
+static Tree warm_up(Dragonstash::Filesystem &fs)
+{
+    Tree tree;
+    for (unsigned f = 0; f < FILES_PER_DIR; ++f) {
+        tree.names.push_back("file" + std::to_string(f));
+    }
+    for (unsigned d = 0; d < DIRS; ++d) {
+        BenchRequest req{&fs};
+        fs.lookup(request(req), Dragonstash::ROOT_INO, "dir" + std::to_string(d));
+        tree.dirs.push_back(req.ino);
+
+        BenchRequest open_req{&fs};
+        fuse_file_info fi{};
+        fs.opendir(request(open_req), req.ino, &fi);
+        for (const auto &name: tree.names) {
+            BenchRequest file_req{&fs};
+            fs.lookup(request(file_req), tree.dirs.back(), name);
+            tree.files.push_back(file_req.ino);
+        }
+    }
+    return tree;
+}
+
+static void worker(Dragonstash::Filesystem &fs, const Tree &tree,
+                   unsigned seed, std::chrono::steady_clock::time_point deadline,
+                   ThreadResult &result)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<unsigned> pick_op(0, 99);
+    std::uniform_int_distribution<std::size_t> pick_file(0, tree.files.size() - 1);
+    std::uniform_int_distribution<std::size_t> pick_block(0, FILE_SIZE / READ_SIZE - 1);
+    std::vector<char> scratch(READ_SIZE);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        const unsigned dice = pick_op(rng);
+        const Op op = dice < 30 ? Op::LOOKUP
+                    : dice < 60 ? Op::GETATTR
+                    : dice < 70 ? Op::READDIRPLUS
+                    : Op::READ;
+        const std::size_t file = pick_file(rng);
+        const ino_t dir = tree.dirs[file / FILES_PER_DIR];
+
+        const auto t0 = std::chrono::steady_clock::now();
+        int error = 0;
+        switch (op) {
+        case Op::LOOKUP:
+        {
+            BenchRequest req{&fs};
+            fs.lookup(request(req), dir, tree.names[file % FILES_PER_DIR]);
+            error = req.error;
+            if (!error) {
+                BenchRequest forget_req{&fs};
+                fs.forget(request(forget_req), req.ino, 1);
+            }
+            break;
+        }
+        case Op::GETATTR:
+        {
+            BenchRequest req{&fs};
+            fs.getattr(request(req), tree.files[file], nullptr);
+            error = req.error;
+            break;
+        }
+        case Op::READDIRPLUS:
+        {
+            // every entry except . and .. is locked until it is forgotten
+            BenchRequest req{&fs};
+            fs.readdirplus(request(req), dir, 1 << 16, 0, nullptr);
+            error = req.error;
+            if (!error) {
+                for (std::size_t i = 0; i < FILES_PER_DIR; ++i) {
+                    BenchRequest forget_req{&fs};
+                    fs.forget(request(forget_req),
+                              tree.files[file - file % FILES_PER_DIR + i], 1);
+                }
+            }
+            break;
+        }
+        case Op::READ:
+        {
+            fuse_file_info fi{};
+            fi.flags = O_RDONLY;
+            BenchRequest open_req{&fs};
+            fs.open(request(open_req), tree.files[file], &fi);
+            error = open_req.error;
+            if (!error) {
+                fi = open_req.fi;
+                BenchRequest read_req{&fs};
+                fs.read(request(read_req), tree.files[file], READ_SIZE,
+                        pick_block(rng) * READ_SIZE, &fi);
+                error = read_req.error;
+                BenchRequest release_req{&fs};
+                fs.release(request(release_req), tree.files[file], &fi);
+            }
+            break;
+        }
+        case Op::COUNT:
+            break;
+        }
+        const auto dt = std::chrono::steady_clock::now() - t0;
+
+        result.latencies_ns[static_cast<int>(op)].push_back(static_cast<std::uint32_t>(
+                std::min<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count(),
+                                       UINT32_MAX)));
+        result.errors += error != 0;
+    }
+}
+
+static double percentile_us(std::vector<std::uint32_t> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t i = std::min(sorted.size() - 1,
+                                   static_cast<std::size_t>(p * sorted.size()));
+    return sorted[i] / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+    const double seconds = argc > 1 ? std::atof(argv[1]) : 1.0;
+    const unsigned max_threads = argc > 2 ? std::atoi(argv[2]) : 64;
+    Dragonstash::set_lock_profiling(argc > 3 && std::atoi(argv[3]) != 0);
+
+    char cachedir_template[] = "/tmp/dragonstash-bench-XXXXXX";
+    if (!mkdtemp(cachedir_template)) {
+        std::cerr << "failed to create cache directory" << std::endl;
+        return 1;
+    }
+    const std::filesystem::path cachedir(cachedir_template);
+
+    install_reply_sink();
+    {
+        Dragonstash::Backend::InMemoryFilesystem backend;
+        populate(backend);
+        Dragonstash::Cache cache(cachedir);
+        Dragonstash::Filesystem fs(cache, backend);
+        const Tree tree = warm_up(fs);
+
+        std::cout << std::setw(8) << "threads" << std::setw(12) << "ops/s"
+                  << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+                  << std::setw(11) << "p99.9 us" << std::setw(8) << "errors";
+        for (const char *name: OP_NAMES) {
+            std::cout << std::setw(16) << (std::string(name) + " p99");
+        }
+        std::cout << std::endl;
+
+        for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+            std::vector<ThreadResult> results(nthreads);
+            std::vector<std::thread> threads;
+            Dragonstash::reset_lock_profiles();
+            const auto t0 = std::chrono::steady_clock::now();
+            const auto deadline = t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(seconds));
+            for (unsigned i = 0; i < nthreads; ++i) {
+                threads.emplace_back(worker, std::ref(fs), std::cref(tree), i + 1,
+                                     deadline, std::ref(results[i]));
+            }
+            for (auto &thread: threads) {
+                thread.join();
+            }
+            const double elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - t0).count();
+
+            std::vector<std::uint32_t> all;
+            std::vector<std::uint32_t> by_op[static_cast<int>(Op::COUNT)];
+            std::uint64_t errors = 0;
+            for (auto &result: results) {
+                for (int op = 0; op < static_cast<int>(Op::COUNT); ++op) {
+                    all.insert(all.end(), result.latencies_ns[op].begin(),
+                               result.latencies_ns[op].end());
+                    by_op[op].insert(by_op[op].end(), result.latencies_ns[op].begin(),
+                                     result.latencies_ns[op].end());
+                }
+                errors += result.errors;
+            }
+            std::sort(all.begin(), all.end());
+
+            std::cout << std::fixed << std::setprecision(1)
+                      << std::setw(8) << nthreads
+                      << std::setw(12) << all.size() / elapsed
+                      << std::setw(10) << percentile_us(all, 0.5)
+                      << std::setw(10) << percentile_us(all, 0.99)
+                      << std::setw(11) << percentile_us(all, 0.999)
+                      << std::setw(8) << errors;
+            for (auto &latencies: by_op) {
+                std::sort(latencies.begin(), latencies.end());
+                std::cout << std::setw(16) << percentile_us(latencies, 0.99);
+            }
+            std::cout << std::endl;
+
+            if (Dragonstash::lock_profiling()) {
+                using Dragonstash::LockProfile;
+                for (const auto &profile: Dragonstash::lock_profiles()) {
+                    std::cout << "    lock " << std::setw(20) << std::left
+                              << profile.name << std::right
+                              << std::setw(12) << profile.acquisitions << " acq"
+                              << std::setw(12) << profile.contended << " contended"
+                              << std::setw(10)
+                              << LockProfile::total(profile.wait) / 1e6 / elapsed
+                              << " ms wait/s"
+                              << std::setw(10)
+                              << LockProfile::quantile(profile.hold, 0.99) / 1e3
+                              << " us hold p99" << std::endl;
+                }
+            }
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(cachedir, ec);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/**********************************************************************
+File name: mount.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dragonstash/cache/cache.hpp"
+#include "dragonstash/recovery.hpp"
+
+/* Measure how long it takes from opening a cache which has not been shut
+ * down cleanly until the first byte of a cached file can be read, with the
+ * recovery deferred to the background (as on mount) and, for comparison,
+ * with the whole recovery done up front.
+ *
+ * The crashed cache is prepared in a child process which exits without
+ * closing the cache, leaving a number of cached files and orphans behind.
+ *
+ * Usage: bench-mount [cached files] [orphans]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static void populate(const std::filesystem::path &dir,
+                     unsigned nfiles, unsigned norphans)
+{
+    Dragonstash::Cache cache(dir);
+    Dragonstash::InodeAttributes attr{
+        .mode = S_IFREG
+    };
+    attr.common.size = Dragonstash::CACHE_PAGE_SIZE;
+    const std::vector<std::byte> data(Dragonstash::CACHE_PAGE_SIZE, std::byte{0x5a});
+
+    std::vector<ino_t> files;
+    std::vector<ino_t> orphans;
+    {
+        auto txn = cache.begin_rw();
+        for (unsigned i = 0; i < nfiles + norphans; ++i) {
+            const std::string name = (i < nfiles ? "file" : "orphan") + std::to_string(i);
+            auto result = txn.emplace(Dragonstash::ROOT_INO, name, attr);
+            if (!result) {
+                std::cerr << "emplace failed: " << result.error() << std::endl;
+                _exit(1);
+            }
+            (i < nfiles ? files : orphans).push_back(*result);
+        }
+        if (!txn.commit()) {
+            _exit(1);
+        }
+    }
+
+    for (const ino_t ino: files) {
+        auto file = cache.open_file(ino);
+        if (!file || !(*file)->pwrite(0, data.data(), data.size(),
+                                      Dragonstash::Blocklist::READ)) {
+            std::cerr << "failed to cache file data" << std::endl;
+            _exit(1);
+        }
+    }
+
+    // locked orphans survive until the process is gone
+    for (const ino_t ino: orphans) {
+        if (!cache.lock(ino)) {
+            _exit(1);
+        }
+    }
+    auto txn = cache.begin_rw();
+    for (unsigned i = nfiles; i < nfiles + norphans; ++i) {
+        if (!txn.unlink(Dragonstash::ROOT_INO, "orphan" + std::to_string(i))) {
+            _exit(1);
+        }
+    }
+    if (!txn.commit()) {
+        _exit(1);
+    }
+}
+
+/**
+ * Prepare a crashed cache in @a dir.
+ */
+static bool crash(const std::filesystem::path &dir,
+                  unsigned nfiles, unsigned norphans)
+{
+    const pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        populate(dir, nfiles, norphans);
+        // skip all destructors, like a crash would
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool read_first_byte(Dragonstash::Cache &cache, ino_t ino)
+{
+    auto file = cache.open_file(ino);
+    if (!file) {
+        return false;
+    }
+    char byte;
+    auto result = (*file)->pread(0, &byte, 1);
+    return result && *result == 1;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned nfiles = argc > 1 ? std::atoi(argv[1]) : 2000;
+    const unsigned norphans = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    char template_deferred[] = "/tmp/dragonstash-bench-XXXXXX";
+    char template_eager[] = "/tmp/dragonstash-bench-XXXXXX";
+    if (!mkdtemp(template_deferred) || !mkdtemp(template_eager)) {
+        std::cerr << "failed to create cache directories" << std::endl;
+        return 1;
+    }
+    const std::filesystem::path dir_deferred(template_deferred);
+    const std::filesystem::path dir_eager(template_eager);
+
+    if (!crash(dir_deferred, nfiles, norphans) ||
+            !crash(dir_eager, nfiles, norphans)) {
+        std::cerr << "failed to prepare the caches" << std::endl;
+        return 1;
+    }
+
+    // the first file is the one which is read
+    const ino_t first = Dragonstash::ROOT_INO + 1;
+    std::cout << nfiles << " cached files, " << norphans << " orphans" << std::endl;
+    int ret = 0;
+
+    {
+        const auto t0 = Clock::now();
+        Dragonstash::Cache cache(dir_deferred);
+        Dragonstash::Recovery recovery(cache);
+        const double ready = ms_since(t0);
+        const bool ok = read_first_byte(cache, first);
+        const double first_byte = ms_since(t0);
+        while (!recovery.stats().swept) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        const double done = ms_since(t0);
+        const auto stats = recovery.stats();
+        std::cout << "deferred: ready " << ready << " ms, first byte "
+                  << first_byte << " ms, recovered " << done << " ms ("
+                  << stats.reaped_orphans << " orphans, "
+                  << stats.checked_files << " files)" << std::endl;
+        ret |= !ok;
+    }
+
+    {
+        const auto t0 = Clock::now();
+        Dragonstash::Cache cache(dir_eager);
+        Dragonstash::RecoveryOptions options;
+        options.enabled = false;
+        Dragonstash::Recovery recovery(cache, options);
+        recovery.sweep();
+        const double ready = ms_since(t0);
+        const bool ok = read_first_byte(cache, first);
+        const double first_byte = ms_since(t0);
+        std::cout << "eager:    ready " << ready << " ms, first byte "
+                  << first_byte << " ms" << std::endl;
+        ret |= !ok;
+    }
+
+    if (ret) {
+        std::cerr << "failed to read the first byte" << std::endl;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir_deferred, ec);
+    std::filesystem::remove_all(dir_eager, ec);
+    return ret;
+}
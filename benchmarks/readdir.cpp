@@ -0,0 +1,128 @@
+/**********************************************************************
+File name: readdir.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dragonstash/backend/local.hpp"
+
+/* List a local directory with many entries through the local backend, once
+ * entry by entry with readdir() and once with read_batch(), and report the
+ * entries per second. The directory is listed a few times first, so that
+ * the dentries are in the kernel cache and the listing is not disk-bound.
+ *
+ * Usage: bench-readdir [entries]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+// keeps the name accesses from being optimised out
+static volatile std::size_t name_bytes_sink = 0;
+
+template <typename F>
+static double measure(Dragonstash::Backend::LocalFilesystem &fs, F &&list)
+{
+    static constexpr unsigned rounds = 5;
+    std::size_t total = 0;
+    const auto t0 = Clock::now();
+    for (unsigned i = 0; i < rounds; ++i) {
+        auto dir = fs.opendir("/");
+        if (!dir) {
+            std::cerr << "opendir failed: " << dir.error() << std::endl;
+            std::exit(1);
+        }
+        total += list(**dir);
+    }
+    const std::chrono::duration<double> dt = Clock::now() - t0;
+    return static_cast<double>(total) / dt.count();
+}
+
+static std::size_t list_entries(Dragonstash::Backend::Dir &dir)
+{
+    std::size_t n = 0;
+    std::size_t name_bytes = 0;
+    while (auto entry = dir.readdir()) {
+        n += 1;
+        name_bytes += entry->name.size();
+    }
+    name_bytes_sink = name_bytes;
+    return n;
+}
+
+static std::size_t list_batches(Dragonstash::Backend::Dir &dir)
+{
+    std::size_t n = 0;
+    std::size_t name_bytes = 0;
+    std::vector<Dragonstash::Backend::DirEntryRef> batch;
+    while (dir.read_batch(batch) && !batch.empty()) {
+        n += batch.size();
+        for (const auto &entry: batch) {
+            name_bytes += entry.name.size();
+        }
+    }
+    name_bytes_sink = name_bytes;
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned nentries = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+    char dir_template[] = "/tmp/dragonstash-bench-XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::cerr << "failed to create directory" << std::endl;
+        return 1;
+    }
+    const std::filesystem::path dir(dir_template);
+    for (unsigned i = 0; i < nentries; ++i) {
+        const std::string path = (dir / ("entry" + std::to_string(i))).native();
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "failed to create " << path << std::endl;
+            return 1;
+        }
+        ::close(fd);
+    }
+
+    {
+        Dragonstash::Backend::LocalFilesystem fs(dir);
+        (void)measure(fs, list_batches);
+        std::cout << "readdir:    " << measure(fs, list_entries) / 1e6
+                  << " M entries/s" << std::endl;
+        std::cout << "read_batch: " << measure(fs, list_batches) / 1e6
+                  << " M entries/s" << std::endl;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/**********************************************************************
+File name: synthetic_walk.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dragonstash/backend/synthetic.hpp"
+#include "dragonstash/fs.hpp"
+
+/* Walk a generated tree through a Filesystem, opening every directory (which
+ * syncs it into the cache) and looking up every entry, and report the walk
+ * rate, the peak RSS and the size of the metadata database as the cache
+ * grows. The tree is never materialised, so it can be far larger than the
+ * memory of the machine.
+ *
+ * Usage: bench-synthetic-walk [tree spec] [max entries]
+ *
+ * The tree spec is the one of --synthetic; it defaults to a tree of about
+ * five million files.
+ */
+
+using Clock = std::chrono::steady_clock;
+using Dragonstash::Backend::SyntheticFilesystem;
+
+static constexpr std::uint64_t REPORT_EVERY = 100000;
+
+/**
+ * Reply sink standing in for the FUSE kernel channel; one per request.
+ */
+struct BenchRequest {
+    Dragonstash::Filesystem *fs;
+    int error;
+    fuse_ino_t ino;
+};
+
+static BenchRequest &sink(fuse_req_t req)
+{
+    return *reinterpret_cast<BenchRequest*>(req);
+}
+
+static void install_reply_sink()
+{
+    Fuse::backend.req_userdata = [](fuse_req_t req) -> void* {
+        return sink(req).fs;
+    };
+    Fuse::backend.req_ctx = [](fuse_req_t) -> const fuse_ctx* {
+        return nullptr;
+    };
+    Fuse::backend.reply_none = [](fuse_req_t) {};
+    Fuse::backend.reply_err = [](fuse_req_t req, int error) {
+        sink(req).error = error;
+        return 0;
+    };
+    Fuse::backend.reply_entry = [](fuse_req_t req, const fuse_entry_param *e) {
+        sink(req).ino = e->ino;
+        return 0;
+    };
+    Fuse::backend.reply_open = [](fuse_req_t, const fuse_file_info *) {
+        return 0;
+    };
+}
+
+static Fuse::Request request(BenchRequest &req)
+{
+    return Fuse::Request(reinterpret_cast<fuse_req_t>(&req));
+}
+
+static std::uint64_t files_size(const std::filesystem::path &dir)
+{
+    std::uint64_t total = 0;
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file(ec)) {
+            total += entry.file_size(ec);
+        }
+    }
+    return total;
+}
+
+static long max_rss_kib()
+{
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+class Walker {
+public:
+    Walker(Dragonstash::Filesystem &fs, const SyntheticFilesystem &backend,
+           const std::filesystem::path &cachedir, std::uint64_t max_entries):
+        m_fs(fs),
+        m_backend(backend),
+        m_cachedir(cachedir),
+        m_max_entries(max_entries),
+        m_name(backend.max_name_length(), '\0'),
+        m_entries(0),
+        m_errors(0),
+        m_t0(Clock::now()),
+        m_last_report(m_t0)
+    {
+
+    }
+
+private:
+    Dragonstash::Filesystem &m_fs;
+    const SyntheticFilesystem &m_backend;
+    const std::filesystem::path m_cachedir;
+    const std::uint64_t m_max_entries;
+    std::string m_name;
+    std::uint64_t m_entries;
+    std::uint64_t m_errors;
+    const Clock::time_point m_t0;
+    Clock::time_point m_last_report;
+
+    void report()
+    {
+        const auto now = Clock::now();
+        const double interval = std::chrono::duration<double>(now - m_last_report).count();
+        m_last_report = now;
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(12) << m_entries
+                  << std::setw(12) << REPORT_EVERY / interval
+                  << std::setw(12) << max_rss_kib() / 1024.0
+                  << std::setw(12) << files_size(m_cachedir) / 1048576.0
+                  << std::setw(8) << m_errors << std::endl;
+    }
+
+public:
+    void walk(ino_t ino, const SyntheticFilesystem::Node &dir)
+    {
+        {
+            const Dragonstash::RequestScope scope;
+            BenchRequest req{&m_fs};
+            fuse_file_info fi{};
+            m_fs.opendir(request(req), ino, &fi);
+            m_errors += req.error != 0;
+        }
+
+        const std::uint64_t count = m_backend.entry_count(dir.depth);
+        for (std::uint64_t i = 0; i < count && m_entries < m_max_entries; ++i) {
+            const std::size_t len = m_backend.format_name(dir, i, m_name.data());
+            BenchRequest req{&m_fs};
+            {
+                const Dragonstash::RequestScope scope;
+                m_fs.lookup(request(req), ino, std::string_view(m_name.data(), len));
+            }
+            m_entries += 1;
+            if (req.error != 0) {
+                m_errors += 1;
+                continue;
+            }
+            if (m_entries % REPORT_EVERY == 0) {
+                report();
+            }
+
+            const auto child = m_backend.child(dir, i);
+            if (child.is_dir) {
+                walk(req.ino, child);
+            }
+            const Dragonstash::RequestScope scope;
+            BenchRequest forget_req{&m_fs};
+            m_fs.forget(request(forget_req), req.ino, 1);
+        }
+    }
+
+    void summary()
+    {
+        const double elapsed = std::chrono::duration<double>(Clock::now() - m_t0).count();
+        std::cout << m_entries << " entries in " << elapsed << " s ("
+                  << m_entries / elapsed << " entries/s), "
+                  << m_errors << " errors" << std::endl;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    auto options = Dragonstash::Backend::SyntheticOptions::parse(
+                argc > 1 ? argv[1] : "dirs=40,files=80,depth=3");
+    if (!options) {
+        std::cerr << "invalid tree spec" << std::endl;
+        return 1;
+    }
+    const std::uint64_t max_entries = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                                               : UINT64_MAX;
+
+    char cachedir_template[] = "/tmp/dragonstash-bench-XXXXXX";
+    if (!mkdtemp(cachedir_template)) {
+        std::cerr << "failed to create cache directory" << std::endl;
+        return 1;
+    }
+    const std::filesystem::path cachedir(cachedir_template);
+
+    std::cout << "tree of " << options->total_directories() << " directories and "
+              << options->total_files() << " files" << std::endl;
+    std::cout << std::setw(12) << "entries" << std::setw(12) << "entries/s"
+              << std::setw(12) << "rss MiB" << std::setw(12) << "db MiB"
+              << std::setw(8) << "errors" << std::endl;
+
+    install_reply_sink();
+    {
+        SyntheticFilesystem backend(*options);
+        Dragonstash::Cache cache(cachedir);
+        Dragonstash::Filesystem fs(cache, backend);
+        Walker walker(fs, backend, cachedir, max_entries);
+        walker.walk(Dragonstash::ROOT_INO, backend.root());
+        walker.summary();
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(cachedir, ec);
+    return 0;
+}
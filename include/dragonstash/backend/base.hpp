@@ -27,8 +27,10 @@ authors named in the AUTHORS file.
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "dragonstash/error.hpp"
 
@@ -55,6 +57,23 @@ struct DirEntry: public Stat {
 };
 
 
+/**
+ * @brief Directory entry of a batch, whose name is owned by the Dir.
+ *
+ * @see Dir::read_batch
+ */
+struct DirEntryRef: public Stat {
+    std::string_view name;
+    bool complete;
+};
+
+
+/**
+ * @brief Number of entries the default Dir::read_batch returns at most.
+ */
+static constexpr std::size_t DIR_BATCH_ENTRIES = 1024;
+
+
 class File {
 public:
     virtual ~File();
@@ -73,11 +92,25 @@ class Dir {
 public:
     virtual ~Dir();
 
+private:
+    std::vector<DirEntry> m_batch_storage;
+
 public:
     virtual Result<DirEntry> readdir() = 0;
     virtual Result<void> fsyncdir() = 0;
     virtual Result<void> closedir() = 0;
 
+    /**
+     * @brief Read the next entries of the directory stream.
+     *
+     * @a batch is cleared and filled with at least one entry; it is left
+     * empty at the end of the stream. The names stay valid until the next
+     * call of readdir() or read_batch() and are not null-terminated.
+     *
+     * The default implementation collects entries from readdir().
+     */
+    virtual Result<void> read_batch(std::vector<DirEntryRef> &batch);
+
 };
 
 class Filesystem {
@@ -92,6 +125,17 @@ public:
     virtual Result<Stat> lstat(std::string_view path) = 0;
     virtual Result<std::string> readlink(std::string_view path) = 0;
 
+    // files are created with open(O_CREAT)
+    virtual Result<void> mkdir(std::string_view path, mode_t mode) = 0;
+    virtual Result<void> unlink(std::string_view path) = 0;
+    virtual Result<void> rmdir(std::string_view path) = 0;
+    virtual Result<void> rename(std::string_view from, std::string_view to) = 0;
+    virtual Result<void> truncate(std::string_view path, off_t size) = 0;
+    virtual Result<void> chmod(std::string_view path, mode_t mode) = 0;
+    virtual Result<void> utimens(std::string_view path,
+                                 const struct timespec &atime,
+                                 const struct timespec &mtime) = 0;
+
 };
 
 }
@@ -27,6 +27,7 @@ authors named in the AUTHORS file.
 
 #include <memory>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 
 #include "dragonstash/backend/base.hpp"
@@ -149,6 +150,19 @@ public:
 
     void remove(const std::string &name);
 
+    /**
+     * @brief Detach a child from the directory.
+     *
+     * @return The child or nullptr if there is no such child.
+     */
+    std::unique_ptr<Node> take(const std::string &name);
+
+    /**
+     * @brief Attach a node as child, replacing any existing child with the
+     * same name.
+     */
+    void insert(const std::string &name, std::unique_ptr<Node> node);
+
 };
 
 class DirHandle: public Dragonstash::Backend::Dir {
@@ -173,6 +187,7 @@ public:
     Result<DirEntry> readdir() override;
     Result<void> fsyncdir() override;
     Result<void> closedir() override;
+    Result<void> read_batch(std::vector<DirEntryRef> &batch) override;
 };
 
 }
@@ -181,6 +196,13 @@ class InMemoryFilesystem: public Filesystem, public InMemory::Directory {
 private:
     bool m_connected{true};
 
+    /**
+     * @brief Find the directory containing @a path.
+     *
+     * @return The directory and the name of the entry within it.
+     */
+    Result<std::tuple<InMemory::Directory*, std::string>> find_parent(std::string_view path);
+
 public:
     [[nodiscard]] inline bool connected() const {
         return m_connected;
@@ -194,6 +216,15 @@ public:
     [[nodiscard]] Result<std::unique_ptr<Dir> > opendir(std::string_view path) override;
     [[nodiscard]] Result<Stat> lstat(std::string_view path) override;
     [[nodiscard]] Result<std::string> readlink(std::string_view path) override;
+    [[nodiscard]] Result<void> mkdir(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> unlink(std::string_view path) override;
+    [[nodiscard]] Result<void> rmdir(std::string_view path) override;
+    [[nodiscard]] Result<void> rename(std::string_view from, std::string_view to) override;
+    [[nodiscard]] Result<void> truncate(std::string_view path, off_t size) override;
+    [[nodiscard]] Result<void> chmod(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> utimens(std::string_view path,
+                                       const struct timespec &atime,
+                                       const struct timespec &mtime) override;
 };
 
 }
@@ -26,8 +26,7 @@ authors named in the AUTHORS file.
 #define DRAGONSTASH_LOCAL_BACKEND_H
 
 #include <filesystem>
-
-#include <dirent.h>
+#include <memory>
 
 #include "dragonstash/backend/base.hpp"
 
@@ -51,19 +50,44 @@ public:
     Result<void> close() override;
 };
 
+/**
+ * @brief Size of the buffer LocalDir reads directory records into.
+ */
+static constexpr std::size_t LOCAL_DIR_BUFFER_SIZE = 256 << 10;
+
+/**
+ * @brief Directory stream read with getdents64(2).
+ *
+ * Each system call fills a large buffer with records; read_batch() hands out
+ * all of them at once, with the names pointing into the buffer.
+ */
 class LocalDir: public Dir {
 public:
-    explicit LocalDir(::DIR *fd);
+    explicit LocalDir(int fd, std::size_t buffer_size = LOCAL_DIR_BUFFER_SIZE);
     ~LocalDir() override;
 
 private:
-    ::DIR *m_fd;
+    int m_fd;
+    const std::size_t m_buffer_size;
+    std::unique_ptr<std::byte[]> m_buffer;
+    std::size_t m_fill;
+    std::size_t m_pos;
+
+    /**
+     * @brief Make sure that an unread record is in the buffer.
+     *
+     * @return false at the end of the stream.
+     */
+    Result<bool> fill();
+
+    DirEntryRef next_record();
 
     // Dir interface
 public:
     Result<DirEntry> readdir() override;
     Result<void> fsyncdir() override;
     Result<void> closedir() override;
+    Result<void> read_batch(std::vector<DirEntryRef> &batch) override;
 };
 
 class LocalFilesystem: public Filesystem {
@@ -83,6 +107,15 @@ public:
     [[nodiscard]] Result<std::unique_ptr<Dir> > opendir(std::string_view path) override;
     [[nodiscard]] Result<Stat> lstat(std::string_view path) override;
     [[nodiscard]] Result<std::string> readlink(std::string_view path) override;
+    [[nodiscard]] Result<void> mkdir(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> unlink(std::string_view path) override;
+    [[nodiscard]] Result<void> rmdir(std::string_view path) override;
+    [[nodiscard]] Result<void> rename(std::string_view from, std::string_view to) override;
+    [[nodiscard]] Result<void> truncate(std::string_view path, off_t size) override;
+    [[nodiscard]] Result<void> chmod(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> utimens(std::string_view path,
+                                       const struct timespec &atime,
+                                       const struct timespec &mtime) override;
 
 };
 
@@ -0,0 +1,205 @@
+/**********************************************************************
+File name: synthetic.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_BACKEND_SYNTHETIC_H
+#define DRAGONSTASH_BACKEND_SYNTHETIC_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "dragonstash/backend/base.hpp"
+
+namespace Dragonstash::Backend {
+
+enum class SyntheticContent {
+    /**
+     * @brief Pseudo-random bytes, which neither compress nor deduplicate.
+     */
+    RANDOM,
+
+    /**
+     * @brief All bytes zero.
+     */
+    ZEROS,
+};
+
+/**
+ * @brief Shape of the tree generated by SyntheticFilesystem.
+ *
+ * Every directory above @a depth has @a directories subdirectories, and
+ * every directory has @a files regular files. The root is at depth zero.
+ */
+struct SyntheticOptions {
+    std::uint64_t seed = 1;
+    unsigned directories = 8;
+    unsigned files = 64;
+    unsigned depth = 3;
+
+    /**
+     * @brief Length of the generated names.
+     *
+     * Names are a kind letter, the index of the entry and a random filler
+     * up to this length; they are never shorter than the first two parts.
+     */
+    unsigned name_length = 16;
+
+    /**
+     * @brief Range of the file sizes, which are distributed log-uniformly
+     * within it (so that small files are much more common than large ones).
+     */
+    std::uint64_t min_file_size = 0;
+    std::uint64_t max_file_size = 1 << 20;
+
+    SyntheticContent content = SyntheticContent::RANDOM;
+
+    /**
+     * @brief Parse a comma separated list of key=value pairs.
+     *
+     * Keys are seed, dirs, files, depth, name, size (either one size or
+     * MIN-MAX, each with an optional k, m or g suffix) and content (random
+     * or zeros). Keys which are not given keep their default.
+     *
+     * Error codes:
+     *
+     * - EINVAL: Unknown key or malformed value.
+     */
+    [[nodiscard]] static Result<SyntheticOptions> parse(std::string_view spec);
+
+    /**
+     * @brief Number of directories in the tree, including the root.
+     */
+    [[nodiscard]] std::uint64_t total_directories() const;
+
+    /**
+     * @brief Number of regular files in the tree.
+     */
+    [[nodiscard]] std::uint64_t total_files() const;
+};
+
+/**
+ * @brief Read-only backend which generates a deterministic tree on the fly.
+ *
+ * Nothing is stored: every node is identified by a hash of its path, from
+ * which its name, attributes and contents are derived when asked for. This
+ * allows simulating upstreams with many millions of files in constant
+ * memory.
+ *
+ * Any attempt to modify the tree fails with EROFS.
+ */
+class SyntheticFilesystem: public Filesystem {
+public:
+    explicit SyntheticFilesystem(const SyntheticOptions &options = SyntheticOptions());
+
+    /**
+     * @brief A resolved node of the tree.
+     */
+    struct Node {
+        std::uint64_t id;
+        unsigned depth;
+        bool is_dir;
+    };
+
+private:
+    const SyntheticOptions m_options;
+    const std::uint64_t m_root_id;
+    const std::uint32_t m_uid;
+    const std::uint32_t m_gid;
+    std::atomic<bool> m_connected;
+
+    Result<Node> find(std::string_view path) const;
+
+public:
+    [[nodiscard]] inline const SyntheticOptions &options() const {
+        return m_options;
+    }
+
+    [[nodiscard]] inline bool connected() const {
+        return m_connected.load(std::memory_order_relaxed);
+    }
+
+    inline void set_connected(bool connected) {
+        m_connected.store(connected, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] inline Node root() const {
+        return Node{m_root_id, 0, true};
+    }
+
+    /**
+     * @brief Number of entries (excluding dot and dotdot) in a directory at
+     * @a depth.
+     */
+    [[nodiscard]] std::uint64_t entry_count(unsigned depth) const;
+
+    /**
+     * @brief Resolve entry @a index of directory @a dir.
+     *
+     * Directories come first, followed by the files.
+     */
+    [[nodiscard]] Node child(const Node &dir, std::uint64_t index) const;
+
+    /**
+     * @brief Write the name of entry @a index of directory @a dir to @a dest.
+     *
+     * @param dest Buffer of at least max_name_length() bytes.
+     * @return Length of the name.
+     */
+    std::size_t format_name(const Node &dir, std::uint64_t index, char *dest) const;
+
+    [[nodiscard]] std::size_t max_name_length() const;
+
+    [[nodiscard]] Stat attributes(const Node &node) const;
+
+    /**
+     * @brief Generate the contents of the file with id @a id.
+     *
+     * This does not check the size of the file.
+     */
+    void contents(std::uint64_t id, off_t offset, void *buf, std::size_t count) const;
+
+    // Filesystem interface
+public:
+    [[nodiscard]] Result<std::unique_ptr<File>> open(std::string_view path,
+                                                     int accesstype,
+                                                     mode_t mode) override;
+    [[nodiscard]] Result<std::unique_ptr<Dir>> opendir(std::string_view path) override;
+    [[nodiscard]] Result<Stat> lstat(std::string_view path) override;
+    [[nodiscard]] Result<std::string> readlink(std::string_view path) override;
+    [[nodiscard]] Result<void> mkdir(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> unlink(std::string_view path) override;
+    [[nodiscard]] Result<void> rmdir(std::string_view path) override;
+    [[nodiscard]] Result<void> rename(std::string_view from, std::string_view to) override;
+    [[nodiscard]] Result<void> truncate(std::string_view path, off_t size) override;
+    [[nodiscard]] Result<void> chmod(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> utimens(std::string_view path,
+                                       const struct timespec &atime,
+                                       const struct timespec &mtime) override;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+/**********************************************************************
+File name: tracing.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_TRACING_BACKEND_H
+#define DRAGONSTASH_TRACING_BACKEND_H
+
+#include "dragonstash/backend/base.hpp"
+
+namespace Dragonstash {
+namespace Backend {
+
+/**
+ * @brief Forward all calls to another backend, recording each of them as a
+ * trace span (see Dragonstash::TraceSpan).
+ *
+ * Files and directories opened through it are wrapped as well.
+ */
+class TracingFilesystem: public Filesystem {
+public:
+    explicit TracingFilesystem(std::unique_ptr<Filesystem> inner);
+
+private:
+    std::unique_ptr<Filesystem> m_inner;
+
+    // Filesystem interface
+public:
+    [[nodiscard]] Result<std::unique_ptr<File>> open(std::string_view path,
+                                                     int accesstype,
+                                                     mode_t mode) override;
+    [[nodiscard]] Result<std::unique_ptr<Dir> > opendir(std::string_view path) override;
+    [[nodiscard]] Result<Stat> lstat(std::string_view path) override;
+    [[nodiscard]] Result<std::string> readlink(std::string_view path) override;
+    [[nodiscard]] Result<void> mkdir(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> unlink(std::string_view path) override;
+    [[nodiscard]] Result<void> rmdir(std::string_view path) override;
+    [[nodiscard]] Result<void> rename(std::string_view from, std::string_view to) override;
+    [[nodiscard]] Result<void> truncate(std::string_view path, off_t size) override;
+    [[nodiscard]] Result<void> chmod(std::string_view path, mode_t mode) override;
+    [[nodiscard]] Result<void> utimens(std::string_view path,
+                                       const struct timespec &atime,
+                                       const struct timespec &mtime) override;
+
+};
+
+}
+}
+
+#endif
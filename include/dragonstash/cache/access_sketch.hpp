@@ -0,0 +1,153 @@
+/**********************************************************************
+File name: access_sketch.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_ACCESS_SKETCH_H
+#define DRAGONSTASH_CACHE_ACCESS_SKETCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "dragonstash/cache/inode.hpp"
+
+namespace Dragonstash {
+
+/**
+ * @brief Approximate, in-memory record of when inodes were last accessed.
+ *
+ * Time is measured in epochs. The eviction hand advances the epoch each time
+ * it completes a sweep over all inodes, which makes this a second-chance
+ * clock: an inode which has been accessed during the current sweep is
+ * skipped.
+ *
+ * Each inode maps to two buckets of a fixed-size table. An access stores the
+ * current epoch into both buckets; the estimate for an inode is the older of
+ * the two. Collisions can only make an inode look more recently used than it
+ * is, never less.
+ *
+ * Updates use relaxed atomics and never block, so they can be done from the
+ * read paths without turning reads into database writes. The table is
+ * written to the database in bulk from time to time.
+ */
+class AccessSketch {
+public:
+    using stamp_t = std::uint16_t;
+
+    /**
+     * @brief Stamp of buckets which have never been accessed.
+     */
+    static constexpr stamp_t NEVER = 0;
+
+    /**
+     * @brief Age reported for inodes which have never been accessed.
+     */
+    static constexpr stamp_t MAX_AGE = std::numeric_limits<stamp_t>::max();
+
+public:
+    /**
+     * @param nbuckets Number of buckets; rounded up to a power of two.
+     */
+    explicit AccessSketch(std::size_t nbuckets);
+    AccessSketch(const AccessSketch &src) = delete;
+    AccessSketch(AccessSketch &&src) = delete;
+    AccessSketch &operator=(const AccessSketch &src) = delete;
+    AccessSketch &operator=(AccessSketch &&src) = delete;
+    ~AccessSketch() = default;
+
+private:
+    std::size_t m_nbuckets;
+    std::unique_ptr<std::atomic<stamp_t>[]> m_buckets;
+    std::atomic<stamp_t> m_epoch;
+
+    [[nodiscard]] inline std::atomic<stamp_t> &bucket(ino_t ino, unsigned which) const
+    {
+        // splitmix64 finaliser; both bucket indices come from one hash
+        std::uint64_t h = ino + 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h = h ^ (h >> 31);
+        return m_buckets[(which ? (h >> 32) : h) & (m_nbuckets - 1)];
+    }
+
+public:
+    /**
+     * @brief Record an access to an inode.
+     */
+    inline void touch(ino_t ino) noexcept
+    {
+        const stamp_t epoch = m_epoch.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < 2; ++i) {
+            std::atomic<stamp_t> &b = bucket(ino, i);
+            // avoid dirtying the cache line if nothing changes
+            if (b.load(std::memory_order_relaxed) != epoch) {
+                b.store(epoch, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Number of epochs since the inode was last accessed.
+     *
+     * @return Zero if the inode was accessed during the current epoch,
+     * MAX_AGE if it has never been accessed.
+     */
+    [[nodiscard]] stamp_t age(ino_t ino) const noexcept;
+
+    [[nodiscard]] inline stamp_t epoch() const noexcept
+    {
+        return m_epoch.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Start a new epoch.
+     */
+    void advance() noexcept;
+
+    [[nodiscard]] inline std::size_t size() const noexcept
+    {
+        return m_nbuckets;
+    }
+
+    /**
+     * @brief Take a snapshot of the table for persistence.
+     *
+     * Concurrent accesses may or may not be included.
+     */
+    [[nodiscard]] std::basic_string<std::byte> serialize() const;
+
+    /**
+     * @brief Restore the table from a snapshot.
+     *
+     * @return false if the snapshot does not match the size of this sketch,
+     * in which case the sketch is left unchanged.
+     */
+    bool load(std::basic_string_view<std::byte> buf);
+};
+
+}
+
+#endif
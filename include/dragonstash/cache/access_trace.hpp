@@ -0,0 +1,124 @@
+/**********************************************************************
+File name: access_trace.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_ACCESS_TRACE_H
+#define DRAGONSTASH_CACHE_ACCESS_TRACE_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dragonstash/error.hpp"
+
+namespace Dragonstash {
+
+/**
+ * @brief Maximum number of ranges kept in an AccessTrace.
+ *
+ * Accesses beyond this are not recorded; the trace is meant to capture what
+ * an application needs right after opening a file, not to mirror its
+ * complete access pattern.
+ */
+static constexpr std::size_t ACCESS_TRACE_MAX_RANGES = 64;
+
+/**
+ * @brief The blocks of a file which have been read while it was open, in
+ * the order in which they were first touched.
+ *
+ * Traces are stored in the cache when a file is closed and replayed by the
+ * Prefetcher when it is opened again.
+ */
+class AccessTrace {
+public:
+    struct Range {
+        std::uint64_t start;
+        std::uint64_t count;
+
+        [[nodiscard]] inline std::uint64_t end() const {
+            return start + count;
+        }
+    };
+
+    AccessTrace() = default;
+
+private:
+    std::vector<Range> m_ranges;
+    std::time_t m_recorded_at = 0;
+
+public:
+    /**
+     * @brief Record an access to a byte range.
+     *
+     * Ranges which overlap or adjoin a range of the trace are merged into
+     * it, so that sequential reads make up a single range.
+     *
+     * @return true if the trace has changed.
+     */
+    bool record(off_t off, std::size_t n);
+
+    void clear();
+
+    [[nodiscard]] inline const std::vector<Range> &ranges() const {
+        return m_ranges;
+    }
+
+    [[nodiscard]] inline bool empty() const {
+        return m_ranges.empty();
+    }
+
+    /**
+     * @brief Total number of blocks covered by the trace.
+     */
+    [[nodiscard]] std::uint64_t blocks() const;
+
+    /**
+     * @brief Time at which the trace was completed.
+     */
+    [[nodiscard]] inline std::time_t recorded_at() const {
+        return m_recorded_at;
+    }
+
+    inline void set_recorded_at(std::time_t t) {
+        m_recorded_at = t;
+    }
+
+    [[nodiscard]] std::string serialize() const;
+
+    /**
+     * @brief Decode a serialised trace.
+     *
+     * Error codes:
+     *
+     * - EINVAL: The buffer does not hold a valid trace.
+     */
+    [[nodiscard]] static Result<AccessTrace> parse(std::string_view buf);
+};
+
+}
+
+#endif
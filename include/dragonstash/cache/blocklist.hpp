@@ -26,7 +26,9 @@ authors named in the AUTHORS file.
 #define DRAGONSTASH_CACHE_BLOCKLIST_H
 
 #include <filesystem>
+#include <limits>
 #include <variant>
+#include <vector>
 
 #include "common.hpp"
 
@@ -180,6 +182,21 @@ private:
     static_assert(alignof(File) <= 16);
     static_assert(std::is_pod<File>::value);
 
+public:
+    /**
+     * @brief A run of consecutive blocks sharing the same state.
+     */
+    struct Range
+    {
+        std::uint64_t start;
+        std::uint64_t count;
+        State state;
+
+        [[nodiscard]] inline std::uint64_t end() const {
+            return start + count;
+        }
+    };
+
 public:
     Blocklist() = delete;
     explicit Blocklist(FileHandle fd);
@@ -395,6 +412,21 @@ public:
      */
     [[nodiscard]] std::size_t truncate_access(off_t start, std::size_t size) const;
 
+    /**
+     * @brief List the present blocks within a range of blocks.
+     *
+     * @param start First block of the range to inspect.
+     * @param count Number of blocks to inspect.
+     * @return The runs of present blocks overlapping the range, clipped to
+     *   the range and in ascending order. Adjacent entries with the same state
+     *   are merged into a single run, so that runs may be longer than the
+     *   internal limit of a single entry. Absent blocks are not reported; they
+     *   are the gaps between the runs.
+     */
+    [[nodiscard]] std::vector<Range> ranges(
+            std::uint64_t start = 0,
+            std::uint64_t count = std::numeric_limits<std::uint64_t>::max()) const;
+
     /**
      * @brief Check internal consistency and throw exceptions.
      *
@@ -430,6 +462,13 @@ public:
      */
     void shrink() const;
 
+    /**
+     * @brief Write all changes to disk.
+     *
+     * Raises std::runtime_error if the changes cannot be synced.
+     */
+    void sync() const;
+
     /**
      * @brief Dump a human-readable text representation of the Blocklist.
      *
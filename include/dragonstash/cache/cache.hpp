@@ -26,19 +26,38 @@ authors named in the AUTHORS file.
 #define DRAGONSTASH_CACHE_CACHE_H
 
 #include <sys/types.h>
+#include <sys/statvfs.h>
+#include <atomic>
 #include <cstdint>
 #include <filesystem>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <shared_mutex>
+#include <limits>
 #include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <set>
+#include <vector>
 
 #include "dragonstash/error.hpp"
 
 #include "lmdb-safe.hh"
 #include "dragonstash/backend/base.hpp"
-#include "dragonstash/debug_mutex.hpp"
+#include "dragonstash/profiled_mutex.hpp"
+#include "dragonstash/request_arena.hpp"
 
+#include "dragonstash/cache/access_sketch.hpp"
+#include "dragonstash/cache/access_trace.hpp"
 #include "dragonstash/cache/inode.hpp"
 #include "dragonstash/cache/common.hpp"
+#include "dragonstash/cache/compression.hpp"
+#include "dragonstash/cache/dedup.hpp"
+#include "dragonstash/cache/fsck.hpp"
+#include "dragonstash/cache/journal.hpp"
+#include "dragonstash/cache/regular_file.hpp"
 
 namespace Dragonstash {
 
@@ -166,25 +185,235 @@ public:
 };
 
 
+/**
+ * @brief Layout of the index used to look up directory entries by name.
+ */
+enum class DirectoryIndex {
+    /**
+     * @brief Key the index by parent inode and full name.
+     *
+     * Names are limited by the maximum key size of LMDB.
+     */
+    NAME = 0,
+
+    /**
+     * @brief Key the index by parent inode and a 64 bit hash of the name.
+     *
+     * Collisions are resolved by comparing against the names stored in the
+     * inode-keyed tree. Names are not limited in length and each name is
+     * stored only once.
+     */
+    HASHED = 1,
+};
+
+
+/**
+ * @brief Number of chunks a file is split into, see
+ * CacheOptions::max_chunk_size.
+ */
+static constexpr std::uint64_t CHUNKS_PER_FILE = 1024;
+
+/**
+ * @brief Maximum number of orphans reaped by a single call to
+ * CacheTransactionRW::clean_orphans().
+ *
+ * This keeps a large backlog (for example after an unclean shutdown) from
+ * stalling whichever write happens to come first; the rest is left to the
+ * background sweep (see Recovery).
+ */
+static constexpr std::size_t ORPHAN_REAP_BATCH = 256;
+
+/**
+ * @brief Options which affect how a cache is created.
+ */
+struct CacheOptions {
+    /**
+     * @brief Directory index to use.
+     *
+     * This only has an effect when a new cache is created; existing caches
+     * keep the index they were created with.
+     */
+    DirectoryIndex directory_index = DirectoryIndex::NAME;
+
+    /**
+     * @brief Maximum number of inodes in the cache, or zero for no limit.
+     *
+     * When the limit is reached, cold inodes are evicted to make room for new
+     * ones.
+     */
+    std::uint64_t max_inodes = 0;
+
+    /**
+     * @brief Maximum number of bytes of cached file data, or zero for no
+     * limit.
+     */
+    std::uint64_t max_bytes = 0;
+
+    /**
+     * @brief Upper bound for the chunk size of regular files.
+     *
+     * Data is fetched from the source in chunks, whose size is chosen per
+     * file: about 1/CHUNKS_PER_FILE of the file size, rounded up to a power
+     * of two, but at least CACHE_PAGE_SIZE and at most this. The chunk size
+     * is stored with the inode and only ever grows with the file. Set this to
+     * CACHE_PAGE_SIZE to fetch only the blocks which are accessed.
+     */
+    std::size_t max_chunk_size = 4 << 20;
+
+    /**
+     * @brief Number of buckets in the access sketch used to pick inodes for
+     * eviction.
+     *
+     * Changing this discards the persisted access information.
+     */
+    std::size_t access_sketch_buckets = 1 << 20;
+
+    /**
+     * @brief Share the storage of identical blocks between cached files.
+     *
+     * Fetched blocks are hashed and looked up in an index of known blocks;
+     * matches are shared with FIDEDUPERANGE. This only saves space if the
+     * file system holding the cache supports sharing extents (e.g. btrfs or
+     * XFS with reflinks); elsewhere it only costs the hashing.
+     *
+     * Deduplication is switched off if compression is enabled.
+     */
+    bool deduplicate = false;
+
+    /**
+     * @brief Compress fetched data with this algorithm.
+     *
+     * Existing compressed data can be read regardless of this setting, as
+     * long as the build supports the algorithm it was compressed with. The
+     * cache limits refer to the uncompressed size of the data.
+     */
+    Compression compression = Compression::NONE;
+
+    /**
+     * @brief Open an existing cache without modifying it.
+     *
+     * Only reading operations may be used; this is meant for inspecting a
+     * cache which is not in use, e.g. by fsck() without repair.
+     */
+    bool read_only = false;
+};
+
+
+/**
+ * @brief Location of a block in the block store.
+ */
+struct ChunkLocation {
+    ino_t ino;
+    std::uint64_t block;
+};
+
+
+/**
+ * @brief Usage counters of a cache.
+ *
+ * The counters are maintained transactionally in the meta database, so
+ * reading them is cheap.
+ */
+struct CacheUsage {
+    /**
+     * @brief Number of inodes, including orphans which have not been
+     * reaped yet.
+     */
+    std::uint64_t inodes;
+
+    /**
+     * @brief Number of bytes of cached file data.
+     */
+    std::uint64_t cached_bytes;
+
+    /**
+     * @brief Number of bytes of cached file data in pinned files.
+     */
+    std::uint64_t pinned_bytes;
+};
+
+
+/**
+ * @brief Locks held by a top-level transaction for its whole lifetime.
+ *
+ * Nested transactions do not hold any locks of their own; they are covered by
+ * the locks of their outermost parent.
+ */
+struct TransactionGuard {
+    /**
+     * @brief Exclusive lock on the writer gate; only held by read-write
+     * transactions.
+     */
+    std::unique_lock<profiled_mutex> writer;
+
+    /**
+     * @brief Shared lock on the LMDB environment.
+     */
+    std::shared_lock<std::shared_mutex> env;
+};
+
+
 class CacheDatabase {
 public:
     CacheDatabase() = delete;
-    explicit CacheDatabase(std::shared_ptr<MDBEnv> env);
+    explicit CacheDatabase(std::shared_ptr<MDBEnv> env,
+                           std::size_t access_sketch_buckets = 1 << 20);
 
 private:
+    /**
+     * @brief Held shared by every top-level transaction and exclusively while
+     * the environment is being replaced.
+     */
+    std::shared_mutex m_env_mutex;
+
+    /**
+     * @brief Held by every top-level read-write transaction and by compaction.
+     *
+     * LMDB serialises writers on its own; this additional gate allows the
+     * compaction to keep writers out while it copies the environment, without
+     * blocking readers.
+     */
+    profiled_mutex m_writer_mutex;
+
     std::shared_ptr<MDBEnv> m_env;
     MDBDbi m_meta_db;
     MDBDbi m_inodes_db;
     MDBDbi m_tree_inode_key_db;
     MDBDbi m_tree_name_key_db;
+    MDBDbi m_tree_hash_key_db;
     MDBDbi m_orphan_db;
     MDBDbi m_links_db;
+    MDBDbi m_journal_db;
+    MDBDbi m_chunks_db;
+    MDBDbi m_traces_db;
 
+    DirectoryIndex m_directory_index;
     size_t m_max_name_length;
 
-    debug_mutex m_in_memory_lock_mutex;
+    std::uint64_t m_max_inodes;
+    std::uint64_t m_max_bytes;
+    std::uint8_t m_max_chunk_shift;
+
+    /**
+     * @brief Inode examined last by the eviction scan, or INVALID_INO to
+     * start at the beginning of the inodes database.
+     *
+     * The keys of the inodes database are sorted bytewise, so the scan has
+     * to step through the database instead of counting up inode numbers.
+     *
+     * Only accessed from read-write transactions, which are serialised.
+     */
+    ino_t m_eviction_hand;
+
+    std::filesystem::path m_data_path;
+
+    AccessSketch m_access_sketch;
+    std::chrono::steady_clock::time_point m_access_sketch_persisted;
+
+    profiled_mutex m_in_memory_lock_mutex;
     InodeReferences m_in_memory_locks;
 
+    void open_dbs();
     void validate_max_key_size();
 
 public:
@@ -193,6 +422,52 @@ public:
         return *m_env;
     }
 
+    /**
+     * @brief Replace the LMDB environment and re-open all databases in it.
+     *
+     * The caller must hold the environment lock exclusively and must have
+     * dropped all other references to the previous environment. In-memory
+     * state (such as inode locks) is kept.
+     */
+    void reopen(std::shared_ptr<MDBEnv> env);
+
+    /**
+     * @brief Drop the reference to the LMDB environment.
+     *
+     * This closes the environment if no other references exist. The only
+     * valid operation afterwards is reopen().
+     */
+    void close();
+
+    [[nodiscard]] inline TransactionGuard ro_guard()
+    {
+        return TransactionGuard{
+            std::unique_lock<profiled_mutex>(),
+            std::shared_lock<std::shared_mutex>(m_env_mutex),
+        };
+    }
+
+    [[nodiscard]] inline TransactionGuard rw_guard()
+    {
+        // order matters: the writer gate is always taken before the
+        // environment lock
+        std::unique_lock<profiled_mutex> writer(m_writer_mutex);
+        return TransactionGuard{
+            std::move(writer),
+            std::shared_lock<std::shared_mutex>(m_env_mutex),
+        };
+    }
+
+    [[nodiscard]] inline auto writer_guard()
+    {
+        return std::unique_lock<profiled_mutex>(m_writer_mutex);
+    }
+
+    [[nodiscard]] inline auto exclusive_env_guard()
+    {
+        return std::unique_lock<std::shared_mutex>(m_env_mutex);
+    }
+
     [[nodiscard]] inline MDBDbi &meta_db()
     {
         return m_meta_db;
@@ -213,6 +488,11 @@ public:
         return m_tree_name_key_db;
     }
 
+    [[nodiscard]] inline MDBDbi &tree_hash_key_db()
+    {
+        return m_tree_hash_key_db;
+    }
+
     [[nodiscard]] inline MDBDbi &orphan_db()
     {
         return m_orphan_db;
@@ -223,15 +503,100 @@ public:
         return m_links_db;
     }
 
+    [[nodiscard]] inline MDBDbi &journal_db()
+    {
+        return m_journal_db;
+    }
+
+    [[nodiscard]] inline MDBDbi &chunks_db()
+    {
+        return m_chunks_db;
+    }
+
+    [[nodiscard]] inline MDBDbi &traces_db()
+    {
+        return m_traces_db;
+    }
+
     [[nodiscard]] inline size_t max_name_length() const
     {
         return m_max_name_length;
     }
 
+    [[nodiscard]] inline DirectoryIndex directory_index() const
+    {
+        return m_directory_index;
+    }
+
+    /**
+     * @brief Select the directory index in use.
+     *
+     * This must match what is stored in the database; it is set by the Cache
+     * after reading the meta database.
+     */
+    void set_directory_index(DirectoryIndex index);
+
+    inline void set_limits(std::uint64_t max_inodes, std::uint64_t max_bytes)
+    {
+        m_max_inodes = max_inodes;
+        m_max_bytes = max_bytes;
+    }
+
+    /**
+     * @brief Set the upper bound for chunk sizes; see
+     * CacheOptions::max_chunk_size.
+     */
+    void set_max_chunk_size(std::size_t max_chunk_size);
+
+    /**
+     * @brief Return the chunk shift for a regular file of the given size.
+     *
+     * @see CacheOptions::max_chunk_size
+     */
+    [[nodiscard]] std::uint8_t chunk_shift_for(std::uint64_t size) const;
+
+    /**
+     * @brief Set the directory holding the cached file data.
+     */
+    inline void set_data_path(const std::filesystem::path &path)
+    {
+        m_data_path = path;
+    }
+
+    [[nodiscard]] inline const std::filesystem::path &data_path() const
+    {
+        return m_data_path;
+    }
+
+    [[nodiscard]] inline std::uint64_t max_inodes() const
+    {
+        return m_max_inodes;
+    }
+
+    [[nodiscard]] inline std::uint64_t max_bytes() const
+    {
+        return m_max_bytes;
+    }
+
+    [[nodiscard]] inline ino_t &eviction_hand()
+    {
+        return m_eviction_hand;
+    }
+
+    [[nodiscard]] inline AccessSketch &access_sketch()
+    {
+        return m_access_sketch;
+    }
+
+    [[nodiscard]] inline std::chrono::steady_clock::time_point &access_sketch_persisted()
+    {
+        return m_access_sketch_persisted;
+    }
+
     [[nodiscard]] Result<void> check_name(std::string_view name, bool for_writing);
 
     [[nodiscard]] inline auto in_memory_lock_guard() {
-        return std::unique_lock<debug_mutex>(m_in_memory_lock_mutex);
+        return std::unique_lock<profiled_mutex>(m_in_memory_lock_mutex);
     }
 
     [[nodiscard]] inline InodeReferences &in_memory_locks() {
@@ -242,48 +607,18 @@ public:
 
 
 /**
- * @brief Handle to a regular, cached file.
- * 
- * This handle arbitrates access to the cached file. The file can be manipulated
- * concurrently. The effects of that are similar to the effects of concurrently
- * manipulating a file on disk.
- * 
- * Most operations will generally not need a valid write transaction, however,
- * in some cases, (write) access to the LMDB data is required (for example, 
- * when resizing a file due to a write beyond the current last block).  In such
- * cases, if not passed a valid write transaction, the methods will start a 
- * transaction on their own.
- * 
- * Note that there is still no synchronisation between the LMDB-backed metadata
- * and the data inside the cache; in case of a crash, it is possible that 
- * data is missing from the cache for which LMDB already has metadata.
- *
- * Random notes:
- *
- * - Three backing files: page list (vector of startpage+size tuples), blockmap
- *   (two bytes / page with access counter and state), actual data
- * - Idea: use mmaped file with vector directly. however, that will not work
- *   because C++ allocators require zero-initialised memory from allocate() and
- *   do not support reallocate (which would be required to resize the mapping as
- *   needed).
- *   -> we need a custom vector-like implementation
+ * @brief Result of a database compaction.
  */
-class RegularFileHandle {
-private:
-    ino_t m_ino;
-    int m_blockmap_fd;
-    int m_blocks_fd;
-    void *m_blockmap_mmap;
-
-public:
-    [[nodiscard]] ino_t inode() const;
-
-    [[nodiscard]] Result<std::size_t> pread(off_t off, void *buf, std::size_t n);
-    [[nodiscard]] Result<std::size_t> pwrite(off_t off, const void *buf, std::size_t n);
-    [[nodiscard]] Result<void> truncate(std::size_t size);
-    [[nodiscard]] Result<void> allocate(int mode, off_t offset, off_t len);
-    [[nodiscard]] Result<void> fsync();
+struct CompactionResult {
+    /**
+     * @brief Size of the database file before compaction, in bytes.
+     */
+    std::uint64_t size_before;
 
+    /**
+     * @brief Size of the database file after compaction, in bytes.
+     */
+    std::uint64_t size_after;
 };
 
 
@@ -293,16 +628,64 @@ public:
 
 public:
     Cache() = delete;
-    explicit Cache(const std::filesystem::path &db_path);
+    explicit Cache(const std::filesystem::path &db_path,
+                   const CacheOptions &options = CacheOptions());
     Cache(const Cache &src) = delete;
     Cache(Cache &&src) = delete;
     Cache &operator=(const Cache &src) = delete;
     Cache &operator=(Cache &&src) = delete;
-    ~Cache() = default;
+    ~Cache();
 
 private:
+    std::filesystem::path m_path;
     CacheDatabase m_db;
 
+    profiled_mutex m_open_files_mutex;
+    std::map<ino_t, std::weak_ptr<RegularFileHandle>> m_open_files;
+
+    /**
+     * @brief Set while the cached files may be inconsistent after an unclean
+     * shutdown and not all of them have been checked yet.
+     */
+    std::atomic<bool> m_recovery_pending;
+
+    /**
+     * @brief Files which have been checked while recovery is pending.
+     *
+     * Guarded by m_open_files_mutex.
+     */
+    std::set<ino_t> m_checked_files;
+
+    /**
+     * @brief Files which are being checked right now.
+     *
+     * The check itself runs without m_open_files_mutex; whoever wants to
+     * check or open such a file waits on m_check_done instead.
+     *
+     * Guarded by m_open_files_mutex.
+     */
+    std::set<ino_t> m_checking_files;
+    std::condition_variable_any m_check_done;
+
+    std::atomic<bool> m_deduplicate;
+    std::atomic<std::uint64_t> m_dedup_hashed_bytes;
+    std::atomic<std::uint64_t> m_dedup_shared_bytes;
+    std::atomic<std::uint64_t> m_dedup_stale_entries;
+
+    Compression m_compression;
+    CompressionCounters m_compression_counters;
+
+    /**
+     * @see CacheOptions::read_only
+     */
+    const bool m_read_only;
+
+    /**
+     * @brief Apply the settings and state stored in the meta database of an
+     * existing or just @a created cache.
+     */
+    void load_meta(MDBROTransactionImpl &txn, bool created);
+
 public:
     /**
      * @brief Get maximum length of directory entry names.
@@ -312,9 +695,214 @@ public:
         return m_db.max_name_length();
     }
 
+    /**
+     * @brief Access information used for eviction.
+     *
+     * Users of the cache should touch() inodes when serving requests for them.
+     */
+    [[nodiscard]] inline AccessSketch &access_sketch()
+    {
+        return m_db.access_sketch();
+    }
+
+    /**
+     * @brief Write the access sketch to the database.
+     *
+     * This happens periodically during eviction and when the cache is
+     * destroyed.
+     */
+    [[nodiscard]] Result<void> persist_access_sketch();
+
+    /**
+     * @brief Directory holding the cached file data.
+     *
+     * @see RegularFileHandle
+     */
+    [[nodiscard]] inline const std::filesystem::path &data_path() const
+    {
+        return m_db.data_path();
+    }
+
+    /**
+     * @brief Get the directory index the cache was created with.
+     */
+    [[nodiscard]] inline DirectoryIndex directory_index() const
+    {
+        return m_db.directory_index();
+    }
+
     [[nodiscard]] CacheTransactionRO begin_ro();
     [[nodiscard]] CacheTransactionRW begin_rw();
 
+    /**
+     * @brief Compact the metadata database while the cache is in use.
+     *
+     * A compacted copy of the database is written next to the live database
+     * using LMDB's compacting copy, which omits free pages. Readers continue
+     * to run while the copy is made; writers are held back until the copy has
+     * been swapped in. The swap itself is an atomic rename and only needs to
+     * wait for the currently running transactions to finish.
+     *
+     * The calling thread must not hold any transaction, and no other process
+     * may have the cache open.
+     *
+     * @return The size of the database file before and after compaction.
+     */
+    [[nodiscard]] Result<CompactionResult> compact();
+
+    /**
+     * @brief Check the consistency of the metadata database and of the
+     * cached data, and optionally repair it.
+     *
+     * The cross-references between the inodes, the directory entries, the
+     * directory index, the orphan list and the per-inode records are checked
+     * in key-range partitions, each in its own read-only transaction, and
+     * the Blocklists of the cached files are checked alongside; up to
+     * FsckOptions::threads partitions are checked in parallel. Repairs are
+     * made in a single transaction afterwards, followed by reaping the
+     * orphans.
+     *
+     * This is meant to run offline: no file of the cache may be open and no
+     * other process may use the cache.
+     *
+     * If no inconsistent cached data is left afterwards, recovery after an
+     * unclean shutdown is finished, too (see finish_recovery()).
+     *
+     * Error codes:
+     *
+     * - EIO: The database could not be read.
+     * - EROFS: Repair was requested on a read-only cache.
+     */
+    [[nodiscard]] Result<FsckReport> fsck(const FsckOptions &options = FsckOptions());
+
+    /**
+     * @brief Open the cached data of a regular file.
+     *
+     * All callers opening the same inode share a single handle while it is
+     * open.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such inode.
+     * - EISDIR: The inode is a directory.
+     * - EINVAL: The inode is not a regular file.
+     * - EIO: The cached data could not be opened.
+     */
+    [[nodiscard]] Result<std::shared_ptr<RegularFileHandle>> open_file(ino_t ino);
+
+    /**
+     * @brief Check whether the previous user of the cache did not shut down
+     * cleanly and not all cached files have been checked since.
+     *
+     * Opening the cache does not wait for the checks: files are checked when
+     * they are first opened (see check_file()) and by the background sweep,
+     * which calls finish_recovery() once it has seen all of them.
+     */
+    [[nodiscard]] inline bool recovery_pending() const
+    {
+        return m_recovery_pending.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Check the cached data of a file once while recovery is pending.
+     *
+     * Inconsistent data is discarded and will be fetched again. This does
+     * nothing if recovery is not pending or if the file has been checked
+     * already.
+     *
+     * The calling thread must not hold any transaction.
+     *
+     * @return Whether data has been discarded.
+     *
+     * @see RegularFileHandle::check()
+     */
+    [[nodiscard]] Result<bool> check_file(ino_t ino);
+
+    /**
+     * @brief Declare that all cached files have been checked.
+     *
+     * Afterwards, the cache is marked as cleanly shut down when it is
+     * destroyed.
+     */
+    void finish_recovery();
+
+    /**
+     * @brief List the inodes for which data is cached, in ascending order.
+     */
+    [[nodiscard]] std::vector<ino_t> cached_files() const;
+
+    /**
+     * @brief Reap orphaned inodes in a transaction of its own.
+     *
+     * @param limit Maximum number of orphans to reap.
+     * @return The number of orphans which have been reaped.
+     */
+    [[nodiscard]] Result<std::size_t> reap_orphans(std::size_t limit);
+
+    /**
+     * @brief Check whether fetched blocks are deduplicated.
+     *
+     * This is switched off automatically once the file system holding the
+     * cache turns out not to support sharing extents.
+     */
+    [[nodiscard]] inline bool deduplication_enabled() const
+    {
+        return m_deduplicate.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Share the storage of freshly fetched blocks with identical
+     * blocks of other cached files.
+     *
+     * Only blocks which lie completely within the range are considered. This
+     * is best-effort; errors are not reported. Blocks which have not been
+     * seen before are added to the index.
+     *
+     * The calling thread must not hold any transaction.
+     *
+     * @param ino Inode of the file.
+     * @param file The cached data of the file.
+     * @param off Offset of the data within the file.
+     * @param data The data as it has been written to the cache.
+     * @param n Length of the data.
+     */
+    void deduplicate(ino_t ino, RegularFileHandle &file, off_t off,
+                     const std::byte *data, std::size_t n);
+
+    /**
+     * @brief Counters of the block deduplication since the cache was opened.
+     */
+    [[nodiscard]] DedupStats dedup_stats() const;
+
+    /**
+     * @brief Algorithm fetched data is compressed with.
+     */
+    [[nodiscard]] inline Compression compression() const
+    {
+        return m_compression;
+    }
+
+    /**
+     * @brief Compress freshly fetched blocks.
+     *
+     * This is best-effort; errors are not reported.
+     *
+     * @see RegularFileHandle::compress()
+     */
+    void compress(RegularFileHandle &file, off_t off, std::size_t n);
+
+    /**
+     * @brief Counters of the compression since the cache was opened.
+     */
+    [[nodiscard]] CompressionStats compression_stats() const;
+
+    /**
+     * @brief Measure the space used by cached data on disk.
+     *
+     * @see Dragonstash::measure_storage()
+     */
+    [[nodiscard]] Result<StorageUsage> storage_usage();
+
     /**
      * @brief Look up the name of an inode
      * @param ino Number of the inode
@@ -374,11 +962,46 @@ public:
 
     [[nodiscard]] Result<void> release(ino_t ino);
 
+    /**
+     * @brief Pin or unpin a regular file.
+     *
+     * @see CacheTransactionRW::set_pinned()
+     */
+    [[nodiscard]] Result<void> set_pinned(ino_t ino, bool pinned);
+
     [[nodiscard]] Result<std::string> readlink(ino_t ino);
 
     [[nodiscard]] Result<void> writelink(ino_t ino, std::string_view dest);
 
     [[nodiscard]] Result<std::string> path(ino_t ino);
+
+    [[nodiscard]] Result<CacheUsage> usage();
+
+    /**
+     * @brief Report how much of a regular file is present in the cache.
+     *
+     * This is cheap enough to be called for many files: it does not open
+     * the cached data, only the Blocklist (or uses the handle of a file
+     * which is open anyway).
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such inode.
+     * - EISDIR: The inode is a directory.
+     * - EINVAL: The inode is not a regular file.
+     * - EIO: The Blocklist cannot be read.
+     *
+     * @see RegularFileHandle::residency()
+     */
+    [[nodiscard]] Result<FileResidency> residency(ino_t ino, bool with_ranges);
+
+    /**
+     * @brief Report cache usage in the format of statvfs(3).
+     *
+     * Limits which are not configured are filled in from the file system
+     * holding the cache directory. This does not scan the database.
+     */
+    [[nodiscard]] Result<struct statvfs> statfs();
 };
 
 
@@ -478,6 +1101,8 @@ class CacheTransactionRO {
 protected:
     CacheTransactionRO(CacheDatabase &db, MDBROTransaction &&txn,
                        CacheTransactionRW *parent = nullptr);
+    CacheTransactionRO(CacheDatabase &db, TransactionGuard &&guard,
+                       MDBROTransaction &&txn);
 
 public:
     CacheTransactionRO(const CacheTransactionRO &src) = delete;
@@ -488,10 +1113,13 @@ public:
 
 private:
     CacheDatabase *m_db;
+    // must be declared before m_txn so that the transaction is destroyed
+    // before the locks are released
+    TransactionGuard m_guard;
     MDBROTransaction m_txn;
     CacheTransactionRW *m_parent;
-    std::vector<TransactionHook> m_transaction_hooks;
-    std::unique_lock<debug_mutex> m_inode_counter_lock;
+    std::pmr::vector<TransactionHook> m_transaction_hooks{request_memory()};
+    std::unique_lock<profiled_mutex> m_inode_counter_lock;
 
 protected:
     [[nodiscard]] inline CacheDatabase &db() {
@@ -507,6 +1135,29 @@ protected:
 protected:
     std::unique_ptr<std::set<ino_t>> m_rewrite_inode_set;
 
+    /**
+     * @brief Find a directory entry by name using the directory index.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such entry.
+     */
+    [[nodiscard]] Result<ino_t> find_entry(ino_t parent, std::string_view name);
+
+    /**
+     * @brief Check whether the entry for @a child in @a parent is named @a
+     * name.
+     */
+    [[nodiscard]] bool entry_name_is(ino_t parent, ino_t child,
+                                     std::string_view name);
+
+    /**
+     * @brief Look up the name of an inode in a directory without copying it.
+     *
+     * The view is only valid until the next write in this transaction.
+     */
+    [[nodiscard]] Result<std::string_view> name_view(ino_t parent, ino_t ino);
+
 public:
     /**
      * @brief Add a hook to the transaction.
@@ -636,6 +1287,16 @@ public:
 
     [[nodiscard]] Result<Stat> getattr(ino_t ino);
 
+    /**
+     * @brief Return the size of the chunks in which the data of a file is
+     * fetched.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such inode.
+     */
+    [[nodiscard]] Result<std::size_t> chunk_size(ino_t ino);
+
     [[nodiscard]] Result<std::string> readlink(ino_t ino);
 
     /**
@@ -658,6 +1319,12 @@ public:
      */
     [[nodiscard]] Result<std::string> path(ino_t ino);
 
+    /**
+     * @brief Reconstruct the full path of an inode in memory from @a memory.
+     */
+    [[nodiscard]] Result<std::pmr::string> path(ino_t ino,
+                                                std::pmr::memory_resource *memory);
+
     /**
      * @brief Increase reference counter of an inode by one.
      *
@@ -681,6 +1348,61 @@ public:
 
     [[nodiscard]] Result<bool> test_flag(ino_t ino, InodeFlag flag);
 
+    /**
+     * @brief List all inodes which have @a flag set.
+     *
+     * This scans all inodes and is meant for recovery after a restart.
+     */
+    [[nodiscard]] Result<std::vector<ino_t>> inodes_with_flag(InodeFlag flag);
+
+    /**
+     * @brief Read records from the start of the operation journal.
+     *
+     * @param max Maximum number of records to return.
+     *
+     * Error codes:
+     *
+     * - EIO: The journal contains an invalid entry.
+     */
+    [[nodiscard]] Result<std::vector<JournalRecord>> journal(
+            std::size_t max = std::numeric_limits<std::size_t>::max());
+
+    /**
+     * @brief Check whether there are operations which have not been replayed
+     * to the backend yet.
+     *
+     * While this is the case, the cache is ahead of the backend and the
+     * backend must not be used to refresh the cache.
+     */
+    [[nodiscard]] bool journal_empty();
+
+    /**
+     * @brief Look up a block in the deduplication index.
+     *
+     * The entry may be stale; the block may have been changed or evicted
+     * since it was recorded.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No block with this hash is known.
+     */
+    [[nodiscard]] Result<ChunkLocation> find_chunk(std::uint64_t hash);
+
+    /**
+     * @brief Return the access trace recorded for a regular file.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No trace is stored for the inode.
+     * - EIO: The stored trace cannot be decoded.
+     */
+    [[nodiscard]] Result<AccessTrace> get_trace(ino_t ino);
+
+    /**
+     * @brief Read the usage counters.
+     */
+    [[nodiscard]] Result<CacheUsage> usage();
+
     inline explicit operator bool() const {
         return bool(m_txn);
     }
@@ -695,6 +1417,8 @@ class CacheTransactionRW: public CacheTransactionRO {
 protected:
     CacheTransactionRW(CacheDatabase &cache, MDBRWTransaction &&txn,
                        CacheTransactionRW *parent = nullptr);
+    CacheTransactionRW(CacheDatabase &cache, TransactionGuard &&guard,
+                       MDBRWTransaction &&txn);
 
 public:
     CacheTransactionRW(const CacheTransactionRW &src) = delete;
@@ -722,6 +1446,77 @@ private:
 
     [[nodiscard]] Result<void> make_orphan(ino_t ino);
 
+    /**
+     * @brief Add an entry to the directory index.
+     *
+     * @param direntry Serialised DirEntry including the name, as stored in
+     * the inode-keyed tree.
+     */
+    void put_index_entry(ino_t parent, std::string_view name, ino_t child,
+                         std::string_view direntry);
+
+    /**
+     * @brief Remove an entry from the directory index.
+     */
+    void del_index_entry(ino_t parent, std::string_view name, ino_t child);
+
+    /**
+     * @brief Reap a single orphaned inode and its cached data.
+     *
+     * @return false if the inode is still locked and cannot be reaped yet.
+     */
+    bool reap_one(ino_t ino);
+
+    /**
+     * @brief Delete the cached data of a regular file, keeping its inode.
+     *
+     * The data is deleted once the transaction is committed.
+     *
+     * @return The number of bytes which have been dropped.
+     */
+    std::uint64_t drop_file_data(ino_t ino);
+
+    void adjust_counter(std::string_view key, std::int64_t delta);
+
+    void persist_access_sketch();
+
+    /**
+     * @brief Check whether an inode may be evicted.
+     *
+     * @param protect Directory which is being modified by the caller; neither
+     * it nor its children are evicted.
+     */
+    [[nodiscard]] bool is_evictable(ino_t ino, ino_t protect);
+
+    /**
+     * @brief Evict cold inodes until the usage is within the configured
+     * limits.
+     *
+     * @param protect Directory which is being modified by the caller.
+     * @param extra_inodes Number of inodes which the caller is about to add.
+     * @param extra_bytes Number of bytes which the caller is about to add.
+     *
+     * Only the limits which the caller adds to (a non-zero @a extra_inodes
+     * or @a extra_bytes) are enforced.
+     *
+     * Only unreferenced, unpinned leaves (regular files, symlinks and empty
+     * directories) are evicted. Directories become candidates once all their
+     * children are gone. The parent of an evicted inode loses its SYNCED flag.
+     * If only the byte limit is exceeded, just the cached data of regular
+     * files is dropped and their inodes are kept.
+     *
+     * Inodes which have been accessed (according to the AccessSketch) since
+     * the hand last passed them get a second chance. The sketch advances to
+     * the next epoch whenever the hand wraps around.
+     *
+     * Error codes:
+     *
+     * - ENOSPC: Not enough inodes or data could be evicted.
+     */
+    [[nodiscard]] Result<void> enforce_limits(ino_t protect,
+                                              std::uint64_t extra_inodes,
+                                              std::uint64_t extra_bytes);
+
 public:
     [[nodiscard]] inline CacheTransactionRW begin_nested()
     {
@@ -752,11 +1547,90 @@ public:
     [[nodiscard]] Result<void> unlink(ino_t parent, ino_t child);
     [[nodiscard]] Result<void> unlink(ino_t parent, std::string_view name);
 
+    /**
+     * @brief Move a directory entry.
+     *
+     * An existing entry at the destination is unlinked. The inode number of
+     * the moved entry is kept.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such entry.
+     * - ENAMETOOLONG: The new name is too long for the directory index.
+     */
+    [[nodiscard]] Result<void> rename(ino_t parent, std::string_view name,
+                                      ino_t new_parent, std::string_view new_name);
+
+    /**
+     * @brief Change the permission bits of an inode.
+     *
+     * The format bits (S_IFMT) of @a mode are ignored.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such inode.
+     */
+    [[nodiscard]] Result<void> chmod(ino_t ino, std::uint32_t mode);
+
+    /**
+     * @brief Replace the common attributes of an inode.
+     *
+     * The mode, the parent and the flags of the inode are kept. The chunk
+     * size of a regular file is raised if it has grown enough.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such inode.
+     */
     // TODO: `which` argument
     [[nodiscard]] Result<void> setattr(ino_t ino, const CommonFileAttributes &attrs);
 
+    /**
+     * @brief Reap up to ORPHAN_REAP_BATCH orphaned inodes.
+     *
+     * Orphans which are still locked are skipped.
+     */
     [[nodiscard]] Result<void> clean_orphans();
 
+    /**
+     * @brief Reap up to @a limit orphaned inodes.
+     *
+     * @return The number of orphans which have been reaped.
+     */
+    [[nodiscard]] Result<std::size_t> reap_orphans(std::size_t limit);
+
+    /**
+     * @brief Account for cached file data being added or removed.
+     *
+     * @param cached Change of the number of cached bytes.
+     * @param pinned Change of the number of cached bytes in pinned files.
+     */
+    void account_bytes(std::int64_t cached, std::int64_t pinned);
+
+    /**
+     * @brief Account for cached data of a regular file being added or
+     * removed.
+     *
+     * The change counts towards the pinned bytes, too, if the file is pinned.
+     *
+     * Added data is subject to CacheOptions::max_bytes: the cached data of
+     * cold files is dropped to make room (see enforce_limits()).
+     */
+    void account_file_bytes(ino_t ino, std::int64_t cached);
+
+    /**
+     * @brief Pin or unpin a regular file.
+     *
+     * Pinned files are never evicted, and their cached data is counted in
+     * CacheUsage::pinned_bytes.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No such inode.
+     * - EINVAL: The inode is not a regular file.
+     */
+    [[nodiscard]] Result<void> set_pinned(ino_t ino, bool pinned);
+
     [[nodiscard]] Result<void> writelink(ino_t ino, std::string_view dest);
 
     [[nodiscard]] Result<void> update_flags(ino_t ino,
@@ -799,6 +1673,50 @@ public:
      * - EBADFD: No rewrite operation is in progress.
      */
     [[nodiscard]] Result<void> finish_dir_rewrite();
+
+    /**
+     * @brief Append an operation to the journal.
+     *
+     * @return The sequence number of the new record.
+     */
+    std::uint64_t journal_append(const JournalEntry &entry);
+
+    /**
+     * @brief Remove a record from the journal after it has been replayed.
+     */
+    void journal_remove(std::uint64_t seq);
+
+    /**
+     * @brief Compact the journal in place.
+     *
+     * @see compact_journal()
+     *
+     * @return The number of records which have been dropped.
+     */
+    [[nodiscard]] Result<std::size_t> compact_journal();
+
+    /**
+     * @brief Record the location of a block in the deduplication index,
+     * replacing any previous entry for the hash.
+     */
+    void put_chunk(std::uint64_t hash, const ChunkLocation &location);
+
+    /**
+     * @brief Store the access trace of a regular file, replacing any
+     * previous trace.
+     *
+     * The trace is dropped together with the inode.
+     */
+    void put_trace(ino_t ino, const AccessTrace &trace);
+
+    void del_trace(ino_t ino);
+
+    /**
+     * @brief Drop all access traces recorded before @a before.
+     *
+     * @return The number of traces which have been dropped.
+     */
+    std::size_t expire_traces(std::time_t before);
 };
 
 }
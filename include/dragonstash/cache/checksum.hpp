@@ -0,0 +1,59 @@
+/**********************************************************************
+File name: checksum.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_CHECKSUM_H
+#define DRAGONSTASH_CACHE_CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dragonstash {
+
+/**
+ * @brief Compute the CRC32C (Castagnoli) of a buffer.
+ *
+ * Uses the SSE4.2 crc32 instruction (on three interleaved streams) if the CPU
+ * supports it and a table-driven implementation otherwise.
+ *
+ * @param crc Result of a previous call to continue a checksum, zero to start
+ * a new one.
+ */
+[[nodiscard]] std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                                   std::size_t n);
+
+/**
+ * @brief Portable implementation of crc32c(); exposed for tests and
+ * benchmarks.
+ */
+[[nodiscard]] std::uint32_t crc32c_portable(std::uint32_t crc, const void *data,
+                                            std::size_t n);
+
+/**
+ * @brief Check whether crc32c() uses hardware acceleration.
+ */
+[[nodiscard]] bool crc32c_accelerated();
+
+}
+
+#endif
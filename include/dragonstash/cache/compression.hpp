@@ -0,0 +1,199 @@
+/**********************************************************************
+File name: compression.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_COMPRESSION_H
+#define DRAGONSTASH_CACHE_COMPRESSION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "dragonstash/error.hpp"
+#include "dragonstash/cache/common.hpp"
+
+namespace Dragonstash {
+
+/**
+ * @brief Compression algorithm for cached data.
+ *
+ * The values are part of the on-disk format (see RegularFileHandle) and must
+ * not be changed.
+ */
+enum class Compression : std::uint8_t {
+    NONE = 0,
+    LZ4 = 1,
+    ZSTD = 2,
+};
+
+/**
+ * @brief Number of blocks compressed as a unit.
+ */
+static constexpr std::size_t COMPRESSION_EXTENT_BLOCKS = 16;
+static constexpr std::size_t COMPRESSION_EXTENT_SIZE = COMPRESSION_EXTENT_BLOCKS * CACHE_PAGE_SIZE;
+
+/**
+ * @brief Sample entropy (in bits per byte) above which data is assumed to be
+ * compressed already.
+ */
+static constexpr double COMPRESSION_ENTROPY_LIMIT = 7.5;
+
+/**
+ * @brief Check whether this build supports an algorithm.
+ *
+ * Compression::NONE is always supported.
+ */
+[[nodiscard]] bool compression_available(Compression algorithm);
+
+/**
+ * @brief Estimate the entropy of a buffer in bits per byte.
+ *
+ * Only a few windows spread over the buffer are looked at, so this is cheap
+ * enough to run on every extent before attempting to compress it.
+ */
+[[nodiscard]] double sample_entropy(const std::byte *data, std::size_t n);
+
+/**
+ * @brief Compress a buffer.
+ *
+ * @return The size of the compressed data, or zero if it does not fit into
+ * @a capacity bytes.
+ *
+ * Error codes:
+ *
+ * - EOPNOTSUPP: The algorithm is not supported by this build.
+ */
+[[nodiscard]] Result<std::size_t> compress(Compression algorithm,
+                                           const std::byte *src, std::size_t n,
+                                           std::byte *dest, std::size_t capacity);
+
+/**
+ * @brief Decompress a buffer.
+ *
+ * @return The size of the decompressed data.
+ *
+ * Error codes:
+ *
+ * - EOPNOTSUPP: The algorithm is not supported by this build.
+ * - EIO: The data is corrupt or does not fit into @a capacity bytes.
+ */
+[[nodiscard]] Result<std::size_t> decompress(Compression algorithm,
+                                             const std::byte *src, std::size_t n,
+                                             std::byte *dest, std::size_t capacity);
+
+/**
+ * @brief Snapshot of CompressionCounters.
+ */
+struct CompressionStats {
+    /**
+     * @brief Number of bytes in complete extents which have been considered
+     * for compression.
+     */
+    std::uint64_t probed_bytes;
+
+    /**
+     * @brief Number of bytes which have not been compressed because their
+     * entropy is too high.
+     */
+    std::uint64_t skipped_bytes;
+
+    /**
+     * @brief Number of bytes which are stored compressed now.
+     */
+    std::uint64_t compressed_bytes;
+
+    /**
+     * @brief Number of bytes the compressed data occupies.
+     */
+    std::uint64_t stored_bytes;
+
+    /**
+     * @brief Time spent in the compressor, in nanoseconds.
+     */
+    std::uint64_t compress_ns;
+
+    /**
+     * @brief Number of bytes produced by the decompressor.
+     */
+    std::uint64_t decompressed_bytes;
+
+    /**
+     * @brief Time spent in the decompressor, in nanoseconds.
+     */
+    std::uint64_t decompress_ns;
+
+    /**
+     * @brief Compression ratio of the extents stored compressed; 1.0 if
+     * nothing has been compressed.
+     */
+    [[nodiscard]] inline double ratio() const
+    {
+        if (stored_bytes == 0) {
+            return 1.0;
+        }
+        return static_cast<double>(compressed_bytes) / stored_bytes;
+    }
+
+    /**
+     * @brief Compressor throughput in bytes per second.
+     */
+    [[nodiscard]] inline double compress_throughput() const
+    {
+        if (compress_ns == 0) {
+            return 0.0;
+        }
+        return static_cast<double>(probed_bytes - skipped_bytes) * 1e9 / compress_ns;
+    }
+
+    /**
+     * @brief Decompressor throughput in bytes per second.
+     */
+    [[nodiscard]] inline double decompress_throughput() const
+    {
+        if (decompress_ns == 0) {
+            return 0.0;
+        }
+        return static_cast<double>(decompressed_bytes) * 1e9 / decompress_ns;
+    }
+};
+
+/**
+ * @brief Counters shared by all handles of a cache.
+ *
+ * @see CompressionStats for the meaning of the counters.
+ */
+struct CompressionCounters {
+    std::atomic<std::uint64_t> probed_bytes{0};
+    std::atomic<std::uint64_t> skipped_bytes{0};
+    std::atomic<std::uint64_t> compressed_bytes{0};
+    std::atomic<std::uint64_t> stored_bytes{0};
+    std::atomic<std::uint64_t> compress_ns{0};
+    std::atomic<std::uint64_t> decompressed_bytes{0};
+    std::atomic<std::uint64_t> decompress_ns{0};
+
+    [[nodiscard]] CompressionStats load() const;
+};
+
+}
+
+#endif
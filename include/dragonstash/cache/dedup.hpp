@@ -0,0 +1,123 @@
+/**********************************************************************
+File name: dedup.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_DEDUP_H
+#define DRAGONSTASH_CACHE_DEDUP_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include "dragonstash/error.hpp"
+
+namespace Dragonstash {
+
+/**
+ * @brief Content hash of a block, used to find candidates for sharing.
+ *
+ * This is XXH64 with seed zero. It is part of the on-disk format (keys of the
+ * `chunks` database) and must not be changed.
+ *
+ * The hash is not collision resistant; data is only ever shared after the
+ * kernel has compared both ranges byte by byte.
+ */
+[[nodiscard]] std::uint64_t chunk_hash(const std::byte *data, std::size_t n);
+
+/**
+ * @brief Make a range of one file share the storage of an identical range of
+ * another file (FIDEDUPERANGE).
+ *
+ * The contents of both files are unchanged; a later write to either file
+ * un-shares the affected extents again.
+ *
+ * @return The number of bytes shared; zero if the ranges differ. Fails with
+ * EOPNOTSUPP or EINVAL if the file system does not support sharing data (or
+ * not for this range).
+ */
+[[nodiscard]] Result<std::size_t> share_range(int src_fd, off_t src_off,
+                                              int dest_fd, off_t dest_off,
+                                              std::size_t n);
+
+/**
+ * @brief Counters of the block deduplication since the cache was opened.
+ */
+struct DedupStats {
+    /**
+     * @brief Number of bytes which have been hashed and looked up.
+     */
+    std::uint64_t hashed_bytes;
+
+    /**
+     * @brief Number of bytes which were found to be stored already and are
+     * now shared.
+     */
+    std::uint64_t shared_bytes;
+
+    /**
+     * @brief Number of lookups which hit a stale index entry.
+     */
+    std::uint64_t stale_entries;
+};
+
+/**
+ * @brief Usage of the block store, taking shared extents into account.
+ */
+struct StorageUsage {
+    /**
+     * @brief Number of bytes allocated by all cached files, counting shared
+     * extents once per file.
+     */
+    std::uint64_t logical_bytes;
+
+    /**
+     * @brief Number of bytes actually allocated on disk.
+     */
+    std::uint64_t physical_bytes;
+
+    /**
+     * @brief Deduplication ratio; 1.0 if nothing is shared.
+     */
+    [[nodiscard]] inline double dedup_ratio() const
+    {
+        if (physical_bytes == 0) {
+            return 1.0;
+        }
+        return static_cast<double>(logical_bytes) / physical_bytes;
+    }
+};
+
+/**
+ * @brief Measure the storage usage of the data directory of a cache.
+ *
+ * This walks the extent maps (FIEMAP) of all data files and is thus
+ * relatively expensive; it is meant for statistics, not for the hot path.
+ */
+[[nodiscard]] Result<StorageUsage> measure_storage(
+        const std::filesystem::path &data_dir);
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+/**********************************************************************
+File name: fsck.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_FSCK_H
+#define DRAGONSTASH_CACHE_FSCK_H
+
+#include <cstdint>
+
+namespace Dragonstash {
+
+/**
+ * @brief Options for Cache::fsck().
+ */
+struct FsckOptions {
+    /**
+     * @brief Number of threads which check in parallel.
+     */
+    unsigned threads = 1;
+
+    /**
+     * @brief Fix the problems which have been found.
+     *
+     * Inodes which cannot be reached are orphaned and reaped, dangling
+     * records are deleted, missing index entries are recreated, inconsistent
+     * cached data is discarded and the usage counters are recomputed.
+     */
+    bool repair = false;
+};
+
+/**
+ * @brief Result of Cache::fsck().
+ *
+ * The problem counters describe the state before any repair.
+ */
+struct FsckReport {
+    /**
+     * @brief Number of inodes checked.
+     */
+    std::uint64_t inodes;
+
+    /**
+     * @brief Number of directory entries checked.
+     */
+    std::uint64_t entries;
+
+    /**
+     * @brief Number of cached files whose Blocklist has been checked.
+     */
+    std::uint64_t files;
+
+    /**
+     * @brief Inode records which cannot be parsed.
+     */
+    std::uint64_t corrupt_inodes;
+
+    /**
+     * @brief Inodes with a parent which do not have a directory entry in it,
+     * or whose parent is not a directory.
+     */
+    std::uint64_t detached_inodes;
+
+    /**
+     * @brief Inodes without a parent which are not in the orphan list.
+     */
+    std::uint64_t lost_orphans;
+
+    /**
+     * @brief Entries in the orphan list for inodes which do not exist or
+     * which still have a parent.
+     */
+    std::uint64_t stale_orphans;
+
+    /**
+     * @brief Directory entries referring to an inode which does not exist or
+     * which has a different parent.
+     */
+    std::uint64_t dangling_entries;
+
+    /**
+     * @brief Directory entries which cannot be found by name.
+     */
+    std::uint64_t missing_index_entries;
+
+    /**
+     * @brief Records in the directory index without a directory entry.
+     */
+    std::uint64_t stale_index_entries;
+
+    /**
+     * @brief Symbolic links without a destination.
+     */
+    std::uint64_t missing_links;
+
+    /**
+     * @brief Link destinations and access traces of inodes which do not
+     * exist or have the wrong type.
+     */
+    std::uint64_t stale_records;
+
+    /**
+     * @brief Cached files with an inconsistent Blocklist.
+     */
+    std::uint64_t corrupt_files;
+
+    /**
+     * @brief Cached files which do not belong to a regular file inode.
+     */
+    std::uint64_t stray_files;
+
+    /**
+     * @brief Usage counters (inodes and cached bytes) which do not match
+     * the contents of the cache.
+     */
+    std::uint64_t wrong_counters;
+
+    /**
+     * @brief Whether the problems have been repaired.
+     */
+    bool repaired;
+
+    [[nodiscard]] inline std::uint64_t problems() const
+    {
+        return corrupt_inodes + detached_inodes + lost_orphans +
+                stale_orphans + dangling_entries + missing_index_entries +
+                stale_index_entries + missing_links + stale_records +
+                corrupt_files + stray_files + wrong_counters;
+    }
+};
+
+}
+
+#endif
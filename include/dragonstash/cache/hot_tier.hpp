@@ -0,0 +1,277 @@
+/**********************************************************************
+File name: hot_tier.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_HOT_TIER_H
+#define DRAGONSTASH_CACHE_HOT_TIER_H
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "dragonstash/profiled_mutex.hpp"
+#include "dragonstash/cache/common.hpp"
+#include "dragonstash/cache/inode.hpp"
+
+namespace Dragonstash {
+
+struct HotTierOptions {
+    /**
+     * @brief Size of the arena in bytes; zero disables the hot tier.
+     */
+    std::size_t capacity = 0;
+
+    /**
+     * @brief Only blocks of files up to this size are admitted.
+     */
+    std::uint64_t max_file_size = 1024*1024;
+
+    /**
+     * @brief Number of reads of a block before it is admitted.
+     */
+    unsigned admission_threshold = 2;
+};
+
+struct HotTierStats {
+    /**
+     * @brief Reads served from memory.
+     */
+    std::uint64_t hits;
+
+    /**
+     * @brief Reads which had to go to the disk store.
+     */
+    std::uint64_t misses;
+
+    /**
+     * @brief Blocks copied into the arena.
+     */
+    std::uint64_t admitted;
+
+    /**
+     * @brief Blocks which were read, but were not hot enough to be admitted.
+     */
+    std::uint64_t rejected;
+
+    /**
+     * @brief Blocks which were evicted to make room for hotter ones.
+     */
+    std::uint64_t evicted;
+
+    /**
+     * @brief Blocks which were dropped because their file changed.
+     */
+    std::uint64_t invalidated;
+
+    /**
+     * @brief Number of blocks currently held.
+     */
+    std::uint64_t resident;
+
+    [[nodiscard]] inline double hit_rate() const
+    {
+        const std::uint64_t total = hits + misses;
+        if (total == 0) {
+            return 0.0;
+        }
+        return static_cast<double>(hits) / total;
+    }
+};
+
+/**
+ * @brief In-memory tier of hot blocks in front of the cached data on disk.
+ *
+ * The arena is allocated once and divided into slots of one block
+ * (CACHE_PAGE_SIZE) each. Reads which are fully covered by resident blocks
+ * are served from the arena without copying: lookup() pins the slots and
+ * returns an iovec per block, to be passed to fuse_reply_iov().
+ *
+ * A block is admitted after a read from the disk store once it has been read
+ * admission_threshold times, according to a small count-min sketch of block
+ * accesses whose counters are halved from time to time. When the arena is
+ * full, a clock hand picks the victim (skipping pinned slots and giving
+ * recently hit ones a second chance), and the new block only replaces it if
+ * it has been read more often. Only blocks of small files are admitted; large
+ * files would flush the arena and are served well by the page cache.
+ *
+ * The tier mirrors the disk store and must be told about every change of the
+ * cached data of a file (invalidate()). To keep a read racing with such a
+ * change from admitting outdated data, admit() takes the generation() from
+ * before the data was read and refuses if anything has been invalidated
+ * since.
+ */
+class HotTier {
+public:
+    /**
+     * @brief Blocks served from memory by lookup().
+     *
+     * The blocks stay pinned until this is destroyed.
+     */
+    class Read {
+    public:
+        Read() = default;
+        Read(const Read &src) = delete;
+        Read(Read &&src) noexcept;
+        Read &operator=(const Read &src) = delete;
+        Read &operator=(Read &&src) noexcept;
+        ~Read();
+
+    private:
+        HotTier *m_tier = nullptr;
+        std::vector<std::size_t> m_slots;
+        std::vector<iovec> m_iov;
+        std::size_t m_size = 0;
+
+        friend class HotTier;
+
+    public:
+        explicit inline operator bool() const
+        {
+            return m_tier != nullptr;
+        }
+
+        [[nodiscard]] inline const iovec *iov() const
+        {
+            return m_iov.data();
+        }
+
+        [[nodiscard]] inline int count() const
+        {
+            return static_cast<int>(m_iov.size());
+        }
+
+        /**
+         * @brief Total number of bytes.
+         */
+        [[nodiscard]] inline std::size_t size() const
+        {
+            return m_size;
+        }
+    };
+
+public:
+    explicit HotTier(const HotTierOptions &options = HotTierOptions());
+    HotTier(const HotTier &src) = delete;
+    HotTier(HotTier &&src) = delete;
+    HotTier &operator=(const HotTier &src) = delete;
+    HotTier &operator=(HotTier &&src) = delete;
+
+private:
+    struct Slot {
+        ino_t ino;
+        std::uint64_t block;
+        std::uint32_t length;
+        std::uint32_t pins;
+        bool used;
+        bool referenced;
+        // invalidated while pinned; freed once the last pin is gone
+        bool stale;
+    };
+
+    const HotTierOptions m_options;
+    const std::size_t m_nslots;
+    std::unique_ptr<std::byte[]> m_arena;
+    std::vector<Slot> m_slots;
+    std::vector<std::uint8_t> m_frequency;
+
+    profiled_mutex m_mutex;
+    std::map<std::pair<ino_t, std::uint64_t>, std::size_t> m_index;
+    std::size_t m_hand;
+    std::uint64_t m_samples;
+    std::atomic<std::uint64_t> m_generation;
+    HotTierStats m_stats;
+
+    /**
+     * @brief Count an access of a block and return its estimated number of
+     * accesses.
+     */
+    unsigned record_access(ino_t ino, std::uint64_t block);
+    [[nodiscard]] unsigned frequency(ino_t ino, std::uint64_t block) const;
+
+    /**
+     * @brief Find a slot for a new block which has been read @a frequency
+     * times.
+     *
+     * @return The slot or m_nslots if the block should not be admitted.
+     */
+    [[nodiscard]] std::size_t find_slot(unsigned frequency);
+
+    void free_slot(std::size_t slot);
+    void unpin(const std::vector<std::size_t> &slots);
+
+public:
+    [[nodiscard]] inline bool enabled() const
+    {
+        return m_nslots > 0;
+    }
+
+    /**
+     * @brief Check whether blocks of a file of the given size are admitted.
+     */
+    [[nodiscard]] inline bool admissible(std::uint64_t file_size) const
+    {
+        return enabled() && file_size <= m_options.max_file_size;
+    }
+
+    [[nodiscard]] inline std::uint64_t generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Serve the byte range [off, off + n) of a file from memory.
+     *
+     * @return A Read which evaluates to false if not all of the range is
+     * resident.
+     */
+    [[nodiscard]] Read lookup(ino_t ino, std::uint64_t off, std::size_t n);
+
+    /**
+     * @brief Offer data which has just been read from the disk store.
+     *
+     * The blocks which are completely covered by the data (or end at the end
+     * of the file) are admitted if they are hot enough.
+     *
+     * @param generation The generation() from before the data was read.
+     */
+    void admit(ino_t ino, std::uint64_t off, const void *data, std::size_t n,
+               std::uint64_t file_size, std::uint64_t generation);
+
+    /**
+     * @brief Drop all blocks of a file.
+     *
+     * Must be called after the cached data of the file has changed.
+     */
+    void invalidate(ino_t ino);
+
+    [[nodiscard]] HotTierStats stats();
+
+};
+
+}
+
+#endif
@@ -29,6 +29,8 @@ authors named in the AUTHORS file.
 #include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <memory_resource>
+#include <string>
 #include <string_view>
 
 #if __cpp_lib_span >= 201803L
@@ -105,7 +107,10 @@ struct Stat {
 static_assert(std::is_pod_v<Stat>);
 
 struct DirectoryEntry: public Stat {
-    std::string name;
+    /**
+     * @brief Name of the entry; allocated from request_memory() by readdir.
+     */
+    std::pmr::string name;
     bool complete;
 };
 
@@ -121,11 +126,40 @@ enum class InodeFlag {
      * been synced yet.
      */
     SYNCED = 0,
+
+    /**
+     * @brief Exclude the inode and, for directories, everything below it from
+     * eviction.
+     */
+    PINNED = 1,
+
+    /**
+     * @brief The cached data of the file contains writes which have not been
+     * written back to the source yet.
+     *
+     * Dirty inodes are never evicted and keep their locally known size and
+     * modification time when they are refreshed from the source.
+     */
+    DIRTY = 2,
 };
 
+/**
+ * @brief Bounds for Inode::chunk_shift.
+ */
+static constexpr std::uint8_t MIN_CHUNK_SHIFT = 12;
+static constexpr std::uint8_t MAX_CHUNK_SHIFT = 30;
+static_assert((std::size_t(1) << MIN_CHUNK_SHIFT) == CACHE_PAGE_SIZE);
+
 struct InodeV1 {
     std::uint8_t version;
-    std::uint8_t _reserved0;
+
+    /**
+     * @brief Binary logarithm of the size of the chunks in which the data of
+     * a regular file is fetched; zero if it has not been chosen yet.
+     *
+     * @see chunk_size()
+     */
+    std::uint8_t chunk_shift;
     std::uint16_t flags;
     std::uint32_t _reserved2;
     ino_t parent;
@@ -155,6 +189,20 @@ struct InodeV1 {
     }
 #endif
 
+    /**
+     * @brief Size of the chunks in which the data of a regular file is
+     * fetched.
+     *
+     * The cached data is still tracked in blocks of CACHE_PAGE_SIZE; the
+     * chunk size only determines how much is fetched at once.
+     */
+    [[nodiscard]] inline std::size_t chunk_size() const {
+        if (chunk_shift == 0) {
+            return CACHE_PAGE_SIZE;
+        }
+        return std::size_t(1) << chunk_shift;
+    }
+
     [[nodiscard]] inline bool test_flag(InodeFlag flag) const {
         return (flags & (1<<static_cast<unsigned>(flag))) != 0;
     }
@@ -170,12 +218,83 @@ struct InodeV1 {
 
 };
 
+/**
+ * @brief Compact on-disk encoding of an inode.
+ *
+ * InodeV1 records are a plain copy of the in-memory structure and thus carry
+ * full timespecs, a 32 bit mode and padding. Version 2 records are encoded
+ * into a variable-length byte sequence instead:
+ *
+ * - uint8_t version (2)
+ * - uint8_t encoding flags (see Encoding)
+ * - uint16_t flags (little endian)
+ * - mode: uint16_t (little endian), or a varint if WIDE_MODE is set
+ * - varint parent, size, nblocks, uid, gid
+ * - timestamps, either
+ *   - (default) mtime as uint64_t (little endian) with the seconds in the
+ *     upper 34 bits and the nanoseconds in the lower 30 bits, followed by
+ *     atime and ctime each as a varint holding the zigzag-encoded seconds
+ *     delta to mtime shifted left by 30, or'd with the nanoseconds. atime or
+ *     ctime are omitted if ATIME_IS_MTIME or CTIME_IS_MTIME are set,
+ *     respectively; or
+ *   - (WIDE_TIMESTAMPS) atime, mtime and ctime each as zigzag varint seconds
+ *     followed by varint nanoseconds, for values which do not fit the packed
+ *     representation.
+ * - (CHUNK_SHIFT) uint8_t chunk shift; omitted if it is zero
+ *
+ * Varints are unsigned LEB128.
+ *
+ * The in-memory representation is always InodeV1; version 1 records are
+ * still accepted by the parser and are migrated when they are next written.
+ */
+struct InodeV2 {
+    static constexpr std::uint8_t VERSION = 2;
+
+    enum Encoding: std::uint8_t {
+        WIDE_TIMESTAMPS = 1 << 0,
+        WIDE_MODE = 1 << 1,
+        ATIME_IS_MTIME = 1 << 2,
+        CTIME_IS_MTIME = 1 << 3,
+        CHUNK_SHIFT = 1 << 4,
+    };
+
+    /**
+     * @brief Upper bound for the size of an encoded record.
+     */
+    static constexpr std::size_t MAX_SIZE =
+            4 /* version, encoding, flags */
+            + 5 /* mode */
+            + 3 * 10 + 2 * 5 /* parent, size, nblocks, uid, gid */
+            + 3 * (10 + 10) /* timestamps */
+            + 1 /* chunk shift */;
+
+    /**
+     * @brief Encode an inode into a buffer.
+     *
+     * @param buf Buffer of at least MAX_SIZE bytes.
+     * @return The number of bytes used.
+     */
+    static std::size_t encode(const InodeV1 &inode, std::byte *buf);
+
+    /**
+     * @brief Decode a version 2 record, including the version byte.
+     *
+     * Error codes:
+     *
+     * - EINVAL: The record is truncated or malformed.
+     */
+    static Result<InodeV1> decode(std::basic_string_view<std::byte> buf);
+};
+
 using Inode = InodeV1;
 
 static_assert(std::is_pod_v<Inode>);
 
+/**
+ * @brief Size of the in-memory inode structure and of version 1 records.
+ */
 static constexpr std::size_t INODE_SIZE = sizeof(Inode);
-static constexpr std::size_t INODE_CURRENT_VERSION = 1;
+static constexpr std::size_t INODE_CURRENT_VERSION = InodeV2::VERSION;
 
 template <typename T>
 inline Inode mkinode(T &&attr, ino_t parent = INVALID_INO) {
@@ -186,22 +305,28 @@ inline Inode mkinode(T &&attr, ino_t parent = INVALID_INO) {
     };
 }
 
-inline void serialize(const Inode &inode, std::byte *buf) {
-    memcpy(buf, &inode, INODE_SIZE);
+/**
+ * @brief Serialize an inode in the current on-disk format.
+ *
+ * @param buf Buffer of at least InodeV2::MAX_SIZE bytes.
+ * @return The number of bytes used.
+ */
+inline std::size_t serialize(const Inode &inode, std::byte *buf) {
+    return InodeV2::encode(inode, buf);
 }
 
 template <typename T, typename _ = typename std::enable_if<sizeof(T) == 1 && std::is_arithmetic_v<T>>::type>
 inline std::basic_string<T> serialize_as(const Inode &inode) {
     std::basic_string<T> buf;
-    buf.resize(INODE_SIZE);
-    serialize(inode, reinterpret_cast<std::byte*>(buf.data()));
+    buf.resize(InodeV2::MAX_SIZE);
+    buf.resize(serialize(inode, reinterpret_cast<std::byte*>(buf.data())));
     return buf;
 }
 
 inline std::basic_string<std::byte> serialize(const Inode &inode) {
     std::basic_string<std::byte> buf;
-    buf.resize(INODE_SIZE);
-    serialize(inode, buf.data());
+    buf.resize(InodeV2::MAX_SIZE);
+    buf.resize(serialize(inode, buf.data()));
     return buf;
 }
 
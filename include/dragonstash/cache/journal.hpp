@@ -0,0 +1,153 @@
+/**********************************************************************
+File name: journal.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_JOURNAL_H
+#define DRAGONSTASH_CACHE_JOURNAL_H
+
+#include <ctime>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dragonstash/error.hpp"
+#include "dragonstash/backend/base.hpp"
+
+namespace Dragonstash {
+
+/**
+ * @brief A metadata operation which has been applied to the cache, but not
+ * yet to the backend.
+ *
+ * Operations refer to backend paths as they were when the operation was
+ * recorded, so that the journal can be replayed in order without consulting
+ * the cache.
+ *
+ * Data written to regular files is not journaled; it is tracked by the
+ * WRITTEN blocks of the cached file and uploaded by the Writeback once the
+ * journal has been replayed.
+ */
+struct JournalEntry {
+    enum class Op: std::uint8_t {
+        /**
+         * @brief Create an empty regular file with `mode` at `path`.
+         */
+        CREATE = 1,
+
+        /**
+         * @brief Create a directory with `mode` at `path`.
+         */
+        MKDIR = 2,
+
+        /**
+         * @brief Remove the file at `path`.
+         */
+        UNLINK = 3,
+
+        /**
+         * @brief Remove the empty directory at `path`.
+         */
+        RMDIR = 4,
+
+        /**
+         * @brief Move `path` to `new_path`.
+         */
+        RENAME = 5,
+
+        /**
+         * @brief Change the attributes selected by `fields` of `path`.
+         */
+        SETATTR = 6,
+    };
+
+    enum Field: std::uint8_t {
+        MODE = 1,
+        SIZE = 2,
+        ATIME = 4,
+        MTIME = 8,
+    };
+
+    Op op;
+    std::uint8_t fields;
+    std::uint32_t mode;
+    std::uint64_t size;
+    struct timespec atime;
+    struct timespec mtime;
+    std::string path;
+    std::string new_path;
+
+    /**
+     * @brief Execute the operation on a backend.
+     *
+     * Error codes are those of the backend. A SETATTR stops at the first
+     * failing change.
+     */
+    [[nodiscard]] Result<void> apply(Backend::Filesystem &backend) const;
+
+    [[nodiscard]] std::string serialize() const;
+
+    /**
+     * @brief Decode a serialised entry.
+     *
+     * Error codes:
+     *
+     * - EINVAL: The buffer does not hold a valid entry.
+     */
+    [[nodiscard]] static Result<JournalEntry> parse(std::string_view buf);
+};
+
+struct JournalRecord {
+    /**
+     * @brief Position of the entry in the journal.
+     */
+    std::uint64_t seq;
+
+    JournalEntry entry;
+};
+
+/**
+ * @brief Remove operations from a journal which do not need to be replayed.
+ *
+ * @param records Journal records in order.
+ *
+ * The following operations are dropped:
+ *
+ * - A CREATE or MKDIR, together with the matching UNLINK or RMDIR and all
+ *   SETATTRs in between, if no other operation touches the path in between.
+ *   The data written to such a file never needs to be uploaded either.
+ * - A SETATTR which is followed by the removal of the same path.
+ * - A SETATTR which is followed by another SETATTR on the same path; the
+ *   fields are merged into the later entry.
+ *
+ * Operations which touch the path of a rename (on either side) or a parent
+ * of it act as barriers.
+ *
+ * @return The remaining records in order; merged entries keep the sequence
+ * number of the later record.
+ */
+[[nodiscard]] std::vector<JournalRecord> compact_journal(std::vector<JournalRecord> records);
+
+}
+
+#endif
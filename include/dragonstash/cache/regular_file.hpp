@@ -0,0 +1,545 @@
+/**********************************************************************
+File name: regular_file.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_CACHE_REGULAR_FILE_H
+#define DRAGONSTASH_CACHE_REGULAR_FILE_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "dragonstash/error.hpp"
+#include "dragonstash/profiled_mutex.hpp"
+#include "dragonstash/cache/access_trace.hpp"
+#include "dragonstash/cache/blocklist.hpp"
+#include "dragonstash/cache/compression.hpp"
+
+namespace Dragonstash {
+
+/**
+ * @brief How much of a file is present in the cache.
+ */
+struct FileResidency {
+    /**
+     * @brief Size of the file.
+     */
+    std::uint64_t size;
+
+    /**
+     * @brief Number of bytes in present blocks.
+     */
+    std::uint64_t resident_bytes;
+
+    /**
+     * @brief Number of bytes in WRITTEN blocks, which have not been written
+     * back yet.
+     */
+    std::uint64_t dirty_bytes;
+
+    /**
+     * @brief The runs of present blocks, if requested.
+     */
+    std::vector<Blocklist::Range> ranges;
+};
+
+/**
+ * @brief Handle to the cached data of a regular file.
+ *
+ * The data of each cached file lives in four files inside the data
+ * directory of the cache, all named after the inode number: the data file
+ * itself, which is sparse and holds the blocks at their natural offsets, a
+ * Blocklist (suffix `.blocks`) recording which blocks are present and in
+ * which state, the CRC32C of each block (suffix `.crc`, one std::uint32_t per
+ * block; zero means that the checksum is unknown) and the extent table
+ * (suffix `.extents`).
+ *
+ * Complete extents of COMPRESSION_EXTENT_BLOCKS blocks may be stored
+ * compressed (see compress()). The compressed data is stored at the start of
+ * the extent and the rest of the extent is punched out of the data file. The
+ * extent table holds one std::uint32_t per extent: zero for an uncompressed
+ * extent, otherwise the Compression algorithm in the upper eight bits and the
+ * size of the compressed data in the lower 24 bits. Extents are decompressed
+ * transparently when reading and stored uncompressed again before they are
+ * written to. Checksums always refer to the uncompressed data.
+ *
+ * Blocks marked as WRITTEN carry data which has not been written back to the
+ * source yet. Writing data marks all blocks it touches as WRITTEN, so callers
+ * must make sure that partially written blocks are present before writing
+ * (see missing()).
+ *
+ * All operations are thread-safe. Note that there is no synchronisation
+ * between the LMDB-backed metadata and the data inside the cache; in case of
+ * a crash, it is possible that data is missing from the cache for which LMDB
+ * already has metadata.
+ */
+class RegularFileHandle {
+public:
+    RegularFileHandle() = delete;
+
+    /**
+     * @brief Open (or create) the cached data of an inode.
+     *
+     * @param data_dir Data directory of the cache.
+     * @param ino Inode number of the file.
+     * @param counters Counters to account compression and decompression in,
+     *   may be null.
+     *
+     * Throws std::runtime_error if the files cannot be opened.
+     */
+    RegularFileHandle(const std::filesystem::path &data_dir, ino_t ino,
+                      CompressionCounters *counters = nullptr);
+    RegularFileHandle(const RegularFileHandle &src) = delete;
+    RegularFileHandle(RegularFileHandle &&src) = delete;
+    RegularFileHandle &operator=(const RegularFileHandle &src) = delete;
+    RegularFileHandle &operator=(RegularFileHandle &&src) = delete;
+    ~RegularFileHandle() = default;
+
+private:
+    ino_t m_ino;
+    mutable profiled_mutex m_mutex;
+    profiled_mutex m_upload_mutex;
+    FileHandle m_data;
+    FileHandle m_checksums;
+    FileHandle m_extents;
+    Blocklist m_blocks;
+    CompressionCounters *m_counters;
+
+    /**
+     * @brief Number of extents which are stored compressed.
+     *
+     * As long as this is zero, the extent table does not need to be looked
+     * at.
+     */
+    std::uint64_t m_compressed_extents;
+
+    struct InflatedExtent {
+        std::uint64_t extent;
+        std::uint64_t last_use;
+        std::size_t size;
+        std::vector<std::byte> data;
+    };
+
+    /**
+     * @brief The most recently decompressed extents, so that small reads
+     * within an extent do not decompress it over and over again.
+     */
+    std::vector<InflatedExtent> m_inflated;
+    std::uint64_t m_inflated_clock;
+
+    /**
+     * @brief Change of the number of present blocks which has not been
+     * accounted for in the cache usage counters yet.
+     */
+    std::int64_t m_unaccounted_blocks;
+
+    /**
+     * @brief Incremented whenever blocks are marked WRITTEN.
+     *
+     * This lets the write-back detect writes which raced with an upload.
+     */
+    std::uint64_t m_write_generation;
+
+    /**
+     * @brief Blocks marked WRITTEN while an upload is in progress, with the
+     * write generation they were marked in.
+     */
+    std::vector<std::pair<std::uint64_t, Blocklist::Range>> m_write_log;
+
+    /**
+     * @brief Whether m_write_log is being recorded.
+     */
+    bool m_logging_writes;
+
+    /**
+     * @brief Block ranges which are being written to through fd().
+     *
+     * Claimed by inflate() and released by mark() or release_write();
+     * compress() leaves the extents touching them alone.
+     */
+    std::vector<Blocklist::Range> m_writes_in_flight;
+
+    /**
+     * @brief Accesses since the trace has last been taken.
+     */
+    AccessTrace m_trace;
+
+    void mark_locked(std::uint64_t start, std::uint64_t count,
+                     Blocklist::State state);
+
+    void release_write_locked(std::uint64_t start);
+
+    /**
+     * @brief Mark the present blocks [start, end) as absent while their
+     * extent is rewritten in place.
+     *
+     * Should we crash before restore_locked(), the blocks are fetched again
+     * instead of being served from a half-rewritten extent.
+     *
+     * @return The ranges to pass to restore_locked().
+     */
+    std::vector<Blocklist::Range> hide_locked(std::uint64_t start,
+                                              std::uint64_t end);
+    void restore_locked(const std::vector<Blocklist::Range> &hidden);
+
+    /**
+     * @brief Recompute the checksums of the blocks [start, end) from the
+     * data file.
+     */
+    [[nodiscard]] Result<void> update_checksums_locked(std::uint64_t start,
+                                                       std::uint64_t end);
+
+    [[nodiscard]] Result<std::uint32_t> extent_info_locked(std::uint64_t extent) const;
+    [[nodiscard]] Result<void> set_extent_info_locked(std::uint64_t extent,
+                                                      std::uint32_t old_info,
+                                                      std::uint32_t new_info);
+
+    /**
+     * @brief Return the decompressed data of a compressed extent.
+     *
+     * The result stays valid until the next call.
+     */
+    [[nodiscard]] Result<const InflatedExtent*> load_extent_locked(
+            std::uint64_t extent, std::uint32_t info);
+
+    /**
+     * @brief Read from the data file, decompressing extents as needed.
+     *
+     * Data beyond the end of the data file reads as zeroes.
+     */
+    [[nodiscard]] Result<void> read_locked(off_t off, std::byte *buf,
+                                           std::size_t n);
+
+    /**
+     * @brief Store all extents touching the blocks [start, end) uncompressed.
+     */
+    [[nodiscard]] Result<void> inflate_locked(std::uint64_t start,
+                                              std::uint64_t end);
+
+    /**
+     * @brief Forget about all compressed extents starting at @a extent.
+     *
+     * The data of the extents is left in the data file.
+     */
+    [[nodiscard]] Result<void> drop_extents_locked(std::uint64_t extent);
+
+public:
+    [[nodiscard]] static std::filesystem::path data_path(
+            const std::filesystem::path &data_dir, ino_t ino);
+    [[nodiscard]] static std::filesystem::path blocklist_path(
+            const std::filesystem::path &data_dir, ino_t ino);
+    [[nodiscard]] static std::filesystem::path checksum_path(
+            const std::filesystem::path &data_dir, ino_t ino);
+    [[nodiscard]] static std::filesystem::path extents_path(
+            const std::filesystem::path &data_dir, ino_t ino);
+
+    /**
+     * @brief Return the number of bytes cached for an inode without opening
+     * a handle.
+     */
+    [[nodiscard]] static std::uint64_t cached_bytes(
+            const std::filesystem::path &data_dir, ino_t ino);
+
+    /**
+     * @brief Delete the cached data of an inode.
+     *
+     * Existing handles stay usable, but their data is lost once they are
+     * closed.
+     */
+    static void remove(const std::filesystem::path &data_dir, ino_t ino);
+
+    /**
+     * @brief Check the Blocklist of a file which is not open and discard the
+     * cached data if it is inconsistent.
+     *
+     * This is the recovery after an unclean shutdown, see Blocklist::fsck().
+     * A file which has never been cached passes.
+     *
+     * @param discard If false, inconsistent data is only reported and left
+     * in place.
+     * @return std::nullopt if the file passed, otherwise the number of bytes
+     * which were accounted for the (discarded) data.
+     */
+    [[nodiscard]] static std::optional<std::uint64_t> check(
+            const std::filesystem::path &data_dir, ino_t ino,
+            bool discard = true);
+
+    [[nodiscard]] inline ino_t inode() const {
+        return m_ino;
+    }
+
+    /**
+     * @brief File descriptor of the data file.
+     *
+     * The range must be prepared with inflate() before data is written
+     * through the file descriptor directly, and the data must be marked with
+     * mark() afterwards (or the write abandoned with release_write()).
+     */
+    [[nodiscard]] inline int fd() const {
+        return int(m_data);
+    }
+
+    /**
+     * @brief Serialise write-back of this file.
+     */
+    [[nodiscard]] inline std::unique_lock<profiled_mutex> upload_lock() {
+        return std::unique_lock<profiled_mutex>(m_upload_mutex);
+    }
+
+    /**
+     * @brief Read cached data.
+     *
+     * @return The number of bytes read. This is less than @a n if a block
+     * within the range is absent, and zero if the first block is absent.
+     */
+    [[nodiscard]] Result<std::size_t> pread(off_t off, void *buf, std::size_t n);
+
+    /**
+     * @brief Write data and mark all blocks it touches with @a state.
+     */
+    [[nodiscard]] Result<std::size_t> pwrite(off_t off, const void *buf,
+                                             std::size_t n,
+                                             Blocklist::State state = Blocklist::WRITTEN);
+
+    /**
+     * @brief Store data fetched from the source.
+     *
+     * Only blocks which are absent are written and marked as READ; blocks
+     * which are present (in particular those which have been written locally)
+     * are left untouched.
+     *
+     * @param off Offset of the data, must be block-aligned.
+     * @param n Length of the data; must be a multiple of the block size unless
+     *   the data ends at the end of the file.
+     */
+    [[nodiscard]] Result<void> fill(off_t off, const void *buf, std::size_t n);
+
+    /**
+     * @brief Mark all blocks touched by a byte range with @a state.
+     *
+     * The checksums of the blocks are updated, unless they are marked as
+     * absent. A write through fd() which inflate() has been called for at
+     * @a off is finished by this, even if @a n is zero.
+     */
+    void mark(off_t off, std::size_t n, Blocklist::State state);
+
+    /**
+     * @brief Abandon a write through fd() which inflate() has been called
+     * for at @a off, without marking anything.
+     */
+    void release_write(off_t off);
+
+    /**
+     * @brief Return the ranges of absent blocks within a byte range.
+     */
+    [[nodiscard]] std::vector<Blocklist::Range> missing(off_t off, std::size_t n) const;
+
+    /**
+     * @brief Return all runs of blocks in the given state.
+     */
+    [[nodiscard]] std::vector<Blocklist::Range> ranges(Blocklist::State state) const;
+
+    /**
+     * @brief Summarise which blocks of the file are present.
+     *
+     * @param size Size of the file; the byte counts do not include the part
+     *   of the last block beyond it.
+     * @param with_ranges Whether to list the runs of present blocks; the
+     *   counts alone do not need to walk the Blocklist.
+     */
+    [[nodiscard]] FileResidency residency(std::uint64_t size,
+                                          bool with_ranges) const;
+
+    /**
+     * @brief Summarise which blocks of a file are present without opening
+     * it.
+     *
+     * Unlike the constructor, this does not create any files; a file which
+     * has never been cached has nothing resident. Must not be used on files
+     * which are open.
+     *
+     * Error codes:
+     *
+     * - EIO: The Blocklist cannot be read.
+     */
+    [[nodiscard]] static Result<FileResidency> residency(
+            const std::filesystem::path &data_dir, ino_t ino,
+            std::uint64_t size, bool with_ranges);
+
+    /**
+     * @brief Atomically re-mark the blocks of a range which are in state
+     * @a from as @a to.
+     *
+     * Blocks in other states are left untouched.
+     */
+    void transition(const Blocklist::Range &range,
+                    Blocklist::State from,
+                    Blocklist::State to);
+
+    /**
+     * @brief Current write generation of the file.
+     *
+     * The generation changes whenever blocks are marked WRITTEN.
+     */
+    [[nodiscard]] std::uint64_t write_generation() const;
+
+    /**
+     * @brief Start or stop recording which blocks are written.
+     *
+     * Stopping discards the record. The caller must hold the upload_lock().
+     */
+    void log_writes(bool enable);
+
+    /**
+     * @brief Re-mark WRITTEN blocks within a range as READ after they have
+     * been uploaded.
+     *
+     * Blocks which have been written since write_generation() returned
+     * @a generation stay WRITTEN, because the upload may have missed the
+     * write. This requires log_writes() to be enabled since then.
+     */
+    void mark_uploaded(const Blocklist::Range &range,
+                       std::uint64_t generation);
+
+    [[nodiscard]] std::uint64_t blocks(Blocklist::State state) const;
+
+    /**
+     * @brief Return and reset the change in cached bytes since the last call.
+     *
+     * The result is meant to be fed into CacheTransactionRW::account_bytes().
+     */
+    [[nodiscard]] std::int64_t take_unaccounted_bytes();
+
+    /**
+     * @brief Record a read in the access trace of the file.
+     *
+     * @see AccessTrace::record()
+     */
+    void record_access(off_t off, std::size_t n);
+
+    /**
+     * @brief Return and reset the access trace.
+     *
+     * @return The trace recorded since the last call; empty if nothing has
+     * been read since.
+     */
+    [[nodiscard]] AccessTrace take_access_trace();
+
+    /**
+     * @brief Discard all data beyond @a size.
+     *
+     * A block which is cut in half keeps its state; the part beyond @a size
+     * reads as zeroes afterwards.
+     */
+    [[nodiscard]] Result<void> truncate(std::uint64_t size);
+
+    /**
+     * @brief Copy cached data from another file and mark all blocks it
+     * touches as WRITTEN.
+     *
+     * Block-aligned parts are cloned (FICLONERANGE) where the underlying
+     * file system supports it and copied otherwise. @a src may be this
+     * handle, but the ranges must not overlap then.
+     *
+     * @return The number of bytes copied. This is less than @a n if a block
+     * of the source range is absent, and zero if the first block is absent.
+     */
+    [[nodiscard]] Result<std::size_t> copy_from(RegularFileHandle &src,
+                                                off_t src_off, off_t off,
+                                                std::size_t n);
+
+    /**
+     * @brief Drop the cached data of all blocks which lie completely within a
+     * byte range.
+     *
+     * The blocks are marked as absent and the data file is punched, so that
+     * they are fetched from the source again on the next access. Blocks which
+     * have been written locally and not uploaded yet are kept.
+     *
+     * The caller must hold the upload_lock().
+     */
+    [[nodiscard]] Result<void> discard(off_t off, std::size_t n);
+
+    /**
+     * @brief Compare the present blocks within a byte range against their
+     * checksums.
+     *
+     * Corrupt blocks are marked as absent, so that they are fetched from the
+     * source again on the next access. Blocks without a checksum are assumed
+     * to be intact.
+     *
+     * Error codes:
+     *
+     * - EIO: A block which has been written locally (and can thus not be
+     *   fetched again) is corrupt. It is left in place; other corrupt blocks
+     *   are dropped nevertheless.
+     *
+     * @return The number of blocks which have been dropped.
+     */
+    [[nodiscard]] Result<std::uint64_t> verify(off_t off, std::size_t n);
+
+    /**
+     * @brief Store the extents of a byte range compressed.
+     *
+     * Only extents which are complete (all their blocks are present, up to
+     * the end of the data file) and which do not hold locally written data
+     * are compressed. Extents whose sampled entropy exceeds
+     * COMPRESSION_ENTROPY_LIMIT are skipped without trying, as are extents
+     * which would not shrink by at least one block.
+     *
+     * Error codes:
+     *
+     * - EOPNOTSUPP: The algorithm is not supported by this build.
+     */
+    [[nodiscard]] Result<void> compress(off_t off, std::size_t n,
+                                        Compression algorithm);
+
+    /**
+     * @brief Store the extents touching a byte range uncompressed again, to
+     * write to it through fd().
+     *
+     * The range is kept from being compressed again until the write is
+     * finished with mark() or abandoned with release_write(). All other
+     * operations writing to the file inflate implicitly.
+     */
+    [[nodiscard]] Result<void> inflate(off_t off, std::size_t n);
+
+    /**
+     * @brief Return the number of extents which are stored compressed.
+     */
+    [[nodiscard]] std::uint64_t compressed_extents() const;
+
+    /**
+     * @brief Make the cached data and the Blocklist durable.
+     */
+    [[nodiscard]] Result<void> fsync(bool datasync = false);
+
+};
+
+}
+
+#endif
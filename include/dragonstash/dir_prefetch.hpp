@@ -0,0 +1,215 @@
+/**********************************************************************
+File name: dir_prefetch.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_DIR_PREFETCH_H
+#define DRAGONSTASH_DIR_PREFETCH_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dragonstash/error.hpp"
+
+namespace Dragonstash {
+
+struct DirPrefetchOptions {
+    /**
+     * @brief Sync the subdirectories of opened directories in the background.
+     */
+    bool enabled = false;
+
+    /**
+     * @brief How many levels below an opened directory are synced.
+     */
+    unsigned max_depth = 2;
+
+    /**
+     * @brief Number of background threads, and thus of concurrent syncs.
+     */
+    unsigned concurrency = 2;
+
+    /**
+     * @brief Upper bound for the number of queued syncs; further
+     * directories are not prefetched.
+     */
+    std::size_t max_pending = 256;
+
+    /**
+     * @brief Queued syncs are dropped once no directory has been opened for
+     * this long, since the walk which caused them has apparently ended.
+     */
+    std::chrono::milliseconds idle_timeout{2000};
+
+    /**
+     * @brief How long the result of a prefetched sync stands in for a sync
+     * on opendir.
+     */
+    std::chrono::milliseconds max_age{5000};
+};
+
+/**
+ * @brief Counters of the directory prefetcher since it was started.
+ */
+struct DirPrefetchStats {
+    /**
+     * @brief Number of directories queued for a sync.
+     */
+    std::uint64_t scheduled;
+
+    /**
+     * @brief Number of syncs carried out in the background.
+     */
+    std::uint64_t synced;
+
+    /**
+     * @brief Number of background syncs which spared an opendir the sync.
+     */
+    std::uint64_t used;
+
+    /**
+     * @brief Number of background syncs which expired without being used.
+     */
+    std::uint64_t wasted;
+};
+
+/**
+ * @brief Speculative syncing of directories ahead of a recursive walk.
+ *
+ * Tools like find(1) or du(1) open one directory after the other, each of
+ * which is synced with the backend on opendir. Once a directory has been
+ * synced, the DirPrefetcher syncs its subdirectories in the background (up
+ * to DirPrefetchOptions::max_depth levels deep), so that the opendir calls
+ * which follow find them synced already.
+ *
+ * The result of a background sync is only used for
+ * DirPrefetchOptions::max_age; after that, opendir syncs again as usual.
+ */
+class DirPrefetcher {
+public:
+    /**
+     * @brief Sync a directory with the backend.
+     *
+     * @return The inodes of the subdirectories.
+     */
+    using SyncFunc = std::function<Result<std::vector<ino_t>>(ino_t)>;
+
+    DirPrefetcher() = delete;
+    DirPrefetcher(SyncFunc sync,
+                  const DirPrefetchOptions &options = DirPrefetchOptions());
+    DirPrefetcher(const DirPrefetcher &src) = delete;
+    DirPrefetcher(DirPrefetcher &&src) = delete;
+    DirPrefetcher &operator=(const DirPrefetcher &src) = delete;
+    DirPrefetcher &operator=(DirPrefetcher &&src) = delete;
+
+    /**
+     * @brief Stop the background threads; queued syncs are dropped.
+     */
+    ~DirPrefetcher();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        ino_t ino;
+        unsigned depth;
+    };
+
+    struct Synced {
+        std::vector<ino_t> subdirs;
+        Clock::time_point at;
+    };
+
+    const SyncFunc m_sync;
+    const DirPrefetchOptions m_options;
+
+    std::atomic<std::uint64_t> m_scheduled;
+    std::atomic<std::uint64_t> m_synced_count;
+    std::atomic<std::uint64_t> m_used;
+    std::atomic<std::uint64_t> m_wasted;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_idle;
+    std::deque<Job> m_queue;
+
+    /**
+     * @brief Directories which are queued or being synced.
+     */
+    std::unordered_set<ino_t> m_pending;
+    std::unordered_map<ino_t, Synced> m_synced;
+    Clock::time_point m_last_activity;
+    unsigned m_active;
+    bool m_stop;
+    std::vector<std::thread> m_threads;
+
+    void schedule_locked(const std::vector<ino_t> &dirs, unsigned depth);
+    void expire_locked(Clock::time_point now);
+    void drop_queue_locked();
+    void run();
+
+public:
+    [[nodiscard]] inline bool enabled() const
+    {
+        return m_options.enabled;
+    }
+
+    /**
+     * @brief Claim the background sync of a directory which is being
+     * opened.
+     *
+     * This also tells the prefetcher that the walk goes on.
+     *
+     * @return The subdirectories, if the directory has been synced in the
+     * background recently; the caller does not need to sync it then.
+     */
+    [[nodiscard]] std::optional<std::vector<ino_t>> take(ino_t ino);
+
+    /**
+     * @brief Queue the subdirectories of a directory which has just been
+     * opened.
+     */
+    void schedule(const std::vector<ino_t> &subdirs);
+
+    /**
+     * @brief Wait until all queued syncs have been carried out or dropped.
+     */
+    void drain();
+
+    [[nodiscard]] DirPrefetchStats stats() const;
+};
+
+}
+
+#endif
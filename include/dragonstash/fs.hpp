@@ -25,37 +25,224 @@ authors named in the AUTHORS file.
 #ifndef DRAGONSTASH_FS_H
 #define DRAGONSTASH_FS_H
 
+#include <array>
 #include <atomic>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 
 #include "fuse/interface.hpp"
 #include "dragonstash/backend/base.hpp"
 #include "cache/cache.hpp"
+#include "cache/hot_tier.hpp"
+#include "dragonstash/dir_prefetch.hpp"
+#include "dragonstash/prefetch.hpp"
+#include "dragonstash/recovery.hpp"
+#include "dragonstash/verifier.hpp"
+#include "dragonstash/writeback.hpp"
 
 namespace Dragonstash {
 
+/**
+ * @brief Number of reads served by each tier of the cache.
+ */
+struct ReadStats {
+    /**
+     * @brief Reads served from the in-memory hot tier.
+     */
+    std::uint64_t memory;
+
+    /**
+     * @brief Reads served from the cached data on disk.
+     */
+    std::uint64_t disk;
+
+    /**
+     * @brief Reads for which data had to be fetched from the backend.
+     */
+    std::uint64_t backend;
+
+    [[nodiscard]] inline std::uint64_t total() const
+    {
+        return memory + disk + backend;
+    }
+
+    [[nodiscard]] inline double rate(std::uint64_t tier) const
+    {
+        const std::uint64_t all = total();
+        if (all == 0) {
+            return 0.0;
+        }
+        return static_cast<double>(tier) / all;
+    }
+};
+
 class Filesystem: public Fuse::Interface
 {
 public:
     Filesystem() = delete;
-    explicit Filesystem(Cache &cache, Backend::Filesystem &backend);
+    explicit Filesystem(Cache &cache, Backend::Filesystem &backend,
+                        const WritebackOptions &writeback_options = WritebackOptions(),
+                        const VerifyOptions &verify_options = VerifyOptions(),
+                        const PrefetchOptions &prefetch_options = PrefetchOptions(),
+                        const DirPrefetchOptions &dir_prefetch_options = DirPrefetchOptions(),
+                        const RecoveryOptions &recovery_options = RecoveryOptions(),
+                        const HotTierOptions &hot_tier_options = HotTierOptions());
 
 private:
     Cache &m_cache;
     Backend::Filesystem &m_backend_fs;
-
-    Result<std::string> get_backend_path(CacheTransactionRO &txn, ino_t ino);
+    Writeback m_writeback;
+    Verifier m_verifier;
+    Prefetcher m_prefetcher;
+    DirPrefetcher m_dir_prefetcher;
+    Recovery m_recovery;
+    HotTier m_hot_tier;
+
+    std::atomic<std::uint64_t> m_reads_memory;
+    std::atomic<std::uint64_t> m_reads_disk;
+    std::atomic<std::uint64_t> m_reads_backend;
+
+    std::mutex m_compaction_mutex;
+    std::optional<CompactionResult> m_last_compaction;
+
+    /**
+     * @brief Counters of local changes to the entries of directories.
+     *
+     * Directories share counters by inode number; a collision only causes
+     * a needless retry in sync_dir().
+     */
+    std::array<std::atomic<std::uint64_t>, 64> m_dir_generations{};
+
+    /**
+     * @brief Backend path of an inode, allocated from request_memory().
+     */
+    Result<std::pmr::string> get_backend_path(CacheTransactionRO &txn, ino_t ino);
+
+    /**
+     * @brief Fetch the absent blocks of a byte range from the backend.
+     *
+     * If anything is absent, the range is extended to whole chunks of the
+     * file (see CacheTransactionRO::chunk_size()) before fetching.
+     *
+     * Blocks beyond @a file_size are not fetched. Data which the backend does
+     * not have (because the file has been extended locally) reads as zeroes.
+     */
+    [[nodiscard]] Result<void> fetch(ino_t ino, RegularFileHandle &file,
+                                     off_t off, std::size_t n,
+                                     std::uint64_t file_size);
+
+    /**
+     * @brief Make sure that blocks which are only partially covered by a write
+     * are present in the cache.
+     */
+    [[nodiscard]] Result<void> prepare_write(ino_t ino, RegularFileHandle &file,
+                                             off_t off, std::size_t n);
+
+    /**
+     * @brief Update the metadata after data has been written to the cache and
+     * hand the file to the write-back.
+     */
+    [[nodiscard]] Result<void> finish_write(ino_t ino,
+                                            const std::shared_ptr<RegularFileHandle> &file,
+                                            off_t off, std::size_t n);
+
+    /**
+     * @brief Replace the cached listing of a directory with the one of the
+     * backend.
+     *
+     * Error codes:
+     *
+     * - ENOTCONN: The backend is unreachable or there are journaled
+     *   operations which have not been replayed yet.
+     * - EAGAIN: The directory kept being changed locally while it was being
+     *   listed.
+     * - Any error of the backend.
+     *
+     * @return The inodes of the subdirectories.
+     */
+    [[nodiscard]] Result<std::vector<ino_t>> sync_dir(ino_t ino);
+
+    /**
+     * @brief Generation counter of the entries of a directory.
+     *
+     * Operations which add or remove entries locally bump it from within
+     * their transaction via touch_dir(), so that sync_dir() can tell that
+     * its listing of the backend may be stale.
+     */
+    [[nodiscard]] std::atomic<std::uint64_t> &dir_generation(ino_t dir);
+    void touch_dir(ino_t dir);
+
+    /**
+     * @brief Apply a SETATTR operation to the backend and the cache.
+     *
+     * If the backend is unreachable (or operations are journaled already),
+     * the change is only applied to the cache and journaled.
+     *
+     * @return The new attributes.
+     */
+    [[nodiscard]] Result<Stat> change_attributes(ino_t ino, JournalEntry change);
 
 public:
+    [[nodiscard]] inline Verifier &verifier()
+    {
+        return m_verifier;
+    }
+
+    [[nodiscard]] inline Prefetcher &prefetcher()
+    {
+        return m_prefetcher;
+    }
+
+    [[nodiscard]] inline DirPrefetcher &dir_prefetcher()
+    {
+        return m_dir_prefetcher;
+    }
+
+    [[nodiscard]] inline Recovery &recovery()
+    {
+        return m_recovery;
+    }
+
+    [[nodiscard]] inline HotTier &hot_tier()
+    {
+        return m_hot_tier;
+    }
+
+    [[nodiscard]] ReadStats read_stats() const;
+
+    void init(struct fuse_conn_info *conn);
+    void destroy();
     void lookup(Fuse::Request &&req, fuse_ino_t parent, std::string_view name);
     void forget(Fuse::Request &&req, fuse_ino_t ino, uint64_t nlookup);
     void getattr(Fuse::Request &&req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void setattr(Fuse::Request &&req, fuse_ino_t ino, struct stat &attr, int to_set, struct fuse_file_info *fi);
     void readlink(Fuse::Request &&req, fuse_ino_t ino);
+    void mkdir(Fuse::Request &&req, fuse_ino_t parent, std::string_view name, mode_t mode);
+    void unlink(Fuse::Request &&req, fuse_ino_t parent, std::string_view name);
+    void rmdir(Fuse::Request &&req, fuse_ino_t parent, std::string_view name);
+    void rename(Fuse::Request &&req, fuse_ino_t parent, std::string_view name, fuse_ino_t newparent, std::string_view newname, unsigned int flags);
+    void open(Fuse::Request &&req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void read(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+    void write(Fuse::Request &&req, fuse_ino_t ino, std::string_view buf, off_t off, struct fuse_file_info *fi);
+    void flush(Fuse::Request &&req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void release(Fuse::Request &&req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void fsync(Fuse::Request &&req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi);
     void opendir(Fuse::Request &&req, fuse_ino_t ino, struct fuse_file_info *fi);
     void readdir(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
     void releasedir(Fuse::Request &&req, fuse_ino_t ino, struct fuse_file_info *fi);
     void readdirplus(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
     void forget_multi(Fuse::Request &&req, size_t count, struct fuse_forget_data *forgets);
+    void statfs(Fuse::Request &&req, fuse_ino_t ino);
+    void setxattr(Fuse::Request &&req, fuse_ino_t ino, std::string_view name, std::string_view value, int flags);
+    void getxattr(Fuse::Request &&req, fuse_ino_t ino, std::string_view name, size_t size);
+    void listxattr(Fuse::Request &&req, fuse_ino_t ino, size_t size);
+    void removexattr(Fuse::Request &&req, fuse_ino_t ino, std::string_view name);
+    void create(Fuse::Request &&req, fuse_ino_t parent, std::string_view name, mode_t mode, struct fuse_file_info *fi);
+    void write_buf(Fuse::Request &&req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t offset, struct fuse_file_info *fi);
+    void fallocate(Fuse::Request &&req, fuse_ino_t ino, int mode, off_t offset, off_t length, struct fuse_file_info *fi);
+    void copy_file_range(Fuse::Request &&req, fuse_ino_t ino_in, off_t off_in, struct fuse_file_info *fi_in, fuse_ino_t ino_out, off_t off_out, struct fuse_file_info *fi_out, size_t len, int flags);
     /* void forget(Fuse::Request &&req, fuse_ino_t ino, uint64_t nlookup); */
 
 };
@@ -26,8 +26,11 @@ authors named in the AUTHORS file.
 #define DRAGONSTASH_FUSE_BUFFER_H
 
 #include <cstring>
+#include <memory_resource>
 #include <string>
 
+#include "dragonstash/request_arena.hpp"
+
 struct fuse_entry_param;
 struct stat;
 
@@ -37,7 +40,7 @@ class Request;
 
 class DirBuffer {
 private:
-    std::basic_string<char> m_buf;
+    std::pmr::string m_buf{Dragonstash::request_memory()};
 
     size_t prepare_add(Request &req, const char *name);
 
@@ -50,7 +53,7 @@ public:
              const char *name,
              const struct stat &stbuf);
 
-    [[nodiscard]] inline const std::basic_string<char> &get() const {
+    [[nodiscard]] inline const std::pmr::string &get() const {
         return m_buf;
     }
 
@@ -62,7 +65,7 @@ public:
 
 class DirBufferPlus {
 private:
-    std::basic_string<char> m_buf;
+    std::pmr::string m_buf{Dragonstash::request_memory()};
 
     size_t prepare_add(Request &req,
                        const char *name,
@@ -82,7 +85,7 @@ public:
              const char *name,
              const fuse_entry_param &e);
 
-    [[nodiscard]] inline const std::basic_string<char> &get() const {
+    [[nodiscard]] inline const std::pmr::string &get() const {
         return m_buf;
     }
 
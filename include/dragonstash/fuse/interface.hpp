@@ -31,10 +31,14 @@ authors named in the AUTHORS file.
 #include <stdexcept>
 
 #include "dragonstash/fuse/request.hpp"
+#include "dragonstash/request_arena.hpp"
+#include "dragonstash/trace.hpp"
 
 namespace Fuse {
 
 #define dragonstash_fuse_dispatch(func, ...) do {\
+    const Dragonstash::RequestScope request_scope; \
+    const Dragonstash::TraceSpan trace_span("fuse", #func); \
     Request request_handle(req); \
     Impl *impl = static_cast<Impl*>(request_handle.userdata()); \
     impl->func(std::move(request_handle), __VA_ARGS__); \
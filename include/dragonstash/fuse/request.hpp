@@ -34,6 +34,8 @@ authors named in the AUTHORS file.
 
 #include <memory>
 
+#include "dragonstash/trace.hpp"
+
 namespace Fuse {
 
 struct RequestBackend {
@@ -146,18 +148,21 @@ public: /* GETTERS */
 
 public: /* REPLY FUNCTIONS */
     inline void reply_none() {
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         backend.reply_none(release());
     }
 
     inline int reply_err(int err)
     {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_err(release(), err);
     }
 
     inline int reply_entry(const fuse_entry_param *e)
     {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_entry(release(), e);
     }
 
@@ -165,32 +170,38 @@ public: /* REPLY FUNCTIONS */
                             const fuse_file_info *fi)
     {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_create(release(), e, fi);
     }
 
     inline int reply_attr(const struct stat &attr, double attr_timeout)
     {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_attr(release(), &attr, attr_timeout);
     }
 
     inline int reply_readlink(const char *link) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_readlink(release(), link);
     }
 
     inline int reply_open(const fuse_file_info *fi) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_open(release(), fi);
     }
 
     inline int reply_write(size_t count) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_write(release(), count);
     }
 
     inline int reply_buf(const char *buf, size_t size) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_buf(release(), buf, size);
     }
 
@@ -201,37 +212,44 @@ public: /* REPLY FUNCTIONS */
 
     inline int reply_data(struct fuse_bufvec *bufv, enum fuse_buf_copy_flags flags) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_data(release(), bufv, flags);
     }
 
     inline int reply_iov(const iovec *iov, int count) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_iov(release(), iov, count);
     }
 
     inline int reply_statfs(const struct statvfs *stbuf) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_statfs(release(), stbuf);
     }
 
     inline int reply_xattr(size_t count) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_xattr(release(), count);
     }
 
     inline int reply_lock(const flock *lock) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_lock(release(), lock);
     }
 
     inline int reply_bmap(uint64_t idx) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_bmap(release(), idx);
     }
 
     inline int reply_ioctl_retry(const iovec *in_iov, size_t in_count,
                                  const iovec *out_iov, size_t out_count) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_ioctl_retry(release(),
                                          in_iov, in_count,
                                          out_iov, out_count);
@@ -239,16 +257,19 @@ public: /* REPLY FUNCTIONS */
 
     inline int reply_ioctl(int result, const void *buf, size_t size) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_ioctl(release(), result, buf, size);
     }
 
     inline int reply_ioctl_iov(int result, const iovec *iov, int count) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_ioctl_iov(release(), result, iov, count);
     }
 
     inline int reply_poll(unsigned revents) {
         check();
+        const Dragonstash::TraceSpan trace_span("reply", __func__);
         return backend.reply_poll(release(), revents);
     }
 };
@@ -0,0 +1,186 @@
+/**********************************************************************
+File name: prefetch.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_PREFETCH_H
+#define DRAGONSTASH_PREFETCH_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "dragonstash/cache/cache.hpp"
+
+namespace Dragonstash {
+
+struct PrefetchOptions {
+    /**
+     * @brief Record access traces and replay them when files are opened.
+     */
+    bool enabled = false;
+
+    /**
+     * @brief Traces older than this are not replayed and are dropped.
+     */
+    std::chrono::seconds max_age{14 * 24 * 3600};
+
+    /**
+     * @brief Upper bound for the amount of data prefetched per open.
+     */
+    std::uint64_t max_bytes = 64 << 20;
+
+    /**
+     * @brief Number of opens which may wait for their prefetch; further
+     * opens are not prefetched for.
+     */
+    std::size_t max_queue = 256;
+};
+
+/**
+ * @brief Counters of the prefetcher since it was started.
+ */
+struct PrefetchStats {
+    std::uint64_t scheduled;
+    std::uint64_t prefetched_bytes;
+    std::uint64_t expired_traces;
+};
+
+/**
+ * @brief Prefetching of file data based on the accesses of earlier opens.
+ *
+ * While a file is open, the ranges which are read from it are recorded in
+ * its RegularFileHandle (see AccessTrace). When the file is closed, the
+ * trace is stored in the cache. When the file is opened again, a background
+ * thread fetches the absent blocks of the recorded ranges in the order in
+ * which they were first touched, so that they are likely to be present by
+ * the time the application asks for them.
+ *
+ * Traces which have not been refreshed for PrefetchOptions::max_age are
+ * dropped when the prefetcher starts and when they are found on open.
+ */
+class Prefetcher {
+public:
+    /**
+     * @brief Fetch the absent blocks of a byte range from the backend.
+     *
+     * Arguments are the inode, its file, the byte range and the size of the
+     * file.
+     */
+    using FetchFunc = std::function<Result<void>(ino_t, RegularFileHandle&,
+                                                 off_t, std::size_t,
+                                                 std::uint64_t)>;
+
+    Prefetcher() = delete;
+    Prefetcher(Cache &cache, FetchFunc fetch,
+               const PrefetchOptions &options = PrefetchOptions());
+    Prefetcher(const Prefetcher &src) = delete;
+    Prefetcher(Prefetcher &&src) = delete;
+    Prefetcher &operator=(const Prefetcher &src) = delete;
+    Prefetcher &operator=(Prefetcher &&src) = delete;
+
+    /**
+     * @brief Stop the background thread; pending prefetches are dropped.
+     */
+    ~Prefetcher();
+
+private:
+    struct Job {
+        ino_t ino;
+        std::shared_ptr<RegularFileHandle> file;
+    };
+
+    Cache &m_cache;
+    const FetchFunc m_fetch;
+    const PrefetchOptions m_options;
+
+    std::atomic<std::uint64_t> m_scheduled;
+    std::atomic<std::uint64_t> m_prefetched_bytes;
+    std::atomic<std::uint64_t> m_expired_traces;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_idle;
+    std::deque<Job> m_queue;
+    bool m_busy;
+    bool m_stop;
+    std::thread m_thread;
+
+    void run();
+
+public:
+    [[nodiscard]] inline bool enabled() const
+    {
+        return m_options.enabled;
+    }
+
+    /**
+     * @brief Queue the replay of the stored trace of a file which has just
+     * been opened.
+     */
+    void schedule(ino_t ino, std::shared_ptr<RegularFileHandle> file);
+
+    /**
+     * @brief Replay the stored trace of a file in the calling thread.
+     *
+     * The calling thread must not hold any transaction.
+     *
+     * Error codes:
+     *
+     * - ENOENT: No (current) trace is stored for the file.
+     * - Any error of the fetch function; the replay stops at the first
+     *   failing range.
+     */
+    [[nodiscard]] Result<void> prefetch(ino_t ino, RegularFileHandle &file);
+
+    /**
+     * @brief Store the accesses recorded on a file which is being closed.
+     *
+     * Nothing is stored if the file has not been read since the trace has
+     * last been stored. The calling thread must not hold any transaction.
+     */
+    [[nodiscard]] Result<void> save(ino_t ino, RegularFileHandle &file);
+
+    /**
+     * @brief Drop all traces older than PrefetchOptions::max_age.
+     *
+     * @return The number of traces which have been dropped.
+     */
+    [[nodiscard]] Result<std::size_t> expire();
+
+    /**
+     * @brief Wait until all queued prefetches have been carried out.
+     */
+    void drain();
+
+    [[nodiscard]] PrefetchStats stats() const;
+};
+
+}
+
+#endif
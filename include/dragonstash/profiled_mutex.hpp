@@ -0,0 +1,298 @@
+/**********************************************************************
+File name: profiled_mutex.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_PROFILED_MUTEX_H
+#define DRAGONSTASH_PROFILED_MUTEX_H
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace Dragonstash {
+
+/**
+ * @brief Number of buckets in a lock time histogram.
+ *
+ * Bucket i counts durations d with 2^(i-1) <= d < 2^i nanoseconds (bucket
+ * zero counts durations below one nanosecond); the last bucket also takes
+ * everything longer.
+ */
+static constexpr std::size_t LOCK_HISTOGRAM_BUCKETS = 40;
+
+using LockHistogram = std::array<std::uint64_t, LOCK_HISTOGRAM_BUCKETS>;
+
+/**
+ * @brief Counters of a named lock site.
+ *
+ * All mutexes constructed with the same site name share one LockSite. The
+ * counters are only updated while profiling is enabled, see
+ * set_lock_profiling().
+ */
+class LockSite
+{
+public:
+    explicit LockSite(std::string name);
+    LockSite(const LockSite &src) = delete;
+    LockSite(LockSite &&src) = delete;
+    LockSite &operator=(const LockSite &src) = delete;
+    LockSite &operator=(LockSite &&src) = delete;
+
+private:
+    const std::string m_name;
+    std::atomic<std::uint64_t> m_acquisitions;
+    std::atomic<std::uint64_t> m_contended;
+    std::array<std::atomic<std::uint64_t>, LOCK_HISTOGRAM_BUCKETS> m_wait;
+    std::array<std::atomic<std::uint64_t>, LOCK_HISTOGRAM_BUCKETS> m_hold;
+
+    static std::size_t bucket(std::int64_t nsec);
+
+public:
+    [[nodiscard]] inline const std::string &name() const {
+        return m_name;
+    }
+
+    /**
+     * @brief Account an acquisition which succeeded without waiting.
+     */
+    inline void uncontended() {
+        m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Account an acquisition which had to wait for another holder.
+     */
+    inline void contended(std::int64_t wait_nsec) {
+        m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+        m_contended.fetch_add(1, std::memory_order_relaxed);
+        m_wait[bucket(wait_nsec)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void held(std::int64_t hold_nsec) {
+        m_hold[bucket(hold_nsec)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset();
+
+    friend struct LockProfile;
+};
+
+/**
+ * @brief Snapshot of the counters of a lock site.
+ */
+struct LockProfile {
+    explicit LockProfile(const LockSite &site);
+
+    std::string name;
+
+    /**
+     * @brief Number of times the lock was taken.
+     */
+    std::uint64_t acquisitions;
+
+    /**
+     * @brief Number of acquisitions which found the lock held.
+     */
+    std::uint64_t contended;
+
+    /**
+     * @brief Time spent waiting, for contended acquisitions only.
+     */
+    LockHistogram wait;
+
+    /**
+     * @brief Time between acquisition and release, for all acquisitions.
+     */
+    LockHistogram hold;
+
+    /**
+     * @brief Upper bound of the bucket which contains the given quantile.
+     *
+     * @param histogram One of wait and hold.
+     * @param q Quantile between 0 and 1.
+     * @return Duration in nanoseconds, or zero if the histogram is empty.
+     */
+    [[nodiscard]] static std::uint64_t quantile(const LockHistogram &histogram,
+                                                double q);
+
+    /**
+     * @brief Sum of the bucket midpoints, an estimate of the total time in
+     * nanoseconds.
+     */
+    [[nodiscard]] static std::uint64_t total(const LockHistogram &histogram);
+};
+
+/**
+ * @brief Find or register the lock site with the given name.
+ *
+ * Sites live until the end of the program.
+ */
+[[nodiscard]] LockSite &lock_site(const std::string &name);
+
+/**
+ * @brief Snapshot all lock sites which have been taken at least once,
+ * sorted by name.
+ */
+[[nodiscard]] std::vector<LockProfile> lock_profiles();
+
+/**
+ * @brief Reset the counters of all lock sites.
+ */
+void reset_lock_profiles();
+
+/**
+ * @brief Enable or disable accounting in all profiled mutexes.
+ *
+ * While disabled, a profiled_mutex costs one relaxed atomic load on top of
+ * the std::mutex it wraps.
+ */
+void set_lock_profiling(bool enabled);
+
+[[nodiscard]] bool lock_profiling();
+
+namespace detail {
+
+extern std::atomic<bool> lock_profiling_enabled;
+
+}
+
+/**
+ * @brief A std::mutex which can account contention to a named lock site.
+ *
+ * In builds without NDEBUG, it additionally throws std::system_error with
+ * EDEADLK when a thread tries to take a lock it already holds, instead of
+ * deadlocking.
+ */
+class profiled_mutex
+{
+public:
+    static constexpr bool is_safe =
+        #ifndef NDEBUG
+            true
+        #else
+            false
+        #endif
+            ;
+
+public:
+    explicit profiled_mutex(LockSite &site);
+    explicit profiled_mutex(const std::string &site_name);
+    profiled_mutex(const profiled_mutex &src) = delete;
+    profiled_mutex(profiled_mutex &&src) = delete;
+    profiled_mutex &operator=(const profiled_mutex &src) = delete;
+    profiled_mutex &operator=(profiled_mutex &&src) = delete;
+
+private:
+    std::mutex m_mutex;
+    LockSite &m_site;
+    /**
+     * @brief Time at which the lock was taken, or zero if profiling was
+     * disabled then. Only accessed by the holder.
+     */
+    std::int64_t m_locked_at;
+#ifndef NDEBUG
+    std::atomic<std::thread::id> m_current_owner;
+#endif
+
+    static inline std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()
+                    ).count();
+    }
+
+    inline void check_owner() {
+#ifndef NDEBUG
+        if (m_current_owner.load(std::memory_order_relaxed) ==
+                std::this_thread::get_id()) {
+            throw std::system_error(std::error_code(EDEADLK, std::system_category()));
+        }
+#endif
+    }
+
+    inline void acquired(std::int64_t at) {
+        m_locked_at = at;
+#ifndef NDEBUG
+        m_current_owner.store(std::this_thread::get_id(),
+                              std::memory_order_relaxed);
+#endif
+    }
+
+public:
+    [[nodiscard]] inline LockSite &site() const {
+        return m_site;
+    }
+
+    inline void lock() {
+        check_owner();
+        if (!detail::lock_profiling_enabled.load(std::memory_order_relaxed)) {
+            m_mutex.lock();
+            acquired(0);
+            return;
+        }
+        if (m_mutex.try_lock()) {
+            m_site.uncontended();
+            acquired(now());
+            return;
+        }
+        const std::int64_t wait_start = now();
+        m_mutex.lock();
+        const std::int64_t at = now();
+        m_site.contended(at - wait_start);
+        acquired(at);
+    }
+
+    inline bool try_lock() {
+        check_owner();
+        if (!m_mutex.try_lock()) {
+            return false;
+        }
+        if (detail::lock_profiling_enabled.load(std::memory_order_relaxed)) {
+            m_site.uncontended();
+            acquired(now());
+        } else {
+            acquired(0);
+        }
+        return true;
+    }
+
+    inline void unlock() {
+        if (m_locked_at != 0) {
+            m_site.held(now() - m_locked_at);
+        }
+#ifndef NDEBUG
+        m_current_owner.store(std::thread::id(), std::memory_order_relaxed);
+#endif
+        m_mutex.unlock();
+    }
+};
+
+}
+
+#endif
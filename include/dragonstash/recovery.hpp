@@ -0,0 +1,164 @@
+/**********************************************************************
+File name: recovery.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_RECOVERY_H
+#define DRAGONSTASH_RECOVERY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "dragonstash/cache/cache.hpp"
+
+namespace Dragonstash {
+
+struct RecoveryOptions {
+    /**
+     * @brief Run the sweep in a background thread.
+     *
+     * If disabled, orphans are only reaped by writes (in batches, see
+     * ORPHAN_REAP_BATCH) and files are only checked when they are opened;
+     * recovery then never completes unless sweep() is called.
+     */
+    bool enabled = true;
+
+    /**
+     * @brief Pause between two rounds of reaping orphans once the sweep has
+     * completed.
+     */
+    std::chrono::milliseconds reap_interval{5000};
+
+    /**
+     * @brief Interval at which the access sketch (see AccessSketch) is
+     * written to the database once the sweep has completed.
+     *
+     * Without this, the recency information would only be saved when the
+     * eviction hand wraps around and on shutdown, and would be lost on a
+     * crash.
+     */
+    std::chrono::milliseconds access_sketch_interval{60000};
+};
+
+/**
+ * @brief Counters of the background recovery since it was started.
+ */
+struct RecoveryStats {
+    std::uint64_t reaped_orphans;
+    std::uint64_t checked_files;
+    std::uint64_t discarded_files;
+    std::uint64_t access_sketch_persists;
+
+    /**
+     * @brief Whether the sweep after opening the cache has completed.
+     */
+    bool swept;
+
+    /**
+     * @brief How long the sweep took, if it has completed.
+     */
+    std::chrono::milliseconds sweep_duration;
+};
+
+/**
+ * @brief Recovery work which is deferred from opening the cache.
+ *
+ * After opening the cache, a background thread reaps the orphans which the
+ * previous user left behind and, if that user did not shut down cleanly,
+ * checks all cached files (see Cache::check_file()). Files which are opened
+ * in the meantime are checked on first access. Afterwards, the thread keeps
+ * reaping orphans which could not be reaped when they were created and
+ * persists the access sketch at regular intervals.
+ */
+class Recovery {
+public:
+    Recovery() = delete;
+    Recovery(Cache &cache, const RecoveryOptions &options = RecoveryOptions());
+    Recovery(const Recovery &src) = delete;
+    Recovery(Recovery &&src) = delete;
+    Recovery &operator=(const Recovery &src) = delete;
+    Recovery &operator=(Recovery &&src) = delete;
+
+    /**
+     * @brief Stop the background thread, even in the middle of the sweep.
+     */
+    ~Recovery();
+
+private:
+    Cache &m_cache;
+    const RecoveryOptions m_options;
+
+    std::atomic<std::uint64_t> m_reaped_orphans;
+    std::atomic<std::uint64_t> m_checked_files;
+    std::atomic<std::uint64_t> m_discarded_files;
+    std::atomic<std::uint64_t> m_access_sketch_persists;
+    std::atomic<bool> m_swept;
+    std::atomic<std::int64_t> m_sweep_duration_ms;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stop;
+    std::thread m_thread;
+
+    [[nodiscard]] bool stopped();
+
+    /**
+     * @brief Wait until @a deadline or until the thread is stopped.
+     *
+     * @return false if the thread has been stopped.
+     */
+    bool sleep_until(std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief Reap orphans in batches until none are left (or all which are
+     * left are locked).
+     *
+     * @return false if the thread has been stopped in the middle.
+     */
+    bool reap();
+
+    /**
+     * @return false if the thread has been stopped in the middle.
+     */
+    bool sweep_pass();
+
+    void run();
+
+public:
+    /**
+     * @brief Run the whole sweep in the calling thread.
+     *
+     * This is what the background thread does first. It is safe, if
+     * pointless, to call while the background thread is running.
+     */
+    void sweep();
+
+    [[nodiscard]] RecoveryStats stats() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,180 @@
+/**********************************************************************
+File name: request_arena.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_REQUEST_ARENA_H
+#define DRAGONSTASH_REQUEST_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+namespace Dragonstash {
+
+/**
+ * @brief Size of the block a request arena starts out with.
+ */
+static constexpr std::size_t REQUEST_ARENA_INITIAL_SIZE = 16 << 10;
+
+/**
+ * @brief Size up to which a request arena grows its block.
+ *
+ * Requests which need more scratch memory than this take the excess from
+ * the upstream resource every time.
+ */
+static constexpr std::size_t REQUEST_ARENA_MAX_SIZE = 1 << 20;
+
+/**
+ * @brief Monotonic memory resource for the scratch allocations of a request.
+ *
+ * Allocations are bumped from a single block, deallocation does nothing and
+ * reset() reclaims everything at once. What does not fit into the block is
+ * taken from the upstream resource; the next reset() then grows the block so
+ * that the same request fits, which keeps the upstream resource out of the
+ * steady state.
+ */
+class RequestArena: public std::pmr::memory_resource
+{
+public:
+    explicit RequestArena(
+            std::size_t initial_size = REQUEST_ARENA_INITIAL_SIZE,
+            std::pmr::memory_resource *upstream = std::pmr::new_delete_resource());
+    RequestArena(const RequestArena &src) = delete;
+    RequestArena(RequestArena &&src) = delete;
+    RequestArena &operator=(const RequestArena &src) = delete;
+    RequestArena &operator=(RequestArena &&src) = delete;
+    ~RequestArena() override;
+
+private:
+    std::pmr::memory_resource *m_upstream;
+    std::byte *m_block;
+    std::size_t m_capacity;
+    std::size_t m_used;
+    std::pmr::monotonic_buffer_resource m_overflow;
+    std::size_t m_overflow_bytes;
+    std::uint64_t m_overflows;
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+public:
+    /**
+     * @brief Release all allocations and grow the block if it overflowed.
+     *
+     * Everything allocated from the arena must be destroyed before.
+     */
+    void reset();
+
+    [[nodiscard]] inline std::size_t capacity() const {
+        return m_capacity;
+    }
+
+    /**
+     * @brief Bytes handed out since the last reset(), including overflow.
+     */
+    [[nodiscard]] inline std::size_t used() const {
+        return m_used + m_overflow_bytes;
+    }
+
+    /**
+     * @brief Number of allocations which did not fit into the block.
+     */
+    [[nodiscard]] inline std::uint64_t overflows() const {
+        return m_overflows;
+    }
+};
+
+namespace detail {
+
+extern std::atomic<bool> request_arenas_enabled;
+
+extern thread_local RequestArena *current_request_arena;
+
+RequestArena &thread_request_arena();
+
+}
+
+/**
+ * @brief Enable or disable the per-thread request arenas.
+ *
+ * While disabled, request_memory() always returns the default resource.
+ */
+void set_request_arenas(bool enabled);
+
+[[nodiscard]] inline bool request_arenas() {
+    return detail::request_arenas_enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Memory for scratch data which does not outlive the current request.
+ *
+ * Inside a RequestScope, this is the arena of the calling thread; outside of
+ * one (e.g. on background threads) it is the default resource.
+ */
+[[nodiscard]] inline std::pmr::memory_resource *request_memory() {
+    RequestArena *arena = detail::current_request_arena;
+    if (arena) {
+        return arena;
+    }
+    return std::pmr::get_default_resource();
+}
+
+/**
+ * @brief Route request_memory() to the arena of the calling thread for the
+ * lifetime of the object and reset the arena afterwards.
+ *
+ * Nested scopes share the arena of the outermost one.
+ */
+class RequestScope
+{
+public:
+    inline RequestScope():
+        m_outermost(!detail::current_request_arena && request_arenas())
+    {
+        if (m_outermost) {
+            detail::current_request_arena = &detail::thread_request_arena();
+        }
+    }
+
+    RequestScope(const RequestScope &src) = delete;
+    RequestScope(RequestScope &&src) = delete;
+    RequestScope &operator=(const RequestScope &src) = delete;
+    RequestScope &operator=(RequestScope &&src) = delete;
+
+    inline ~RequestScope() {
+        if (m_outermost) {
+            detail::current_request_arena->reset();
+            detail::current_request_arena = nullptr;
+        }
+    }
+
+private:
+    const bool m_outermost;
+};
+
+}
+
+#endif
@@ -0,0 +1,207 @@
+/**********************************************************************
+File name: trace.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_TRACE_H
+#define DRAGONSTASH_TRACE_H
+
+#include <sys/types.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace Dragonstash {
+
+/**
+ * @brief Number of events each thread keeps; older events are overwritten.
+ */
+static constexpr std::size_t TRACE_BUFFER_EVENTS = 4096;
+
+/**
+ * @brief Number of buffers of exited threads which are kept for dumping.
+ */
+static constexpr std::size_t TRACE_RETIRED_BUFFERS = 16;
+
+/**
+ * @brief A completed span.
+ *
+ * Name and category must be string literals (or otherwise live until the
+ * end of the program), since only the pointers are stored.
+ */
+struct TraceEvent {
+    const char *category;
+    const char *name;
+    /**
+     * @brief Start of the span on the steady clock, in nanoseconds.
+     */
+    std::int64_t start;
+    std::int64_t duration;
+    /**
+     * @brief Inode the span refers to, or zero.
+     */
+    std::uint64_t arg;
+    pid_t tid;
+};
+
+/**
+ * @brief Ring buffer of the events of a single thread.
+ *
+ * Only the owning thread writes; any thread may collect. Slots are guarded
+ * by a sequence number, so a collector skips slots which are overwritten
+ * while it reads them instead of blocking the writer.
+ */
+class TraceBuffer
+{
+public:
+    TraceBuffer();
+    TraceBuffer(const TraceBuffer &src) = delete;
+    TraceBuffer(TraceBuffer &&src) = delete;
+    TraceBuffer &operator=(const TraceBuffer &src) = delete;
+    TraceBuffer &operator=(TraceBuffer &&src) = delete;
+
+private:
+    struct Slot {
+        /**
+         * @brief 2 * position + 1 while the slot is written, 2 * position + 2
+         * once it holds the event at that position.
+         */
+        std::atomic<std::uint64_t> seq;
+        std::atomic<const char*> category;
+        std::atomic<const char*> name;
+        std::atomic<std::int64_t> start;
+        std::atomic<std::int64_t> duration;
+        std::atomic<std::uint64_t> arg;
+    };
+
+    const pid_t m_tid;
+    std::atomic<std::uint64_t> m_head;
+    std::atomic<bool> m_retired;
+    std::array<Slot, TRACE_BUFFER_EVENTS> m_slots;
+
+public:
+    [[nodiscard]] inline pid_t tid() const {
+        return m_tid;
+    }
+
+    [[nodiscard]] inline bool retired() const {
+        return m_retired.load(std::memory_order_acquire);
+    }
+
+    inline void retire() {
+        m_retired.store(true, std::memory_order_release);
+    }
+
+    /**
+     * @brief Append an event; must only be called by the owning thread.
+     */
+    void push(const char *category, const char *name,
+              std::int64_t start, std::int64_t duration,
+              std::uint64_t arg);
+
+    /**
+     * @brief Append the events currently in the buffer, oldest first.
+     */
+    void collect(std::vector<TraceEvent> &dest) const;
+};
+
+namespace detail {
+
+extern std::atomic<bool> tracing_enabled;
+
+TraceBuffer &thread_trace_buffer();
+
+}
+
+/**
+ * @brief Enable or disable recording of trace spans.
+ *
+ * While disabled, a TraceSpan costs one relaxed atomic load.
+ */
+void set_tracing(bool enabled);
+
+[[nodiscard]] inline bool tracing() {
+    return detail::tracing_enabled.load(std::memory_order_relaxed);
+}
+
+[[nodiscard]] inline std::int64_t trace_clock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+                ).count();
+}
+
+/**
+ * @brief Record the time from construction to destruction as an event in
+ * the ring buffer of the current thread.
+ */
+class TraceSpan
+{
+public:
+    inline TraceSpan(const char *category, const char *name,
+                     std::uint64_t arg = 0):
+        m_category(category),
+        m_name(name),
+        m_arg(arg),
+        m_start(tracing() ? trace_clock() : 0)
+    {
+
+    }
+
+    TraceSpan(const TraceSpan &src) = delete;
+    TraceSpan(TraceSpan &&src) = delete;
+    TraceSpan &operator=(const TraceSpan &src) = delete;
+    TraceSpan &operator=(TraceSpan &&src) = delete;
+
+    inline ~TraceSpan() {
+        if (m_start != 0) {
+            detail::thread_trace_buffer().push(
+                        m_category, m_name,
+                        m_start, trace_clock() - m_start,
+                        m_arg);
+        }
+    }
+
+private:
+    const char *m_category;
+    const char *m_name;
+    std::uint64_t m_arg;
+    std::int64_t m_start;
+};
+
+/**
+ * @brief Collect the events of all threads, sorted by start time.
+ */
+[[nodiscard]] std::vector<TraceEvent> collect_trace();
+
+/**
+ * @brief Write the events of all threads in the Chrome trace event format,
+ * which can be loaded into Perfetto or chrome://tracing.
+ */
+void write_chrome_trace(std::ostream &out);
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+/**********************************************************************
+File name: verifier.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_VERIFIER_H
+#define DRAGONSTASH_VERIFIER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "dragonstash/cache/cache.hpp"
+
+namespace Dragonstash {
+
+enum class VerifyMode {
+    /**
+     * Checksums are maintained, but never checked.
+     */
+    NONE,
+
+    /**
+     * Every read is checked before it is served.
+     */
+    ALWAYS,
+
+    /**
+     * Every VerifyOptions::sample_interval-th read is checked.
+     */
+    SAMPLED,
+
+    /**
+     * A background thread periodically checks all cached data.
+     */
+    SCRUB,
+};
+
+struct VerifyOptions {
+    VerifyMode mode = VerifyMode::NONE;
+
+    /**
+     * @brief With VerifyMode::SAMPLED, check one in this many reads.
+     */
+    unsigned sample_interval = 64;
+
+    /**
+     * @brief With VerifyMode::SCRUB, pause between two passes over the cache.
+     */
+    std::chrono::seconds scrub_interval{3600};
+
+    /**
+     * @brief With VerifyMode::SCRUB, upper bound for the number of bytes
+     * checked per second, to leave the disk to the users.
+     */
+    std::uint64_t scrub_rate = 64 << 20;
+};
+
+/**
+ * @brief Counters of the verification since it was started.
+ */
+struct VerifyStats {
+    std::uint64_t verified_bytes;
+    std::uint64_t corrupt_blocks;
+    std::uint64_t scrub_passes;
+};
+
+/**
+ * @brief Verification of cached data against the per-block checksums.
+ *
+ * Corrupt blocks are dropped from the cache (see RegularFileHandle::verify())
+ * and thus fetched from the source again on the next access. Depending on the
+ * VerifyMode, this happens on the read path or in a background scrubber.
+ */
+class Verifier {
+public:
+    Verifier() = delete;
+    Verifier(Cache &cache, const VerifyOptions &options = VerifyOptions());
+    Verifier(const Verifier &src) = delete;
+    Verifier(Verifier &&src) = delete;
+    Verifier &operator=(const Verifier &src) = delete;
+    Verifier &operator=(Verifier &&src) = delete;
+
+    /**
+     * @brief Stop the scrubber.
+     */
+    ~Verifier();
+
+private:
+    Cache &m_cache;
+    const VerifyOptions m_options;
+
+    std::atomic<std::uint64_t> m_reads;
+    std::atomic<std::uint64_t> m_verified_bytes;
+    std::atomic<std::uint64_t> m_corrupt_blocks;
+    std::atomic<std::uint64_t> m_scrub_passes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stop;
+    std::thread m_thread;
+
+    /**
+     * @brief Wait until @a deadline or until the scrubber is stopped.
+     *
+     * @return false if the scrubber has been stopped.
+     */
+    bool sleep_until(std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief Check all cached data once.
+     *
+     * @return false if the scrubber has been stopped in the middle.
+     */
+    bool scrub_pass(bool rate_limited);
+
+    void run();
+
+public:
+    /**
+     * @brief Decide whether a read is to be checked.
+     */
+    [[nodiscard]] bool should_verify();
+
+    /**
+     * @brief Check a byte range of a cached file and drop corrupt blocks.
+     *
+     * The calling thread must not hold any transaction.
+     *
+     * @return The number of blocks which have been dropped; the caller should
+     * fetch them again.
+     *
+     * @see RegularFileHandle::verify()
+     */
+    [[nodiscard]] Result<std::uint64_t> verify(RegularFileHandle &file,
+                                               off_t off, std::size_t n);
+
+    /**
+     * @brief Check all cached data once.
+     *
+     * This is what the scrubber does periodically, but without the rate
+     * limit. Errors of individual files are skipped.
+     */
+    void scrub();
+
+    [[nodiscard]] VerifyStats stats() const;
+};
+
+}
+
+#endif
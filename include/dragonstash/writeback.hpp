@@ -0,0 +1,219 @@
+/**********************************************************************
+File name: writeback.hpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#ifndef DRAGONSTASH_WRITEBACK_H
+#define DRAGONSTASH_WRITEBACK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "dragonstash/backend/base.hpp"
+#include "dragonstash/cache/cache.hpp"
+
+namespace Dragonstash {
+
+struct WritebackOptions {
+    /**
+     * @brief Amount of dirty data at which write-back starts regardless of
+     * its age.
+     */
+    std::uint64_t background_bytes = 16 << 20;
+
+    /**
+     * @brief Amount of dirty data at which writers are held back until the
+     * flusher has completed a round.
+     */
+    std::uint64_t limit_bytes = 64 << 20;
+
+    /**
+     * @brief Age after which dirty data is written back.
+     */
+    std::chrono::milliseconds expire{5000};
+
+    /**
+     * @brief Upper bound for the size of a single write to the backend.
+     *
+     * Contiguous dirty blocks are coalesced into writes of up to this size.
+     */
+    std::size_t max_upload_size = 4 << 20;
+
+    /**
+     * @brief Number of journaled operations replayed per metadata
+     * transaction.
+     */
+    std::size_t replay_batch = 256;
+};
+
+/**
+ * @brief Asynchronous write-back of locally written file data.
+ *
+ * Writes land in the cache (as WRITTEN blocks) and are acknowledged right
+ * away. The Writeback keeps track of the files with dirty blocks and owns the
+ * DIRTY inode flag: it sets the flag when a file first becomes dirty and
+ * clears it once all of the file's blocks have been written back.
+ *
+ * A background thread writes back dirty data once it has expired or when the
+ * total amount of dirty data exceeds WritebackOptions::background_bytes. Runs
+ * of contiguous dirty blocks are coalesced into large sequential writes.
+ *
+ * If the backend is not reachable, dirty data simply stays in the cache; the
+ * DIRTY flag makes sure that the files are picked up again after a restart.
+ *
+ * The Writeback also replays the operation journal of the cache (see
+ * JournalEntry) once the backend is reachable. No data is uploaded while the
+ * journal is not empty, because the files may not exist on the backend yet
+ * or may exist under a different name.
+ */
+class Writeback {
+public:
+    Writeback() = delete;
+    Writeback(Cache &cache, Backend::Filesystem &backend,
+              const WritebackOptions &options = WritebackOptions());
+    Writeback(const Writeback &src) = delete;
+    Writeback(Writeback &&src) = delete;
+    Writeback &operator=(const Writeback &src) = delete;
+    Writeback &operator=(Writeback &&src) = delete;
+
+    /**
+     * @brief Stop the flusher and attempt to write back all dirty data.
+     */
+    ~Writeback();
+
+private:
+    struct DirtyFile {
+        std::shared_ptr<RegularFileHandle> file;
+        std::uint64_t bytes;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    Cache &m_cache;
+    Backend::Filesystem &m_backend;
+    const WritebackOptions m_options;
+
+    /**
+     * @brief Serialises journal replays.
+     */
+    std::mutex m_replay_mutex;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_progress;
+    std::map<ino_t, DirtyFile> m_dirty;
+    std::uint64_t m_dirty_bytes;
+    std::uint64_t m_rounds;
+    bool m_kick;
+    bool m_stop;
+    std::thread m_thread;
+
+    /**
+     * @brief Write all WRITTEN blocks of a file to the backend.
+     *
+     * Blocks are only re-marked as READ once the backend has accepted the
+     * data, so that an interrupted upload is repeated after a restart. Blocks
+     * of chunks during whose upload the file was written to stay WRITTEN (see
+     * RegularFileHandle::write_generation()).
+     *
+     * Fails with ENOTCONN while the journal has not been replayed.
+     */
+    [[nodiscard]] Result<void> upload(RegularFileHandle &file, bool sync);
+
+    /**
+     * @brief Update the bookkeeping for a file after an upload attempt.
+     *
+     * The caller must hold m_mutex.
+     */
+    void settle(const std::shared_ptr<RegularFileHandle> &file, int error);
+
+    [[nodiscard]] Result<void> write_back(const std::shared_ptr<RegularFileHandle> &file,
+                                          bool sync);
+
+    void run();
+
+public:
+    /**
+     * @brief Register data written to a file.
+     *
+     * Must be called after the written blocks have been marked and without
+     * holding a transaction.
+     */
+    [[nodiscard]] Result<void> mark_dirty(const std::shared_ptr<RegularFileHandle> &file);
+
+    /**
+     * @brief Hold back the caller while too much data is dirty.
+     *
+     * Waits for at most one round of the flusher, so that writers are not
+     * blocked indefinitely while the backend is unreachable.
+     */
+    void throttle();
+
+    /**
+     * @brief Compact the journal and replay it to the backend.
+     *
+     * Operations are replayed in batches of WritebackOptions::replay_batch;
+     * the replayed operations of a batch are removed from the journal in a
+     * single transaction. Operations which the backend rejects for other
+     * reasons than being unreachable are dropped: either they have been
+     * replayed before a crash already, or they conflict with changes on the
+     * backend, which is authoritative.
+     *
+     * Error codes:
+     *
+     * - ENOTCONN: The backend became unreachable; the remaining operations
+     *   are kept.
+     */
+    [[nodiscard]] Result<void> replay_journal();
+
+    /**
+     * @brief Write back all dirty data of an inode synchronously.
+     *
+     * The journal is replayed first.
+     *
+     * @param sync Also fsync the file on the backend.
+     *
+     * Error codes are those of the backend; in particular ENOTCONN if the
+     * backend is not reachable. The data is kept dirty in that case.
+     */
+    [[nodiscard]] Result<void> flush(ino_t ino, bool sync = false);
+
+    /**
+     * @brief Write back all dirty data synchronously.
+     *
+     * @return The first error encountered, if any.
+     */
+    [[nodiscard]] Result<void> flush_all();
+
+    /**
+     * @brief Return the amount of dirty data, in bytes.
+     */
+    [[nodiscard]] std::uint64_t dirty_bytes() const;
+};
+
+}
+
+#endif
@@ -30,6 +30,29 @@ File::~File() = default;
 
 Dir::~Dir() = default;
 
+Result<void> Dir::read_batch(std::vector<DirEntryRef> &batch)
+{
+    batch.clear();
+    m_batch_storage.clear();
+    while (m_batch_storage.size() < DIR_BATCH_ENTRIES) {
+        auto entry = readdir();
+        if (!entry) {
+            if (entry.error() != 0) {
+                return copy_error(entry);
+            }
+            break;
+        }
+        m_batch_storage.emplace_back(std::move(*entry));
+    }
+
+    // only take references once the storage does not move anymore
+    batch.reserve(m_batch_storage.size());
+    for (const DirEntry &entry: m_batch_storage) {
+        batch.emplace_back(DirEntryRef{entry, entry.name, entry.complete});
+    }
+    return make_result();
+}
+
 Filesystem::~Filesystem() = default;
 
 }
@@ -27,6 +27,7 @@ authors named in the AUTHORS file.
 #include <cassert>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -146,6 +147,23 @@ void Directory::remove(const std::string &name)
     m_children.erase(iter);
 }
 
+std::unique_ptr<Node> Directory::take(const std::string &name)
+{
+    auto iter = m_children.find(name);
+    if (iter == m_children.end()) {
+        return nullptr;
+    }
+
+    auto result = std::move(iter->second);
+    m_children.erase(iter);
+    return result;
+}
+
+void Directory::insert(const std::string &name, std::unique_ptr<Node> node)
+{
+    m_children[name] = std::move(node);
+}
+
 DirHandle::DirHandle(Directory &node):
     m_node(&node),
     m_state(DOT),
@@ -195,6 +213,26 @@ Result<DirEntry> DirHandle::readdir()
     };
 }
 
+Result<void> DirHandle::read_batch(std::vector<DirEntryRef> &batch)
+{
+    // the names of the children live as long as the nodes, so they can be
+    // referenced directly
+    batch.clear();
+    if (m_state == DOT) {
+        batch.emplace_back(DirEntryRef{Stat{.ino = 0}, ".", false});
+        m_state = DOTDOT;
+    }
+    if (m_state == DOTDOT) {
+        batch.emplace_back(DirEntryRef{Stat{.ino = 0}, "..", false});
+        m_state = ITERATION;
+    }
+    for (; m_iter != m_node->children().end() && batch.size() < DIR_BATCH_ENTRIES;
+         ++m_iter) {
+        batch.emplace_back(DirEntryRef{Stat{.ino = 0}, m_iter->first, false});
+    }
+    return make_result();
+}
+
 Result<void> DirHandle::fsyncdir()
 {
     return make_result(FAILED, EOPNOTSUPP);
@@ -269,6 +307,24 @@ void InMemoryFilesystem::set_connected(bool connected)
     m_connected = connected;
 }
 
+Result<std::tuple<InMemory::Directory *, std::string> > InMemoryFilesystem::find_parent(std::string_view path)
+{
+    const auto last_slash = path.find_last_of('/');
+    if (last_slash == std::string_view::npos || last_slash + 1 == path.size()) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    Result<InMemory::Node*> parent = find(last_slash == 0 ? "/" : path.substr(0, last_slash));
+    if (!parent) {
+        return copy_error(parent);
+    }
+    auto *dir = dynamic_cast<InMemory::Directory*>(*parent);
+    if (!dir) {
+        return make_result(FAILED, ENOTDIR);
+    }
+    return std::make_tuple(dir, std::string(path.substr(last_slash + 1)));
+}
+
 Result<std::unique_ptr<File> > InMemoryFilesystem::open(std::string_view path, int accesstype, mode_t mode)
 {
     if (!m_connected) {
@@ -276,6 +332,18 @@ Result<std::unique_ptr<File> > InMemoryFilesystem::open(std::string_view path, i
     }
 
     Result<InMemory::Node*> node = find(path);
+    if (!node && node.error() == ENOENT && (accesstype & O_CREAT)) {
+        auto parent = find_parent(path);
+        if (!parent) {
+            return copy_error(parent);
+        }
+        auto &[dir, name] = *parent;
+        auto &file = dir->emplace<InMemory::File>(name);
+        file.attr().mode = S_IFREG | (mode & ~S_IFMT);
+        node = &file;
+    } else if (node && (accesstype & O_CREAT) && (accesstype & O_EXCL)) {
+        return make_result(FAILED, EEXIST);
+    }
     if (!node) {
         return copy_error(node);
     }
@@ -289,6 +357,10 @@ Result<std::unique_ptr<File> > InMemoryFilesystem::open(std::string_view path, i
     if (!file) {
         return make_result(FAILED, EINVAL);
     }
+    if ((accesstype & O_TRUNC) && (accesstype & O_ACCMODE) != O_RDONLY) {
+        file->data().clear();
+        file->attr().size = 0;
+    }
     return std::make_unique<InMemory::FileHandle>(*file);
 }
 
@@ -339,4 +411,183 @@ Result<std::string> InMemoryFilesystem::readlink(std::string_view path)
     return link->destination();
 }
 
+Result<void> InMemoryFilesystem::mkdir(std::string_view path, mode_t mode)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto parent = find_parent(path);
+    if (!parent) {
+        return copy_error(parent);
+    }
+    auto &[dir, name] = *parent;
+    if (dir->children().count(name) > 0) {
+        return make_result(FAILED, EEXIST);
+    }
+    auto &child = dir->emplace<InMemory::Directory>(name);
+    child.attr().mode = S_IFDIR | (mode & ~S_IFMT);
+    return make_result();
+}
+
+Result<void> InMemoryFilesystem::unlink(std::string_view path)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto parent = find_parent(path);
+    if (!parent) {
+        return copy_error(parent);
+    }
+    auto &[dir, name] = *parent;
+    auto iter = dir->children().find(name);
+    if (iter == dir->children().end()) {
+        return make_result(FAILED, ENOENT);
+    }
+    if (dynamic_cast<InMemory::Directory*>(iter->second.get())) {
+        return make_result(FAILED, EISDIR);
+    }
+    dir->children().erase(iter);
+    return make_result();
+}
+
+Result<void> InMemoryFilesystem::rmdir(std::string_view path)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto parent = find_parent(path);
+    if (!parent) {
+        return copy_error(parent);
+    }
+    auto &[dir, name] = *parent;
+    auto iter = dir->children().find(name);
+    if (iter == dir->children().end()) {
+        return make_result(FAILED, ENOENT);
+    }
+    auto *child = dynamic_cast<InMemory::Directory*>(iter->second.get());
+    if (!child) {
+        return make_result(FAILED, ENOTDIR);
+    }
+    if (!child->children().empty()) {
+        return make_result(FAILED, ENOTEMPTY);
+    }
+    dir->children().erase(iter);
+    return make_result();
+}
+
+Result<void> InMemoryFilesystem::rename(std::string_view from, std::string_view to)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    if (to.size() > from.size() && to.substr(0, from.size()) == from &&
+            to[from.size()] == '/') {
+        // cannot move a directory into itself
+        return make_result(FAILED, EINVAL);
+    }
+
+    auto src_parent = find_parent(from);
+    if (!src_parent) {
+        return copy_error(src_parent);
+    }
+    auto dest_parent = find_parent(to);
+    if (!dest_parent) {
+        return copy_error(dest_parent);
+    }
+    auto &[src_dir, src_name] = *src_parent;
+    auto &[dest_dir, dest_name] = *dest_parent;
+
+    auto src_iter = src_dir->children().find(src_name);
+    if (src_iter == src_dir->children().end()) {
+        return make_result(FAILED, ENOENT);
+    }
+    if (src_dir == dest_dir && src_name == dest_name) {
+        return make_result();
+    }
+
+    const bool src_is_dir = dynamic_cast<InMemory::Directory*>(src_iter->second.get()) != nullptr;
+    auto dest_iter = dest_dir->children().find(dest_name);
+    if (dest_iter != dest_dir->children().end()) {
+        auto *dest_node = dynamic_cast<InMemory::Directory*>(dest_iter->second.get());
+        if (!src_is_dir && dest_node) {
+            return make_result(FAILED, EISDIR);
+        }
+        if (src_is_dir && !dest_node) {
+            return make_result(FAILED, ENOTDIR);
+        }
+        if (dest_node && !dest_node->children().empty()) {
+            return make_result(FAILED, ENOTEMPTY);
+        }
+    }
+
+    dest_dir->insert(dest_name, src_dir->take(src_name));
+    return make_result();
+}
+
+Result<void> InMemoryFilesystem::truncate(std::string_view path, off_t size)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    if (size < 0) {
+        return make_result(FAILED, EINVAL);
+    }
+    Result<InMemory::Node*> node = find(path);
+    if (!node) {
+        return copy_error(node);
+    }
+    if (dynamic_cast<InMemory::Directory*>(*node)) {
+        return make_result(FAILED, EISDIR);
+    }
+    auto *file = dynamic_cast<InMemory::File*>(*node);
+    if (!file) {
+        return make_result(FAILED, EINVAL);
+    }
+    file->data().resize(size);
+    file->attr().size = size;
+    return make_result();
+}
+
+Result<void> InMemoryFilesystem::chmod(std::string_view path, mode_t mode)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    Result<InMemory::Node*> node = find(path);
+    if (!node) {
+        return copy_error(node);
+    }
+    auto &attr = (*node)->attr();
+    attr.mode = (attr.mode & S_IFMT) | (mode & ~S_IFMT);
+    return make_result();
+}
+
+Result<void> InMemoryFilesystem::utimens(std::string_view path,
+                                         const timespec &atime,
+                                         const timespec &mtime)
+{
+    if (!m_connected) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    Result<InMemory::Node*> node = find(path);
+    if (!node) {
+        return copy_error(node);
+    }
+    auto &attr = (*node)->attr();
+    if (atime.tv_nsec != UTIME_OMIT) {
+        attr.atime = atime;
+    }
+    if (mtime.tv_nsec != UTIME_OMIT) {
+        attr.mtime = mtime;
+    }
+    return make_result();
+}
+
 }
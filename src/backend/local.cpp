@@ -24,11 +24,14 @@ authors named in the AUTHORS file.
 **********************************************************************/
 #include "dragonstash/backend/local.hpp"
 
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <cstddef>
 #include <cstring>
 
 namespace Dragonstash {
@@ -107,64 +110,112 @@ Result<void> LocalFile::close()
     return Result<void>();
 }
 
-LocalDir::LocalDir(DIR *fd):
-    m_fd(fd)
+static std::uint32_t mode_from_d_type(unsigned char d_type)
+{
+    switch (d_type) {
+    case DT_BLK:
+        return S_IFBLK;
+    case DT_CHR:
+        return S_IFCHR;
+    case DT_REG:
+        return S_IFREG;
+    case DT_DIR:
+        return S_IFDIR;
+    case DT_FIFO:
+        return S_IFIFO;
+    case DT_LNK:
+        return S_IFLNK;
+    case DT_SOCK:
+        return S_IFSOCK;
+    }
+    return 0;
+}
+
+LocalDir::LocalDir(int fd, std::size_t buffer_size):
+    m_fd(fd),
+    m_buffer_size(buffer_size),
+    // new[] aligns the buffer suitably for the records
+    m_buffer(new std::byte[buffer_size]),
+    m_fill(0),
+    m_pos(0)
 {
 
 }
 
 LocalDir::~LocalDir()
 {
-    if (m_fd) {
-        closedir();
+    if (m_fd >= 0) {
+        (void)closedir();
     }
 }
 
-Result<DirEntry> LocalDir::readdir()
+Result<bool> LocalDir::fill()
 {
-    struct dirent *entry = ::readdir(m_fd);
-    if (!entry) {
-        return Result<DirEntry>(FAILED, 0);
+    if (m_pos < m_fill) {
+        return true;
     }
-
-    uint32_t st_mode = 0;
-    switch (entry->d_type) {
-    case DT_BLK:
-        st_mode = S_IFBLK;
-        break;
-    case DT_CHR:
-        st_mode = S_IFCHR;
-        break;
-    case DT_REG:
-        st_mode = S_IFREG;
-        break;
-    case DT_DIR:
-        st_mode = S_IFDIR;
-        break;
-    case DT_FIFO:
-        st_mode = S_IFIFO;
-        break;
-    case DT_LNK:
-        st_mode = S_IFLNK;
-        break;
-    case DT_SOCK:
-        st_mode = S_IFSOCK;
-        break;
+    // the records have the layout of struct dirent64, which is what glibc's
+    // own getdents64() wrapper uses; the syscall is used directly, since the
+    // wrapper is fairly recent
+    const long nread = ::syscall(SYS_getdents64, m_fd, m_buffer.get(),
+                                 m_buffer_size);
+    if (nread < 0) {
+        return make_result(FAILED, errno);
     }
+    m_fill = static_cast<std::size_t>(nread);
+    m_pos = 0;
+    return m_fill > 0;
+}
 
-    return DirEntry{
+DirEntryRef LocalDir::next_record()
+{
+    const auto *record = reinterpret_cast<const struct dirent64*>(
+                m_buffer.get() + m_pos);
+    m_pos += record->d_reclen;
+    return DirEntryRef{
         Stat{
-            .mode = st_mode,
-            .ino = entry->d_ino,
+            .mode = mode_from_d_type(record->d_type),
+            .ino = record->d_ino,
         },
-        entry->d_name,
+        std::string_view(record->d_name),
         false,
     };
 }
 
+Result<DirEntry> LocalDir::readdir()
+{
+    auto fill_result = fill();
+    if (!fill_result) {
+        return copy_error(fill_result);
+    }
+    if (!*fill_result) {
+        return Result<DirEntry>(FAILED, 0);
+    }
+
+    const DirEntryRef entry = next_record();
+    return DirEntry{
+        entry,
+        std::string(entry.name),
+        entry.complete,
+    };
+}
+
+Result<void> LocalDir::read_batch(std::vector<DirEntryRef> &batch)
+{
+    batch.clear();
+    auto fill_result = fill();
+    if (!fill_result) {
+        return copy_error(fill_result);
+    }
+    while (m_pos < m_fill) {
+        batch.emplace_back(next_record());
+    }
+    return make_result();
+}
+
 Result<void> LocalDir::fsyncdir()
 {
-    if (::fsync(dirfd(m_fd)) < 0) {
+    if (::fsync(m_fd) < 0) {
         return Result<void>(FAILED, errno);
     }
     return Result<void>();
@@ -172,10 +223,10 @@ Result<void> LocalDir::fsyncdir()
 
 Result<void> LocalDir::closedir()
 {
-    if (::closedir(m_fd) < 0) {
+    if (::close(m_fd) < 0) {
         return Result<void>(FAILED, errno);
     }
-    m_fd = 0;
+    m_fd = -1;
     return Result<void>();
 }
 
@@ -228,8 +279,9 @@ Result<std::unique_ptr<Dir>> LocalFilesystem::opendir(std::string_view path)
         return copy_error(full_path);
     }
 
-    DIR *fd = ::opendir(full_path->c_str());
-    if (fd == nullptr) {
+    const int fd = ::open(full_path->c_str(),
+                          O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
         return make_result(FAILED, errno);
     }
 
@@ -280,5 +332,103 @@ Result<std::string> LocalFilesystem::readlink(std::string_view path)
     return link_buf;
 }
 
+Result<void> LocalFilesystem::mkdir(std::string_view path, mode_t mode)
+{
+    const auto full_path = map_path(path);
+    if (!full_path) {
+        return copy_error(full_path);
+    }
+
+    if (::mkdir(full_path->c_str(), mode) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
+Result<void> LocalFilesystem::unlink(std::string_view path)
+{
+    const auto full_path = map_path(path);
+    if (!full_path) {
+        return copy_error(full_path);
+    }
+
+    if (::unlink(full_path->c_str()) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
+Result<void> LocalFilesystem::rmdir(std::string_view path)
+{
+    const auto full_path = map_path(path);
+    if (!full_path) {
+        return copy_error(full_path);
+    }
+
+    if (::rmdir(full_path->c_str()) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
+Result<void> LocalFilesystem::rename(std::string_view from, std::string_view to)
+{
+    const auto full_from = map_path(from);
+    if (!full_from) {
+        return copy_error(full_from);
+    }
+    const auto full_to = map_path(to);
+    if (!full_to) {
+        return copy_error(full_to);
+    }
+
+    if (::rename(full_from->c_str(), full_to->c_str()) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
+Result<void> LocalFilesystem::truncate(std::string_view path, off_t size)
+{
+    const auto full_path = map_path(path);
+    if (!full_path) {
+        return copy_error(full_path);
+    }
+
+    if (::truncate(full_path->c_str(), size) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
+Result<void> LocalFilesystem::chmod(std::string_view path, mode_t mode)
+{
+    const auto full_path = map_path(path);
+    if (!full_path) {
+        return copy_error(full_path);
+    }
+
+    if (::chmod(full_path->c_str(), mode) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
+Result<void> LocalFilesystem::utimens(std::string_view path,
+                                      const timespec &atime,
+                                      const timespec &mtime)
+{
+    const auto full_path = map_path(path);
+    if (!full_path) {
+        return copy_error(full_path);
+    }
+
+    const struct timespec times[2] = {atime, mtime};
+    if (::utimensat(AT_FDCWD, full_path->c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) {
+        return make_result(FAILED, errno);
+    }
+    return make_result();
+}
+
 }
 }
@@ -0,0 +1,612 @@
+/**********************************************************************
+File name: synthetic.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/backend/synthetic.hpp"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+namespace Dragonstash::Backend {
+
+static constexpr std::uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15ULL;
+
+// salts, so that the values derived from one id are independent
+static constexpr std::uint64_t SALT_NAME = 0x6e616d65;
+static constexpr std::uint64_t SALT_SIZE = 0x73697a65;
+static constexpr std::uint64_t SALT_TIME = 0x74696d65;
+
+/**
+ * Timestamps are spread over five years from this point in time.
+ */
+static constexpr std::int64_t EPOCH = 1500000000;
+static constexpr std::uint64_t TIME_SPREAD = 5 * 365 * 86400;
+
+static constexpr unsigned MAX_INDEX_DIGITS = 20;
+
+/**
+ * @brief The splitmix64 finaliser.
+ */
+static inline std::uint64_t mix(std::uint64_t x)
+{
+    x += GOLDEN_GAMMA;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static bool parse_number(std::string_view s, std::uint64_t &dest)
+{
+    const char *end = s.data() + s.size();
+    auto [ptr, ec] = std::from_chars(s.data(), end, dest);
+    return ec == std::errc() && ptr == end && !s.empty();
+}
+
+static bool parse_size(std::string_view s, std::uint64_t &dest)
+{
+    unsigned shift = 0;
+    if (!s.empty()) {
+        switch (s.back()) {
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        }
+    }
+    if (shift > 0) {
+        s.remove_suffix(1);
+    }
+    if (!parse_number(s, dest) || dest > (UINT64_MAX >> shift)) {
+        return false;
+    }
+    dest <<= shift;
+    return true;
+}
+
+static bool parse_unsigned(std::string_view s, unsigned &dest)
+{
+    std::uint64_t value;
+    if (!parse_number(s, value) || value > UINT_MAX) {
+        return false;
+    }
+    dest = static_cast<unsigned>(value);
+    return true;
+}
+
+Result<SyntheticOptions> SyntheticOptions::parse(std::string_view spec)
+{
+    SyntheticOptions result;
+    while (!spec.empty()) {
+        const std::size_t comma = spec.find(',');
+        const std::string_view item = spec.substr(0, comma);
+        spec.remove_prefix(comma == std::string_view::npos ? spec.size() : comma + 1);
+
+        const std::size_t eq = item.find('=');
+        if (eq == std::string_view::npos) {
+            return make_result(FAILED, EINVAL);
+        }
+        const std::string_view key = item.substr(0, eq);
+        const std::string_view value = item.substr(eq + 1);
+
+        bool ok;
+        if (key == "seed") {
+            ok = parse_number(value, result.seed);
+        } else if (key == "dirs") {
+            ok = parse_unsigned(value, result.directories);
+        } else if (key == "files") {
+            ok = parse_unsigned(value, result.files);
+        } else if (key == "depth") {
+            ok = parse_unsigned(value, result.depth);
+        } else if (key == "name") {
+            ok = parse_unsigned(value, result.name_length);
+        } else if (key == "size") {
+            const std::size_t dash = value.find('-');
+            if (dash == std::string_view::npos) {
+                ok = parse_size(value, result.min_file_size);
+                result.max_file_size = result.min_file_size;
+            } else {
+                ok = parse_size(value.substr(0, dash), result.min_file_size) &&
+                        parse_size(value.substr(dash + 1), result.max_file_size) &&
+                        result.min_file_size <= result.max_file_size;
+            }
+        } else if (key == "content") {
+            ok = true;
+            if (value == "random") {
+                result.content = SyntheticContent::RANDOM;
+            } else if (value == "zeros") {
+                result.content = SyntheticContent::ZEROS;
+            } else {
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return make_result(FAILED, EINVAL);
+        }
+    }
+    return result;
+}
+
+std::uint64_t SyntheticOptions::total_directories() const
+{
+    std::uint64_t total = 1;
+    std::uint64_t level = 1;
+    for (unsigned i = 0; i < depth; ++i) {
+        level *= directories;
+        total += level;
+    }
+    return total;
+}
+
+std::uint64_t SyntheticOptions::total_files() const
+{
+    return total_directories() * files;
+}
+
+namespace {
+
+class SyntheticFile: public File {
+public:
+    SyntheticFile(const SyntheticFilesystem &fs, const Stat &attr):
+        m_fs(fs),
+        m_attr(attr)
+    {
+
+    }
+
+private:
+    const SyntheticFilesystem &m_fs;
+    const Stat m_attr;
+
+public:
+    Result<Stat> fstat() override
+    {
+        return m_attr;
+    }
+
+    Result<ssize_t> pread(void *buf, size_t count, off_t offset) override
+    {
+        if (offset < 0) {
+            return make_result(FAILED, EINVAL);
+        }
+        if (static_cast<std::uint64_t>(offset) >= m_attr.size) {
+            return make_result(ssize_t(0));
+        }
+        count = std::min<std::uint64_t>(count, m_attr.size - offset);
+        m_fs.contents(m_attr.ino, offset, buf, count);
+        return make_result(static_cast<ssize_t>(count));
+    }
+
+    Result<ssize_t> pwrite(const void *, size_t, off_t) override
+    {
+        return make_result(FAILED, EBADF);
+    }
+
+    Result<void> fsync() override
+    {
+        return make_result();
+    }
+
+    Result<void> close() override
+    {
+        return make_result();
+    }
+};
+
+class SyntheticDir: public Dir {
+public:
+    SyntheticDir(const SyntheticFilesystem &fs,
+                 const SyntheticFilesystem::Node &dir):
+        m_fs(fs),
+        m_dir(dir),
+        m_count(fs.entry_count(dir.depth)),
+        m_next(0)
+    {
+        // sized once, so that the names of a batch do not move
+        m_names.resize(DIR_BATCH_ENTRIES * fs.max_name_length());
+    }
+
+private:
+    const SyntheticFilesystem &m_fs;
+    const SyntheticFilesystem::Node m_dir;
+    const std::uint64_t m_count;
+    /**
+     * @brief Position in the stream: 0 is dot, 1 is dotdot, entry i is at
+     * i + 2.
+     */
+    std::uint64_t m_next;
+    std::string m_names;
+
+    /**
+     * @brief Produce the entry at the current position and advance.
+     *
+     * @param name_buf Buffer for the name, of max_name_length() bytes.
+     */
+    DirEntryRef next(char *name_buf)
+    {
+        const std::uint64_t pos = m_next++;
+        if (pos < 2) {
+            return DirEntryRef{
+                Stat{
+                    .mode = S_IFDIR,
+                    .ino = 0,
+                },
+                pos == 0 ? "." : "..",
+                false,
+            };
+        }
+        const std::uint64_t index = pos - 2;
+        const auto child = m_fs.child(m_dir, index);
+        const std::size_t len = m_fs.format_name(m_dir, index, name_buf);
+        return DirEntryRef{
+            Stat{
+                .mode = std::uint32_t(child.is_dir ? S_IFDIR : S_IFREG),
+                .ino = child.id,
+            },
+            std::string_view(name_buf, len),
+            false,
+        };
+    }
+
+public:
+    Result<DirEntry> readdir() override
+    {
+        if (m_next >= m_count + 2) {
+            return make_result(FAILED, 0);
+        }
+        const DirEntryRef entry = next(m_names.data());
+        return DirEntry{
+            entry,
+            std::string(entry.name),
+            entry.complete,
+        };
+    }
+
+    Result<void> read_batch(std::vector<DirEntryRef> &batch) override
+    {
+        batch.clear();
+        char *name_buf = m_names.data();
+        while (m_next < m_count + 2 && batch.size() < DIR_BATCH_ENTRIES) {
+            batch.emplace_back(next(name_buf));
+            name_buf += m_fs.max_name_length();
+        }
+        return make_result();
+    }
+
+    Result<void> fsyncdir() override
+    {
+        return make_result();
+    }
+
+    Result<void> closedir() override
+    {
+        return make_result();
+    }
+};
+
+}
+
+SyntheticFilesystem::SyntheticFilesystem(const SyntheticOptions &options):
+    m_options(options),
+    m_root_id(mix(options.seed)),
+    m_uid(getuid()),
+    m_gid(getgid()),
+    m_connected(true)
+{
+
+}
+
+Result<SyntheticFilesystem::Node> SyntheticFilesystem::find(std::string_view path) const
+{
+    if (path.empty() || path[0] != '/') {
+        return make_result(FAILED, EINVAL);
+    }
+
+    Node node = root();
+    char expected[NAME_MAX + MAX_INDEX_DIGITS + 2];
+    path.remove_prefix(1);
+    while (!path.empty()) {
+        const std::size_t slash = path.find('/');
+        const std::string_view component = path.substr(0, slash);
+        path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+        if (component.empty()) {
+            continue;
+        }
+        if (!node.is_dir) {
+            return make_result(FAILED, ENOTDIR);
+        }
+
+        // the kind and index are encoded in the name; everything else is
+        // checked by generating the name again
+        if (component.size() < 2 || (component[0] != 'd' && component[0] != 'f')) {
+            return make_result(FAILED, ENOENT);
+        }
+        const bool is_dir = component[0] == 'd';
+        std::size_t ndigits = 1;
+        while (ndigits < component.size() && ndigits <= MAX_INDEX_DIGITS &&
+               component[ndigits] >= '0' && component[ndigits] <= '9') {
+            ++ndigits;
+        }
+        std::uint64_t index;
+        if (!parse_number(component.substr(1, ndigits - 1), index)) {
+            return make_result(FAILED, ENOENT);
+        }
+        const std::uint64_t ndirs = node.depth < m_options.depth ? m_options.directories : 0;
+        if (is_dir ? index >= ndirs : index >= m_options.files) {
+            return make_result(FAILED, ENOENT);
+        }
+        const std::uint64_t entry = is_dir ? index : ndirs + index;
+        const std::size_t len = format_name(node, entry, expected);
+        if (component != std::string_view(expected, len)) {
+            return make_result(FAILED, ENOENT);
+        }
+        node = child(node, entry);
+    }
+    return node;
+}
+
+std::uint64_t SyntheticFilesystem::entry_count(unsigned depth) const
+{
+    return (depth < m_options.depth ? m_options.directories : 0) +
+            std::uint64_t(m_options.files);
+}
+
+SyntheticFilesystem::Node SyntheticFilesystem::child(const Node &dir,
+                                                     std::uint64_t index) const
+{
+    const bool is_dir = dir.depth < m_options.depth && index < m_options.directories;
+    return Node{
+        mix(dir.id ^ mix(2 * index + is_dir)),
+        dir.depth + 1,
+        is_dir,
+    };
+}
+
+std::size_t SyntheticFilesystem::format_name(const Node &dir, std::uint64_t index,
+                                             char *dest) const
+{
+    const Node node = child(dir, index);
+    const std::uint64_t local_index = node.is_dir || dir.depth >= m_options.depth
+            ? index
+            : index - m_options.directories;
+
+    dest[0] = node.is_dir ? 'd' : 'f';
+    auto [end, ec] = std::to_chars(dest + 1, dest + 1 + MAX_INDEX_DIGITS, local_index);
+    (void)ec;
+    std::size_t len = end - dest;
+
+    // the filler consists of letters only, so that the index can be parsed
+    // back without a separator
+    const std::size_t target = std::min<std::size_t>(m_options.name_length, NAME_MAX);
+    std::uint64_t h = mix(node.id ^ SALT_NAME);
+    unsigned available = 13;
+    for (; len < target; ++len) {
+        if (available == 0) {
+            h = mix(h);
+            available = 13;
+        }
+        dest[len] = static_cast<char>('a' + h % 26);
+        h /= 26;
+        --available;
+    }
+    return len;
+}
+
+std::size_t SyntheticFilesystem::max_name_length() const
+{
+    return std::max<std::size_t>(std::min<std::size_t>(m_options.name_length, NAME_MAX),
+                                 1 + MAX_INDEX_DIGITS);
+}
+
+Stat SyntheticFilesystem::attributes(const Node &node) const
+{
+    const struct timespec time{
+        static_cast<time_t>(EPOCH + mix(node.id ^ SALT_TIME) % TIME_SPREAD),
+        0,
+    };
+    Stat result{
+        .mode = std::uint32_t(node.is_dir ? S_IFDIR | 0755 : S_IFREG | 0644),
+        .size = 0,
+        .ino = node.id,
+        .uid = m_uid,
+        .gid = m_gid,
+        .atime = time,
+        .mtime = time,
+        .ctime = time,
+    };
+    if (!node.is_dir) {
+        // log-uniform between the bounds
+        const double u = static_cast<double>(mix(node.id ^ SALT_SIZE) >> 11) * 0x1.0p-53;
+        const double lo = std::log1p(static_cast<double>(m_options.min_file_size));
+        const double hi = std::log1p(static_cast<double>(m_options.max_file_size));
+        const auto size = static_cast<std::uint64_t>(std::expm1(lo + u * (hi - lo)));
+        result.size = std::clamp(size, m_options.min_file_size, m_options.max_file_size);
+    }
+    return result;
+}
+
+void SyntheticFilesystem::contents(std::uint64_t id, off_t offset,
+                                   void *buf, std::size_t count) const
+{
+    auto *dest = static_cast<unsigned char*>(buf);
+    if (m_options.content == SyntheticContent::ZEROS) {
+        memset(dest, 0, count);
+        return;
+    }
+
+    // word i of the file is the i-th output of a splitmix64 stream seeded
+    // with the id, so any range can be generated directly
+    auto pos = static_cast<std::uint64_t>(offset);
+    while (count > 0) {
+        const std::uint64_t word = mix(id + (pos / 8) * GOLDEN_GAMMA);
+        const std::size_t skip = pos % 8;
+        const std::size_t n = std::min<std::size_t>(8 - skip, count);
+        memcpy(dest, reinterpret_cast<const unsigned char*>(&word) + skip, n);
+        dest += n;
+        pos += n;
+        count -= n;
+    }
+}
+
+Result<std::unique_ptr<File>> SyntheticFilesystem::open(std::string_view path,
+                                                        int accesstype,
+                                                        mode_t mode)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto node = find(path);
+    if (!node) {
+        if (node.error() == ENOENT && (accesstype & O_CREAT)) {
+            return make_result(FAILED, EROFS);
+        }
+        return copy_error(node);
+    }
+    if (node->is_dir) {
+        return make_result(FAILED, EISDIR);
+    }
+    if ((accesstype & O_ACCMODE) != O_RDONLY || (accesstype & O_TRUNC)) {
+        return make_result(FAILED, EROFS);
+    }
+    return std::make_unique<SyntheticFile>(*this, attributes(*node));
+}
+
+Result<std::unique_ptr<Dir>> SyntheticFilesystem::opendir(std::string_view path)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto node = find(path);
+    if (!node) {
+        return copy_error(node);
+    }
+    if (!node->is_dir) {
+        return make_result(FAILED, ENOTDIR);
+    }
+    return std::make_unique<SyntheticDir>(*this, *node);
+}
+
+Result<Stat> SyntheticFilesystem::lstat(std::string_view path)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto node = find(path);
+    if (!node) {
+        return copy_error(node);
+    }
+    return attributes(*node);
+}
+
+Result<std::string> SyntheticFilesystem::readlink(std::string_view path)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+
+    auto node = find(path);
+    if (!node) {
+        return copy_error(node);
+    }
+    // there are no symlinks in the tree
+    return make_result(FAILED, EINVAL);
+}
+
+Result<void> SyntheticFilesystem::mkdir(std::string_view, mode_t)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+Result<void> SyntheticFilesystem::unlink(std::string_view)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+Result<void> SyntheticFilesystem::rmdir(std::string_view)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+Result<void> SyntheticFilesystem::rename(std::string_view, std::string_view)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+Result<void> SyntheticFilesystem::truncate(std::string_view, off_t)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+Result<void> SyntheticFilesystem::chmod(std::string_view, mode_t)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+Result<void> SyntheticFilesystem::utimens(std::string_view,
+                                          const struct timespec &,
+                                          const struct timespec &)
+{
+    if (!connected()) {
+        return make_result(FAILED, ENOTCONN);
+    }
+    return make_result(FAILED, EROFS);
+}
+
+}
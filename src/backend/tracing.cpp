@@ -0,0 +1,205 @@
+/**********************************************************************
+File name: tracing.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/backend/tracing.hpp"
+
+#include "dragonstash/trace.hpp"
+
+namespace Dragonstash {
+namespace Backend {
+
+static constexpr const char *TRACE_CATEGORY = "backend";
+
+namespace {
+
+class TracingFile: public File {
+public:
+    explicit TracingFile(std::unique_ptr<File> inner):
+        m_inner(std::move(inner))
+    {
+
+    }
+
+private:
+    std::unique_ptr<File> m_inner;
+
+public:
+    Result<Stat> fstat() override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "fstat");
+        return m_inner->fstat();
+    }
+
+    Result<ssize_t> pread(void *buf, size_t count, off_t offset) override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "pread");
+        return m_inner->pread(buf, count, offset);
+    }
+
+    Result<ssize_t> pwrite(const void *buf, size_t count, off_t offset) override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "pwrite");
+        return m_inner->pwrite(buf, count, offset);
+    }
+
+    Result<void> fsync() override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "fsync");
+        return m_inner->fsync();
+    }
+
+    Result<void> close() override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "close");
+        return m_inner->close();
+    }
+};
+
+class TracingDir: public Dir {
+public:
+    explicit TracingDir(std::unique_ptr<Dir> inner):
+        m_inner(std::move(inner))
+    {
+
+    }
+
+private:
+    std::unique_ptr<Dir> m_inner;
+
+public:
+    Result<DirEntry> readdir() override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "readdir");
+        return m_inner->readdir();
+    }
+
+    Result<void> fsyncdir() override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "fsyncdir");
+        return m_inner->fsyncdir();
+    }
+
+    Result<void> closedir() override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "closedir");
+        return m_inner->closedir();
+    }
+
+    Result<void> read_batch(std::vector<DirEntryRef> &batch) override
+    {
+        const TraceSpan span(TRACE_CATEGORY, "read_batch");
+        return m_inner->read_batch(batch);
+    }
+};
+
+}
+
+TracingFilesystem::TracingFilesystem(std::unique_ptr<Filesystem> inner):
+    m_inner(std::move(inner))
+{
+
+}
+
+Result<std::unique_ptr<File>> TracingFilesystem::open(std::string_view path,
+                                                      int accesstype,
+                                                      mode_t mode)
+{
+    const TraceSpan span(TRACE_CATEGORY, "open");
+    auto result = m_inner->open(path, accesstype, mode);
+    if (!result) {
+        return copy_error(result);
+    }
+    return make_result(std::unique_ptr<File>(
+                           std::make_unique<TracingFile>(std::move(*result))));
+}
+
+Result<std::unique_ptr<Dir>> TracingFilesystem::opendir(std::string_view path)
+{
+    const TraceSpan span(TRACE_CATEGORY, "opendir");
+    auto result = m_inner->opendir(path);
+    if (!result) {
+        return copy_error(result);
+    }
+    return make_result(std::unique_ptr<Dir>(
+                           std::make_unique<TracingDir>(std::move(*result))));
+}
+
+Result<Stat> TracingFilesystem::lstat(std::string_view path)
+{
+    const TraceSpan span(TRACE_CATEGORY, "lstat");
+    return m_inner->lstat(path);
+}
+
+Result<std::string> TracingFilesystem::readlink(std::string_view path)
+{
+    const TraceSpan span(TRACE_CATEGORY, "readlink");
+    return m_inner->readlink(path);
+}
+
+Result<void> TracingFilesystem::mkdir(std::string_view path, mode_t mode)
+{
+    const TraceSpan span(TRACE_CATEGORY, "mkdir");
+    return m_inner->mkdir(path, mode);
+}
+
+Result<void> TracingFilesystem::unlink(std::string_view path)
+{
+    const TraceSpan span(TRACE_CATEGORY, "unlink");
+    return m_inner->unlink(path);
+}
+
+Result<void> TracingFilesystem::rmdir(std::string_view path)
+{
+    const TraceSpan span(TRACE_CATEGORY, "rmdir");
+    return m_inner->rmdir(path);
+}
+
+Result<void> TracingFilesystem::rename(std::string_view from, std::string_view to)
+{
+    const TraceSpan span(TRACE_CATEGORY, "rename");
+    return m_inner->rename(from, to);
+}
+
+Result<void> TracingFilesystem::truncate(std::string_view path, off_t size)
+{
+    const TraceSpan span(TRACE_CATEGORY, "truncate");
+    return m_inner->truncate(path, size);
+}
+
+Result<void> TracingFilesystem::chmod(std::string_view path, mode_t mode)
+{
+    const TraceSpan span(TRACE_CATEGORY, "chmod");
+    return m_inner->chmod(path, mode);
+}
+
+Result<void> TracingFilesystem::utimens(std::string_view path,
+                                        const struct timespec &atime,
+                                        const struct timespec &mtime)
+{
+    const TraceSpan span(TRACE_CATEGORY, "utimens");
+    return m_inner->utimens(path, atime, mtime);
+}
+
+}
+}
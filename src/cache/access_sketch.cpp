@@ -0,0 +1,135 @@
+/**********************************************************************
+File name: access_sketch.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/access_sketch.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Dragonstash {
+
+/**
+ * Snapshot layout:
+ *
+ * - uint16_t epoch
+ * - uint16_t reserved
+ * - uint32_t number of buckets
+ * - uint16_t stamp for each bucket
+ */
+static constexpr std::size_t SNAPSHOT_HEADER_SIZE = 8;
+
+static std::size_t round_up_pow2(std::size_t n)
+{
+    std::size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+AccessSketch::AccessSketch(std::size_t nbuckets):
+    m_nbuckets(round_up_pow2(std::max<std::size_t>(nbuckets, 2))),
+    m_buckets(std::make_unique<std::atomic<stamp_t>[]>(m_nbuckets)),
+    m_epoch(1)
+{
+    for (std::size_t i = 0; i < m_nbuckets; ++i) {
+        m_buckets[i].store(NEVER, std::memory_order_relaxed);
+    }
+}
+
+AccessSketch::stamp_t AccessSketch::age(ino_t ino) const noexcept
+{
+    const stamp_t a = bucket(ino, 0).load(std::memory_order_relaxed);
+    const stamp_t b = bucket(ino, 1).load(std::memory_order_relaxed);
+    if (a == NEVER || b == NEVER) {
+        return MAX_AGE;
+    }
+
+    const stamp_t epoch = m_epoch.load(std::memory_order_relaxed);
+    // stamps live in [1, MAX_AGE], skipping NEVER on wrap-around
+    auto distance = [epoch](stamp_t stamp) -> stamp_t {
+        if (stamp <= epoch) {
+            return epoch - stamp;
+        }
+        return static_cast<stamp_t>(epoch + (MAX_AGE - stamp));
+    };
+    return std::max(distance(a), distance(b));
+}
+
+void AccessSketch::advance() noexcept
+{
+    stamp_t next = m_epoch.load(std::memory_order_relaxed) + 1;
+    if (next == NEVER) {
+        next = 1;
+    }
+    m_epoch.store(next, std::memory_order_relaxed);
+}
+
+std::basic_string<std::byte> AccessSketch::serialize() const
+{
+    std::basic_string<std::byte> buf;
+    buf.resize(SNAPSHOT_HEADER_SIZE + m_nbuckets * sizeof(stamp_t));
+
+    const stamp_t epoch = this->epoch();
+    const std::uint16_t reserved = 0;
+    const auto nbuckets = static_cast<std::uint32_t>(m_nbuckets);
+    memcpy(&buf[0], &epoch, sizeof(epoch));
+    memcpy(&buf[2], &reserved, sizeof(reserved));
+    memcpy(&buf[4], &nbuckets, sizeof(nbuckets));
+
+    std::byte *dest = &buf[SNAPSHOT_HEADER_SIZE];
+    for (std::size_t i = 0; i < m_nbuckets; ++i) {
+        const stamp_t stamp = m_buckets[i].load(std::memory_order_relaxed);
+        memcpy(dest, &stamp, sizeof(stamp));
+        dest += sizeof(stamp);
+    }
+    return buf;
+}
+
+bool AccessSketch::load(std::basic_string_view<std::byte> buf)
+{
+    if (buf.size() != SNAPSHOT_HEADER_SIZE + m_nbuckets * sizeof(stamp_t)) {
+        return false;
+    }
+
+    stamp_t epoch;
+    std::uint32_t nbuckets;
+    memcpy(&epoch, &buf[0], sizeof(epoch));
+    memcpy(&nbuckets, &buf[4], sizeof(nbuckets));
+    if (nbuckets != m_nbuckets || epoch == NEVER) {
+        return false;
+    }
+
+    const std::byte *src = &buf[SNAPSHOT_HEADER_SIZE];
+    for (std::size_t i = 0; i < m_nbuckets; ++i) {
+        stamp_t stamp;
+        memcpy(&stamp, src, sizeof(stamp));
+        src += sizeof(stamp);
+        m_buckets[i].store(stamp, std::memory_order_relaxed);
+    }
+    m_epoch.store(epoch, std::memory_order_relaxed);
+    return true;
+}
+
+}
@@ -0,0 +1,151 @@
+/**********************************************************************
+File name: access_trace.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/access_trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include "dragonstash/cache/common.hpp"
+
+namespace Dragonstash {
+
+namespace {
+
+static constexpr std::uint8_t ACCESS_TRACE_VERSION = 1;
+
+struct AccessTraceV1 {
+    std::uint8_t version;
+    std::uint8_t _reserved0;
+    std::uint16_t nranges;
+    std::uint32_t _reserved1;
+    std::int64_t recorded_at;
+};
+
+struct AccessTraceRangeV1 {
+    std::uint64_t start;
+    std::uint64_t count;
+};
+
+static_assert(std::is_pod_v<AccessTraceV1>);
+static_assert(std::is_pod_v<AccessTraceRangeV1>);
+
+}
+
+bool AccessTrace::record(off_t off, std::size_t n)
+{
+    if (off < 0 || n == 0) {
+        return false;
+    }
+    const std::uint64_t start = off / CACHE_PAGE_SIZE;
+    const std::uint64_t end = (off + n + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+
+    for (auto &range: m_ranges) {
+        if (start > range.end() || end < range.start) {
+            continue;
+        }
+        // extend the range in place, so that it keeps its position in the
+        // order of first touches
+        const std::uint64_t new_start = std::min(range.start, start);
+        const std::uint64_t new_end = std::max(range.end(), end);
+        if (new_start == range.start && new_end == range.end()) {
+            return false;
+        }
+        range.start = new_start;
+        range.count = new_end - new_start;
+        return true;
+    }
+
+    if (m_ranges.size() >= ACCESS_TRACE_MAX_RANGES) {
+        return false;
+    }
+    m_ranges.push_back(Range{start, end - start});
+    return true;
+}
+
+void AccessTrace::clear()
+{
+    m_ranges.clear();
+    m_recorded_at = 0;
+}
+
+std::uint64_t AccessTrace::blocks() const
+{
+    std::uint64_t result = 0;
+    for (const auto &range: m_ranges) {
+        result += range.count;
+    }
+    return result;
+}
+
+std::string AccessTrace::serialize() const
+{
+    AccessTraceV1 header{};
+    header.version = ACCESS_TRACE_VERSION;
+    header.nranges = m_ranges.size();
+    header.recorded_at = m_recorded_at;
+
+    std::string result;
+    result.reserve(sizeof(header) + m_ranges.size() * sizeof(AccessTraceRangeV1));
+    result.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto &range: m_ranges) {
+        const AccessTraceRangeV1 entry{range.start, range.count};
+        result.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    }
+    return result;
+}
+
+Result<AccessTrace> AccessTrace::parse(std::string_view buf)
+{
+    if (buf.size() < sizeof(AccessTraceV1)) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    AccessTraceV1 header;
+    memcpy(&header, buf.data(), sizeof(header));
+    if (header.version != ACCESS_TRACE_VERSION ||
+            header.nranges > ACCESS_TRACE_MAX_RANGES) {
+        return make_result(FAILED, EINVAL);
+    }
+    buf.remove_prefix(sizeof(header));
+    if (buf.size() != header.nranges * sizeof(AccessTraceRangeV1)) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    AccessTrace result;
+    result.m_recorded_at = header.recorded_at;
+    result.m_ranges.reserve(header.nranges);
+    for (std::size_t i = 0; i < header.nranges; ++i) {
+        AccessTraceRangeV1 entry;
+        memcpy(&entry, buf.data() + i * sizeof(entry), sizeof(entry));
+        if (entry.count == 0 || entry.start + entry.count < entry.start) {
+            return make_result(FAILED, EINVAL);
+        }
+        result.m_ranges.push_back(Range{entry.start, entry.count});
+    }
+    return result;
+}
+
+}
@@ -626,6 +626,50 @@ std::size_t Blocklist::truncate_access(off_t start, std::size_t size) const
     return std::min(size, max_length);
 }
 
+void Blocklist::sync() const
+{
+    if (m_mapping) {
+        int rc = msync(m_mapping, m_mapped_size, MS_SYNC);
+        if (rc != 0) {
+            throw std::runtime_error(std::string("failed to sync blocklist: ") + std::strerror(errno));
+        }
+    }
+    if (::fsync(int(m_fd)) != 0) {
+        throw std::runtime_error(std::string("failed to sync blocklist: ") + std::strerror(errno));
+    }
+}
+
+std::vector<Blocklist::Range> Blocklist::ranges(std::uint64_t start,
+                                                std::uint64_t count) const
+{
+    std::vector<Range> result;
+    const std::uint64_t end =
+            count > std::numeric_limits<std::uint64_t>::max() - start
+            ? std::numeric_limits<std::uint64_t>::max()
+            : start + count;
+    for (auto iter = search_entry(start);
+         iter != m_mapping->end() && iter->start < end;
+         ++iter)
+    {
+        const std::uint64_t run_start = std::max(iter->start, start);
+        const std::uint64_t run_end = std::min(iter->end(), end);
+        const auto state = State(iter->state);
+        if (!result.empty() &&
+                result.back().end() == run_start &&
+                result.back().state == state)
+        {
+            result.back().count += run_end - run_start;
+            continue;
+        }
+        result.push_back(Range{
+                             .start = run_start,
+                             .count = run_end - run_start,
+                             .state = state,
+                         });
+    }
+    return result;
+}
+
 void Blocklist::fsck() const
 {
     ensure_mapped();
@@ -24,30 +24,65 @@ authors named in the AUTHORS file.
 **********************************************************************/
 #include "dragonstash/cache/cache.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <ctime>
+#include <optional>
+#include <thread>
 
 #include "dragonstash/cache/direntry.hpp"
+#include "dragonstash/trace.hpp"
 
 /**
  * LMDB database layout
  *
- * Database `inodes` (MDB_INTEGERKEY):
+ * Database `inodes`:
  *
- * - key: uint64_t inode
- * - value: uint8_t version + struct InodeV1 + type-specific inode data
+ * - key: uint64_t inode (native-endian, so sorted bytewise and not by
+ *   number)
+ * - value: uint8_t version + encoded inode (see InodeV2) + type-specific
+ *   inode data; version 1 records (struct InodeV1) are still read and are
+ *   rewritten in the current format on the next update
  *
  * Database `treei`:
  *
  * - key: uint64_t parent_inode + uint64_t child_inode
  * - value: uint32_t mode cache + name
  *
- * Database `treen`:
+ * Database `treen` (only with DirectoryIndex::NAME):
  *
  * - key: uint64_t parent_inode + name
  * - value: uint64_t child_inode + uint32_t mode cache
+ *
+ * Database `treeh` (MDB_DUPSORT, only with DirectoryIndex::HASHED):
+ *
+ * - key: uint64_t parent_inode + uint64_t name hash (see name_hash())
+ * - value: uint64_t child_inode
+ *
+ * Database `journal` (MDB_INTEGERKEY):
+ *
+ * - key: uint64_t sequence number
+ * - value: serialised JournalEntry
+ *
+ * Database `chunks` (MDB_INTEGERKEY, only filled with deduplication):
+ *
+ * - key: uint64_t content hash of a block (see chunk_hash())
+ * - value: uint64_t inode + uint64_t block number of a copy of the block;
+ *   entries are not updated when the block changes and are verified on use
+ *
+ * Database `traces` (MDB_INTEGERKEY):
+ *
+ * - key: uint64_t inode of a regular file
+ * - value: serialised AccessTrace of the last time the file was open
+ *
+ * The data of regular files is stored outside of LMDB, in the `data`
+ * directory next to the database (see RegularFileHandle).
  */
 
 
@@ -58,14 +93,38 @@ constexpr void safe_assert(T &&x) {
 
 namespace Dragonstash {
 
+static const char DB_FILE_NAME[] = "db";
+static const char DB_COMPACT_FILE_NAME[] = "db.compact";
+static const char DATA_DIR_NAME[] = "data";
+
 static const std::string_view DB_NAME_META = "meta";
 static const std::string_view DB_NAME_INODES = "inodes";
 static const std::string_view DB_NAME_TREE_INODE_KEY = "treei";
 static const std::string_view DB_NAME_TREE_NAME_KEY = "treen";
+static const std::string_view DB_NAME_TREE_HASH_KEY = "treeh";
 static const std::string_view DB_NAME_ORPHANS = "orphans";
 static const std::string_view DB_NAME_LINKS = "links";
+static const std::string_view DB_NAME_JOURNAL = "journal";
+static const std::string_view DB_NAME_CHUNKS = "chunks";
+static const std::string_view DB_NAME_TRACES = "traces";
 
 static const std::string_view META_KEY_NEXT_INO = "next_ino";
+static const std::string_view META_KEY_DIRECTORY_INDEX = "dir_index";
+static const std::string_view META_KEY_INODES = "n_inodes";
+static const std::string_view META_KEY_CACHED_BYTES = "cached_bytes";
+static const std::string_view META_KEY_PINNED_BYTES = "pinned_bytes";
+static const std::string_view META_KEY_ACCESS_SKETCH = "access_sketch";
+static const std::string_view META_KEY_CLEAN_SHUTDOWN = "clean_shutdown";
+
+/**
+ * Minimum interval between writes of the access sketch during eviction.
+ */
+static constexpr std::chrono::seconds ACCESS_SKETCH_PERSIST_INTERVAL(60);
+
+/**
+ * Maximum number of inodes looked at by a single eviction run.
+ */
+static constexpr std::size_t EVICTION_SCAN_LIMIT = 4096;
 
 template<typename T, typename _ = typename std::enable_if<std::is_arithmetic<T>::value && std::numeric_limits<T>::min() == 0>::type>
 T safe_dec(T &value, T by = 1)
@@ -88,6 +147,46 @@ static inline std::basic_string_view<std::byte> view(const MDBOutVal &val)
                 val.d_mdbval.mv_size);
 }
 
+static inline std::basic_string_view<std::byte> view(std::string_view val)
+{
+    return std::basic_string_view<std::byte>(
+                reinterpret_cast<const std::byte*>(val.data()), val.size());
+}
+
+
+/**
+ * Hash used for the keys of the `treeh` database.
+ *
+ * This is 64 bit FNV-1a. It is part of the on-disk format and must not be
+ * changed.
+ */
+static std::uint64_t name_hash(std::string_view name)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char ch: name) {
+        hash ^= static_cast<std::uint8_t>(ch);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+static inline std::string_view key_view(const std::array<std::uint64_t, 2> &key)
+{
+    return std::string_view(reinterpret_cast<const char*>(key.data()),
+                            key.size() * sizeof(std::uint64_t));
+}
+
+
+static inline std::string name_key(ino_t parent, std::string_view name)
+{
+    std::string key;
+    key.resize(sizeof(ino_t) + name.length());
+    memcpy(&key[0], &parent, sizeof(ino_t));
+    memcpy(&key[sizeof(ino_t)], name.data(), name.length());
+    return key;
+}
+
 
 static inline Result<Inode> inode_from_lmdb(const MDBOutVal &val)
 {
@@ -229,26 +328,90 @@ Result<void> CachedDir::Seek(off_t offset)
 
 /* Dragonstash::CacheDatabase */
 
-CacheDatabase::CacheDatabase(std::shared_ptr<MDBEnv> env):
+CacheDatabase::CacheDatabase(std::shared_ptr<MDBEnv> env,
+                             std::size_t access_sketch_buckets):
+    m_writer_mutex("cache.writer"),
     m_env(std::move(env)),
-    m_meta_db(m_env->openDB(DB_NAME_META, MDB_CREATE)),
-    m_inodes_db(m_env->openDB(DB_NAME_INODES, MDB_CREATE)),
-    m_tree_inode_key_db(m_env->openDB(DB_NAME_TREE_INODE_KEY, MDB_CREATE)),
-    m_tree_name_key_db(m_env->openDB(DB_NAME_TREE_NAME_KEY, MDB_CREATE)),
-    m_orphan_db(m_env->openDB(DB_NAME_ORPHANS, MDB_CREATE)),
-    m_links_db(m_env->openDB(DB_NAME_LINKS, MDB_CREATE)),
-    m_max_name_length(0)
+    m_directory_index(DirectoryIndex::NAME),
+    m_max_name_length(0),
+    m_max_inodes(0),
+    m_max_bytes(0),
+    m_max_chunk_shift(MIN_CHUNK_SHIFT),
+    m_eviction_hand(INVALID_INO),
+    m_access_sketch(access_sketch_buckets),
+    m_access_sketch_persisted(std::chrono::steady_clock::now()),
+    m_in_memory_lock_mutex("cache.inode_refs")
+{
+    open_dbs();
+    validate_max_key_size();
+}
+
+void CacheDatabase::set_max_chunk_size(std::size_t max_chunk_size)
+{
+    m_max_chunk_shift = MIN_CHUNK_SHIFT;
+    while (m_max_chunk_shift < MAX_CHUNK_SHIFT &&
+           (std::size_t(1) << (m_max_chunk_shift + 1)) <= max_chunk_size) {
+        ++m_max_chunk_shift;
+    }
+}
+
+std::uint8_t CacheDatabase::chunk_shift_for(std::uint64_t size) const
+{
+    const std::uint64_t target = size / CHUNKS_PER_FILE;
+    std::uint8_t result = MIN_CHUNK_SHIFT;
+    while (result < m_max_chunk_shift && (std::uint64_t(1) << result) < target) {
+        ++result;
+    }
+    return result;
+}
+
+void CacheDatabase::open_dbs()
 {
+    m_meta_db = m_env->openDB(DB_NAME_META, MDB_CREATE);
+    m_inodes_db = m_env->openDB(DB_NAME_INODES, MDB_CREATE);
+    m_tree_inode_key_db = m_env->openDB(DB_NAME_TREE_INODE_KEY, MDB_CREATE);
+    m_tree_name_key_db = m_env->openDB(DB_NAME_TREE_NAME_KEY, MDB_CREATE);
+    m_tree_hash_key_db = m_env->openDB(DB_NAME_TREE_HASH_KEY, MDB_CREATE | MDB_DUPSORT);
+    m_orphan_db = m_env->openDB(DB_NAME_ORPHANS, MDB_CREATE);
+    m_links_db = m_env->openDB(DB_NAME_LINKS, MDB_CREATE);
+    m_journal_db = m_env->openDB(DB_NAME_JOURNAL, MDB_CREATE | MDB_INTEGERKEY);
+    m_chunks_db = m_env->openDB(DB_NAME_CHUNKS, MDB_CREATE | MDB_INTEGERKEY);
+    m_traces_db = m_env->openDB(DB_NAME_TRACES, MDB_CREATE | MDB_INTEGERKEY);
+}
+
+void CacheDatabase::reopen(std::shared_ptr<MDBEnv> env)
+{
+    m_env = std::move(env);
+    open_dbs();
     validate_max_key_size();
 }
 
+void CacheDatabase::close()
+{
+    m_env = nullptr;
+}
+
 void CacheDatabase::validate_max_key_size()
 {
     const size_t max_key_size = mdb_env_get_maxkeysize(*m_env);
     if (max_key_size < sizeof(ino_t) * 2) {
         throw std::runtime_error("cannot use this version of LMDB. maxkeysize too small.");
     }
-    m_max_name_length = max_key_size - sizeof(ino_t);
+    switch (m_directory_index) {
+    case DirectoryIndex::NAME:
+        m_max_name_length = max_key_size - sizeof(ino_t);
+        break;
+    case DirectoryIndex::HASHED:
+        // names are only stored in values
+        m_max_name_length = std::numeric_limits<size_t>::max();
+        break;
+    }
+}
+
+void CacheDatabase::set_directory_index(DirectoryIndex index)
+{
+    m_directory_index = index;
+    validate_max_key_size();
 }
 
 Result<void> CacheDatabase::check_name(std::string_view name, bool for_writing)
@@ -293,18 +456,90 @@ auto with_rw_txn(CacheTransactionRW &&txn, T &&f) -> decltype(f(txn))
     return result;
 }
 
-const bool Cache::deadlock_detection = debug_mutex::is_safe;
+const bool Cache::deadlock_detection = profiled_mutex::is_safe;
+
+static std::shared_ptr<MDBEnv> open_env(const std::filesystem::path &db_file,
+                                        bool read_only = false)
+{
+    return getMDBEnv(db_file.c_str(), MDB_NOSUBDIR | (read_only ? MDB_RDONLY : 0),
+                     0600);
+}
+
+void Cache::load_meta(MDBROTransactionImpl &txn, bool created)
+{
+    MDBOutVal value{};
+    // caches created before the hashed index existed lack the key
+    if (txn.get(m_db.meta_db(), META_KEY_DIRECTORY_INDEX, value) == 0) {
+        switch (value.get<std::uint8_t>()) {
+        case static_cast<std::uint8_t>(DirectoryIndex::NAME):
+            m_db.set_directory_index(DirectoryIndex::NAME);
+            break;
+        case static_cast<std::uint8_t>(DirectoryIndex::HASHED):
+            m_db.set_directory_index(DirectoryIndex::HASHED);
+            break;
+        default:
+            throw std::runtime_error("database corrupt: unknown directory index");
+        }
+    }
+    if (txn.get(m_db.meta_db(), META_KEY_ACCESS_SKETCH, value) == 0) {
+        // a mismatch in size leaves the sketch empty, which is fine
+        (void)m_db.access_sketch().load(view(value));
+    }
+    // the flag is cleared while the cache is in use; if it is not set now,
+    // the previous user crashed and the cached files need to be checked
+    // (see check_file()). Caches created before the flag existed are
+    // checked once.
+    if (!created &&
+            (txn.get(m_db.meta_db(), META_KEY_CLEAN_SHUTDOWN, value) != 0 ||
+             value.get<std::uint8_t>() == 0)) {
+        m_recovery_pending.store(true, std::memory_order_release);
+    }
+}
 
-Cache::Cache(const std::filesystem::path &db_path):
-    m_db(getMDBEnv((db_path / "db").c_str(), MDB_NOSUBDIR, 0600))
+Cache::Cache(const std::filesystem::path &db_path,
+             const CacheOptions &options):
+    m_path(db_path),
+    m_db(open_env(db_path / DB_FILE_NAME, options.read_only),
+         options.access_sketch_buckets),
+    m_open_files_mutex("cache.open_files"),
+    m_recovery_pending(false),
+    m_deduplicate(options.deduplicate && options.compression == Compression::NONE),
+    m_dedup_hashed_bytes(0),
+    m_dedup_shared_bytes(0),
+    m_dedup_stale_entries(0),
+    m_compression(options.compression),
+    m_read_only(options.read_only)
 {
+    if (!compression_available(m_compression)) {
+        throw std::runtime_error("compression algorithm not supported by this build");
+    }
+    m_db.set_limits(options.max_inodes, options.max_bytes);
+    m_db.set_max_chunk_size(options.max_chunk_size);
+    m_db.set_data_path(m_path / DATA_DIR_NAME);
+
+    if (m_read_only) {
+        auto txn = m_db.env().getROTransaction();
+        MDBOutVal value{};
+        if (txn->get(m_db.meta_db(), META_KEY_NEXT_INO, value) == MDB_NOTFOUND) {
+            throw std::runtime_error("cannot create a cache in read-only mode");
+        }
+        load_meta(*txn, false);
+        return;
+    }
+
+    std::filesystem::create_directories(m_db.data_path());
+
     auto txn = m_db.env().getRWTransaction();
     MDBOutVal value{};
-    if (txn->get(m_db.meta_db(), META_KEY_NEXT_INO, value) == MDB_NOTFOUND) {
+    const bool created = txn->get(m_db.meta_db(), META_KEY_NEXT_INO, value) == MDB_NOTFOUND;
+    if (created) {
         // initialise next inode to root inode + 1
         const ino_t next_inode = ROOT_INO + 1;
         txn->put(m_db.meta_db(), META_KEY_NEXT_INO, next_inode);
 
+        const auto directory_index = static_cast<std::uint8_t>(options.directory_index);
+        txn->put(m_db.meta_db(), META_KEY_DIRECTORY_INDEX, directory_index);
+
         // initialise the remainder of the database
         // create root inode!
         struct timespec now{};
@@ -325,180 +560,1190 @@ Cache::Cache(const std::filesystem::path &db_path):
         auto buf = serialize_as<char>(root);
         txn->put(m_db.inodes_db(), root_ino, buf);
     }
+    // initialise the usage counters; caches created before the counters
+    // existed get the inode count from the database statistics.
+    if (txn->get(m_db.meta_db(), META_KEY_INODES, value) == MDB_NOTFOUND) {
+        MDB_stat stat{};
+        if (int rc = mdb_stat(*txn, m_db.inodes_db(), &stat); rc != 0) {
+            throw std::runtime_error("failed to read database statistics");
+        }
+        const std::uint64_t ninodes = stat.ms_entries;
+        const std::uint64_t zero = 0;
+        txn->put(m_db.meta_db(), META_KEY_INODES, ninodes);
+        txn->put(m_db.meta_db(), META_KEY_CACHED_BYTES, zero);
+        txn->put(m_db.meta_db(), META_KEY_PINNED_BYTES, zero);
+    }
+    load_meta(*txn, created);
+    const std::uint8_t in_use = 0;
+    txn->put(m_db.meta_db(), META_KEY_CLEAN_SHUTDOWN, in_use);
     txn->commit();
 
-    with_rw_txn(begin_rw(), [](CacheTransactionRW &txn){
-        return txn.clean_orphans();
-    });
+    // orphans left over from the previous user are reaped in the background
+    // and by the next writes, so that the cache is usable right away.
 }
 
-CacheTransactionRO Cache::begin_ro()
+Cache::~Cache()
 {
-    return CacheTransactionRO(m_db, m_db.env().getROTransaction());
+    if (m_read_only) {
+        return;
+    }
+    try {
+        (void)persist_access_sketch();
+    } catch (const std::exception &) {
+        // nothing sensible to do during destruction; the sketch is only
+        // a hint.
+    }
+    if (recovery_pending()) {
+        // the next user has to continue checking
+        return;
+    }
+    try {
+        auto txn = begin_rw();
+        const std::uint8_t clean = 1;
+        txn.rw_transaction()->put(m_db.meta_db(), META_KEY_CLEAN_SHUTDOWN, clean);
+        (void)txn.commit();
+    } catch (const std::exception &) {
+        // the next user checks the files again, which is merely slow
+    }
 }
 
-CacheTransactionRW Cache::begin_rw()
+Result<void> Cache::persist_access_sketch()
 {
-    return CacheTransactionRW(m_db, m_db.env().getRWTransaction());
+    return with_rw_txn(begin_rw(), [](CacheTransactionRW &txn){
+        txn.persist_access_sketch();
+        return make_result();
+    });
 }
 
-Result<std::string> Cache::name(ino_t ino)
+CacheTransactionRO Cache::begin_ro()
 {
-    return begin_ro().name(ino);
+    const TraceSpan trace_span("cache", "begin_ro");
+    // the guard must be acquired before the transaction is started
+    auto guard = m_db.ro_guard();
+    return CacheTransactionRO(m_db, std::move(guard),
+                              m_db.env().getROTransaction());
 }
 
-Result<ino_t> Cache::parent(ino_t ino)
+CacheTransactionRW Cache::begin_rw()
 {
-    return begin_ro().parent(ino);
+    const TraceSpan trace_span("cache", "begin_rw");
+    auto guard = m_db.rw_guard();
+    return CacheTransactionRW(m_db, std::move(guard),
+                              m_db.env().getRWTransaction());
 }
 
-Result<ino_t> Cache::lookup(ino_t parent, std::string_view name)
+Result<std::shared_ptr<RegularFileHandle>> Cache::open_file(ino_t ino)
 {
-    return begin_ro().lookup(parent, name);
-}
+    {
+        auto txn = begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        switch (attr_result->attr.mode & S_IFMT) {
+        case S_IFREG:
+            break;
+        case S_IFDIR:
+            return make_result(FAILED, EISDIR);
+        default:
+            return make_result(FAILED, EINVAL);
+        }
+    }
 
-Result<Stat> Cache::getattr(ino_t ino)
-{
-    return begin_ro().getattr(ino);
-}
+    if (recovery_pending()) {
+        auto check_result = check_file(ino);
+        if (!check_result) {
+            return copy_error(check_result);
+        }
+    }
 
-Result<ino_t> Cache::emplace(ino_t parent, std::string_view name, const InodeAttributes &attrs)
-{
-    return with_rw_txn(begin_rw(), [parent, name, &attrs](CacheTransactionRW &txn){
-        return txn.emplace(parent, name, attrs);
-    });
-}
+    std::lock_guard<profiled_mutex> lock(m_open_files_mutex);
+    auto iter = m_open_files.find(ino);
+    if (iter != m_open_files.end()) {
+        if (auto existing = iter->second.lock()) {
+            return existing;
+        }
+    }
 
-Result<void> Cache::lock(ino_t ino)
-{
-    return with_rw_txn(begin_rw(), [ino](CacheTransactionRW &txn){
-        return txn.lock(ino);
-    });
+    std::shared_ptr<RegularFileHandle> file;
+    try {
+        file = std::make_shared<RegularFileHandle>(m_db.data_path(), ino,
+                                                   &m_compression_counters);
+    } catch (const std::runtime_error &) {
+        return make_result(FAILED, EIO);
+    }
+    m_open_files[ino] = file;
+
+    // drop stale entries while we are at it
+    for (auto stale = m_open_files.begin(); stale != m_open_files.end(); ) {
+        if (stale->second.expired()) {
+            stale = m_open_files.erase(stale);
+        } else {
+            ++stale;
+        }
+    }
+
+    return file;
 }
 
-Result<void> Cache::release(ino_t ino)
+Result<bool> Cache::check_file(ino_t ino)
 {
-    return with_rw_txn(begin_rw(), [ino](CacheTransactionRW &txn){
-        return txn.release(ino);
-    });
+    if (!recovery_pending()) {
+        return false;
+    }
+
+    {
+        std::unique_lock<profiled_mutex> lock(m_open_files_mutex);
+        // callers open the file right after this returns, so they have to
+        // wait for a check of the same file which is in progress
+        m_check_done.wait(lock, [this, ino]() {
+            return m_checking_files.count(ino) == 0;
+        });
+        if (!m_checked_files.emplace(ino).second) {
+            return false;
+        }
+        auto iter = m_open_files.find(ino);
+        if (iter != m_open_files.end() && !iter->second.expired()) {
+            // opened before recovery began (i.e. by a compaction), nothing
+            // to check
+            return false;
+        }
+        // open_file() and residency() of other files go ahead meanwhile
+        m_checking_files.insert(ino);
+    }
+    const auto discarded = RegularFileHandle::check(m_db.data_path(), ino);
+    {
+        std::lock_guard<profiled_mutex> lock(m_open_files_mutex);
+        m_checking_files.erase(ino);
+    }
+    m_check_done.notify_all();
+    if (!discarded) {
+        return false;
+    }
+
+    auto txn = begin_rw();
+    txn.account_file_bytes(ino, -static_cast<std::int64_t>(*discarded));
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        return copy_error(commit_result);
+    }
+    return true;
 }
 
-Result<std::string> Cache::readlink(ino_t ino)
+void Cache::finish_recovery()
 {
-    return begin_ro().readlink(ino);
+    std::lock_guard<profiled_mutex> lock(m_open_files_mutex);
+    m_recovery_pending.store(false, std::memory_order_release);
+    m_checked_files.clear();
 }
 
-Result<void> Cache::writelink(ino_t ino, std::string_view dest)
+std::vector<ino_t> Cache::cached_files() const
 {
-    return with_rw_txn(begin_rw(), [ino, &dest](CacheTransactionRW &txn){
-        return txn.writelink(ino, dest);
-    });
+    std::vector<ino_t> result;
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::directory_iterator(data_path(), ec)) {
+        // only the data files are named after the bare inode number
+        const std::string name = entry.path().filename().string();
+        ino_t ino = INVALID_INO;
+        const auto [end, err] = std::from_chars(name.data(), name.data() + name.size(), ino);
+        if (err == std::errc() && end == name.data() + name.size()) {
+            result.push_back(ino);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
 }
 
-Result<std::string> Cache::path(ino_t ino)
+Result<std::size_t> Cache::reap_orphans(std::size_t limit)
 {
-    return begin_ro().path(ino);
+    auto txn = begin_rw();
+    auto result = txn.reap_orphans(limit);
+    if (!result) {
+        txn.abort();
+        return result;
+    }
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        return copy_error(commit_result);
+    }
+    return result;
 }
 
-/* Dragonstash::CacheTransactionRO */
-
-CacheTransactionRO::CacheTransactionRO(CacheDatabase &db, MDBROTransaction &&txn,
-                                       CacheTransactionRW *parent):
-    m_db(&db),
-    m_txn(std::move(txn)),
-    m_parent(parent)
+Result<CompactionResult> Cache::compact()
 {
+    const std::filesystem::path db_file = m_path / DB_FILE_NAME;
+    const std::filesystem::path tmp_file = m_path / DB_COMPACT_FILE_NAME;
 
-}
+    // keep writers out until the compacted copy is in place; anything they
+    // write after the copy started would be lost otherwise.
+    auto writer_guard = m_db.writer_guard();
 
-InodeReferences &CacheTransactionRO::inode_in_memory_locks() {
-    if (m_inode_counter_lock) {
-        return db().in_memory_locks();
+    std::error_code ec;
+    // left-over from an interrupted compaction
+    std::filesystem::remove(tmp_file, ec);
+
+    const std::uint64_t size_before = std::filesystem::file_size(db_file, ec);
+    if (ec) {
+        return make_result(FAILED, ec.value());
     }
 
-    CacheTransactionRW *parent = m_parent;
-    while (parent) {
-        if (parent->m_inode_counter_lock) {
-            return parent->db().in_memory_locks();
+    {
+        // readers may continue while the copy is made; the copy runs in its
+        // own read-only transaction.
+        auto env_guard = m_db.ro_guard();
+        int rc = mdb_env_copy2(m_db.env(), tmp_file.c_str(), MDB_CP_COMPACT);
+        if (rc != 0) {
+            std::filesystem::remove(tmp_file, ec);
+            // LMDB uses negative numbers for its own error codes
+            return make_result(FAILED, rc > 0 ? rc : EIO);
         }
-        parent = parent->m_parent;
     }
 
-    // we don’t hold the lock and no parent holds the lock -> we need to lock
-    // here.
-    assert(!m_inode_counter_lock);
-    m_inode_counter_lock = db().in_memory_lock_guard();
-    return db().in_memory_locks();
-}
+    const std::uint64_t size_after = std::filesystem::file_size(tmp_file, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_file, ec);
+        return make_result(FAILED, ec.value());
+    }
 
-Result<std::string> CacheTransactionRO::name(ino_t parent, ino_t ino)
-{
-    if (ino == ROOT_INO || parent == INVALID_INO) {
-        return make_result(std::string_view(""));
+    {
+        // wait for all readers to finish; they still use the old environment
+        auto env_guard = m_db.exclusive_env_guard();
+        if (::rename(tmp_file.c_str(), db_file.c_str()) != 0) {
+            const int err = errno;
+            std::filesystem::remove(tmp_file, ec);
+            return make_result(FAILED, err);
+        }
+        // the old environment must be closed before the new one is opened,
+        // since both share the lock file.
+        m_db.close();
+        m_db.reopen(open_env(db_file));
     }
 
-    std::string key;
-    key.resize(sizeof(ino_t)*2);
-    memcpy(&key[0], &parent, sizeof(ino_t));
-    memcpy(&key[sizeof(ino_t)], &ino, sizeof(ino_t));
+    return CompactionResult{size_before, size_after};
+}
 
-    auto cursor = ro_transaction()->getROCursor(db().tree_inode_key_db());
-    MDBOutVal key_out{};
-    MDBOutVal value{};
-    if (int rc = cursor.find(key, key_out, value) == MDB_NOTFOUND) {
-        // should this be possible? on deletion, we should normally unset the
-        // parent...
-        (void)rc;
-        return make_result(FAILED, ENOENT);
+/**
+ * Problems found by Cache::fsck(), together with the records needed to
+ * repair them. Directory entries and index records are kept as raw key and
+ * value.
+ */
+struct FsckFindings {
+    using Record = std::pair<std::string, std::string>;
+
+    std::uint64_t inodes = 0;
+    std::uint64_t entries = 0;
+    std::uint64_t files = 0;
+    std::uint64_t cached_bytes = 0;
+    std::uint64_t corrupt_bytes = 0;
+
+    std::vector<ino_t> corrupt_inodes;
+    std::vector<ino_t> detached_inodes;
+    std::vector<ino_t> lost_orphans;
+    std::vector<ino_t> stale_orphans;
+    std::vector<Record> dangling_entries;
+    std::vector<Record> missing_index_entries;
+    std::vector<Record> stale_index_entries;
+    std::vector<ino_t> missing_links;
+    std::vector<ino_t> stale_links;
+    std::vector<ino_t> stale_traces;
+    std::vector<ino_t> corrupt_files;
+    std::vector<ino_t> stray_files;
+
+    template <typename T>
+    static void append(std::vector<T> &dest, std::vector<T> &&src)
+    {
+        dest.insert(dest.end(),
+                    std::make_move_iterator(src.begin()),
+                    std::make_move_iterator(src.end()));
     }
 
-    auto parse_result = DirEntry::parse(view(value));
-    if (!parse_result) {
-        return copy_error(parse_result);
-    }
-    return make_result(std::get<1>(*parse_result));
-}
+    void merge(FsckFindings &&other)
+    {
+        inodes += other.inodes;
+        entries += other.entries;
+        files += other.files;
+        cached_bytes += other.cached_bytes;
+        corrupt_bytes += other.corrupt_bytes;
+        append(corrupt_inodes, std::move(other.corrupt_inodes));
+        append(detached_inodes, std::move(other.detached_inodes));
+        append(lost_orphans, std::move(other.lost_orphans));
+        append(stale_orphans, std::move(other.stale_orphans));
+        append(dangling_entries, std::move(other.dangling_entries));
+        append(missing_index_entries, std::move(other.missing_index_entries));
+        append(stale_index_entries, std::move(other.stale_index_entries));
+        append(missing_links, std::move(other.missing_links));
+        append(stale_links, std::move(other.stale_links));
+        append(stale_traces, std::move(other.stale_traces));
+        append(corrupt_files, std::move(other.corrupt_files));
+        append(stray_files, std::move(other.stray_files));
+    }
+};
 
-Result<std::string> CacheTransactionRO::name(ino_t ino)
+/**
+ * Visit the records in one of @a nparts partitions of a database.
+ *
+ * Integer-keyed databases are split into equal ranges of inode numbers below
+ * @a end_ino (the last range is open-ended). All other databases have keys
+ * starting with a native-endian inode number and are sorted bytewise, so
+ * they are split by the first byte of the key; this spreads the inodes
+ * evenly on little-endian machines and covers all keys everywhere.
+ */
+template <typename F>
+static void scan_partition(MDBROTransactionImpl &txn, const MDBDbi &dbi,
+                           bool integer_key, ino_t end_ino,
+                           unsigned part, unsigned nparts, F &&f)
 {
-    if (ino == ROOT_INO) {
-        return make_result(std::string_view(""));
+    auto cursor = txn.getROCursor(dbi);
+    MDBOutVal key{};
+    MDBOutVal value{};
+    if (integer_key) {
+        const std::uint64_t span = end_ino / nparts + 1;
+        const std::uint64_t lower = span * part;
+        const bool last = part + 1 == nparts;
+        for (int rc = cursor.lower_bound(lower, key, value);
+             rc == 0 && (last || key.get<std::uint64_t>() < lower + span);
+             rc = cursor.nextprev(key, value, MDB_NEXT))
+        {
+            f(key, value);
+        }
+        return;
     }
 
-    auto parent_result = parent(ino);
-    if (!parent_result) {
-        return make_result(FAILED, parent_result.error());
+    const unsigned lower = 256 * part / nparts;
+    const unsigned upper = 256 * (part + 1) / nparts;
+    if (lower == upper) {
+        return;
     }
-    if (*parent_result == INVALID_INO) {
-        return "";
+    int rc = lower == 0
+            ? cursor.nextprev(key, value, MDB_FIRST)
+            : cursor.lower_bound(std::string(1, static_cast<char>(lower)), key, value);
+    for (;
+         rc == 0 && static_cast<const unsigned char*>(key.d_mdbval.mv_data)[0] < upper;
+         rc = cursor.nextprev(key, value, MDB_NEXT))
+    {
+        f(key, value);
     }
-    return name(*parent_result, ino);
 }
 
-Result<ino_t> CacheTransactionRO::parent(ino_t ino)
+static std::optional<std::uint32_t> fsck_inode_mode(MDBROTransactionImpl &txn,
+                                                    const MDBDbi &inodes_db,
+                                                    ino_t ino)
 {
-    if (ino == ROOT_INO) {
-        return ino;
-    }
-
     MDBOutVal value{};
-    if (int rc = ro_transaction()->get(db().inodes_db(), ino, value) == MDB_NOTFOUND) {
-        (void)rc;
-        return make_result(FAILED, ENOENT);
+    if (txn.get(inodes_db, ino, value) != 0) {
+        return std::nullopt;
     }
-
-    auto parsed = inode_from_lmdb_inplace(value);
-    if (!parsed) {
-        return copy_error(parsed);
+    auto inode = inode_from_lmdb_inplace(value);
+    if (!inode) {
+        return std::nullopt;
     }
-
-    return (*parsed)->parent;
+    return (*inode)->attr.mode & S_IFMT;
 }
 
-Result<ino_t> CacheTransactionRO::lookup(ino_t parent, std::string_view name)
+Result<FsckReport> Cache::fsck(const FsckOptions &options)
 {
+    if (options.repair && m_read_only) {
+        return make_result(FAILED, EROFS);
+    }
+
+    const unsigned threads = std::max(options.threads, 1u);
+    // several partitions per thread even out differences in their size
+    const unsigned nparts = std::min(threads * 4, 256u);
+    const auto &data_dir = m_db.data_path();
+
+    ino_t end_ino = ROOT_INO + 1;
+    CacheUsage usage{};
     {
-        Result<void> name_ok = db().check_name(name, false);
+        auto txn = begin_ro();
+        MDBOutVal value{};
+        if (txn.ro_transaction()->get(m_db.meta_db(), META_KEY_NEXT_INO, value) == 0) {
+            end_ino = value.get<ino_t>();
+        }
+        auto usage_result = txn.usage();
+        if (!usage_result) {
+            return copy_error(usage_result);
+        }
+        usage = *usage_result;
+    }
+
+    const std::vector<ino_t> files = cached_files();
+
+    using Task = std::function<void(CacheTransactionRO&, FsckFindings&)>;
+    std::vector<Task> tasks;
+    for (unsigned part = 0; part < nparts; ++part) {
+        tasks.emplace_back([this, end_ino, part, nparts](CacheTransactionRO &txn, FsckFindings &found){
+            auto &ro = *txn.ro_transaction();
+            scan_partition(ro, m_db.inodes_db(), false, end_ino, part, nparts,
+                           [&](MDBOutVal &key, MDBOutVal &value){
+                const auto ino = key.get<ino_t>();
+                ++found.inodes;
+                auto inode = inode_from_lmdb_inplace(value);
+                if (!inode) {
+                    found.corrupt_inodes.push_back(ino);
+                    return;
+                }
+                const ino_t parent = (*inode)->parent;
+                MDBOutVal other{};
+                if (parent == INVALID_INO) {
+                    if (ino != ROOT_INO &&
+                            ro.get(m_db.orphan_db(), ino, other) != 0) {
+                        found.lost_orphans.push_back(ino);
+                    }
+                } else {
+                    const std::array<std::uint64_t, 2> entry_key{{parent, ino}};
+                    if (fsck_inode_mode(ro, m_db.inodes_db(), parent) != S_IFDIR ||
+                            ro.get(m_db.tree_inode_key_db(), key_view(entry_key), other) != 0) {
+                        found.detached_inodes.push_back(ino);
+                        return;
+                    }
+                }
+                if (((*inode)->attr.mode & S_IFMT) == S_IFLNK &&
+                        ro.get(m_db.links_db(), ino, other) != 0) {
+                    found.missing_links.push_back(ino);
+                }
+            });
+        });
+
+        tasks.emplace_back([this, end_ino, part, nparts](CacheTransactionRO &txn, FsckFindings &found){
+            auto &ro = *txn.ro_transaction();
+            scan_partition(ro, m_db.tree_inode_key_db(), false, end_ino, part, nparts,
+                           [&](MDBOutVal &key, MDBOutVal &value){
+                ++found.entries;
+                std::array<std::uint64_t, 2> ids{};
+                auto direntry = DirEntry::parse_inplace(view(value));
+                if (key.d_mdbval.mv_size != sizeof(ids) || !direntry) {
+                    found.dangling_entries.emplace_back(key.get<std::string>(),
+                                                        value.get<std::string>());
+                    return;
+                }
+                memcpy(ids.data(), key.d_mdbval.mv_data, sizeof(ids));
+                const ino_t parent = ids[0];
+                const ino_t child = ids[1];
+
+                MDBOutVal child_value{};
+                bool linked = false;
+                if (std::get<0>(*direntry)->entry_ino == child &&
+                        ro.get(m_db.inodes_db(), child, child_value) == 0) {
+                    auto inode = inode_from_lmdb_inplace(child_value);
+                    linked = inode && (*inode)->parent == parent;
+                }
+                if (!linked) {
+                    found.dangling_entries.emplace_back(key.get<std::string>(),
+                                                        value.get<std::string>());
+                    return;
+                }
+
+                auto indexed = txn.find_entry(parent, std::get<1>(*direntry));
+                if (!indexed || *indexed != child) {
+                    found.missing_index_entries.emplace_back(key.get<std::string>(),
+                                                             value.get<std::string>());
+                }
+            });
+        });
+
+        tasks.emplace_back([this, end_ino, part, nparts](CacheTransactionRO &txn, FsckFindings &found){
+            auto &ro = *txn.ro_transaction();
+            switch (m_db.directory_index()) {
+            case DirectoryIndex::NAME:
+            {
+                scan_partition(ro, m_db.tree_name_key_db(), false, end_ino, part, nparts,
+                               [&](MDBOutVal &key, MDBOutVal &value){
+                    auto direntry = DirEntry::parse_inplace(view(value));
+                    bool valid = false;
+                    if (key.d_mdbval.mv_size >= sizeof(ino_t) && direntry) {
+                        ino_t parent = INVALID_INO;
+                        memcpy(&parent, key.d_mdbval.mv_data, sizeof(ino_t));
+                        const std::string_view name(
+                                    static_cast<const char*>(key.d_mdbval.mv_data) + sizeof(ino_t),
+                                    key.d_mdbval.mv_size - sizeof(ino_t));
+                        valid = txn.entry_name_is(parent, std::get<0>(*direntry)->entry_ino, name);
+                    }
+                    if (!valid) {
+                        found.stale_index_entries.emplace_back(key.get<std::string>(),
+                                                               value.get<std::string>());
+                    }
+                });
+                break;
+            }
+            case DirectoryIndex::HASHED:
+            {
+                scan_partition(ro, m_db.tree_hash_key_db(), false, end_ino, part, nparts,
+                               [&](MDBOutVal &key, MDBOutVal &value){
+                    std::array<std::uint64_t, 2> ids{};
+                    bool valid = false;
+                    if (key.d_mdbval.mv_size == sizeof(ids) &&
+                            value.d_mdbval.mv_size == sizeof(ino_t)) {
+                        memcpy(ids.data(), key.d_mdbval.mv_data, sizeof(ids));
+                        const std::array<std::uint64_t, 2> entry_key{{ids[0], value.get<ino_t>()}};
+                        MDBOutVal entry{};
+                        if (ro.get(m_db.tree_inode_key_db(), key_view(entry_key), entry) == 0) {
+                            auto direntry = DirEntry::parse_inplace(view(entry));
+                            valid = direntry && name_hash(std::get<1>(*direntry)) == ids[1];
+                        }
+                    }
+                    if (!valid) {
+                        found.stale_index_entries.emplace_back(key.get<std::string>(),
+                                                               value.get<std::string>());
+                    }
+                });
+                break;
+            }
+            }
+        });
+
+        tasks.emplace_back([this, end_ino, part, nparts](CacheTransactionRO &txn, FsckFindings &found){
+            auto &ro = *txn.ro_transaction();
+            scan_partition(ro, m_db.orphan_db(), false, end_ino, part, nparts,
+                           [&](MDBOutVal &key, MDBOutVal &){
+                const auto ino = key.get<ino_t>();
+                MDBOutVal value{};
+                if (ro.get(m_db.inodes_db(), ino, value) != 0) {
+                    found.stale_orphans.push_back(ino);
+                    return;
+                }
+                // orphans with a broken record are still reaped fine
+                auto inode = inode_from_lmdb_inplace(value);
+                if (inode && (*inode)->parent != INVALID_INO) {
+                    // reaping would delete an inode which is still linked
+                    found.stale_orphans.push_back(ino);
+                }
+            });
+            scan_partition(ro, m_db.links_db(), false, end_ino, part, nparts,
+                           [&](MDBOutVal &key, MDBOutVal &){
+                const auto ino = key.get<ino_t>();
+                if (fsck_inode_mode(ro, m_db.inodes_db(), ino) != S_IFLNK) {
+                    found.stale_links.push_back(ino);
+                }
+            });
+            scan_partition(ro, m_db.traces_db(), true, end_ino, part, nparts,
+                           [&](MDBOutVal &key, MDBOutVal &){
+                const auto ino = key.get<ino_t>();
+                if (fsck_inode_mode(ro, m_db.inodes_db(), ino) != S_IFREG) {
+                    found.stale_traces.push_back(ino);
+                }
+            });
+        });
+
+        const std::size_t files_begin = files.size() * part / nparts;
+        const std::size_t files_end = files.size() * (part + 1) / nparts;
+        tasks.emplace_back([this, &files, &data_dir, files_begin, files_end](CacheTransactionRO &txn, FsckFindings &found){
+            auto &ro = *txn.ro_transaction();
+            for (std::size_t i = files_begin; i < files_end; ++i) {
+                const ino_t ino = files[i];
+                ++found.files;
+                if (fsck_inode_mode(ro, m_db.inodes_db(), ino) != S_IFREG) {
+                    found.stray_files.push_back(ino);
+                } else if (auto accounted = RegularFileHandle::check(data_dir, ino, false)) {
+                    found.corrupt_files.push_back(ino);
+                    found.corrupt_bytes += *accounted;
+                } else {
+                    found.cached_bytes += RegularFileHandle::cached_bytes(data_dir, ino);
+                }
+            }
+        });
+    }
+
+    FsckFindings found;
+    bool failed = false;
+    {
+        std::atomic<std::size_t> next_task(0);
+        std::mutex merge_mutex;
+        auto worker = [&](){
+            FsckFindings local;
+            bool local_failed = false;
+            try {
+                for (std::size_t i = next_task.fetch_add(1);
+                     i < tasks.size();
+                     i = next_task.fetch_add(1))
+                {
+                    auto txn = begin_ro();
+                    tasks[i](txn, local);
+                }
+            } catch (const std::exception &) {
+                local_failed = true;
+            }
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            found.merge(std::move(local));
+            failed = failed || local_failed;
+        };
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread: workers) {
+            thread.join();
+        }
+    }
+    if (failed) {
+        return make_result(FAILED, EIO);
+    }
+
+    const std::uint64_t expected_inodes = found.inodes - found.corrupt_inodes.size();
+
+    FsckReport report{};
+    report.inodes = found.inodes;
+    report.entries = found.entries;
+    report.files = found.files;
+    report.corrupt_inodes = found.corrupt_inodes.size();
+    report.detached_inodes = found.detached_inodes.size();
+    report.lost_orphans = found.lost_orphans.size();
+    report.stale_orphans = found.stale_orphans.size();
+    report.dangling_entries = found.dangling_entries.size();
+    report.missing_index_entries = found.missing_index_entries.size();
+    report.stale_index_entries = found.stale_index_entries.size();
+    report.missing_links = found.missing_links.size();
+    report.stale_records = found.stale_links.size() + found.stale_traces.size();
+    report.corrupt_files = found.corrupt_files.size();
+    report.stray_files = found.stray_files.size();
+    // the data of corrupt files is still accounted for until it is discarded
+    report.wrong_counters = (usage.inodes != found.inodes ? 1 : 0) +
+            (usage.cached_bytes != found.cached_bytes + found.corrupt_bytes ? 1 : 0);
+
+    if (!options.repair || report.problems() == 0) {
+        if (report.corrupt_files == 0) {
+            finish_recovery();
+        }
+        return report;
+    }
+
+    {
+        auto txn = begin_rw();
+        auto &rw = *txn.rw_transaction();
+
+        for (ino_t ino: found.corrupt_inodes) {
+            // the entries in the directory are detached below, as the parent
+            // is not a directory for them; cached data is a stray file
+            rw.del(m_db.inodes_db(), ino);
+            rw.del(m_db.orphan_db(), ino);
+            rw.del(m_db.links_db(), ino);
+            rw.del(m_db.traces_db(), ino);
+        }
+
+        for (const auto &[key, value]: found.dangling_entries) {
+            rw.del(m_db.tree_inode_key_db(), key);
+            auto direntry = DirEntry::parse(view(value));
+            if (!direntry || key.size() != sizeof(std::uint64_t) * 2) {
+                continue;
+            }
+            ino_t parent = INVALID_INO;
+            memcpy(&parent, key.data(), sizeof(ino_t));
+            const ino_t child = std::get<0>(*direntry).entry_ino;
+            const std::string &name = std::get<1>(*direntry);
+            // the name may legitimately refer to another inode by now
+            auto indexed = txn.find_entry(parent, name);
+            if (indexed && *indexed == child) {
+                txn.del_index_entry(parent, name, child);
+            }
+        }
+
+        for (const auto &[key, value]: found.stale_index_entries) {
+            switch (m_db.directory_index()) {
+            case DirectoryIndex::NAME:
+                rw.del(m_db.tree_name_key_db(), key);
+                break;
+            case DirectoryIndex::HASHED:
+                rw.del(m_db.tree_hash_key_db(), key, value);
+                break;
+            }
+        }
+
+        for (const auto &[key, value]: found.missing_index_entries) {
+            auto direntry = DirEntry::parse(view(value));
+            assert(direntry);
+            ino_t parent = INVALID_INO;
+            memcpy(&parent, key.data(), sizeof(ino_t));
+            txn.put_index_entry(parent, std::get<1>(*direntry),
+                                std::get<0>(*direntry).entry_ino, value);
+        }
+
+        // unreachable inodes and symlinks without destination are orphaned;
+        // the latter are fetched again when they are looked up the next time
+        std::vector<ino_t> unreachable = std::move(found.detached_inodes);
+        unreachable.insert(unreachable.end(),
+                           found.missing_links.begin(), found.missing_links.end());
+        for (ino_t ino: unreachable) {
+            MDBOutVal value{};
+            if (rw.get(m_db.inodes_db(), ino, value) != 0) {
+                continue;
+            }
+            auto inode = inode_from_lmdb(value);
+            if (!inode) {
+                continue;
+            }
+            const std::array<std::uint64_t, 2> entry_key{{inode->parent, ino}};
+            MDBOutVal entry{};
+            if (inode->parent != INVALID_INO &&
+                    rw.get(m_db.tree_inode_key_db(), key_view(entry_key), entry) == 0) {
+                auto direntry = DirEntry::parse(view(entry));
+                if (direntry) {
+                    auto indexed = txn.find_entry(inode->parent, std::get<1>(*direntry));
+                    if (indexed && *indexed == ino) {
+                        txn.del_index_entry(inode->parent, std::get<1>(*direntry), ino);
+                    }
+                }
+                rw.del(m_db.tree_inode_key_db(), key_view(entry_key));
+            }
+            inode->parent = INVALID_INO;
+            rw.put(m_db.inodes_db(), ino, serialize_as<char>(*inode));
+            const std::uint8_t orphan = 0;
+            rw.put(m_db.orphan_db(), ino, orphan);
+        }
+
+        for (ino_t ino: found.lost_orphans) {
+            const std::uint8_t orphan = 0;
+            rw.put(m_db.orphan_db(), ino, orphan);
+        }
+        for (ino_t ino: found.stale_orphans) {
+            rw.del(m_db.orphan_db(), ino);
+        }
+        for (ino_t ino: found.stale_links) {
+            rw.del(m_db.links_db(), ino);
+        }
+        for (ino_t ino: found.stale_traces) {
+            rw.del(m_db.traces_db(), ino);
+        }
+
+        rw.put(m_db.meta_db(), META_KEY_INODES, expected_inodes);
+        rw.put(m_db.meta_db(), META_KEY_CACHED_BYTES, found.cached_bytes);
+
+        auto commit_result = txn.commit();
+        if (!commit_result) {
+            return copy_error(commit_result);
+        }
+    }
+
+    for (ino_t ino: found.corrupt_files) {
+        RegularFileHandle::remove(data_dir, ino);
+    }
+    for (ino_t ino: found.stray_files) {
+        RegularFileHandle::remove(data_dir, ino);
+    }
+
+    for (;;) {
+        auto reap_result = reap_orphans(ORPHAN_REAP_BATCH);
+        if (!reap_result) {
+            return copy_error(reap_result);
+        }
+        if (*reap_result < ORPHAN_REAP_BATCH) {
+            break;
+        }
+    }
+
+    finish_recovery();
+    report.repaired = true;
+    return report;
+}
+
+Result<std::string> Cache::name(ino_t ino)
+{
+    return begin_ro().name(ino);
+}
+
+Result<ino_t> Cache::parent(ino_t ino)
+{
+    return begin_ro().parent(ino);
+}
+
+Result<ino_t> Cache::lookup(ino_t parent, std::string_view name)
+{
+    return begin_ro().lookup(parent, name);
+}
+
+Result<Stat> Cache::getattr(ino_t ino)
+{
+    return begin_ro().getattr(ino);
+}
+
+Result<ino_t> Cache::emplace(ino_t parent, std::string_view name, const InodeAttributes &attrs)
+{
+    return with_rw_txn(begin_rw(), [parent, name, &attrs](CacheTransactionRW &txn){
+        return txn.emplace(parent, name, attrs);
+    });
+}
+
+Result<void> Cache::lock(ino_t ino)
+{
+    return with_rw_txn(begin_rw(), [ino](CacheTransactionRW &txn){
+        return txn.lock(ino);
+    });
+}
+
+Result<void> Cache::release(ino_t ino)
+{
+    return with_rw_txn(begin_rw(), [ino](CacheTransactionRW &txn){
+        return txn.release(ino);
+    });
+}
+
+Result<void> Cache::set_pinned(ino_t ino, bool pinned)
+{
+    return with_rw_txn(begin_rw(), [ino, pinned](CacheTransactionRW &txn){
+        return txn.set_pinned(ino, pinned);
+    });
+}
+
+Result<std::string> Cache::readlink(ino_t ino)
+{
+    return begin_ro().readlink(ino);
+}
+
+Result<void> Cache::writelink(ino_t ino, std::string_view dest)
+{
+    return with_rw_txn(begin_rw(), [ino, &dest](CacheTransactionRW &txn){
+        return txn.writelink(ino, dest);
+    });
+}
+
+Result<std::string> Cache::path(ino_t ino)
+{
+    return begin_ro().path(ino);
+}
+
+Result<CacheUsage> Cache::usage()
+{
+    return begin_ro().usage();
+}
+
+Result<FileResidency> Cache::residency(ino_t ino, bool with_ranges)
+{
+    std::uint64_t size;
+    {
+        auto txn = begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        switch (attr_result->attr.mode & S_IFMT) {
+        case S_IFREG:
+            break;
+        case S_IFDIR:
+            return make_result(FAILED, EISDIR);
+        default:
+            return make_result(FAILED, EINVAL);
+        }
+        size = attr_result->attr.common.size;
+    }
+
+    if (recovery_pending()) {
+        auto check_result = check_file(ino);
+        if (!check_result) {
+            return copy_error(check_result);
+        }
+    }
+
+    std::shared_ptr<RegularFileHandle> file;
+    {
+        std::lock_guard<profiled_mutex> lock(m_open_files_mutex);
+        auto iter = m_open_files.find(ino);
+        if (iter != m_open_files.end()) {
+            file = iter->second.lock();
+        }
+        if (!file) {
+            // nobody can open the file while we hold the lock
+            return RegularFileHandle::residency(m_db.data_path(), ino, size,
+                                                with_ranges);
+        }
+    }
+    return file->residency(size, with_ranges);
+}
+
+Result<struct statvfs> Cache::statfs()
+{
+    auto usage_result = usage();
+    if (!usage_result) {
+        return copy_error(usage_result);
+    }
+    const CacheUsage &usage = *usage_result;
+
+    struct statvfs backing{};
+    if (::statvfs(m_path.c_str(), &backing) != 0) {
+        return make_result(FAILED, errno);
+    }
+
+    struct statvfs result{};
+    result.f_bsize = CACHE_PAGE_SIZE;
+    result.f_frsize = CACHE_PAGE_SIZE;
+
+    const std::uint64_t used_blocks =
+            (usage.cached_bytes + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+    if (m_db.max_bytes() > 0) {
+        result.f_blocks = m_db.max_bytes() / CACHE_PAGE_SIZE;
+        result.f_bfree = result.f_blocks - std::min<std::uint64_t>(used_blocks, result.f_blocks);
+    } else {
+        result.f_bfree = std::uint64_t(backing.f_bavail) * backing.f_frsize / CACHE_PAGE_SIZE;
+        result.f_blocks = used_blocks + result.f_bfree;
+    }
+    result.f_bavail = result.f_bfree;
+
+    if (m_db.max_inodes() > 0) {
+        result.f_files = m_db.max_inodes();
+        result.f_ffree = result.f_files - std::min<std::uint64_t>(usage.inodes, result.f_files);
+    } else {
+        result.f_ffree = backing.f_favail;
+        result.f_files = usage.inodes + result.f_ffree;
+    }
+    result.f_favail = result.f_ffree;
+
+    result.f_namemax = std::min<std::size_t>(m_db.max_name_length(), NAME_MAX);
+    return result;
+}
+
+void Cache::deduplicate(ino_t ino, RegularFileHandle &file, off_t off,
+                        const std::byte *data, std::size_t n)
+{
+    if (!deduplication_enabled()) {
+        return;
+    }
+
+    const std::uint64_t first = (off + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+    const std::uint64_t end = (off + n) / CACHE_PAGE_SIZE;
+    if (first >= end) {
+        return;
+    }
+
+    struct Candidate {
+        std::uint64_t hash;
+        std::uint64_t block;
+        ChunkLocation source;
+    };
+
+    std::vector<Candidate> candidates;
+    {
+        auto txn = begin_rw();
+        for (std::uint64_t block = first; block < end; ++block) {
+            const std::byte *chunk = data + (block * CACHE_PAGE_SIZE - off);
+            const std::uint64_t hash = chunk_hash(chunk, CACHE_PAGE_SIZE);
+            auto find_result = txn.find_chunk(hash);
+            if (find_result && !(find_result->ino == ino
+                                 && find_result->block == block)) {
+                candidates.push_back(Candidate{hash, block, *find_result});
+            } else if (!find_result) {
+                txn.put_chunk(hash, ChunkLocation{ino, block});
+            }
+        }
+        if (!txn.commit()) {
+            return;
+        }
+    }
+    m_dedup_hashed_bytes.fetch_add((end - first) * CACHE_PAGE_SIZE,
+                                   std::memory_order_relaxed);
+
+    // share runs of blocks which are consecutive in both files with a single
+    // request each
+    std::vector<Candidate> stale;
+    FileHandle src_fd;
+    ino_t src_ino = INVALID_INO;
+    for (auto run = candidates.begin(); run != candidates.end(); ) {
+        auto run_end = run + 1;
+        while (run_end != candidates.end()
+               && run_end->source.ino == run->source.ino
+               && run_end->block == run->block + (run_end - run)
+               && run_end->source.block == run->source.block + (run_end - run)) {
+            ++run_end;
+        }
+        const std::size_t count = run_end - run;
+
+        if (run->source.ino != src_ino) {
+            src_ino = run->source.ino;
+            src_fd = FileHandle(::open(
+                        RegularFileHandle::data_path(m_db.data_path(), src_ino).c_str(),
+                        O_RDONLY | O_CLOEXEC));
+        }
+
+        auto share = [&](std::size_t skip, std::size_t blocks) -> Result<std::size_t> {
+            if (!src_fd) {
+                return make_result(std::size_t(0));
+            }
+            auto share_result = share_range(
+                        int(src_fd), (run->source.block + skip) * CACHE_PAGE_SIZE,
+                        file.fd(), (run->block + skip) * CACHE_PAGE_SIZE,
+                        blocks * CACHE_PAGE_SIZE);
+            if (!share_result) {
+                return share_result;
+            }
+            return make_result(*share_result / CACHE_PAGE_SIZE);
+        };
+
+        auto run_result = share(0, count);
+        if (!run_result && run_result.error() == EOPNOTSUPP) {
+            // no need to keep looking on this file system
+            m_deduplicate.store(false, std::memory_order_relaxed);
+            return;
+        }
+        std::size_t shared = run_result ? *run_result : 0;
+        if (shared == count) {
+            m_dedup_shared_bytes.fetch_add(shared * CACHE_PAGE_SIZE,
+                                           std::memory_order_relaxed);
+            run = run_end;
+            continue;
+        }
+
+        // a single differing block fails the whole request; sort out the
+        // rest of the run block by block
+        for (auto candidate = run + shared; candidate != run_end; ++candidate) {
+            auto block_result = share(candidate - run, 1);
+            if (block_result && *block_result == 1) {
+                ++shared;
+            } else {
+                // point the index at the copy we have just written
+                stale.push_back(*candidate);
+            }
+        }
+        m_dedup_shared_bytes.fetch_add(shared * CACHE_PAGE_SIZE,
+                                       std::memory_order_relaxed);
+        run = run_end;
+    }
+
+    if (!stale.empty()) {
+        m_dedup_stale_entries.fetch_add(stale.size(), std::memory_order_relaxed);
+        auto txn = begin_rw();
+        for (const auto &entry: stale) {
+            txn.put_chunk(entry.hash, ChunkLocation{ino, entry.block});
+        }
+        (void)txn.commit();
+    }
+}
+
+DedupStats Cache::dedup_stats() const
+{
+    return DedupStats{
+        .hashed_bytes = m_dedup_hashed_bytes.load(std::memory_order_relaxed),
+        .shared_bytes = m_dedup_shared_bytes.load(std::memory_order_relaxed),
+        .stale_entries = m_dedup_stale_entries.load(std::memory_order_relaxed),
+    };
+}
+
+void Cache::compress(RegularFileHandle &file, off_t off, std::size_t n)
+{
+    if (m_compression == Compression::NONE) {
+        return;
+    }
+    (void)file.compress(off, n, m_compression);
+}
+
+CompressionStats Cache::compression_stats() const
+{
+    return m_compression_counters.load();
+}
+
+Result<StorageUsage> Cache::storage_usage()
+{
+    return measure_storage(m_db.data_path());
+}
+
+/* Dragonstash::CacheTransactionRO */
+
+CacheTransactionRO::CacheTransactionRO(CacheDatabase &db, MDBROTransaction &&txn,
+                                       CacheTransactionRW *parent):
+    m_db(&db),
+    m_txn(std::move(txn)),
+    m_parent(parent)
+{
+
+}
+
+CacheTransactionRO::CacheTransactionRO(CacheDatabase &db, TransactionGuard &&guard,
+                                       MDBROTransaction &&txn):
+    m_db(&db),
+    m_guard(std::move(guard)),
+    m_txn(std::move(txn)),
+    m_parent(nullptr)
+{
+
+}
+
+InodeReferences &CacheTransactionRO::inode_in_memory_locks() {
+    if (m_inode_counter_lock) {
+        return db().in_memory_locks();
+    }
+
+    CacheTransactionRW *parent = m_parent;
+    while (parent) {
+        if (parent->m_inode_counter_lock) {
+            return parent->db().in_memory_locks();
+        }
+        parent = parent->m_parent;
+    }
+
+    // we don’t hold the lock and no parent holds the lock -> we need to lock
+    // here.
+    assert(!m_inode_counter_lock);
+    m_inode_counter_lock = db().in_memory_lock_guard();
+    return db().in_memory_locks();
+}
+
+Result<std::string_view> CacheTransactionRO::name_view(ino_t parent, ino_t ino)
+{
+    if (ino == ROOT_INO || parent == INVALID_INO) {
+        return make_result(std::string_view(""));
+    }
+
+    const std::array<std::uint64_t, 2> key{{parent, ino}};
+    MDBOutVal value{};
+    if (ro_transaction()->get(db().tree_inode_key_db(), key_view(key),
+                              value) != 0) {
+        // should this be possible? on deletion, we should normally unset the
+        // parent...
+        return make_result(FAILED, ENOENT);
+    }
+
+    auto parse_result = DirEntry::parse_inplace(view(value));
+    if (!parse_result) {
+        return copy_error(parse_result);
+    }
+    return make_result(std::get<1>(*parse_result));
+}
+
+Result<std::string> CacheTransactionRO::name(ino_t parent, ino_t ino)
+{
+    auto name_result = name_view(parent, ino);
+    if (!name_result) {
+        return copy_error(name_result);
+    }
+    return std::string(*name_result);
+}
+
+Result<std::string> CacheTransactionRO::name(ino_t ino)
+{
+    if (ino == ROOT_INO) {
+        return make_result(std::string_view(""));
+    }
+
+    auto parent_result = parent(ino);
+    if (!parent_result) {
+        return make_result(FAILED, parent_result.error());
+    }
+    if (*parent_result == INVALID_INO) {
+        return "";
+    }
+    return name(*parent_result, ino);
+}
+
+Result<ino_t> CacheTransactionRO::parent(ino_t ino)
+{
+    if (ino == ROOT_INO) {
+        return ino;
+    }
+
+    MDBOutVal value{};
+    if (int rc = ro_transaction()->get(db().inodes_db(), ino, value) == MDB_NOTFOUND) {
+        (void)rc;
+        return make_result(FAILED, ENOENT);
+    }
+
+    auto parsed = inode_from_lmdb_inplace(value);
+    if (!parsed) {
+        return copy_error(parsed);
+    }
+
+    return (*parsed)->parent;
+}
+
+Result<ino_t> CacheTransactionRO::lookup(ino_t parent, std::string_view name)
+{
+    {
+        Result<void> name_ok = db().check_name(name, false);
         if (!name_ok) {
             return make_result(FAILED, name_ok.error());
         }
@@ -508,41 +1753,59 @@ Result<ino_t> CacheTransactionRO::lookup(ino_t parent, std::string_view name)
         return make_result(FAILED, EINVAL);
     }
 
-    auto cursor = ro_transaction()->getROCursor(m_db->tree_name_key_db());
+    return find_entry(parent, name);
+}
 
+Result<ino_t> CacheTransactionRO::find_entry(ino_t parent, std::string_view name)
+{
     MDBOutVal key_out{};
     MDBOutVal value_out{};
 
-    for (int rc = cursor.lower_bound(parent, key_out, value_out);
-         rc != MDB_NOTFOUND;
-         rc = cursor.nextprev(key_out, value_out, MDB_NEXT))
+    switch (db().directory_index()) {
+    case DirectoryIndex::NAME:
     {
-        assert(key_out.d_mdbval.mv_size >= sizeof(ino_t));
+        if (ro_transaction()->get(db().tree_name_key_db(), name_key(parent, name),
+                                  value_out) != 0) {
+            return make_result(FAILED, ENOENT);
+        }
         auto parse_result = DirEntry::parse_inplace(view(value_out));
         assert(parse_result);
-
-        const size_t name_length = key_out.d_mdbval.mv_size - sizeof(ino_t);
-        if (name_length != name.length()) {
-            continue;
+        return make_result(std::get<0>(*parse_result)->entry_ino);
+    }
+    case DirectoryIndex::HASHED:
+    {
+        const std::array<std::uint64_t, 2> key{{parent, name_hash(name)}};
+        auto cursor = ro_transaction()->getROCursor(db().tree_hash_key_db());
+        for (int rc = cursor.find(key_view(key), key_out, value_out);
+             rc == 0;
+             rc = cursor.nextprev(key_out, value_out, MDB_NEXT_DUP))
+        {
+            const auto child = value_out.get<ino_t>();
+            if (entry_name_is(parent, child, name)) {
+                return make_result(child);
+            }
         }
+        return make_result(FAILED, ENOENT);
+    }
+    }
 
-        ino_t entry_parent_ino;
-        memcpy(&entry_parent_ino, key_out.d_mdbval.mv_data, sizeof(ino_t));
-        if (entry_parent_ino != parent) {
-            // end of directory
-            break;
-        }
+    return make_result(FAILED, EIO);
+}
 
-        auto entry_child_ino = std::get<0>(*parse_result)->entry_ino;
-        std::string_view entry_name(reinterpret_cast<char*>(key_out.d_mdbval.mv_data),
-                                    key_out.d_mdbval.mv_size);
-        entry_name.remove_prefix(sizeof(ino_t));
-        if (entry_name == name) {
-            return make_result(entry_child_ino);
-        }
+bool CacheTransactionRO::entry_name_is(ino_t parent, ino_t child,
+                                       std::string_view name)
+{
+    const std::array<std::uint64_t, 2> key{{parent, child}};
+    MDBOutVal value_out{};
+    if (ro_transaction()->get(db().tree_inode_key_db(), key_view(key),
+                              value_out) != 0) {
+        return false;
     }
-
-    return make_result(FAILED, ENOENT);
+    auto parse_result = DirEntry::parse_inplace(view(value_out));
+    if (!parse_result) {
+        return false;
+    }
+    return std::get<1>(*parse_result) == name;
 }
 
 Result<Stat> CacheTransactionRO::getattr(ino_t ino)
@@ -563,6 +1826,20 @@ Result<Stat> CacheTransactionRO::getattr(ino_t ino)
     };
 }
 
+Result<std::size_t> CacheTransactionRO::chunk_size(ino_t ino)
+{
+    MDBOutVal value{};
+    if (ro_transaction()->get(db().inodes_db(), ino, value) == MDB_NOTFOUND) {
+        return make_result(FAILED, ENOENT);
+    }
+
+    auto parsed = inode_from_lmdb_inplace(value);
+    if (!parsed) {
+        return copy_error(parsed);
+    }
+    return make_result((*parsed)->chunk_size());
+}
+
 Result<std::string> CacheTransactionRO::readlink(ino_t ino)
 {
     MDBOutVal value{};
@@ -587,7 +1864,7 @@ Result<DirectoryEntry> CacheTransactionRO::readdir(ino_t dir, ino_t prev_end)
                                Stat{
                                    .ino = dir,
                                },
-                               std::string("."),
+                               std::pmr::string(".", request_memory()),
                                false,
                            });
     }
@@ -601,7 +1878,7 @@ Result<DirectoryEntry> CacheTransactionRO::readdir(ino_t dir, ino_t prev_end)
                                Stat{
                                    .ino = *parent_result,
                                },
-                               std::string(".."),
+                               std::pmr::string("..", request_memory()),
                                false,
                            });
     }
@@ -644,7 +1921,7 @@ Result<DirectoryEntry> CacheTransactionRO::readdir(ino_t dir, ino_t prev_end)
         }
     }
 
-    auto parse_result = DirEntry::parse(view(value_out));
+    auto parse_result = DirEntry::parse_inplace(view(value_out));
     if (!parse_result) {
         return make_result(FAILED, EIO);
     }
@@ -652,25 +1929,36 @@ Result<DirectoryEntry> CacheTransactionRO::readdir(ino_t dir, ino_t prev_end)
                            Stat{
                                .ino = key[1],
                            },
-                           std::string(std::get<1>(*parse_result)),
+                           std::pmr::string(std::get<1>(*parse_result),
+                                            request_memory()),
                            false,
                        });
 }
 
 Result<std::string> CacheTransactionRO::path(ino_t ino)
 {
+    auto path_result = path(ino, std::pmr::get_default_resource());
+    if (!path_result) {
+        return copy_error(path_result);
+    }
+    return std::string(*path_result);
+}
+
+Result<std::pmr::string> CacheTransactionRO::path(ino_t ino,
+                                                  std::pmr::memory_resource *memory)
+{
+    std::pmr::string buf(memory);
     if (ino == Dragonstash::ROOT_INO) {
-        return "";
+        return buf;
     }
 
-    std::string buf;
     do {
         auto parent_result = parent(ino);
         if (!parent_result) {
             return copy_error(parent_result);
         }
 
-        auto name_result = name(*parent_result, ino);
+        auto name_result = name_view(*parent_result, ino);
         if (!name_result) {
             return copy_error(name_result);
         }
@@ -738,6 +2026,99 @@ Result<bool> CacheTransactionRO::test_flag(ino_t ino, InodeFlag flag)
     return (*inode)->test_flag(flag);
 }
 
+Result<std::vector<ino_t>> CacheTransactionRO::inodes_with_flag(InodeFlag flag)
+{
+    std::vector<ino_t> result;
+    auto cursor = ro_transaction()->getCursor(db().inodes_db());
+    MDBOutVal key_out{};
+    MDBOutVal value_out{};
+    int rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
+    while (rc == 0) {
+        auto inode = inode_from_lmdb_inplace(value_out);
+        if (inode && (*inode)->test_flag(flag)) {
+            result.push_back(key_out.get<ino_t>());
+        }
+        rc = cursor.nextprev(key_out, value_out, MDB_NEXT);
+    }
+    return result;
+}
+
+Result<std::vector<JournalRecord>> CacheTransactionRO::journal(std::size_t max)
+{
+    std::vector<JournalRecord> result;
+    auto cursor = ro_transaction()->getCursor(db().journal_db());
+    MDBOutVal key_out{};
+    MDBOutVal value_out{};
+    int rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
+    while (rc == 0 && result.size() < max) {
+        auto entry = JournalEntry::parse(value_out.get<std::string_view>());
+        if (!entry) {
+            return make_result(FAILED, EIO);
+        }
+        result.push_back(JournalRecord{key_out.get<std::uint64_t>(), std::move(*entry)});
+        rc = cursor.nextprev(key_out, value_out, MDB_NEXT);
+    }
+    return result;
+}
+
+bool CacheTransactionRO::journal_empty()
+{
+    auto cursor = ro_transaction()->getCursor(db().journal_db());
+    MDBOutVal key_out{};
+    MDBOutVal value_out{};
+    return cursor.nextprev(key_out, value_out, MDB_FIRST) != 0;
+}
+
+Result<ChunkLocation> CacheTransactionRO::find_chunk(std::uint64_t hash)
+{
+    MDBOutVal value{};
+    if (ro_transaction()->get(db().chunks_db(), hash, value) != 0) {
+        return make_result(FAILED, ENOENT);
+    }
+    const auto raw = view(value);
+    if (raw.size() != sizeof(std::uint64_t) * 2) {
+        return make_result(FAILED, EIO);
+    }
+    std::array<std::uint64_t, 2> fields;
+    memcpy(fields.data(), raw.data(), raw.size());
+    return make_result(ChunkLocation{
+                           .ino = static_cast<ino_t>(fields[0]),
+                           .block = fields[1],
+                       });
+}
+
+Result<AccessTrace> CacheTransactionRO::get_trace(ino_t ino)
+{
+    MDBOutVal value{};
+    if (ro_transaction()->get(db().traces_db(), ino, value) != 0) {
+        return make_result(FAILED, ENOENT);
+    }
+    auto trace = AccessTrace::parse(value.get<std::string_view>());
+    if (!trace) {
+        return make_result(FAILED, EIO);
+    }
+    return trace;
+}
+
+Result<CacheUsage> CacheTransactionRO::usage()
+{
+    CacheUsage result{};
+    MDBOutVal value{};
+    if (ro_transaction()->get(db().meta_db(), META_KEY_INODES, value) != 0) {
+        return make_result(FAILED, EIO);
+    }
+    result.inodes = value.get<std::uint64_t>();
+    if (ro_transaction()->get(db().meta_db(), META_KEY_CACHED_BYTES, value) != 0) {
+        return make_result(FAILED, EIO);
+    }
+    result.cached_bytes = value.get<std::uint64_t>();
+    if (ro_transaction()->get(db().meta_db(), META_KEY_PINNED_BYTES, value) != 0) {
+        return make_result(FAILED, EIO);
+    }
+    result.pinned_bytes = value.get<std::uint64_t>();
+    return result;
+}
+
 void CacheTransactionRO::abort()
 {
     // two separate loops here to ensure that all stage 1 rollback callbacks
@@ -756,6 +2137,7 @@ void CacheTransactionRO::abort()
     }
     m_txn->abort();
     m_txn = nullptr;
+    m_guard = TransactionGuard{};
     if (m_inode_counter_lock) {
         m_inode_counter_lock.unlock();
     }
@@ -767,6 +2149,8 @@ Result<void> CacheTransactionRO::commit()
         return make_result();
     }
 
+    const TraceSpan trace_span("cache", "commit");
+
     if (!m_parent) {
         Result<void> result;
         auto iter = m_transaction_hooks.begin();
@@ -794,6 +2178,7 @@ Result<void> CacheTransactionRO::commit()
     }
     m_transaction_hooks.clear();
     m_txn = nullptr;
+    m_guard = TransactionGuard{};
     if (m_inode_counter_lock) {
         if (m_parent) {
             m_parent->m_inode_counter_lock = std::move(m_inode_counter_lock);
@@ -812,6 +2197,12 @@ CacheTransactionRW::CacheTransactionRW(CacheDatabase &cache, MDBRWTransaction &&
 
 }
 
+CacheTransactionRW::CacheTransactionRW(CacheDatabase &cache, TransactionGuard &&guard, MDBRWTransaction &&txn):
+    CacheTransactionRO(cache, std::move(guard), std::move(txn))
+{
+
+}
+
 ino_t CacheTransactionRW::allocate_next_inode()
 {
     MDBRWTransaction sub_txn = rw_transaction()->getRWTransaction();
@@ -847,8 +2238,8 @@ Result<void> CacheTransactionRW::make_orphan(ino_t ino)
     memcpy(&key[0], &parent, sizeof(ino_t));
     memcpy(&key[sizeof(ino_t)], &ino, sizeof(ino_t));
 
-    // look up inode name, calculate the lookup key for the name-keyed database
-    // and delete the entry from the inode-keyed database.
+    // look up inode name, delete the entry from the directory index and from
+    // the inode-keyed database.
     {
         MDBOutVal key_out{};
         MDBOutVal value_out{};
@@ -859,14 +2250,11 @@ Result<void> CacheTransactionRW::make_orphan(ino_t ino)
         auto direntry_result = DirEntry::parse(view(value_out));
         assert(direntry_result);
         std::string_view name = std::get<1>(*direntry_result);
-        key.resize(sizeof(ino_t) + name.length());
-        memcpy(&key[sizeof(ino_t)], name.data(), name.length());
+        // delete the entry from the name-keyed index
+        del_index_entry(*parent, name, ino);
         ino_cursor.del();
     }
 
-    // delete the entry from the name-keyed database
-    rw_transaction()->del(db().tree_name_key_db(), key);
-
     const std::uint8_t value = 0;
     // add the inode to the orphans
     rw_transaction()->put(db().orphan_db(), ino, value);
@@ -889,6 +2277,44 @@ Result<void> CacheTransactionRW::make_orphan(ino_t ino)
     return make_result();
 }
 
+void CacheTransactionRW::put_index_entry(ino_t parent, std::string_view name,
+                                         ino_t child, std::string_view direntry)
+{
+    switch (db().directory_index()) {
+    case DirectoryIndex::NAME:
+    {
+        rw_transaction()->put(db().tree_name_key_db(), name_key(parent, name),
+                              direntry);
+        return;
+    }
+    case DirectoryIndex::HASHED:
+    {
+        const std::array<std::uint64_t, 2> key{{parent, name_hash(name)}};
+        rw_transaction()->put(db().tree_hash_key_db(), key_view(key), child);
+        return;
+    }
+    }
+}
+
+void CacheTransactionRW::del_index_entry(ino_t parent, std::string_view name,
+                                         ino_t child)
+{
+    switch (db().directory_index()) {
+    case DirectoryIndex::NAME:
+    {
+        rw_transaction()->del(db().tree_name_key_db(), name_key(parent, name));
+        return;
+    }
+    case DirectoryIndex::HASHED:
+    {
+        // only remove the duplicate which refers to this child
+        const std::array<std::uint64_t, 2> key{{parent, name_hash(name)}};
+        rw_transaction()->del(db().tree_hash_key_db(), key_view(key), child);
+        return;
+    }
+    }
+}
+
 Result<ino_t> CacheTransactionRW::emplace(ino_t parent, std::string_view name,
                                           const InodeAttributes &attrs)
 {
@@ -900,24 +2326,17 @@ Result<ino_t> CacheTransactionRW::emplace(ino_t parent, std::string_view name,
     }
 
     Inode inode = mkinode(attrs, parent);
+    if ((attrs.mode & S_IFMT) == S_IFREG) {
+        inode.chunk_shift = db().chunk_shift_for(attrs.common.size);
+    }
 
     // orphan old inode if this emplace operation overwrites an existing inode
     {
-        auto name_cursor = rw_transaction()->getRWCursor(db().tree_name_key_db());
-        std::string key;
-        key.resize(sizeof(ino_t) + name.length());
-        memcpy(&key[0], &parent, sizeof(ino_t));
-        memcpy(&key[sizeof(ino_t)], name.data(), name.length());
-
         MDBOutVal key_out{};
         MDBOutVal value_out{};
-        if (name_cursor.find(key, key_out, value_out) != MDB_NOTFOUND) {
-            ino_t old_ino;
-            {
-                auto parse_result = DirEntry::parse_inplace(view(value_out));
-                assert(parse_result);
-                old_ino = std::get<0>(*parse_result)->entry_ino;
-            }
+        auto find_result = find_entry(parent, name);
+        if (find_result) {
+            const ino_t old_ino = *find_result;
             // now we have to check whether the format differs
             auto ino_cursor = rw_transaction()->getRWCursor(db().inodes_db());
             assert(ino_cursor.find(old_ino, key_out, value_out) == 0);
@@ -925,6 +2344,18 @@ Result<ino_t> CacheTransactionRW::emplace(ino_t parent, std::string_view name,
             assert(old_inode);
             if (((*old_inode)->attr.mode & S_IFMT) == (attrs.mode & S_IFMT)) {
                 // do *not* remove, only update in-place
+                if ((*old_inode)->test_flag(InodeFlag::DIRTY)) {
+                    // the source has not seen our writes yet
+                    inode.attr.common.size = (*old_inode)->attr.common.size;
+                    inode.attr.common.mtime = (*old_inode)->attr.common.mtime;
+                    inode.set_flag(InodeFlag::DIRTY);
+                }
+                if ((*old_inode)->test_flag(InodeFlag::PINNED)) {
+                    inode.set_flag(InodeFlag::PINNED);
+                }
+                // keep the chunk size chosen earlier, but let it grow with
+                // the file
+                inode.chunk_shift = std::max(inode.chunk_shift, (*old_inode)->chunk_shift);
                 const auto buf = serialize_as<char>(inode);
                 ino_cursor.put(key_out, buf);
                 if (m_rewrite_inode_set) {
@@ -937,8 +2368,15 @@ Result<ino_t> CacheTransactionRW::emplace(ino_t parent, std::string_view name,
                 return make_result(old_ino);
             }
 
-            // if orphaning won't work, we can't be saved anyways
-            (void)make_orphan(old_ino);
+            // if orphaning won't work, we can't be saved anyways
+            (void)make_orphan(old_ino);
+        }
+    }
+
+    {
+        auto limit_result = enforce_limits(parent, 1, 0);
+        if (!limit_result) {
+            return copy_error(limit_result);
         }
     }
 
@@ -949,6 +2387,7 @@ Result<ino_t> CacheTransactionRW::emplace(ino_t parent, std::string_view name,
         MDBInVal key(ino);
         const auto buf = serialize_as<char>(inode);
         rw_transaction()->put(db().inodes_db(), key, buf);
+        adjust_counter(META_KEY_INODES, 1);
     }
 
     std::basic_string<std::byte> direntry_buffer;
@@ -962,21 +2401,11 @@ Result<ino_t> CacheTransactionRW::emplace(ino_t parent, std::string_view name,
                                    direntry_buffer.size());
 
     // write directory entry pair
-    std::basic_string<std::byte> key_buf;
-    {
-        key_buf.resize(sizeof(ino_t) + name.length());
-        memcpy(&key_buf[0], &parent, sizeof(ino_t));
-        memcpy(&key_buf[sizeof(ino_t)], name.data(), name.length());
-        std::string_view key(reinterpret_cast<char*>(key_buf.data()), key_buf.size());
-        rw_transaction()->put(db().tree_name_key_db(), key, direntry_view);
-    }
+    put_index_entry(parent, name, ino, direntry_view);
 
     {
-        key_buf.resize(sizeof(ino_t)*2);
-        memcpy(&key_buf[0], &parent, sizeof(ino_t));
-        memcpy(&key_buf[sizeof(ino_t)], &ino, sizeof(ino_t));
-        std::string_view key(reinterpret_cast<char*>(key_buf.data()), key_buf.size());
-        rw_transaction()->put(db().tree_inode_key_db(), key, direntry_view);
+        const std::array<std::uint64_t, 2> key{{parent, ino}};
+        rw_transaction()->put(db().tree_inode_key_db(), key_view(key), direntry_view);
     }
 
     (void)clean_orphans();
@@ -1000,91 +2429,453 @@ Result<void> CacheTransactionRW::unlink(ino_t parent, ino_t child)
 
 Result<void> CacheTransactionRW::unlink(ino_t parent, std::string_view name)
 {
-    auto cursor = rw_transaction()->getRWCursor(db().tree_name_key_db());
-    std::string key_buffer;
-    key_buffer.resize(sizeof(ino_t) + name.length());
-    memcpy(&key_buffer[0], &parent, sizeof(ino_t));
-    memcpy(&key_buffer[sizeof(ino_t)], name.data(), name.length());
-
-    MDBOutVal key_out{};
-    MDBOutVal value_out{};
-    if (cursor.find(key_buffer, key_out, value_out) != 0) {
-        return make_result(FAILED, ENOENT);
+    auto find_result = find_entry(parent, name);
+    if (!find_result) {
+        return copy_error(find_result);
     }
 
-    auto parse_result = DirEntry::parse_inplace(view(value_out));
-    assert(parse_result);
-    auto orphan_result = make_orphan(std::get<0>(*parse_result)->entry_ino);
+    auto orphan_result = make_orphan(*find_result);
     if (!orphan_result) {
         return copy_error(orphan_result);
     }
     return clean_orphans();
 }
 
+Result<void> CacheTransactionRW::rename(ino_t parent, std::string_view name,
+                                        ino_t new_parent, std::string_view new_name)
+{
+    {
+        auto name_ok = db().check_name(new_name, true);
+        if (!name_ok) {
+            return name_ok;
+        }
+    }
+
+    auto find_result = find_entry(parent, name);
+    if (!find_result) {
+        return copy_error(find_result);
+    }
+    const ino_t ino = *find_result;
+    if (parent == new_parent && name == new_name) {
+        return make_result();
+    }
+
+    auto existing = find_entry(new_parent, new_name);
+    if (existing && *existing != ino) {
+        auto orphan_result = make_orphan(*existing);
+        if (!orphan_result) {
+            return orphan_result;
+        }
+    }
+
+    // re-key the entry in both trees; the header of the entry is kept
+    std::basic_string<std::byte> direntry_buffer;
+    {
+        const std::array<std::uint64_t, 2> key{{parent, ino}};
+        MDBOutVal value_out{};
+        if (rw_transaction()->get(db().tree_inode_key_db(), key_view(key),
+                                  value_out) != 0) {
+            return make_result(FAILED, EIO);
+        }
+        const auto old_entry = view(value_out);
+        direntry_buffer.assign(old_entry.data(), DIR_ENTRY_SIZE);
+        direntry_buffer.append(reinterpret_cast<const std::byte*>(new_name.data()),
+                               new_name.size());
+        del_index_entry(parent, name, ino);
+        rw_transaction()->del(db().tree_inode_key_db(), key_view(key));
+    }
+    std::string_view direntry_view(reinterpret_cast<char*>(direntry_buffer.data()),
+                                   direntry_buffer.size());
+    put_index_entry(new_parent, new_name, ino, direntry_view);
+    {
+        const std::array<std::uint64_t, 2> key{{new_parent, ino}};
+        rw_transaction()->put(db().tree_inode_key_db(), key_view(key), direntry_view);
+    }
+
+    if (parent != new_parent) {
+        auto cursor = rw_transaction()->getRWCursor(db().inodes_db());
+        MDBOutVal key_out{};
+        MDBOutVal value_out{};
+        if (cursor.find(ino, key_out, value_out) != 0) {
+            return make_result(FAILED, EIO);
+        }
+        auto inode = inode_from_lmdb(value_out);
+        if (!inode) {
+            return copy_error(inode);
+        }
+        inode->parent = new_parent;
+        const auto buf = serialize_as<char>(*inode);
+        cursor.put(key_out, buf);
+    }
+
+    return clean_orphans();
+}
+
 Result<void> CacheTransactionRW::clean_orphans()
 {
-    auto &inode_locks = inode_in_memory_locks();
+    auto result = reap_orphans(ORPHAN_REAP_BATCH);
+    if (!result) {
+        return copy_error(result);
+    }
+    return make_result();
+}
+
+Result<std::size_t> CacheTransactionRW::reap_orphans(std::size_t limit)
+{
+    std::size_t reaped = 0;
     auto cursor = rw_transaction()->getRWCursor(db().orphan_db());
     MDBOutVal key_out{};
     MDBOutVal value_out{};
     int rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
-    while (rc == 0)
+    while (rc == 0 && reaped < limit)
     {
         const auto ino = key_out.get<ino_t>();
-        const auto doom_result = inode_locks.doom(ino);
-        if (!doom_result) {
+        if (!reap_one(ino)) {
             // cannot doom -> need to skip
             rc = cursor.nextprev(key_out, value_out, MDB_NEXT);
             continue;
         }
+        ++reaped;
+        // XXX: this is very inefficient, but there doesn’t seem to be a safe
+        // way to detect when the last item has been deleted...?
+        rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
+    }
+    return reaped;
+}
+
+bool CacheTransactionRW::reap_one(ino_t ino)
+{
+    const auto doom_result = inode_in_memory_locks().doom(ino);
+    if (!doom_result) {
+        return false;
+    }
+
+    // TODO: clean up data associated with the inode:
+    // - DONE: for S_IFDIR: orphan child inodes recursively
+    // - DONE: for S_IFREG: delete cached blocks, release quota
+    // - DONE: for S_IFLNK: delete link destination entry
+    {
+        auto inode_cursor = rw_transaction()->getCursor(db().inodes_db());
+        MDBOutVal key_out{};
+        MDBOutVal value_out{};
+        if (inode_cursor.find(ino, key_out, value_out) == 0) {
+            auto inode_res = inode_from_lmdb_inplace(value_out);
+            if (inode_res) {
+                switch ((*inode_res)->attr.mode & S_IFMT)
+                {
+                case S_IFLNK:
+                {
+                    rw_transaction()->del(db().links_db(), ino);
+                    break;
+                }
+                case S_IFREG:
+                {
+                    const auto &data_path = db().data_path();
+                    const auto bytes = -static_cast<std::int64_t>(
+                                RegularFileHandle::cached_bytes(data_path, ino));
+                    account_bytes(bytes, (*inode_res)->test_flag(InodeFlag::PINNED) ? bytes : 0);
+                    rw_transaction()->del(db().traces_db(), ino);
+                    // the data must survive if the transaction is rolled
+                    // back, so it is only deleted once it is committed
+                    add_transaction_hook(nullptr, nullptr, [data_path, ino](){
+                        RegularFileHandle::remove(data_path, ino);
+                    }, nullptr);
+                    break;
+                }
+                case S_IFDIR:
+                {
+                    // orphan all child entries of this directory
+                    auto dir_cursor = rw_transaction()->getCursor(db().tree_inode_key_db());
+                    while (dir_cursor.lower_bound(ino, key_out, value_out) == 0) {
+                        ino_t found_parent_ino;
+                        memcpy(&found_parent_ino, key_out.d_mdbval.mv_data, sizeof(ino_t));
+                        if (found_parent_ino != ino) {
+                            // no more entries in this directory!
+                            break;
+                        }
+
+                        auto direntry_result = DirEntry::parse(view(value_out));
+                        assert(direntry_result);
+                        const ino_t found_child_ino = std::get<0>(*direntry_result).entry_ino;
+                        (void)make_orphan(found_child_ino);
+                    }
+                }
+                default:;
+                }
+            }
+            inode_cursor.del();
+            adjust_counter(META_KEY_INODES, -1);
+        }
+    }
+    rw_transaction()->del(db().orphan_db(), ino);
+    return true;
+}
+
+std::uint64_t CacheTransactionRW::drop_file_data(ino_t ino)
+{
+    auto attr_result = getattr(ino);
+    if (!attr_result || !S_ISREG(attr_result->attr.mode)) {
+        return 0;
+    }
+    const auto &data_path = db().data_path();
+    const std::uint64_t bytes = RegularFileHandle::cached_bytes(data_path, ino);
+    if (bytes == 0) {
+        return 0;
+    }
+    // evictable files are not pinned
+    account_bytes(-static_cast<std::int64_t>(bytes), 0);
+    // as in reap_one(), the data must survive a rollback
+    add_transaction_hook(nullptr, nullptr, [data_path, ino](){
+        RegularFileHandle::remove(data_path, ino);
+    }, nullptr);
+    return bytes;
+}
+
+void CacheTransactionRW::account_bytes(std::int64_t cached, std::int64_t pinned)
+{
+    adjust_counter(META_KEY_CACHED_BYTES, cached);
+    adjust_counter(META_KEY_PINNED_BYTES, pinned);
+}
+
+void CacheTransactionRW::account_file_bytes(ino_t ino, std::int64_t cached)
+{
+    if (cached == 0) {
+        return;
+    }
+    if (cached > 0) {
+        // the data is in the cache already; if not enough can be evicted,
+        // the limit is exceeded until the next attempt
+        (void)enforce_limits(ino, 0, static_cast<std::uint64_t>(cached));
+    }
+    auto pinned = test_flag(ino, InodeFlag::PINNED);
+    account_bytes(cached, pinned && *pinned ? cached : 0);
+}
+
+Result<void> CacheTransactionRW::set_pinned(ino_t ino, bool pinned)
+{
+    auto attr_result = getattr(ino);
+    if (!attr_result) {
+        return copy_error(attr_result);
+    }
+    if (!S_ISREG(attr_result->attr.mode)) {
+        return make_result(FAILED, EINVAL);
+    }
+    auto flag_result = test_flag(ino, InodeFlag::PINNED);
+    if (!flag_result) {
+        return copy_error(flag_result);
+    }
+    if (*flag_result == pinned) {
+        return make_result();
+    }
+
+    auto update_result = pinned
+            ? update_flags(ino, {InodeFlag::PINNED})
+            : update_flags(ino, {}, {InodeFlag::PINNED});
+    if (!update_result) {
+        return update_result;
+    }
+    const auto bytes = static_cast<std::int64_t>(
+                RegularFileHandle::cached_bytes(db().data_path(), ino));
+    adjust_counter(META_KEY_PINNED_BYTES, pinned ? bytes : -bytes);
+    return make_result();
+}
+
+void CacheTransactionRW::persist_access_sketch()
+{
+    const auto snapshot = db().access_sketch().serialize();
+    rw_transaction()->put(
+                db().meta_db(), META_KEY_ACCESS_SKETCH,
+                std::string_view(reinterpret_cast<const char*>(snapshot.data()),
+                                 snapshot.size()));
+    db().access_sketch_persisted() = std::chrono::steady_clock::now();
+}
+
+void CacheTransactionRW::adjust_counter(std::string_view key, std::int64_t delta)
+{
+    if (delta == 0) {
+        return;
+    }
+    MDBOutVal value{};
+    std::uint64_t counter = 0;
+    if (rw_transaction()->get(db().meta_db(), key, value) == 0) {
+        counter = value.get<std::uint64_t>();
+    }
+    if (delta < 0) {
+        safe_dec(counter, static_cast<std::uint64_t>(-delta));
+    } else {
+        counter += static_cast<std::uint64_t>(delta);
+    }
+    rw_transaction()->put(db().meta_db(), key, counter);
+}
+
+bool CacheTransactionRW::is_evictable(ino_t ino, ino_t protect)
+{
+    if (ino == ROOT_INO || ino == protect) {
+        return false;
+    }
+
+    if (inode_in_memory_locks().refcount(ino) > 0) {
+        return false;
+    }
+
+    MDBOutVal value{};
+    if (rw_transaction()->get(db().inodes_db(), ino, value) != 0) {
+        return false;
+    }
+    ino_t parent;
+    {
+        auto inode = inode_from_lmdb_inplace(value);
+        if (!inode) {
+            return false;
+        }
+        parent = (*inode)->parent;
+        if (parent == INVALID_INO || parent == protect ||
+                (*inode)->test_flag(InodeFlag::PINNED)) {
+            // orphans are reaped by clean_orphans() as soon as possible
+            return false;
+        }
+
+        if ((*inode)->test_flag(InodeFlag::DIRTY)) {
+            // evicting would lose data which only exists in the cache
+            return false;
+        }
+
+        if (((*inode)->attr.mode & S_IFMT) == S_IFDIR) {
+            // only empty directories
+            const std::array<std::uint64_t, 2> key{{ino, 0}};
+            auto cursor = rw_transaction()->getCursor(db().tree_inode_key_db());
+            MDBOutVal key_out{};
+            MDBOutVal value_out{};
+            if (cursor.lower_bound(key_view(key), key_out, value_out) == 0 &&
+                    key_out.get_struct<std::array<std::uint64_t, 2>>()[0] == ino) {
+                return false;
+            }
+        }
+    }
+
+    // anything below a pinned directory is pinned, too
+    while (parent != ROOT_INO && parent != INVALID_INO) {
+        auto pinned = test_flag(parent, InodeFlag::PINNED);
+        if (!pinned || *pinned) {
+            return false;
+        }
+        auto next = this->parent(parent);
+        if (!next) {
+            return false;
+        }
+        parent = *next;
+    }
+    return true;
+}
+
+Result<void> CacheTransactionRW::enforce_limits(ino_t protect,
+                                                std::uint64_t extra_inodes,
+                                                std::uint64_t extra_bytes)
+{
+    const std::uint64_t max_inodes = db().max_inodes();
+    const std::uint64_t max_bytes = db().max_bytes();
+    if (max_inodes == 0 && max_bytes == 0) {
+        return make_result();
+    }
 
+    auto usage_result = usage();
+    if (!usage_result) {
+        return copy_error(usage_result);
+    }
+    // a caller only answers for the limits it adds to: creating an inode
+    // must not fail because too much data is cached, and vice versa
+    auto over_inode_limit = [&usage_result, max_inodes, extra_inodes](){
+        return extra_inodes > 0 && max_inodes > 0 &&
+                usage_result->inodes + extra_inodes > max_inodes;
+    };
+    auto over_byte_limit = [&usage_result, max_bytes, extra_bytes](){
+        return extra_bytes > 0 && max_bytes > 0 &&
+                usage_result->cached_bytes + extra_bytes > max_bytes;
+    };
+    auto over_limit = [&over_inode_limit, &over_byte_limit](){
+        return over_inode_limit() || over_byte_limit();
+    };
 
-        // TODO: clean up data associated with the inode:
-        // - DONE: for S_IFDIR: orphan child inodes recursively
-        // - for S_IFREG: delete cached blocks, release quota
-        // - DONE: for S_IFLNK: delete link destination entry
+    ino_t &hand = db().eviction_hand();
+    bool wrapped = false;
+    std::size_t examined = 0;
+    while (over_limit() && examined < EVICTION_SCAN_LIMIT) {
+        ino_t candidate;
         {
-            auto inode_cursor = rw_transaction()->getCursor(db().inodes_db());
+            auto cursor = rw_transaction()->getCursor(db().inodes_db());
             MDBOutVal key_out{};
             MDBOutVal value_out{};
-            if (inode_cursor.find(ino, key_out, value_out) == 0) {
-                auto inode_res = inode_from_lmdb_inplace(value_out);
-                if (inode_res) {
-                    switch ((*inode_res)->attr.mode & S_IFMT)
-                    {
-                    case S_IFLNK:
-                    {
-                        rw_transaction()->del(db().links_db(), ino);
-                        break;
-                    }
-                    case S_IFDIR:
-                    {
-                        // orphan all child entries of this directory
-                        auto dir_cursor = rw_transaction()->getCursor(db().tree_inode_key_db());
-                        while (dir_cursor.lower_bound(ino, key_out, value_out) == 0) {
-                            ino_t found_parent_ino;
-                            memcpy(&found_parent_ino, key_out.d_mdbval.mv_data, sizeof(ino_t));
-                            if (found_parent_ino != ino) {
-                                // no more entries in this directory!
-                                break;
-                            }
-
-                            auto direntry_result = DirEntry::parse(view(value_out));
-                            assert(direntry_result);
-                            const ino_t found_child_ino = std::get<0>(*direntry_result).entry_ino;
-                            (void)make_orphan(found_child_ino);
-                        }
-                    }
-                    default:;
-                    }
+            int rc;
+            if (hand == INVALID_INO) {
+                rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
+            } else {
+                rc = cursor.lower_bound(hand, key_out, value_out);
+                if (rc == 0 && key_out.get<ino_t>() == hand) {
+                    rc = cursor.nextprev(key_out, value_out, MDB_NEXT);
+                }
+            }
+            if (rc != 0) {
+                if (wrapped) {
+                    break;
                 }
-                inode_cursor.del();
+                wrapped = true;
+                hand = INVALID_INO;
+                // everything which has not been accessed since now is cold
+                // at the next pass
+                db().access_sketch().advance();
+                const auto now = std::chrono::steady_clock::now();
+                if (now - db().access_sketch_persisted() >= ACCESS_SKETCH_PERSIST_INTERVAL) {
+                    persist_access_sketch();
+                }
+                continue;
             }
+            candidate = key_out.get<ino_t>();
         }
-        cursor.del();
-        // XXX: this is very inefficient, but there doesn’t seem to be a safe
-        // way to detect when the last item has been deleted...?
-        rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
+        hand = candidate;
+        examined += 1;
+
+        if (db().access_sketch().age(candidate) == 0) {
+            // second chance
+            continue;
+        }
+
+        if (!is_evictable(candidate, protect)) {
+            continue;
+        }
+
+        if (!over_inode_limit()) {
+            // only the data is in the way; keep the metadata
+            if (drop_file_data(candidate) == 0) {
+                continue;
+            }
+            usage_result = usage();
+            if (!usage_result) {
+                return copy_error(usage_result);
+            }
+            continue;
+        }
+
+        auto parent_result = this->parent(candidate);
+        if (!parent_result) {
+            continue;
+        }
+        if (!make_orphan(candidate)) {
+            continue;
+        }
+        // the directory is no longer complete in the cache
+        (void)update_flags(*parent_result, {}, {InodeFlag::SYNCED});
+        // reap it right away; clean_orphans() might spend its batch on older
+        // orphans which are still locked
+        (void)reap_one(candidate);
+
+        usage_result = usage();
+        if (!usage_result) {
+            return copy_error(usage_result);
+        }
+    }
+
+    if (over_limit()) {
+        return make_result(FAILED, ENOSPC);
     }
     return make_result();
 }
@@ -1114,6 +2905,58 @@ Result<void> CacheTransactionRW::writelink(ino_t ino, std::string_view dest)
     return make_result();
 }
 
+Result<void> CacheTransactionRW::setattr(ino_t ino, const CommonFileAttributes &attrs)
+{
+    auto cursor = rw_transaction()->getRWCursor(db().inodes_db());
+    const MDBInVal key_in(ino);
+    MDBOutVal key_out{};
+    MDBOutVal value_out{};
+
+    if (cursor.find(key_in, key_out, value_out) != 0) {
+        return make_result(FAILED, ENOENT);
+    }
+
+    auto inode = inode_from_lmdb(value_out);
+    if (!inode) {
+        return copy_error(inode);
+    }
+
+    inode->attr.common = attrs;
+    if ((inode->attr.mode & S_IFMT) == S_IFREG) {
+        inode->chunk_shift = std::max(inode->chunk_shift,
+                                      db().chunk_shift_for(attrs.size));
+    }
+
+    const auto buf = serialize_as<char>(*inode);
+    cursor.put(key_out, buf);
+
+    return make_result();
+}
+
+Result<void> CacheTransactionRW::chmod(ino_t ino, std::uint32_t mode)
+{
+    auto cursor = rw_transaction()->getRWCursor(db().inodes_db());
+    const MDBInVal key_in(ino);
+    MDBOutVal key_out{};
+    MDBOutVal value_out{};
+
+    if (cursor.find(key_in, key_out, value_out) != 0) {
+        return make_result(FAILED, ENOENT);
+    }
+
+    auto inode = inode_from_lmdb(value_out);
+    if (!inode) {
+        return copy_error(inode);
+    }
+
+    inode->attr.mode = (inode->attr.mode & S_IFMT) | (mode & ~S_IFMT);
+
+    const auto buf = serialize_as<char>(*inode);
+    cursor.put(key_out, buf);
+
+    return make_result();
+}
+
 Result<void> CacheTransactionRW::update_flags(ino_t ino, std::initializer_list<InodeFlag> to_set, std::initializer_list<InodeFlag> to_clear)
 {
     auto cursor = rw_transaction()->getRWCursor(db().inodes_db());
@@ -1191,4 +3034,83 @@ Result<void> CacheTransactionRW::finish_dir_rewrite()
     return make_result();
 }
 
+std::uint64_t CacheTransactionRW::journal_append(const JournalEntry &entry)
+{
+    std::uint64_t seq = 1;
+    {
+        auto cursor = rw_transaction()->getCursor(db().journal_db());
+        MDBOutVal key_out{};
+        MDBOutVal value_out{};
+        if (cursor.nextprev(key_out, value_out, MDB_LAST) == 0) {
+            seq = key_out.get<std::uint64_t>() + 1;
+        }
+    }
+    rw_transaction()->put(db().journal_db(), seq, entry.serialize());
+    return seq;
+}
+
+void CacheTransactionRW::journal_remove(std::uint64_t seq)
+{
+    rw_transaction()->del(db().journal_db(), seq);
+}
+
+Result<std::size_t> CacheTransactionRW::compact_journal()
+{
+    auto records = journal();
+    if (!records) {
+        return copy_error(records);
+    }
+
+    const std::size_t before = records->size();
+    const auto compacted = Dragonstash::compact_journal(std::move(*records));
+    if (compacted.size() == before) {
+        return make_result(std::size_t(0));
+    }
+
+    rw_transaction()->clear(db().journal_db());
+    for (const auto &record: compacted) {
+        rw_transaction()->put(db().journal_db(), record.seq, record.entry.serialize());
+    }
+    return make_result(before - compacted.size());
+}
+
+void CacheTransactionRW::put_chunk(std::uint64_t hash, const ChunkLocation &location)
+{
+    const std::array<std::uint64_t, 2> fields{location.ino, location.block};
+    rw_transaction()->put(db().chunks_db(), hash, key_view(fields));
+}
+
+void CacheTransactionRW::put_trace(ino_t ino, const AccessTrace &trace)
+{
+    rw_transaction()->put(db().traces_db(), ino, trace.serialize());
+}
+
+void CacheTransactionRW::del_trace(ino_t ino)
+{
+    rw_transaction()->del(db().traces_db(), ino);
+}
+
+std::size_t CacheTransactionRW::expire_traces(std::time_t before)
+{
+    std::vector<ino_t> expired;
+    {
+        auto cursor = rw_transaction()->getCursor(db().traces_db());
+        MDBOutVal key_out{};
+        MDBOutVal value_out{};
+        int rc = cursor.nextprev(key_out, value_out, MDB_FIRST);
+        while (rc == 0) {
+            // traces which cannot be parsed are of no use either
+            auto trace = AccessTrace::parse(value_out.get<std::string_view>());
+            if (!trace || trace->recorded_at() < before) {
+                expired.push_back(key_out.get<ino_t>());
+            }
+            rc = cursor.nextprev(key_out, value_out, MDB_NEXT);
+        }
+    }
+    for (const ino_t ino: expired) {
+        rw_transaction()->del(db().traces_db(), ino);
+    }
+    return expired.size();
+}
+
 }
@@ -0,0 +1,221 @@
+/**********************************************************************
+File name: checksum.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/checksum.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace Dragonstash {
+
+/**
+ * CRC32C polynomial, bit-reflected.
+ */
+static constexpr std::uint32_t CRC32C_POLY = 0x82f63b78;
+
+/**
+ * Length of each of the three streams which the accelerated implementation
+ * works on in parallel. Three streams of this length plus a bit fit a cache
+ * block.
+ */
+static constexpr std::size_t STREAM_LENGTH = 1360;
+static_assert(STREAM_LENGTH % 8 == 0);
+
+using CrcTables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+static constexpr CrcTables make_tables()
+{
+    CrcTables tables{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        for (std::size_t k = 1; k < tables.size(); ++k) {
+            const std::uint32_t prev = tables[k - 1][i];
+            tables[k][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+    return tables;
+}
+
+static constexpr CrcTables CRC_TABLES = make_tables();
+
+/**
+ * @brief Advance the raw CRC register over a buffer (slicing-by-8).
+ */
+static std::uint32_t crc32c_update_portable(std::uint32_t crc,
+                                            const std::uint8_t *p,
+                                            std::size_t n)
+{
+    while (n >= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = CRC_TABLES[7][word & 0xff] ^
+                CRC_TABLES[6][(word >> 8) & 0xff] ^
+                CRC_TABLES[5][(word >> 16) & 0xff] ^
+                CRC_TABLES[4][(word >> 24) & 0xff] ^
+                CRC_TABLES[3][(word >> 32) & 0xff] ^
+                CRC_TABLES[2][(word >> 40) & 0xff] ^
+                CRC_TABLES[1][(word >> 48) & 0xff] ^
+                CRC_TABLES[0][word >> 56];
+        p += 8;
+        n -= 8;
+    }
+    while (n > 0) {
+        crc = (crc >> 8) ^ CRC_TABLES[0][(crc ^ *p) & 0xff];
+        ++p;
+        --n;
+    }
+    return crc;
+}
+
+std::uint32_t crc32c_portable(std::uint32_t crc, const void *data, std::size_t n)
+{
+    return ~crc32c_update_portable(~crc, static_cast<const std::uint8_t*>(data), n);
+}
+
+#if defined(__x86_64__)
+
+/**
+ * @brief Tables to advance the raw CRC register over STREAM_LENGTH zero
+ * bytes.
+ *
+ * The register update is linear, so the register after A || B equals the
+ * register after A advanced over |B| zero bytes, xor the register after B
+ * when starting from zero. This is how the three streams are combined.
+ */
+using ShiftTables = std::array<std::array<std::uint32_t, 256>, 4>;
+
+static ShiftTables make_shift_tables()
+{
+    static const std::array<std::uint8_t, STREAM_LENGTH> zeroes{};
+    ShiftTables tables{};
+    for (std::size_t k = 0; k < tables.size(); ++k) {
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            tables[k][i] = crc32c_update_portable(i << (8 * k), zeroes.data(),
+                                                  zeroes.size());
+        }
+    }
+    return tables;
+}
+
+static const ShiftTables SHIFT_TABLES = make_shift_tables();
+
+static inline std::uint32_t shift(std::uint32_t crc)
+{
+    return SHIFT_TABLES[0][crc & 0xff] ^
+            SHIFT_TABLES[1][(crc >> 8) & 0xff] ^
+            SHIFT_TABLES[2][(crc >> 16) & 0xff] ^
+            SHIFT_TABLES[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static std::uint32_t crc32c_update_sse42(std::uint32_t crc,
+                                         const std::uint8_t *p,
+                                         std::size_t n)
+{
+    auto load = [](const std::uint8_t *src) {
+        std::uint64_t word;
+        std::memcpy(&word, src, sizeof(word));
+        return word;
+    };
+
+    // the crc32 instruction has a latency of three cycles, but a throughput
+    // of one per cycle; interleaving three independent streams keeps it busy
+    while (n >= 3 * STREAM_LENGTH) {
+        std::uint64_t crc0 = crc;
+        std::uint64_t crc1 = 0;
+        std::uint64_t crc2 = 0;
+        for (std::size_t i = 0; i < STREAM_LENGTH; i += 8) {
+            crc0 = _mm_crc32_u64(crc0, load(p + i));
+            crc1 = _mm_crc32_u64(crc1, load(p + STREAM_LENGTH + i));
+            crc2 = _mm_crc32_u64(crc2, load(p + 2 * STREAM_LENGTH + i));
+        }
+        crc = shift(shift(static_cast<std::uint32_t>(crc0))
+                    ^ static_cast<std::uint32_t>(crc1))
+                ^ static_cast<std::uint32_t>(crc2);
+        p += 3 * STREAM_LENGTH;
+        n -= 3 * STREAM_LENGTH;
+    }
+
+    std::uint64_t crc64 = crc;
+    while (n >= 8) {
+        crc64 = _mm_crc32_u64(crc64, load(p));
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<std::uint32_t>(crc64);
+    while (n > 0) {
+        crc = _mm_crc32_u8(crc, *p);
+        ++p;
+        --n;
+    }
+    return crc;
+}
+
+// initialised after SHIFT_TABLES; callers from other static initialisers
+// which run earlier get the portable implementation
+static const bool HAVE_SSE42 = [](){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") != 0;
+}();
+
+std::uint32_t crc32c(std::uint32_t crc, const void *data, std::size_t n)
+{
+    const auto *p = static_cast<const std::uint8_t*>(data);
+    if (HAVE_SSE42) {
+        return ~crc32c_update_sse42(~crc, p, n);
+    }
+    return ~crc32c_update_portable(~crc, p, n);
+}
+
+bool crc32c_accelerated()
+{
+    return HAVE_SSE42;
+}
+
+#else
+
+std::uint32_t crc32c(std::uint32_t crc, const void *data, std::size_t n)
+{
+    return crc32c_portable(crc, data, n);
+}
+
+bool crc32c_accelerated()
+{
+    return false;
+}
+
+#endif
+
+}
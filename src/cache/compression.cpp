@@ -0,0 +1,236 @@
+/**********************************************************************
+File name: compression.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/compression.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+#ifdef DRAGONSTASH_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef DRAGONSTASH_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace Dragonstash {
+
+/**
+ * Number and size of the windows looked at by sample_entropy().
+ */
+static constexpr std::size_t ENTROPY_WINDOWS = 16;
+static constexpr std::size_t ENTROPY_WINDOW_SIZE = 256;
+
+#ifdef DRAGONSTASH_WITH_ZSTD
+/**
+ * Compression is done inline with fetching data, so speed matters more than
+ * the last few percent of ratio.
+ */
+static constexpr int ZSTD_LEVEL = 1;
+
+struct ZstdContextDeleter {
+    void operator()(ZSTD_CCtx *ctx) const {
+        ZSTD_freeCCtx(ctx);
+    }
+
+    void operator()(ZSTD_DCtx *ctx) const {
+        ZSTD_freeDCtx(ctx);
+    }
+};
+
+// contexts are expensive to set up; keep one per thread
+static thread_local std::unique_ptr<ZSTD_CCtx, ZstdContextDeleter> zstd_cctx;
+static thread_local std::unique_ptr<ZSTD_DCtx, ZstdContextDeleter> zstd_dctx;
+#endif
+
+bool compression_available(Compression algorithm)
+{
+    switch (algorithm) {
+    case Compression::NONE:
+        return true;
+    case Compression::LZ4:
+#ifdef DRAGONSTASH_WITH_LZ4
+        return true;
+#else
+        return false;
+#endif
+    case Compression::ZSTD:
+#ifdef DRAGONSTASH_WITH_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+double sample_entropy(const std::byte *data, std::size_t n)
+{
+    if (n == 0) {
+        return 0.0;
+    }
+
+    std::array<std::uint32_t, 256> histogram{};
+    const std::size_t windows = std::min(
+                ENTROPY_WINDOWS,
+                (n + ENTROPY_WINDOW_SIZE - 1) / ENTROPY_WINDOW_SIZE);
+    const std::size_t stride = n / windows;
+    std::size_t total = 0;
+    for (std::size_t window = 0; window < windows; ++window) {
+        const std::byte *begin = data + window * stride;
+        const std::size_t len = std::min(ENTROPY_WINDOW_SIZE, n - window * stride);
+        for (std::size_t i = 0; i < len; ++i) {
+            ++histogram[static_cast<std::uint8_t>(begin[i])];
+        }
+        total += len;
+    }
+
+    double result = 0.0;
+    for (std::uint32_t count: histogram) {
+        if (count == 0) {
+            continue;
+        }
+        const double p = static_cast<double>(count) / total;
+        result -= p * std::log2(p);
+    }
+    return result;
+}
+
+Result<std::size_t> compress(Compression algorithm,
+                             const std::byte *src, std::size_t n,
+                             std::byte *dest, std::size_t capacity)
+{
+    switch (algorithm) {
+    case Compression::NONE:
+        break;
+    case Compression::LZ4:
+    {
+#ifdef DRAGONSTASH_WITH_LZ4
+        if (n > static_cast<std::size_t>(LZ4_MAX_INPUT_SIZE)) {
+            return make_result(std::size_t(0));
+        }
+        const int result = LZ4_compress_default(
+                    reinterpret_cast<const char*>(src),
+                    reinterpret_cast<char*>(dest),
+                    static_cast<int>(n),
+                    static_cast<int>(std::min<std::size_t>(
+                                         capacity, std::numeric_limits<int>::max())));
+        // zero means that the output did not fit
+        return make_result(static_cast<std::size_t>(std::max(result, 0)));
+#else
+        break;
+#endif
+    }
+    case Compression::ZSTD:
+    {
+#ifdef DRAGONSTASH_WITH_ZSTD
+        if (!zstd_cctx) {
+            zstd_cctx.reset(ZSTD_createCCtx());
+            if (!zstd_cctx) {
+                return make_result(FAILED, ENOMEM);
+            }
+        }
+        const std::size_t result = ZSTD_compressCCtx(zstd_cctx.get(),
+                                                     dest, capacity,
+                                                     src, n, ZSTD_LEVEL);
+        if (ZSTD_isError(result)) {
+            // the only error we can reasonably run into
+            return make_result(std::size_t(0));
+        }
+        return make_result(result);
+#else
+        break;
+#endif
+    }
+    }
+    return make_result(FAILED, EOPNOTSUPP);
+}
+
+Result<std::size_t> decompress(Compression algorithm,
+                               const std::byte *src, std::size_t n,
+                               std::byte *dest, std::size_t capacity)
+{
+    switch (algorithm) {
+    case Compression::NONE:
+        break;
+    case Compression::LZ4:
+    {
+#ifdef DRAGONSTASH_WITH_LZ4
+        const int result = LZ4_decompress_safe(
+                    reinterpret_cast<const char*>(src),
+                    reinterpret_cast<char*>(dest),
+                    static_cast<int>(std::min<std::size_t>(
+                                         n, std::numeric_limits<int>::max())),
+                    static_cast<int>(std::min<std::size_t>(
+                                         capacity, std::numeric_limits<int>::max())));
+        if (result < 0) {
+            return make_result(FAILED, EIO);
+        }
+        return make_result(static_cast<std::size_t>(result));
+#else
+        break;
+#endif
+    }
+    case Compression::ZSTD:
+    {
+#ifdef DRAGONSTASH_WITH_ZSTD
+        if (!zstd_dctx) {
+            zstd_dctx.reset(ZSTD_createDCtx());
+            if (!zstd_dctx) {
+                return make_result(FAILED, ENOMEM);
+            }
+        }
+        const std::size_t result = ZSTD_decompressDCtx(zstd_dctx.get(),
+                                                       dest, capacity,
+                                                       src, n);
+        if (ZSTD_isError(result)) {
+            return make_result(FAILED, EIO);
+        }
+        return make_result(result);
+#else
+        break;
+#endif
+    }
+    }
+    return make_result(FAILED, EOPNOTSUPP);
+}
+
+CompressionStats CompressionCounters::load() const
+{
+    return CompressionStats{
+        .probed_bytes = probed_bytes.load(std::memory_order_relaxed),
+        .skipped_bytes = skipped_bytes.load(std::memory_order_relaxed),
+        .compressed_bytes = compressed_bytes.load(std::memory_order_relaxed),
+        .stored_bytes = stored_bytes.load(std::memory_order_relaxed),
+        .compress_ns = compress_ns.load(std::memory_order_relaxed),
+        .decompressed_bytes = decompressed_bytes.load(std::memory_order_relaxed),
+        .decompress_ns = decompress_ns.load(std::memory_order_relaxed),
+    };
+}
+
+}
@@ -0,0 +1,276 @@
+/**********************************************************************
+File name: dedup.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/dedup.hpp"
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "dragonstash/cache/blocklist.hpp"
+
+namespace Dragonstash {
+
+static constexpr std::uint64_t XXH_PRIME64_1 = 0x9e3779b185ebca87ULL;
+static constexpr std::uint64_t XXH_PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+static constexpr std::uint64_t XXH_PRIME64_3 = 0x165667b19e3779f9ULL;
+static constexpr std::uint64_t XXH_PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+static constexpr std::uint64_t XXH_PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+/**
+ * Number of extents fetched per FIEMAP call.
+ */
+static constexpr std::size_t FIEMAP_BATCH = 256;
+
+static inline std::uint64_t rotl64(std::uint64_t x, unsigned r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline std::uint64_t read64(const std::byte *p)
+{
+    std::uint64_t result;
+    std::memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+static inline std::uint32_t read32(const std::byte *p)
+{
+    std::uint32_t result;
+    std::memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+static inline std::uint64_t xxh64_round(std::uint64_t acc, std::uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline std::uint64_t xxh64_merge(std::uint64_t acc, std::uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+std::uint64_t chunk_hash(const std::byte *data, std::size_t n)
+{
+    // reads are little endian; like the rest of the on-disk format, the hash
+    // is only stable on little endian hosts
+    const std::byte *p = data;
+    const std::byte *const end = data + n;
+    std::uint64_t h;
+
+    if (n >= 32) {
+        // four independent lanes, which keeps the multipliers busy
+        std::uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+        std::uint64_t v2 = XXH_PRIME64_2;
+        std::uint64_t v3 = 0;
+        std::uint64_t v4 = -XXH_PRIME64_1;
+        const std::byte *const limit = end - 32;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = XXH_PRIME64_5;
+    }
+
+    h += n;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<std::uint64_t>(read32(p)) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= static_cast<std::uint64_t>(*p) * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+Result<std::size_t> share_range(int src_fd, off_t src_off,
+                                int dest_fd, off_t dest_off,
+                                std::size_t n)
+{
+    // struct file_dedupe_range ends in a flexible array with one entry per
+    // destination
+    std::uint64_t buffer[(sizeof(struct file_dedupe_range)
+                          + sizeof(struct file_dedupe_range_info)
+                          + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t)];
+    auto *range = reinterpret_cast<struct file_dedupe_range*>(buffer);
+    struct file_dedupe_range_info &info = range->info[0];
+
+    std::size_t done = 0;
+    while (done < n) {
+        std::memset(buffer, 0, sizeof(buffer));
+        range->src_offset = src_off + done;
+        range->src_length = n - done;
+        range->dest_count = 1;
+        info.dest_fd = dest_fd;
+        info.dest_offset = dest_off + done;
+        if (::ioctl(src_fd, FIDEDUPERANGE, range) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return make_result(FAILED, errno);
+        }
+        if (info.status == FILE_DEDUPE_RANGE_DIFFERS) {
+            break;
+        }
+        if (info.status < 0) {
+            return make_result(FAILED, -info.status);
+        }
+        if (info.bytes_deduped == 0) {
+            break;
+        }
+        // file systems may limit the length of a single request
+        done += info.bytes_deduped;
+    }
+    return make_result(done);
+}
+
+/**
+ * @brief Total length of the union of a set of intervals.
+ */
+static std::uint64_t union_length(
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> &intervals)
+{
+    std::sort(intervals.begin(), intervals.end());
+    std::uint64_t result = 0;
+    std::uint64_t covered_until = 0;
+    for (const auto &[start, length]: intervals) {
+        const std::uint64_t end = start + length;
+        if (end <= covered_until) {
+            continue;
+        }
+        result += end - std::max(start, covered_until);
+        covered_until = end;
+    }
+    return result;
+}
+
+Result<StorageUsage> measure_storage(const std::filesystem::path &data_dir)
+{
+    StorageUsage result{};
+    // physical location and length of shared extents, which must only be
+    // counted once
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> shared;
+
+    const std::size_t buffer_size = sizeof(struct fiemap)
+            + FIEMAP_BATCH * sizeof(struct fiemap_extent);
+    auto buffer = std::make_unique<std::uint64_t[]>(
+                (buffer_size + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+    auto *map = reinterpret_cast<struct fiemap*>(buffer.get());
+
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::directory_iterator(data_dir, ec)) {
+        if (!entry.is_regular_file(ec)) {
+            continue;
+        }
+        FileHandle fd(::open(entry.path().c_str(), O_RDONLY | O_CLOEXEC));
+        if (!fd) {
+            // evicted while we were looking
+            continue;
+        }
+
+        bool mapped = true;
+        std::uint64_t start = 0;
+        for (;;) {
+            std::memset(map, 0, buffer_size);
+            map->fm_start = start;
+            map->fm_length = FIEMAP_MAX_OFFSET - start;
+            map->fm_extent_count = FIEMAP_BATCH;
+            if (::ioctl(int(fd), FS_IOC_FIEMAP, map) != 0) {
+                mapped = false;
+                break;
+            }
+            if (map->fm_mapped_extents == 0) {
+                break;
+            }
+            for (std::uint32_t i = 0; i < map->fm_mapped_extents; ++i) {
+                const struct fiemap_extent &extent = map->fm_extents[i];
+                result.logical_bytes += extent.fe_length;
+                if ((extent.fe_flags & FIEMAP_EXTENT_SHARED)
+                        && !(extent.fe_flags & FIEMAP_EXTENT_UNKNOWN)) {
+                    shared.emplace_back(extent.fe_physical, extent.fe_length);
+                } else {
+                    result.physical_bytes += extent.fe_length;
+                }
+            }
+            const struct fiemap_extent &last = map->fm_extents[map->fm_mapped_extents - 1];
+            if (last.fe_flags & FIEMAP_EXTENT_LAST) {
+                break;
+            }
+            start = last.fe_logical + last.fe_length;
+        }
+
+        if (!mapped) {
+            // no extent information; assume nothing is shared
+            struct stat st{};
+            if (::fstat(int(fd), &st) == 0) {
+                result.logical_bytes += st.st_blocks * 512;
+                result.physical_bytes += st.st_blocks * 512;
+            }
+        }
+    }
+    if (ec) {
+        return make_result(FAILED, ec.value());
+    }
+
+    result.physical_bytes += union_length(shared);
+    return make_result(result);
+}
+
+}
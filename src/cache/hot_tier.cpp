@@ -0,0 +1,317 @@
+/**********************************************************************
+File name: hot_tier.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/hot_tier.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace Dragonstash {
+
+/**
+ * Saturation value of the access counters; a block which has been read this
+ * often is as hot as it gets.
+ */
+static constexpr std::uint8_t HOT_TIER_MAX_FREQUENCY = 15;
+
+/**
+ * Number of counters per slot of the arena.
+ */
+static constexpr std::size_t HOT_TIER_COUNTERS_PER_SLOT = 4;
+
+static std::uint64_t block_hash(ino_t ino, std::uint64_t block)
+{
+    // splitmix64 finaliser
+    std::uint64_t x = static_cast<std::uint64_t>(ino) * 0x9e3779b97f4a7c15ULL ^ block;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static std::size_t counters_for(std::size_t nslots)
+{
+    std::size_t result = 64;
+    while (result < nslots * HOT_TIER_COUNTERS_PER_SLOT) {
+        result *= 2;
+    }
+    return result;
+}
+
+/* Dragonstash::HotTier::Read */
+
+HotTier::Read::Read(Read &&src) noexcept:
+    m_tier(src.m_tier),
+    m_slots(std::move(src.m_slots)),
+    m_iov(std::move(src.m_iov)),
+    m_size(src.m_size)
+{
+    src.m_tier = nullptr;
+}
+
+HotTier::Read &HotTier::Read::operator=(Read &&src) noexcept
+{
+    if (m_tier) {
+        m_tier->unpin(m_slots);
+    }
+    m_tier = src.m_tier;
+    m_slots = std::move(src.m_slots);
+    m_iov = std::move(src.m_iov);
+    m_size = src.m_size;
+    src.m_tier = nullptr;
+    return *this;
+}
+
+HotTier::Read::~Read()
+{
+    if (m_tier) {
+        m_tier->unpin(m_slots);
+    }
+}
+
+/* Dragonstash::HotTier */
+
+HotTier::HotTier(const HotTierOptions &options):
+    m_options(options),
+    m_nslots(options.capacity / CACHE_PAGE_SIZE),
+    m_arena(m_nslots > 0 ? std::make_unique<std::byte[]>(m_nslots * CACHE_PAGE_SIZE) : nullptr),
+    m_slots(m_nslots, Slot{}),
+    m_frequency(m_nslots > 0 ? counters_for(m_nslots) : 0, 0),
+    m_mutex("hot_tier"),
+    m_hand(0),
+    m_samples(0),
+    m_generation(0),
+    m_stats{}
+{
+
+}
+
+unsigned HotTier::record_access(ino_t ino, std::uint64_t block)
+{
+    const std::uint64_t hash = block_hash(ino, block);
+    const std::size_t mask = m_frequency.size() - 1;
+    auto &first = m_frequency[hash & mask];
+    auto &second = m_frequency[(hash >> 32) & mask];
+    if (first < HOT_TIER_MAX_FREQUENCY) {
+        ++first;
+    }
+    if (second < HOT_TIER_MAX_FREQUENCY) {
+        ++second;
+    }
+
+    // age the counters, so that blocks which used to be hot make room
+    if (++m_samples >= m_frequency.size() * HOT_TIER_MAX_FREQUENCY / 2) {
+        for (auto &counter: m_frequency) {
+            counter /= 2;
+        }
+        m_samples = 0;
+    }
+    return std::min(first, second);
+}
+
+unsigned HotTier::frequency(ino_t ino, std::uint64_t block) const
+{
+    const std::uint64_t hash = block_hash(ino, block);
+    const std::size_t mask = m_frequency.size() - 1;
+    return std::min(m_frequency[hash & mask], m_frequency[(hash >> 32) & mask]);
+}
+
+std::size_t HotTier::find_slot(unsigned frequency)
+{
+    // two rounds: the first one may only clear the referenced flags
+    for (std::size_t i = 0; i < 2 * m_nslots; ++i) {
+        const std::size_t slot = m_hand;
+        m_hand = (m_hand + 1) % m_nslots;
+        Slot &candidate = m_slots[slot];
+        if (!candidate.used) {
+            return slot;
+        }
+        if (candidate.pins > 0) {
+            continue;
+        }
+        if (candidate.referenced) {
+            candidate.referenced = false;
+            continue;
+        }
+        if (this->frequency(candidate.ino, candidate.block) >= frequency) {
+            // the victim is at least as hot as the newcomer
+            return m_nslots;
+        }
+        free_slot(slot);
+        ++m_stats.evicted;
+        return slot;
+    }
+    return m_nslots;
+}
+
+void HotTier::free_slot(std::size_t slot)
+{
+    Slot &entry = m_slots[slot];
+    if (!entry.stale) {
+        m_index.erase(std::make_pair(entry.ino, entry.block));
+    }
+    entry = Slot{};
+}
+
+void HotTier::unpin(const std::vector<std::size_t> &slots)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    for (std::size_t slot: slots) {
+        Slot &entry = m_slots[slot];
+        assert(entry.pins > 0);
+        if (--entry.pins == 0 && entry.stale) {
+            free_slot(slot);
+        }
+    }
+}
+
+HotTier::Read HotTier::lookup(ino_t ino, std::uint64_t off, std::size_t n)
+{
+    Read result;
+    if (!enabled() || n == 0) {
+        return result;
+    }
+
+    const std::uint64_t end = off + n;
+    const std::uint64_t first_block = off / CACHE_PAGE_SIZE;
+    const std::uint64_t last_block = (end - 1) / CACHE_PAGE_SIZE;
+
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    result.m_slots.reserve(last_block - first_block + 1);
+    result.m_iov.reserve(last_block - first_block + 1);
+    for (std::uint64_t block = first_block; block <= last_block; ++block) {
+        const std::uint64_t block_start = block * CACHE_PAGE_SIZE;
+        const std::uint64_t from = std::max(off, block_start) - block_start;
+        const std::uint64_t to = std::min(end, block_start + CACHE_PAGE_SIZE) - block_start;
+        auto iter = m_index.find(std::make_pair(ino, block));
+        if (iter == m_index.end() || m_slots[iter->second].length < to) {
+            ++m_stats.misses;
+            result.m_slots.clear();
+            result.m_iov.clear();
+            return result;
+        }
+        result.m_slots.push_back(iter->second);
+        result.m_iov.push_back(iovec{
+            .iov_base = m_arena.get() + iter->second * CACHE_PAGE_SIZE + from,
+            .iov_len = to - from,
+        });
+        result.m_size += to - from;
+    }
+
+    for (std::size_t i = 0; i < result.m_slots.size(); ++i) {
+        Slot &entry = m_slots[result.m_slots[i]];
+        ++entry.pins;
+        entry.referenced = true;
+        (void)record_access(ino, first_block + i);
+    }
+    ++m_stats.hits;
+    result.m_tier = this;
+    return result;
+}
+
+void HotTier::admit(ino_t ino, std::uint64_t off, const void *data,
+                    std::size_t n, std::uint64_t file_size,
+                    std::uint64_t generation)
+{
+    if (!admissible(file_size) || n == 0) {
+        return;
+    }
+    const std::uint64_t end = std::min<std::uint64_t>(off + n, file_size);
+    const std::uint64_t first_block = (off + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    if (generation != m_generation.load(std::memory_order_relaxed)) {
+        // the data may have changed while it was read
+        return;
+    }
+    for (std::uint64_t block = first_block; ; ++block) {
+        const std::uint64_t block_start = block * CACHE_PAGE_SIZE;
+        const std::uint64_t block_end = std::min(block_start + CACHE_PAGE_SIZE, file_size);
+        if (block_start >= block_end || block_end > end) {
+            // incomplete; the final block is complete if it reaches the end
+            // of the file
+            break;
+        }
+
+        const unsigned frequency = record_access(ino, block);
+        const auto key = std::make_pair(ino, block);
+        if (m_index.count(key) > 0) {
+            continue;
+        }
+        if (frequency < m_options.admission_threshold) {
+            ++m_stats.rejected;
+            continue;
+        }
+        const std::size_t slot = find_slot(frequency);
+        if (slot == m_nslots) {
+            ++m_stats.rejected;
+            continue;
+        }
+
+        Slot &entry = m_slots[slot];
+        entry.ino = ino;
+        entry.block = block;
+        entry.length = static_cast<std::uint32_t>(block_end - block_start);
+        entry.used = true;
+        memcpy(m_arena.get() + slot * CACHE_PAGE_SIZE,
+               static_cast<const std::byte*>(data) + (block_start - off),
+               entry.length);
+        m_index.emplace(key, slot);
+        ++m_stats.admitted;
+    }
+}
+
+void HotTier::invalidate(ino_t ino)
+{
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    m_generation.fetch_add(1, std::memory_order_release);
+    auto iter = m_index.lower_bound(std::make_pair(ino, std::uint64_t(0)));
+    while (iter != m_index.end() && iter->first.first == ino) {
+        Slot &entry = m_slots[iter->second];
+        if (entry.pins > 0) {
+            // still being sent; freed by the last unpin()
+            entry.stale = true;
+        } else {
+            entry = Slot{};
+        }
+        iter = m_index.erase(iter);
+        ++m_stats.invalidated;
+    }
+}
+
+HotTierStats HotTier::stats()
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    HotTierStats result = m_stats;
+    result.resident = m_index.size();
+    return result;
+}
+
+}
@@ -26,6 +26,7 @@ authors named in the AUTHORS file.
 
 #include <cassert>
 #include <cstring>
+#include <limits>
 
 namespace Dragonstash {
 
@@ -49,12 +50,308 @@ void put(std::uint8_t *&buf, T in)
     buf += sizeof(T);
 }
 
+/* varint and fixed-width helpers for InodeV2 */
+
+static constexpr unsigned PACKED_NSEC_BITS = 30;
+static constexpr unsigned PACKED_SEC_BITS = 34;
+static constexpr std::uint64_t PACKED_NSEC_MASK = (std::uint64_t(1) << PACKED_NSEC_BITS) - 1;
+static constexpr long NSEC_PER_SEC = 1000000000;
+
+static inline void put_varint(std::byte *&buf, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        *buf++ = static_cast<std::byte>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    *buf++ = static_cast<std::byte>(value);
+}
+
+static inline bool scan_varint(std::basic_string_view<std::byte> &buf,
+                               std::uint64_t &out)
+{
+    std::uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (buf.empty()) {
+            return false;
+        }
+        const auto byte = static_cast<std::uint8_t>(buf[0]);
+        buf.remove_prefix(1);
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            out = value;
+            return true;
+        }
+    }
+    // more than ten bytes
+    return false;
+}
+
+template <typename T>
+static inline void put_le(std::byte *&buf, T value)
+{
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        *buf++ = static_cast<std::byte>(value & 0xff);
+        value >>= 8;
+    }
+}
+
+template <typename T>
+static inline bool scan_le(std::basic_string_view<std::byte> &buf, T &out)
+{
+    if (buf.size() < sizeof(T)) {
+        return false;
+    }
+    T value = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        value |= T(static_cast<std::uint8_t>(buf[i])) << (8 * i);
+    }
+    buf.remove_prefix(sizeof(T));
+    out = value;
+    return true;
+}
+
+static inline std::uint64_t zigzag(std::int64_t value)
+{
+    return (static_cast<std::uint64_t>(value) << 1) ^
+            static_cast<std::uint64_t>(value >> 63);
+}
+
+static inline std::int64_t unzigzag(std::uint64_t value)
+{
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+static inline bool packable(const struct timespec &ts)
+{
+    return ts.tv_sec >= 0 &&
+            static_cast<std::uint64_t>(ts.tv_sec) < (std::uint64_t(1) << PACKED_SEC_BITS) &&
+            ts.tv_nsec >= 0 && ts.tv_nsec < NSEC_PER_SEC;
+}
+
+static inline bool delta_packable(const struct timespec &ts,
+                                  const struct timespec &ref)
+{
+    // both are packable, so the difference cannot overflow
+    return zigzag(std::int64_t(ts.tv_sec) - std::int64_t(ref.tv_sec)) <
+            (std::uint64_t(1) << PACKED_SEC_BITS);
+}
+
+static inline bool same_time(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static inline void put_delta(std::byte *&buf, const struct timespec &ts,
+                             const struct timespec &ref)
+{
+    const std::uint64_t delta = zigzag(std::int64_t(ts.tv_sec) - std::int64_t(ref.tv_sec));
+    put_varint(buf, (delta << PACKED_NSEC_BITS) | std::uint64_t(ts.tv_nsec));
+}
+
+static inline bool scan_delta(std::basic_string_view<std::byte> &buf,
+                              const struct timespec &ref,
+                              struct timespec &out)
+{
+    std::uint64_t value;
+    if (!scan_varint(buf, value)) {
+        return false;
+    }
+    const std::uint64_t nsec = value & PACKED_NSEC_MASK;
+    if (nsec >= NSEC_PER_SEC) {
+        return false;
+    }
+    out.tv_sec = ref.tv_sec + unzigzag(value >> PACKED_NSEC_BITS);
+    out.tv_nsec = static_cast<long>(nsec);
+    return true;
+}
+
+static inline void put_wide(std::byte *&buf, const struct timespec &ts)
+{
+    put_varint(buf, zigzag(ts.tv_sec));
+    put_varint(buf, zigzag(ts.tv_nsec));
+}
+
+static inline bool scan_wide(std::basic_string_view<std::byte> &buf,
+                             struct timespec &out)
+{
+    std::uint64_t sec, nsec;
+    if (!scan_varint(buf, sec) || !scan_varint(buf, nsec)) {
+        return false;
+    }
+    out.tv_sec = unzigzag(sec);
+    out.tv_nsec = unzigzag(nsec);
+    return true;
+}
+
+template <typename T>
+static inline bool scan_varint_as(std::basic_string_view<std::byte> &buf, T &out)
+{
+    std::uint64_t value;
+    if (!scan_varint(buf, value) || value > std::numeric_limits<T>::max()) {
+        return false;
+    }
+    out = static_cast<T>(value);
+    return true;
+}
+
+/* Dragonstash::InodeV2 */
+
+std::size_t InodeV2::encode(const InodeV1 &inode, std::byte *buf)
+{
+    const CommonFileAttributes &common = inode.attr.common;
+    std::byte *const start = buf;
+
+    std::uint8_t encoding = 0;
+    const bool packed = packable(common.mtime) &&
+            packable(common.atime) && delta_packable(common.atime, common.mtime) &&
+            packable(common.ctime) && delta_packable(common.ctime, common.mtime);
+    if (!packed) {
+        encoding |= WIDE_TIMESTAMPS;
+    } else {
+        if (same_time(common.atime, common.mtime)) {
+            encoding |= ATIME_IS_MTIME;
+        }
+        if (same_time(common.ctime, common.mtime)) {
+            encoding |= CTIME_IS_MTIME;
+        }
+    }
+    if (inode.attr.mode > std::numeric_limits<std::uint16_t>::max()) {
+        encoding |= WIDE_MODE;
+    }
+    if (inode.chunk_shift != 0) {
+        encoding |= CHUNK_SHIFT;
+    }
+
+    *buf++ = static_cast<std::byte>(VERSION);
+    *buf++ = static_cast<std::byte>(encoding);
+    put_le<std::uint16_t>(buf, inode.flags);
+    if (encoding & WIDE_MODE) {
+        put_varint(buf, inode.attr.mode);
+    } else {
+        put_le<std::uint16_t>(buf, static_cast<std::uint16_t>(inode.attr.mode));
+    }
+    put_varint(buf, inode.parent);
+    put_varint(buf, common.size);
+    put_varint(buf, common.nblocks);
+    put_varint(buf, common.uid);
+    put_varint(buf, common.gid);
+
+    if (encoding & WIDE_TIMESTAMPS) {
+        put_wide(buf, common.atime);
+        put_wide(buf, common.mtime);
+        put_wide(buf, common.ctime);
+    } else {
+        put_le<std::uint64_t>(buf,
+                              (std::uint64_t(common.mtime.tv_sec) << PACKED_NSEC_BITS) |
+                              std::uint64_t(common.mtime.tv_nsec));
+        if (!(encoding & ATIME_IS_MTIME)) {
+            put_delta(buf, common.atime, common.mtime);
+        }
+        if (!(encoding & CTIME_IS_MTIME)) {
+            put_delta(buf, common.ctime, common.mtime);
+        }
+    }
+    if (encoding & CHUNK_SHIFT) {
+        *buf++ = static_cast<std::byte>(inode.chunk_shift);
+    }
+
+    const auto size = static_cast<std::size_t>(buf - start);
+    assert(size <= MAX_SIZE);
+    return size;
+}
+
+Result<InodeV1> InodeV2::decode(std::basic_string_view<std::byte> buf)
+{
+    if (buf.size() < 2 || static_cast<std::uint8_t>(buf[0]) != VERSION) {
+        return make_result(FAILED, EINVAL);
+    }
+    const auto encoding = static_cast<std::uint8_t>(buf[1]);
+    buf.remove_prefix(2);
+
+    InodeV1 inode{};
+    inode.version = VERSION;
+    CommonFileAttributes &common = inode.attr.common;
+
+    if (!scan_le(buf, inode.flags)) {
+        return make_result(FAILED, EINVAL);
+    }
+    if (encoding & WIDE_MODE) {
+        if (!scan_varint_as(buf, inode.attr.mode)) {
+            return make_result(FAILED, EINVAL);
+        }
+    } else {
+        std::uint16_t mode;
+        if (!scan_le(buf, mode)) {
+            return make_result(FAILED, EINVAL);
+        }
+        inode.attr.mode = mode;
+    }
+
+    if (!scan_varint_as(buf, inode.parent) ||
+            !scan_varint_as(buf, common.size) ||
+            !scan_varint_as(buf, common.nblocks) ||
+            !scan_varint_as(buf, common.uid) ||
+            !scan_varint_as(buf, common.gid)) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    if (encoding & WIDE_TIMESTAMPS) {
+        if (!scan_wide(buf, common.atime) ||
+                !scan_wide(buf, common.mtime) ||
+                !scan_wide(buf, common.ctime)) {
+            return make_result(FAILED, EINVAL);
+        }
+    } else {
+        std::uint64_t mtime;
+        if (!scan_le(buf, mtime) || (mtime & PACKED_NSEC_MASK) >= NSEC_PER_SEC) {
+            return make_result(FAILED, EINVAL);
+        }
+        common.mtime.tv_sec = static_cast<time_t>(mtime >> PACKED_NSEC_BITS);
+        common.mtime.tv_nsec = static_cast<long>(mtime & PACKED_NSEC_MASK);
+
+        if (encoding & ATIME_IS_MTIME) {
+            common.atime = common.mtime;
+        } else if (!scan_delta(buf, common.mtime, common.atime)) {
+            return make_result(FAILED, EINVAL);
+        }
+
+        if (encoding & CTIME_IS_MTIME) {
+            common.ctime = common.mtime;
+        } else if (!scan_delta(buf, common.mtime, common.ctime)) {
+            return make_result(FAILED, EINVAL);
+        }
+    }
+    if (encoding & CHUNK_SHIFT) {
+        if (buf.empty()) {
+            return make_result(FAILED, EINVAL);
+        }
+        inode.chunk_shift = static_cast<std::uint8_t>(buf[0]);
+        buf.remove_prefix(1);
+        if (inode.chunk_shift < MIN_CHUNK_SHIFT || inode.chunk_shift > MAX_CHUNK_SHIFT) {
+            return make_result(FAILED, EINVAL);
+        }
+    }
+
+    // trailing bytes are reserved for type-specific data
+    return inode;
+}
+
+/* Dragonstash::InodeV1 */
+
 Result<copyfree_wrap<Inode> > Inode::parse_inplace(std::basic_string_view<std::byte> buf)
 {
     if (buf.empty()) {
         return make_result(FAILED, EINVAL);
     }
     const auto version = static_cast<std::uint8_t>(buf[0]);
+    if (version == InodeV2::VERSION) {
+        // the compact format always needs to be decoded into a copy
+        auto decoded = InodeV2::decode(buf);
+        if (!decoded) {
+            return copy_error(decoded);
+        }
+        return copyfree_wrap<Inode>(std::move(*decoded));
+    }
     if (version != 1) {
         return make_result(FAILED, EINVAL);
     }
@@ -0,0 +1,280 @@
+/**********************************************************************
+File name: journal.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/journal.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <type_traits>
+
+namespace Dragonstash {
+
+namespace {
+
+static constexpr std::uint8_t JOURNAL_ENTRY_VERSION = 1;
+
+struct JournalEntryV1 {
+    std::uint8_t version;
+    std::uint8_t op;
+    std::uint8_t fields;
+    std::uint8_t _reserved0;
+    std::uint32_t mode;
+    std::uint64_t size;
+    std::int64_t atime_sec;
+    std::int64_t atime_nsec;
+    std::int64_t mtime_sec;
+    std::int64_t mtime_nsec;
+    std::uint32_t path_length;
+    std::uint32_t new_path_length;
+};
+
+static_assert(std::is_pod_v<JournalEntryV1>);
+
+/**
+ * @brief Check whether @a path is @a dir or lies below it.
+ */
+bool is_within(std::string_view path, std::string_view dir)
+{
+    if (path.size() < dir.size() || path.substr(0, dir.size()) != dir) {
+        return false;
+    }
+    return path.size() == dir.size() || path[dir.size()] == '/';
+}
+
+bool related(std::string_view a, std::string_view b)
+{
+    return is_within(a, b) || is_within(b, a);
+}
+
+bool touches(const JournalEntry &entry, std::string_view path)
+{
+    return related(entry.path, path) ||
+            (entry.op == JournalEntry::Op::RENAME && related(entry.new_path, path));
+}
+
+}
+
+Result<void> JournalEntry::apply(Backend::Filesystem &backend) const
+{
+    switch (op) {
+    case Op::CREATE:
+    {
+        auto file = backend.open(path, O_CREAT | O_EXCL | O_WRONLY, mode);
+        if (!file) {
+            return copy_error(file);
+        }
+        return (*file)->close();
+    }
+    case Op::MKDIR:
+        return backend.mkdir(path, mode);
+    case Op::UNLINK:
+        return backend.unlink(path);
+    case Op::RMDIR:
+        return backend.rmdir(path);
+    case Op::RENAME:
+        return backend.rename(path, new_path);
+    case Op::SETATTR:
+    {
+        if (fields & MODE) {
+            auto result = backend.chmod(path, mode);
+            if (!result) {
+                return result;
+            }
+        }
+        if (fields & SIZE) {
+            auto result = backend.truncate(path, size);
+            if (!result) {
+                return result;
+            }
+        }
+        if (fields & (ATIME | MTIME)) {
+            static const struct timespec omit{0, UTIME_OMIT};
+            auto result = backend.utimens(path,
+                                          (fields & ATIME) ? atime : omit,
+                                          (fields & MTIME) ? mtime : omit);
+            if (!result) {
+                return result;
+            }
+        }
+        return make_result();
+    }
+    }
+
+    return make_result(FAILED, EINVAL);
+}
+
+std::string JournalEntry::serialize() const
+{
+    JournalEntryV1 header{};
+    header.version = JOURNAL_ENTRY_VERSION;
+    header.op = static_cast<std::uint8_t>(op);
+    header.fields = fields;
+    header.mode = mode;
+    header.size = size;
+    header.atime_sec = atime.tv_sec;
+    header.atime_nsec = atime.tv_nsec;
+    header.mtime_sec = mtime.tv_sec;
+    header.mtime_nsec = mtime.tv_nsec;
+    header.path_length = path.size();
+    header.new_path_length = new_path.size();
+
+    std::string result;
+    result.reserve(sizeof(header) + path.size() + new_path.size());
+    result.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    result.append(path);
+    result.append(new_path);
+    return result;
+}
+
+Result<JournalEntry> JournalEntry::parse(std::string_view buf)
+{
+    if (buf.size() < sizeof(JournalEntryV1)) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    JournalEntryV1 header;
+    memcpy(&header, buf.data(), sizeof(header));
+    if (header.version != JOURNAL_ENTRY_VERSION) {
+        return make_result(FAILED, EINVAL);
+    }
+    if (header.op < static_cast<std::uint8_t>(Op::CREATE) ||
+            header.op > static_cast<std::uint8_t>(Op::SETATTR)) {
+        return make_result(FAILED, EINVAL);
+    }
+    buf.remove_prefix(sizeof(header));
+    if (buf.size() != std::size_t(header.path_length) + header.new_path_length) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    JournalEntry result;
+    result.op = static_cast<Op>(header.op);
+    result.fields = header.fields;
+    result.mode = header.mode;
+    result.size = header.size;
+    result.atime.tv_sec = header.atime_sec;
+    result.atime.tv_nsec = header.atime_nsec;
+    result.mtime.tv_sec = header.mtime_sec;
+    result.mtime.tv_nsec = header.mtime_nsec;
+    result.path = buf.substr(0, header.path_length);
+    result.new_path = buf.substr(header.path_length);
+    return result;
+}
+
+std::vector<JournalRecord> compact_journal(std::vector<JournalRecord> records)
+{
+    using Op = JournalEntry::Op;
+
+    std::vector<bool> alive(records.size(), true);
+    std::vector<std::size_t> setattrs;
+
+    // cancel out creations with their removal; removals are visited in
+    // order, so that the contents of a directory are gone by the time the
+    // directory itself is looked at.
+    for (std::size_t j = 0; j < records.size(); ++j) {
+        const JournalEntry &removal = records[j].entry;
+        if (removal.op != Op::UNLINK && removal.op != Op::RMDIR) {
+            continue;
+        }
+        const Op creation_op = removal.op == Op::UNLINK ? Op::CREATE : Op::MKDIR;
+
+        setattrs.clear();
+        for (std::size_t i = j; i-- > 0;) {
+            if (!alive[i]) {
+                continue;
+            }
+            const JournalEntry &entry = records[i].entry;
+            if (!touches(entry, removal.path)) {
+                continue;
+            }
+            if (entry.path == removal.path && entry.op == Op::SETATTR) {
+                setattrs.push_back(i);
+                continue;
+            }
+            if (entry.path == removal.path && entry.op == creation_op) {
+                alive[i] = false;
+                alive[j] = false;
+            }
+            break;
+        }
+
+        // attribute changes of something which is removed afterwards are
+        // moot
+        for (const std::size_t i: setattrs) {
+            alive[i] = false;
+        }
+    }
+
+    // merge runs of attribute changes on the same path
+    for (std::size_t j = 0; j < records.size(); ++j) {
+        if (!alive[j] || records[j].entry.op != Op::SETATTR) {
+            continue;
+        }
+        JournalEntry &later = records[j].entry;
+
+        for (std::size_t i = j; i-- > 0;) {
+            if (!alive[i]) {
+                continue;
+            }
+            const JournalEntry &earlier = records[i].entry;
+            if (!touches(earlier, later.path)) {
+                continue;
+            }
+            // shrinking and then growing a file zeroes the tail; this cannot
+            // be expressed with a single size
+            const bool regrown = (earlier.fields & later.fields & JournalEntry::SIZE) &&
+                    earlier.size < later.size;
+            if (earlier.op == Op::SETATTR && earlier.path == later.path && !regrown) {
+                const std::uint8_t inherited = earlier.fields & ~later.fields;
+                if (inherited & JournalEntry::MODE) {
+                    later.mode = earlier.mode;
+                }
+                if (inherited & JournalEntry::SIZE) {
+                    later.size = earlier.size;
+                }
+                if (inherited & JournalEntry::ATIME) {
+                    later.atime = earlier.atime;
+                }
+                if (inherited & JournalEntry::MTIME) {
+                    later.mtime = earlier.mtime;
+                }
+                later.fields |= inherited;
+                alive[i] = false;
+            }
+            break;
+        }
+    }
+
+    std::vector<JournalRecord> result;
+    result.reserve(records.size());
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (alive[i]) {
+            result.emplace_back(std::move(records[i]));
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,1244 @@
+/**********************************************************************
+File name: regular_file.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/cache/regular_file.hpp"
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "dragonstash/cache/checksum.hpp"
+#include "dragonstash/cache/common.hpp"
+
+namespace Dragonstash {
+
+static constexpr const char *BLOCKLIST_SUFFIX = ".blocks";
+static constexpr const char *CHECKSUM_SUFFIX = ".crc";
+static constexpr const char *EXTENTS_SUFFIX = ".extents";
+
+/**
+ * Number of blocks checksummed or verified per read of the data file.
+ */
+static constexpr std::uint64_t CHECKSUM_BATCH = 64;
+
+/**
+ * Number of decompressed extents kept in memory per handle.
+ */
+static constexpr std::size_t INFLATED_EXTENTS = 4;
+
+static constexpr std::uint32_t EXTENT_SIZE_MASK = 0xffffff;
+static constexpr unsigned EXTENT_ALGORITHM_SHIFT = 24;
+static_assert(COMPRESSION_EXTENT_SIZE <= EXTENT_SIZE_MASK);
+
+static inline std::uint64_t first_block(off_t off)
+{
+    return off / CACHE_PAGE_SIZE;
+}
+
+static inline std::uint64_t end_block(off_t off, std::size_t n)
+{
+    return (off + n + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+}
+
+/**
+ * @brief Lock sites shared by all handles, so that opening a file does not
+ * need to look them up.
+ */
+static LockSite &file_lock_site()
+{
+    static LockSite &site = lock_site("regular_file");
+    return site;
+}
+
+static LockSite &upload_lock_site()
+{
+    static LockSite &site = lock_site("regular_file.upload");
+    return site;
+}
+
+/**
+ * @brief Return the runs of blocks in [start, end) which are not covered by
+ * @a present.
+ */
+static std::vector<Blocklist::Range> gaps(
+        const std::vector<Blocklist::Range> &present,
+        std::uint64_t start,
+        std::uint64_t end)
+{
+    std::vector<Blocklist::Range> result;
+    std::uint64_t cursor = start;
+    for (const auto &range: present) {
+        if (range.start > cursor) {
+            result.push_back(Blocklist::Range{
+                                 .start = cursor,
+                                 .count = range.start - cursor,
+                                 .state = Blocklist::ABSENT,
+                             });
+        }
+        cursor = range.end();
+    }
+    if (cursor < end) {
+        result.push_back(Blocklist::Range{
+                             .start = cursor,
+                             .count = end - cursor,
+                             .state = Blocklist::ABSENT,
+                         });
+    }
+    return result;
+}
+
+static Result<void> pwrite_all(int fd, const std::byte *buf, std::size_t n,
+                               off_t off)
+{
+    while (n > 0) {
+        const ssize_t written = ::pwrite(fd, buf, n, off);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return make_result(FAILED, errno);
+        }
+        buf += written;
+        n -= written;
+        off += written;
+    }
+    return make_result();
+}
+
+/**
+ * @brief Read a byte range; data beyond the end of the file reads as zeroes.
+ */
+static Result<void> pread_all(int fd, std::byte *buf, std::size_t n, off_t off)
+{
+    while (n > 0) {
+        const ssize_t nread = ::pread(fd, buf, n, off);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return make_result(FAILED, errno);
+        }
+        if (nread == 0) {
+            std::fill_n(buf, n, std::byte(0));
+            break;
+        }
+        buf += nread;
+        n -= nread;
+        off += nread;
+    }
+    return make_result();
+}
+
+/**
+ * @brief Copy a byte range between data files through a buffer.
+ *
+ * Data beyond the end of the source file is a hole and copied as zeroes.
+ */
+static Result<void> copy_all(int src_fd, off_t src_off, int dest_fd,
+                             off_t dest_off, std::size_t n)
+{
+    std::array<std::byte, CACHE_PAGE_SIZE * 16> buffer;
+    while (n > 0) {
+        ssize_t nread = ::pread(src_fd, buffer.data(),
+                                std::min(n, buffer.size()), src_off);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return make_result(FAILED, errno);
+        }
+        if (nread == 0) {
+            nread = std::min(n, buffer.size());
+            std::fill_n(buffer.begin(), nread, std::byte(0));
+        }
+        auto write_result = pwrite_all(dest_fd, buffer.data(), nread, dest_off);
+        if (!write_result) {
+            return write_result;
+        }
+        src_off += nread;
+        dest_off += nread;
+        n -= nread;
+    }
+    return make_result();
+}
+
+static inline std::uint64_t nanoseconds_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+}
+
+/**
+ * @brief Count the non-zero entries of an extent table.
+ */
+static std::uint64_t count_compressed_extents(int fd)
+{
+    std::array<std::uint32_t, 1024> entries;
+    std::uint64_t result = 0;
+    off_t off = 0;
+    while (true) {
+        const ssize_t nread = ::pread(fd, entries.data(),
+                                      entries.size() * sizeof(std::uint32_t), off);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("failed to read extent table: ") + std::strerror(errno));
+        }
+        // a torn trailing entry is ignored
+        const std::size_t count = nread / sizeof(std::uint32_t);
+        if (count == 0) {
+            break;
+        }
+        result += count - std::count(entries.begin(), entries.begin() + count, 0U);
+        off += count * sizeof(std::uint32_t);
+    }
+    return result;
+}
+
+static FileHandle open_data_file(const std::filesystem::path &path)
+{
+    FileHandle result(::open(path.c_str(),
+                             O_CREAT | O_RDWR | O_CLOEXEC,
+                             S_IRUSR | S_IWUSR));
+    if (!result) {
+        throw std::runtime_error(std::string("failed to open cached data: ") + std::strerror(errno));
+    }
+    return result;
+}
+
+RegularFileHandle::RegularFileHandle(const std::filesystem::path &data_dir,
+                                     ino_t ino,
+                                     CompressionCounters *counters):
+    m_ino(ino),
+    m_mutex(file_lock_site()),
+    m_upload_mutex(upload_lock_site()),
+    m_data(open_data_file(data_path(data_dir, ino))),
+    m_checksums(open_data_file(checksum_path(data_dir, ino))),
+    m_extents(open_data_file(extents_path(data_dir, ino))),
+    m_blocks(blocklist_path(data_dir, ino)),
+    m_counters(counters),
+    m_compressed_extents(count_compressed_extents(int(m_extents))),
+    m_inflated_clock(0),
+    m_unaccounted_blocks(0),
+    m_write_generation(0),
+    m_logging_writes(false)
+{
+
+}
+
+std::filesystem::path RegularFileHandle::data_path(
+        const std::filesystem::path &data_dir, ino_t ino)
+{
+    return data_dir / std::to_string(ino);
+}
+
+std::filesystem::path RegularFileHandle::blocklist_path(
+        const std::filesystem::path &data_dir, ino_t ino)
+{
+    return data_dir / (std::to_string(ino) + BLOCKLIST_SUFFIX);
+}
+
+std::filesystem::path RegularFileHandle::checksum_path(
+        const std::filesystem::path &data_dir, ino_t ino)
+{
+    return data_dir / (std::to_string(ino) + CHECKSUM_SUFFIX);
+}
+
+std::filesystem::path RegularFileHandle::extents_path(
+        const std::filesystem::path &data_dir, ino_t ino)
+{
+    return data_dir / (std::to_string(ino) + EXTENTS_SUFFIX);
+}
+
+std::uint64_t RegularFileHandle::cached_bytes(
+        const std::filesystem::path &data_dir, ino_t ino)
+{
+    const auto path = blocklist_path(data_dir, ino);
+    std::error_code ec;
+    // opening an empty blocklist would initialise it
+    if (std::filesystem::file_size(path, ec) == 0 || ec) {
+        return 0;
+    }
+    try {
+        return Blocklist(path).present_blocks() * CACHE_PAGE_SIZE;
+    } catch (const std::runtime_error &) {
+        return 0;
+    }
+}
+
+/**
+ * @brief Summarise the blocks of a Blocklist of a file of @a size bytes.
+ */
+static FileResidency blocklist_residency(const Blocklist &blocks,
+                                         std::uint64_t size, bool with_ranges)
+{
+    FileResidency result{
+        .size = size,
+        .resident_bytes = blocks.present_blocks() * CACHE_PAGE_SIZE,
+        .dirty_bytes = blocks.blocks(Blocklist::WRITTEN) * CACHE_PAGE_SIZE,
+        .ranges = {},
+    };
+    // the last block only counts up to the end of the file
+    const std::uint64_t overhang = (CACHE_PAGE_SIZE - size % CACHE_PAGE_SIZE) % CACHE_PAGE_SIZE;
+    const Blocklist::State last_state = overhang > 0
+            ? blocks.state(size / CACHE_PAGE_SIZE)
+            : Blocklist::ABSENT;
+    if (last_state != Blocklist::ABSENT) {
+        result.resident_bytes -= overhang;
+    }
+    if (last_state == Blocklist::WRITTEN) {
+        result.dirty_bytes -= overhang;
+    }
+    if (with_ranges) {
+        result.ranges = blocks.ranges();
+    }
+    return result;
+}
+
+Result<FileResidency> RegularFileHandle::residency(
+        const std::filesystem::path &data_dir, ino_t ino,
+        std::uint64_t size, bool with_ranges)
+{
+    const auto path = blocklist_path(data_dir, ino);
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec)) {
+        return FileResidency{.size = size};
+    }
+    try {
+        return blocklist_residency(Blocklist(path), size, with_ranges);
+    } catch (const std::runtime_error &) {
+        return make_result(FAILED, EIO);
+    }
+}
+
+void RegularFileHandle::remove(const std::filesystem::path &data_dir, ino_t ino)
+{
+    std::error_code ec;
+    std::filesystem::remove(blocklist_path(data_dir, ino), ec);
+    std::filesystem::remove(checksum_path(data_dir, ino), ec);
+    std::filesystem::remove(extents_path(data_dir, ino), ec);
+    std::filesystem::remove(data_path(data_dir, ino), ec);
+}
+
+std::optional<std::uint64_t> RegularFileHandle::check(
+        const std::filesystem::path &data_dir, ino_t ino, bool discard)
+{
+    const auto path = blocklist_path(data_dir, ino);
+    std::error_code ec;
+    // an empty blocklist is consistent; opening it would initialise it
+    if (std::filesystem::file_size(path, ec) == 0 || ec) {
+        return std::nullopt;
+    }
+    // if the blocklist cannot even be opened, cached_bytes() reports zero
+    // for it, so nothing has to be un-accounted either
+    std::uint64_t accounted = 0;
+    try {
+        Blocklist blocks(path);
+        accounted = blocks.present_blocks() * CACHE_PAGE_SIZE;
+        blocks.fsck();
+        return std::nullopt;
+    } catch (const std::runtime_error &) {
+        // fall through
+    }
+    if (discard) {
+        remove(data_dir, ino);
+    }
+    return accounted;
+}
+
+void RegularFileHandle::mark_locked(std::uint64_t start, std::uint64_t count,
+                                    Blocklist::State state)
+{
+    const std::uint64_t before = m_blocks.present_blocks();
+    m_blocks.mark(start, count, state);
+    m_unaccounted_blocks += static_cast<std::int64_t>(m_blocks.present_blocks())
+            - static_cast<std::int64_t>(before);
+    if (state == Blocklist::WRITTEN) {
+        ++m_write_generation;
+        if (m_logging_writes) {
+            m_write_log.emplace_back(m_write_generation,
+                                     Blocklist::Range{start, count, state});
+        }
+    }
+}
+
+std::vector<Blocklist::Range> RegularFileHandle::hide_locked(
+        std::uint64_t start, std::uint64_t end)
+{
+    auto hidden = m_blocks.ranges(start, end - start);
+    mark_locked(start, end - start, Blocklist::ABSENT);
+    return hidden;
+}
+
+void RegularFileHandle::restore_locked(const std::vector<Blocklist::Range> &hidden)
+{
+    for (const auto &range: hidden) {
+        mark_locked(range.start, range.count, range.state);
+    }
+}
+
+Result<void> RegularFileHandle::update_checksums_locked(std::uint64_t start,
+                                                      std::uint64_t end)
+{
+    const std::uint64_t batch_size = std::min(CHECKSUM_BATCH, end - start);
+    std::vector<std::byte> data(batch_size * CACHE_PAGE_SIZE);
+    std::vector<std::uint32_t> sums(batch_size);
+    for (std::uint64_t batch = start; batch < end; batch += batch_size) {
+        const std::uint64_t count = std::min(batch_size, end - batch);
+        auto read_result = read_locked(batch * CACHE_PAGE_SIZE, data.data(),
+                                       count * CACHE_PAGE_SIZE);
+        if (!read_result) {
+            return read_result;
+        }
+        for (std::uint64_t i = 0; i < count; ++i) {
+            sums[i] = crc32c(0, data.data() + i * CACHE_PAGE_SIZE, CACHE_PAGE_SIZE);
+        }
+        auto write_result = pwrite_all(int(m_checksums),
+                                       reinterpret_cast<const std::byte*>(sums.data()),
+                                       count * sizeof(std::uint32_t),
+                                       batch * sizeof(std::uint32_t));
+        if (!write_result) {
+            return write_result;
+        }
+    }
+    return make_result();
+}
+
+Result<std::uint32_t> RegularFileHandle::extent_info_locked(std::uint64_t extent) const
+{
+    std::uint32_t info = 0;
+    if (m_compressed_extents == 0) {
+        return make_result(info);
+    }
+    auto read_result = pread_all(int(m_extents), reinterpret_cast<std::byte*>(&info),
+                                 sizeof(info), extent * sizeof(info));
+    if (!read_result) {
+        return copy_error(read_result);
+    }
+    return make_result(info);
+}
+
+Result<void> RegularFileHandle::set_extent_info_locked(std::uint64_t extent,
+                                                       std::uint32_t old_info,
+                                                       std::uint32_t new_info)
+{
+    auto write_result = pwrite_all(int(m_extents),
+                                   reinterpret_cast<const std::byte*>(&new_info),
+                                   sizeof(new_info), extent * sizeof(new_info));
+    if (!write_result) {
+        return write_result;
+    }
+    if (old_info == 0 && new_info != 0) {
+        ++m_compressed_extents;
+    } else if (old_info != 0 && new_info == 0) {
+        --m_compressed_extents;
+    }
+    m_inflated.erase(std::remove_if(m_inflated.begin(), m_inflated.end(),
+                                    [extent](const InflatedExtent &cached) {
+                                        return cached.extent == extent;
+                                    }),
+                     m_inflated.end());
+    return make_result();
+}
+
+Result<const RegularFileHandle::InflatedExtent*> RegularFileHandle::load_extent_locked(
+        std::uint64_t extent, std::uint32_t info)
+{
+    ++m_inflated_clock;
+    for (auto &cached: m_inflated) {
+        if (cached.extent == extent) {
+            cached.last_use = m_inflated_clock;
+            const InflatedExtent *result = &cached;
+            return make_result(result);
+        }
+    }
+
+    std::vector<std::byte> compressed(info & EXTENT_SIZE_MASK);
+    auto read_result = pread_all(int(m_data), compressed.data(), compressed.size(),
+                                 extent * COMPRESSION_EXTENT_SIZE);
+    if (!read_result) {
+        return copy_error(read_result);
+    }
+
+    InflatedExtent *slot;
+    if (m_inflated.size() < INFLATED_EXTENTS) {
+        slot = &m_inflated.emplace_back();
+        slot->data.resize(COMPRESSION_EXTENT_SIZE);
+    } else {
+        slot = &*std::min_element(m_inflated.begin(), m_inflated.end(),
+                                  [](const InflatedExtent &a, const InflatedExtent &b) {
+                                      return a.last_use < b.last_use;
+                                  });
+    }
+
+    const auto t0 = std::chrono::steady_clock::now();
+    auto decompress_result = decompress(
+                static_cast<Compression>(info >> EXTENT_ALGORITHM_SHIFT),
+                compressed.data(), compressed.size(),
+                slot->data.data(), slot->data.size());
+    if (!decompress_result) {
+        // do not leave a half-filled entry behind
+        slot->extent = std::numeric_limits<std::uint64_t>::max();
+        slot->last_use = 0;
+        return copy_error(decompress_result);
+    }
+    if (m_counters) {
+        m_counters->decompressed_bytes.fetch_add(*decompress_result, std::memory_order_relaxed);
+        m_counters->decompress_ns.fetch_add(nanoseconds_since(t0), std::memory_order_relaxed);
+    }
+    std::fill(slot->data.begin() + *decompress_result, slot->data.end(), std::byte(0));
+    slot->extent = extent;
+    slot->last_use = m_inflated_clock;
+    slot->size = *decompress_result;
+    const InflatedExtent *result = slot;
+    return make_result(result);
+}
+
+Result<void> RegularFileHandle::read_locked(off_t off, std::byte *buf,
+                                            std::size_t n)
+{
+    if (m_compressed_extents == 0) {
+        return pread_all(int(m_data), buf, n, off);
+    }
+
+    while (n > 0) {
+        const std::uint64_t extent = off / COMPRESSION_EXTENT_SIZE;
+        const std::size_t in_extent = off % COMPRESSION_EXTENT_SIZE;
+        const std::size_t len = std::min(n, COMPRESSION_EXTENT_SIZE - in_extent);
+        auto info_result = extent_info_locked(extent);
+        if (!info_result) {
+            return copy_error(info_result);
+        }
+        if (*info_result == 0) {
+            auto read_result = pread_all(int(m_data), buf, len, off);
+            if (!read_result) {
+                return read_result;
+            }
+        } else {
+            auto load_result = load_extent_locked(extent, *info_result);
+            if (!load_result) {
+                return copy_error(load_result);
+            }
+            std::copy_n((*load_result)->data.begin() + in_extent, len, buf);
+        }
+        buf += len;
+        off += len;
+        n -= len;
+    }
+    return make_result();
+}
+
+Result<void> RegularFileHandle::inflate_locked(std::uint64_t start,
+                                               std::uint64_t end)
+{
+    if (m_compressed_extents == 0 || start >= end) {
+        return make_result();
+    }
+
+    const std::uint64_t first = start / COMPRESSION_EXTENT_BLOCKS;
+    const std::uint64_t last = (end + COMPRESSION_EXTENT_BLOCKS - 1) / COMPRESSION_EXTENT_BLOCKS;
+    std::vector<std::byte> data;
+    for (std::uint64_t extent = first; extent < last && m_compressed_extents > 0; ++extent) {
+        auto info_result = extent_info_locked(extent);
+        if (!info_result) {
+            return copy_error(info_result);
+        }
+        if (*info_result == 0) {
+            continue;
+        }
+        auto load_result = load_extent_locked(extent, *info_result);
+        if (!load_result) {
+            return copy_error(load_result);
+        }
+        data.assign((*load_result)->data.begin(),
+                    (*load_result)->data.begin() + (*load_result)->size);
+
+        // on failure, the blocks stay hidden and are fetched again
+        const auto hidden = hide_locked(
+                    extent * COMPRESSION_EXTENT_BLOCKS,
+                    end_block(extent * COMPRESSION_EXTENT_SIZE, data.size()));
+        auto info_write_result = set_extent_info_locked(extent, *info_result, 0);
+        if (!info_write_result) {
+            return info_write_result;
+        }
+        auto write_result = pwrite_all(int(m_data), data.data(), data.size(),
+                                       extent * COMPRESSION_EXTENT_SIZE);
+        if (!write_result) {
+            return write_result;
+        }
+        restore_locked(hidden);
+    }
+    return make_result();
+}
+
+Result<void> RegularFileHandle::drop_extents_locked(std::uint64_t extent)
+{
+    if (m_compressed_extents == 0) {
+        return make_result();
+    }
+
+    std::array<std::uint32_t, 1024> entries;
+    off_t off = extent * sizeof(std::uint32_t);
+    while (true) {
+        const ssize_t nread = ::pread(int(m_extents), entries.data(),
+                                      entries.size() * sizeof(std::uint32_t), off);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return make_result(FAILED, errno);
+        }
+        const std::size_t count = nread / sizeof(std::uint32_t);
+        if (count == 0) {
+            break;
+        }
+        m_compressed_extents -= count - std::count(entries.begin(), entries.begin() + count, 0U);
+        off += count * sizeof(std::uint32_t);
+    }
+    if (::ftruncate(int(m_extents), extent * sizeof(std::uint32_t)) != 0) {
+        return make_result(FAILED, errno);
+    }
+    m_inflated.erase(std::remove_if(m_inflated.begin(), m_inflated.end(),
+                                    [extent](const InflatedExtent &cached) {
+                                        return cached.extent >= extent;
+                                    }),
+                     m_inflated.end());
+    return make_result();
+}
+
+Result<std::size_t> RegularFileHandle::pread(off_t off, void *buf, std::size_t n)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    const std::size_t available = m_blocks.truncate_access(off, n);
+    // present blocks beyond the end of the data file are holes
+    auto read_result = read_locked(off, static_cast<std::byte*>(buf), available);
+    if (!read_result) {
+        return copy_error(read_result);
+    }
+    return make_result(available);
+}
+
+Result<std::size_t> RegularFileHandle::pwrite(off_t off, const void *buf,
+                                              std::size_t n,
+                                              Blocklist::State state)
+{
+    if (n == 0) {
+        return make_result(n);
+    }
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    auto inflate_result = inflate_locked(start, end);
+    if (!inflate_result) {
+        return copy_error(inflate_result);
+    }
+    auto write_result = pwrite_all(int(m_data),
+                                   static_cast<const std::byte*>(buf), n, off);
+    if (!write_result) {
+        return copy_error(write_result);
+    }
+    mark_locked(start, end - start, state);
+    auto checksum_result = update_checksums_locked(start, end);
+    if (!checksum_result) {
+        return copy_error(checksum_result);
+    }
+    return make_result(n);
+}
+
+Result<void> RegularFileHandle::fill(off_t off, const void *buf, std::size_t n)
+{
+    const auto *src = static_cast<const std::byte*>(buf);
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    for (const auto &gap: gaps(m_blocks.ranges(start, end - start), start, end)) {
+        const std::size_t gap_off = (gap.start - start) * CACHE_PAGE_SIZE;
+        const std::size_t gap_len = std::min<std::size_t>(
+                    gap.count * CACHE_PAGE_SIZE, n - gap_off);
+        auto inflate_result = inflate_locked(gap.start, gap.end());
+        if (!inflate_result) {
+            return inflate_result;
+        }
+        auto write_result = pwrite_all(int(m_data), src + gap_off, gap_len,
+                                       off + gap_off);
+        if (!write_result) {
+            return write_result;
+        }
+        mark_locked(gap.start, gap.count, Blocklist::READ);
+        auto checksum_result = update_checksums_locked(gap.start, gap.end());
+        if (!checksum_result) {
+            return checksum_result;
+        }
+    }
+    return make_result();
+}
+
+void RegularFileHandle::mark(off_t off, std::size_t n, Blocklist::State state)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    release_write_locked(first_block(off));
+    if (n == 0) {
+        return;
+    }
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+    mark_locked(start, end - start, state);
+    if (state != Blocklist::ABSENT) {
+        // a failure shows up as a mismatch on verification
+        (void)update_checksums_locked(start, end);
+    }
+}
+
+std::vector<Blocklist::Range> RegularFileHandle::missing(off_t off, std::size_t n) const
+{
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    return gaps(m_blocks.ranges(start, end - start), start, end);
+}
+
+std::vector<Blocklist::Range> RegularFileHandle::ranges(Blocklist::State state) const
+{
+    std::vector<Blocklist::Range> result;
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    for (const auto &range: m_blocks.ranges()) {
+        if (range.state == state) {
+            result.push_back(range);
+        }
+    }
+    return result;
+}
+
+void RegularFileHandle::transition(const Blocklist::Range &range,
+                                   Blocklist::State from,
+                                   Blocklist::State to)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    for (const auto &sub: m_blocks.ranges(range.start, range.count)) {
+        if (sub.state == from) {
+            mark_locked(sub.start, sub.count, to);
+        }
+    }
+}
+
+std::uint64_t RegularFileHandle::write_generation() const
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    return m_write_generation;
+}
+
+void RegularFileHandle::log_writes(bool enable)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    m_logging_writes = enable;
+    if (!enable) {
+        m_write_log.clear();
+    }
+}
+
+void RegularFileHandle::mark_uploaded(const Blocklist::Range &range,
+                                      std::uint64_t generation)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    for (const auto &sub: m_blocks.ranges(range.start, range.count)) {
+        if (sub.state != Blocklist::WRITTEN) {
+            continue;
+        }
+        // carve out everything which has been written to again since
+        std::vector<Blocklist::Range> clean{sub};
+        for (const auto &[written_generation, written]: m_write_log) {
+            if (written_generation <= generation) {
+                continue;
+            }
+            std::vector<Blocklist::Range> remaining;
+            for (const auto &part: clean) {
+                if (written.end() <= part.start || written.start >= part.end()) {
+                    remaining.push_back(part);
+                    continue;
+                }
+                if (part.start < written.start) {
+                    remaining.push_back(Blocklist::Range{
+                        part.start, written.start - part.start, part.state
+                    });
+                }
+                if (written.end() < part.end()) {
+                    remaining.push_back(Blocklist::Range{
+                        written.end(), part.end() - written.end(), part.state
+                    });
+                }
+            }
+            clean = std::move(remaining);
+        }
+        for (const auto &part: clean) {
+            mark_locked(part.start, part.count, Blocklist::READ);
+        }
+    }
+}
+
+FileResidency RegularFileHandle::residency(std::uint64_t size,
+                                          bool with_ranges) const
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    return blocklist_residency(m_blocks, size, with_ranges);
+}
+
+std::uint64_t RegularFileHandle::blocks(Blocklist::State state) const
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    return m_blocks.blocks(state);
+}
+
+std::int64_t RegularFileHandle::take_unaccounted_bytes()
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    const std::int64_t result = m_unaccounted_blocks * static_cast<std::int64_t>(CACHE_PAGE_SIZE);
+    m_unaccounted_blocks = 0;
+    return result;
+}
+
+void RegularFileHandle::record_access(off_t off, std::size_t n)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    (void)m_trace.record(off, n);
+}
+
+AccessTrace RegularFileHandle::take_access_trace()
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    AccessTrace result;
+    std::swap(result, m_trace);
+    return result;
+}
+
+Result<void> RegularFileHandle::truncate(std::uint64_t size)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    const std::uint64_t keep = (size + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+    for (const auto &range: m_blocks.ranges(keep)) {
+        mark_locked(range.start, range.count, Blocklist::ABSENT);
+    }
+    if (size % COMPRESSION_EXTENT_SIZE != 0) {
+        // the extent which is cut in half must be stored uncompressed
+        auto inflate_result = inflate_locked(size / CACHE_PAGE_SIZE,
+                                             size / CACHE_PAGE_SIZE + 1);
+        if (!inflate_result) {
+            return inflate_result;
+        }
+    }
+    auto drop_result = drop_extents_locked(
+                (size + COMPRESSION_EXTENT_SIZE - 1) / COMPRESSION_EXTENT_SIZE);
+    if (!drop_result) {
+        return drop_result;
+    }
+    if (::ftruncate(int(m_data), size) != 0) {
+        return make_result(FAILED, errno);
+    }
+    const std::uint64_t last = size / CACHE_PAGE_SIZE;
+    if (size % CACHE_PAGE_SIZE != 0 && !m_blocks.ranges(last, 1).empty()) {
+        // the tail of the last block now reads as zeroes
+        return update_checksums_locked(last, last + 1);
+    }
+    return make_result();
+}
+
+Result<std::size_t> RegularFileHandle::copy_from(RegularFileHandle &src,
+                                                 off_t src_off, off_t off,
+                                                 std::size_t n)
+{
+    if (n == 0) {
+        return make_result(n);
+    }
+    if (&src == this && src_off < static_cast<off_t>(off + n)
+            && off < static_cast<off_t>(src_off + n)) {
+        return make_result(FAILED, EINVAL);
+    }
+
+    std::unique_lock<profiled_mutex> src_lock(src.m_mutex, std::defer_lock);
+    std::unique_lock<profiled_mutex> lock(m_mutex, std::defer_lock);
+    if (&src == this) {
+        lock.lock();
+    } else {
+        std::lock(src_lock, lock);
+    }
+
+    n = src.m_blocks.truncate_access(src_off, n);
+    if (n == 0) {
+        return make_result(n);
+    }
+
+    // both sides are accessed through their data files below
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+    auto src_inflate_result = src.inflate_locked(first_block(src_off),
+                                                 end_block(src_off, n));
+    if (!src_inflate_result) {
+        return copy_error(src_inflate_result);
+    }
+    auto inflate_result = inflate_locked(start, end);
+    if (!inflate_result) {
+        return copy_error(inflate_result);
+    }
+
+    // with equal alignment, the whole blocks in between can share extents
+    std::size_t head = 0;
+    std::size_t cloned = 0;
+    if (src_off % CACHE_PAGE_SIZE == off % CACHE_PAGE_SIZE) {
+        head = std::min<std::size_t>(
+                    (CACHE_PAGE_SIZE - off % CACHE_PAGE_SIZE) % CACHE_PAGE_SIZE, n);
+        const std::size_t length = (n - head) / CACHE_PAGE_SIZE * CACHE_PAGE_SIZE;
+        if (length > 0) {
+            struct file_clone_range clone{
+                .src_fd = int(src.m_data),
+                .src_offset = static_cast<std::uint64_t>(src_off + head),
+                .src_length = length,
+                .dest_offset = static_cast<std::uint64_t>(off + head),
+            };
+            // any failure (no reflink support, source data ending early,
+            // ...) falls back to copying
+            if (::ioctl(int(m_data), FICLONERANGE, &clone) == 0) {
+                cloned = length;
+            }
+        }
+    }
+
+    if (cloned > 0) {
+        auto head_result = copy_all(int(src.m_data), src_off,
+                                    int(m_data), off, head);
+        if (!head_result) {
+            return copy_error(head_result);
+        }
+        const std::size_t tail = head + cloned;
+        auto tail_result = copy_all(int(src.m_data), src_off + tail,
+                                    int(m_data), off + tail, n - tail);
+        if (!tail_result) {
+            return copy_error(tail_result);
+        }
+    } else {
+        auto copy_result = copy_all(int(src.m_data), src_off,
+                                    int(m_data), off, n);
+        if (!copy_result) {
+            return copy_error(copy_result);
+        }
+    }
+
+    mark_locked(start, end - start, Blocklist::WRITTEN);
+    auto checksum_result = update_checksums_locked(start, end);
+    if (!checksum_result) {
+        return copy_error(checksum_result);
+    }
+    return make_result(n);
+}
+
+Result<void> RegularFileHandle::discard(off_t off, std::size_t n)
+{
+    const std::uint64_t start = end_block(off, 0);
+    const std::uint64_t end = first_block(off + n);
+    if (start >= end) {
+        return make_result();
+    }
+
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    const std::uint64_t first_extent = start / COMPRESSION_EXTENT_BLOCKS;
+    const std::uint64_t end_extent = (end + COMPRESSION_EXTENT_BLOCKS - 1) / COMPRESSION_EXTENT_BLOCKS;
+    for (std::uint64_t extent = first_extent;
+         extent < end_extent && m_compressed_extents > 0;
+         ++extent) {
+        auto info_result = extent_info_locked(extent);
+        if (!info_result) {
+            return copy_error(info_result);
+        }
+        if (*info_result == 0) {
+            continue;
+        }
+        const std::uint64_t extent_start = extent * COMPRESSION_EXTENT_BLOCKS;
+        if (extent_start >= start && extent_start + COMPRESSION_EXTENT_BLOCKS <= end) {
+            // gone completely, no need to decompress it
+            auto info_write_result = set_extent_info_locked(extent, *info_result, 0);
+            if (!info_write_result) {
+                return info_write_result;
+            }
+        } else {
+            auto inflate_result = inflate_locked(extent_start, extent_start + 1);
+            if (!inflate_result) {
+                return inflate_result;
+            }
+        }
+    }
+
+    for (const auto &range: m_blocks.ranges(start, end - start)) {
+        if (range.state == Blocklist::WRITTEN) {
+            continue;
+        }
+        if (::fallocate(int(m_data), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        range.start * CACHE_PAGE_SIZE,
+                        range.count * CACHE_PAGE_SIZE) != 0
+                && errno != EOPNOTSUPP) {
+            // without hole punching support, the space is only reclaimed
+            // when the file is evicted, but the blocks are gone all the same
+            return make_result(FAILED, errno);
+        }
+        mark_locked(range.start, range.count, Blocklist::ABSENT);
+    }
+    return make_result();
+}
+
+Result<std::uint64_t> RegularFileHandle::verify(off_t off, std::size_t n)
+{
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+    if (start >= end) {
+        return make_result(std::uint64_t(0));
+    }
+
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    const std::uint64_t batch_size = std::min(CHECKSUM_BATCH, end - start);
+    std::vector<std::byte> data(batch_size * CACHE_PAGE_SIZE);
+    std::vector<std::uint32_t> sums(batch_size);
+    std::uint64_t dropped = 0;
+    bool lost = false;
+    for (const auto &range: m_blocks.ranges(start, end - start)) {
+        for (std::uint64_t batch = range.start; batch < range.end(); batch += batch_size) {
+            const std::uint64_t count = std::min(batch_size, range.end() - batch);
+            auto sums_result = pread_all(int(m_checksums),
+                                         reinterpret_cast<std::byte*>(sums.data()),
+                                         count * sizeof(std::uint32_t),
+                                         batch * sizeof(std::uint32_t));
+            if (!sums_result) {
+                return copy_error(sums_result);
+            }
+            auto read_result = read_locked(batch * CACHE_PAGE_SIZE, data.data(),
+                                           count * CACHE_PAGE_SIZE);
+            if (!read_result) {
+                return copy_error(read_result);
+            }
+            for (std::uint64_t i = 0; i < count; ++i) {
+                if (sums[i] == 0 ||
+                        crc32c(0, data.data() + i * CACHE_PAGE_SIZE, CACHE_PAGE_SIZE) == sums[i]) {
+                    continue;
+                }
+                if (range.state == Blocklist::WRITTEN) {
+                    lost = true;
+                    continue;
+                }
+                mark_locked(batch + i, 1, Blocklist::ABSENT);
+                ++dropped;
+            }
+        }
+    }
+    if (lost) {
+        return make_result(FAILED, EIO);
+    }
+    return make_result(dropped);
+}
+
+Result<void> RegularFileHandle::compress(off_t off, std::size_t n,
+                                         Compression algorithm)
+{
+    if (algorithm == Compression::NONE || n == 0) {
+        return make_result();
+    }
+    if (!compression_available(algorithm)) {
+        return make_result(FAILED, EOPNOTSUPP);
+    }
+
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    struct stat st;
+    if (::fstat(int(m_data), &st) != 0) {
+        return make_result(FAILED, errno);
+    }
+    const std::uint64_t data_end = st.st_size;
+
+    const std::uint64_t first = off / COMPRESSION_EXTENT_SIZE;
+    const std::uint64_t last = (off + n + COMPRESSION_EXTENT_SIZE - 1) / COMPRESSION_EXTENT_SIZE;
+    std::vector<std::byte> plain(COMPRESSION_EXTENT_SIZE);
+    std::vector<std::byte> compressed(COMPRESSION_EXTENT_SIZE);
+    for (std::uint64_t extent = first; extent < last; ++extent) {
+        const std::uint64_t extent_off = extent * COMPRESSION_EXTENT_SIZE;
+        if (extent_off >= data_end) {
+            break;
+        }
+        const std::size_t length = std::min<std::uint64_t>(
+                    COMPRESSION_EXTENT_SIZE, data_end - extent_off);
+        const std::uint64_t start = extent_off / CACHE_PAGE_SIZE;
+        const std::uint64_t end = end_block(extent_off, length);
+        if (end - start < 2) {
+            // cannot shrink by a whole block
+            continue;
+        }
+
+        auto info_result = extent_info_locked(extent);
+        if (!info_result) {
+            return copy_error(info_result);
+        }
+        if (*info_result != 0) {
+            continue;
+        }
+
+        const bool writing = std::any_of(
+                    m_writes_in_flight.begin(), m_writes_in_flight.end(),
+                    [start, end](const Blocklist::Range &range) {
+                        return range.start < end && range.end() > start;
+                    });
+        if (writing) {
+            // the blocks are only marked WRITTEN once the data has landed
+            continue;
+        }
+
+        std::uint64_t present = 0;
+        for (const auto &range: m_blocks.ranges(start, end - start)) {
+            if (range.state == Blocklist::WRITTEN) {
+                // would only be decompressed again on the next write
+                present = 0;
+                break;
+            }
+            present += range.count;
+        }
+        if (present != end - start) {
+            continue;
+        }
+
+        auto read_result = pread_all(int(m_data), plain.data(), length, extent_off);
+        if (!read_result) {
+            return read_result;
+        }
+        if (m_counters) {
+            m_counters->probed_bytes.fetch_add(length, std::memory_order_relaxed);
+        }
+        if (sample_entropy(plain.data(), length) > COMPRESSION_ENTROPY_LIMIT) {
+            if (m_counters) {
+                m_counters->skipped_bytes.fetch_add(length, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        const auto t0 = std::chrono::steady_clock::now();
+        auto compress_result = Dragonstash::compress(
+                    algorithm, plain.data(), length, compressed.data(),
+                    (end - start - 1) * CACHE_PAGE_SIZE);
+        if (m_counters) {
+            m_counters->compress_ns.fetch_add(nanoseconds_since(t0), std::memory_order_relaxed);
+        }
+        if (!compress_result) {
+            return copy_error(compress_result);
+        }
+        if (*compress_result == 0) {
+            continue;
+        }
+        const std::size_t stored = *compress_result;
+
+        // on failure, the blocks stay hidden and are fetched again
+        const auto hidden = hide_locked(start, end);
+        auto write_result = pwrite_all(int(m_data), compressed.data(), stored,
+                                       extent_off);
+        if (!write_result) {
+            return write_result;
+        }
+        auto info_write_result = set_extent_info_locked(
+                    extent, 0,
+                    (static_cast<std::uint32_t>(algorithm) << EXTENT_ALGORITHM_SHIFT) | stored);
+        if (!info_write_result) {
+            return info_write_result;
+        }
+        restore_locked(hidden);
+        const std::uint64_t hole = end_block(extent_off, stored) * CACHE_PAGE_SIZE;
+        if (::fallocate(int(m_data), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        hole, end * CACHE_PAGE_SIZE - hole) != 0
+                && errno != EOPNOTSUPP) {
+            return make_result(FAILED, errno);
+        }
+        if (m_counters) {
+            m_counters->compressed_bytes.fetch_add(length, std::memory_order_relaxed);
+            m_counters->stored_bytes.fetch_add(stored, std::memory_order_relaxed);
+        }
+    }
+    return make_result();
+}
+
+Result<void> RegularFileHandle::inflate(off_t off, std::size_t n)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    const std::uint64_t start = first_block(off);
+    const std::uint64_t end = end_block(off, n);
+    auto inflate_result = inflate_locked(start, end);
+    if (!inflate_result) {
+        return inflate_result;
+    }
+    m_writes_in_flight.push_back(Blocklist::Range{start, end - start, Blocklist::WRITTEN});
+    return make_result();
+}
+
+void RegularFileHandle::release_write(off_t off)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    release_write_locked(first_block(off));
+}
+
+void RegularFileHandle::release_write_locked(std::uint64_t start)
+{
+    auto iter = std::find_if(m_writes_in_flight.begin(), m_writes_in_flight.end(),
+                             [start](const Blocklist::Range &range) {
+                                 return range.start == start;
+                             });
+    if (iter != m_writes_in_flight.end()) {
+        m_writes_in_flight.erase(iter);
+    }
+}
+
+std::uint64_t RegularFileHandle::compressed_extents() const
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    return m_compressed_extents;
+}
+
+Result<void> RegularFileHandle::fsync(bool datasync)
+{
+    std::lock_guard<profiled_mutex> lock(m_mutex);
+    try {
+        m_blocks.sync();
+    } catch (const std::runtime_error &) {
+        return make_result(FAILED, EIO);
+    }
+    for (int fd: {int(m_data), int(m_checksums), int(m_extents)}) {
+        const int rc = datasync ? ::fdatasync(fd) : ::fsync(fd);
+        if (rc != 0) {
+            return make_result(FAILED, errno);
+        }
+    }
+    return make_result();
+}
+
+}
@@ -0,0 +1,194 @@
+/**********************************************************************
+File name: dir_prefetch.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/dir_prefetch.hpp"
+
+#include <algorithm>
+
+namespace Dragonstash {
+
+DirPrefetcher::DirPrefetcher(SyncFunc sync, const DirPrefetchOptions &options):
+    m_sync(std::move(sync)),
+    m_options(options),
+    m_scheduled(0),
+    m_synced_count(0),
+    m_used(0),
+    m_wasted(0),
+    m_last_activity(Clock::now()),
+    m_active(0),
+    m_stop(false)
+{
+    if (m_options.enabled) {
+        for (unsigned i = 0; i < std::max(1u, m_options.concurrency); ++i) {
+            m_threads.emplace_back(&DirPrefetcher::run, this);
+        }
+    }
+}
+
+DirPrefetcher::~DirPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        drop_queue_locked();
+    }
+    m_wakeup.notify_all();
+    for (auto &thread: m_threads) {
+        thread.join();
+    }
+}
+
+void DirPrefetcher::schedule_locked(const std::vector<ino_t> &dirs,
+                                    unsigned depth)
+{
+    if (depth > m_options.max_depth) {
+        return;
+    }
+    for (const ino_t ino: dirs) {
+        if (m_queue.size() >= m_options.max_pending) {
+            break;
+        }
+        if (m_pending.count(ino) || m_synced.count(ino)) {
+            continue;
+        }
+        m_pending.insert(ino);
+        m_queue.push_back(Job{ino, depth});
+        m_scheduled.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void DirPrefetcher::expire_locked(Clock::time_point now)
+{
+    for (auto iter = m_synced.begin(); iter != m_synced.end();) {
+        if (now - iter->second.at > m_options.max_age) {
+            m_wasted.fetch_add(1, std::memory_order_relaxed);
+            iter = m_synced.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+void DirPrefetcher::drop_queue_locked()
+{
+    for (const auto &job: m_queue) {
+        m_pending.erase(job.ino);
+    }
+    m_queue.clear();
+    if (m_active == 0) {
+        m_idle.notify_all();
+    }
+}
+
+std::optional<std::vector<ino_t>> DirPrefetcher::take(ino_t ino)
+{
+    if (!m_options.enabled) {
+        return std::nullopt;
+    }
+
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_last_activity = now;
+    expire_locked(now);
+    auto iter = m_synced.find(ino);
+    if (iter == m_synced.end()) {
+        return std::nullopt;
+    }
+    std::vector<ino_t> result = std::move(iter->second.subdirs);
+    m_synced.erase(iter);
+    m_used.fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
+
+void DirPrefetcher::schedule(const std::vector<ino_t> &subdirs)
+{
+    if (!m_options.enabled || subdirs.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        schedule_locked(subdirs, 1);
+    }
+    m_wakeup.notify_all();
+}
+
+void DirPrefetcher::drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this](){ return m_stop || (m_queue.empty() && m_active == 0); });
+}
+
+void DirPrefetcher::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wakeup.wait(lock, [this](){ return m_stop || !m_queue.empty(); });
+        if (m_stop) {
+            break;
+        }
+        if (Clock::now() - m_last_activity > m_options.idle_timeout) {
+            // the walk has ended (or moved elsewhere)
+            drop_queue_locked();
+            continue;
+        }
+
+        const Job job = m_queue.front();
+        m_queue.pop_front();
+        ++m_active;
+
+        lock.unlock();
+        auto sync_result = m_sync(job.ino);
+        lock.lock();
+
+        --m_active;
+        m_pending.erase(job.ino);
+        if (sync_result) {
+            m_synced_count.fetch_add(1, std::memory_order_relaxed);
+            const auto now = Clock::now();
+            expire_locked(now);
+            schedule_locked(*sync_result, job.depth + 1);
+            m_synced[job.ino] = Synced{std::move(*sync_result), now};
+            m_wakeup.notify_all();
+        } else if (sync_result.error() == ENOTCONN) {
+            // nothing to gain until the backend is back
+            drop_queue_locked();
+        }
+
+        if (m_queue.empty() && m_active == 0) {
+            m_idle.notify_all();
+        }
+    }
+}
+
+DirPrefetchStats DirPrefetcher::stats() const
+{
+    return DirPrefetchStats{
+        .scheduled = m_scheduled.load(std::memory_order_relaxed),
+        .synced = m_synced_count.load(std::memory_order_relaxed),
+        .used = m_used.load(std::memory_order_relaxed),
+        .wasted = m_wasted.load(std::memory_order_relaxed),
+    };
+}
+
+}
@@ -24,15 +24,598 @@ authors named in the AUTHORS file.
 **********************************************************************/
 #include "dragonstash/fs.hpp"
 
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include "dragonstash/fuse/buffer.hpp"
 
 namespace Dragonstash {
 
-Filesystem::Filesystem(Cache &cache, Backend::Filesystem &backend):
+/**
+ * Virtual extended attributes of regular files, reporting how much of the
+ * file is present in the cache:
+ *
+ * - `resident`: number of bytes present, in decimal
+ * - `dirty`: number of bytes not written back yet, in decimal
+ * - `extents`: one line per run of present blocks, holding byte offset,
+ *   length and state, separated by spaces
+ */
+static const std::string_view XATTR_RESIDENT = "user.dragonstash.resident";
+static const std::string_view XATTR_DIRTY = "user.dragonstash.dirty";
+static const std::string_view XATTR_EXTENTS = "user.dragonstash.extents";
+
+/**
+ * Control attribute of regular files: `1` if the file is pinned, i.e.
+ * excluded from eviction, `0` otherwise. Setting it pins or unpins the file;
+ * removing it unpins the file.
+ */
+static const std::string_view XATTR_PINNED = "user.dragonstash.pinned";
+
+/**
+ * Control attribute of the root directory: setting it (to any value)
+ * compacts the metadata database while the mount keeps serving requests;
+ * reading it returns the database size before and after the last compaction,
+ * in bytes, separated by a space.
+ */
+static const std::string_view XATTR_COMPACT = "user.dragonstash.compact";
+
+/**
+ * @brief Access the cached file stored in the fh of an open file.
+ */
+static inline std::shared_ptr<RegularFileHandle> &open_file(struct fuse_file_info *fi)
+{
+    return *reinterpret_cast<std::shared_ptr<RegularFileHandle>*>(fi->fh);
+}
+
+static inline struct timespec now()
+{
+    struct timespec result{};
+    clock_gettime(CLOCK_REALTIME, &result);
+    return result;
+}
+
+/**
+ * @brief Build the backend path of a directory entry.
+ */
+static Result<std::string> entry_path(CacheTransactionRO &txn, ino_t parent,
+                                      std::string_view name)
+{
+    auto path_result = txn.path(parent);
+    if (!path_result) {
+        return copy_error(path_result);
+    }
+    std::string result = std::move(*path_result);
+    result.reserve(result.size() + name.size() + 1);
+    result += '/';
+    result += name;
+    return result;
+}
+
+/**
+ * @brief How often sync_dir() lists a directory before giving up because it
+ * keeps being changed locally.
+ */
+static constexpr unsigned SYNC_DIR_ATTEMPTS = 3;
+
+static const char *state_name(Blocklist::State state)
+{
+    switch (state) {
+    case Blocklist::READAHEAD:
+        return "readahead";
+    case Blocklist::READ:
+        return "read";
+    case Blocklist::PINNED:
+        return "pinned";
+    case Blocklist::WRITTEN:
+        return "written";
+    case Blocklist::ABSENT:
+        break;
+    }
+    return "absent";
+}
+
+/**
+ * @brief Reply to a getxattr or listxattr request with @a value.
+ *
+ * With a @a size of zero, only the size of the value is reported.
+ */
+static void reply_xattr_value(Fuse::Request &req, std::string_view value,
+                              std::size_t size)
+{
+    if (size == 0) {
+        req.reply_xattr(value.size());
+    } else if (size < value.size()) {
+        req.reply_err(ERANGE);
+    } else {
+        req.reply_buf(value.data(), value.size());
+    }
+}
+
+/**
+ * @brief Attributes for an inode which is created locally.
+ */
+static InodeAttributes new_attributes(Fuse::Request &req, std::uint32_t mode)
+{
+    const fuse_ctx *ctx = req.ctx();
+    const struct timespec timestamp = now();
+    return InodeAttributes{
+        .common = CommonFileAttributes{
+            .size = 0,
+            .nblocks = 0,
+            .uid = ctx ? ctx->uid : getuid(),
+            .gid = ctx ? ctx->gid : getgid(),
+            .atime = timestamp,
+            .mtime = timestamp,
+            .ctime = timestamp,
+        },
+        .mode = mode,
+    };
+}
+
+/**
+ * @brief Look up a directory entry in the cache alone.
+ *
+ * ENOENT is only reported for synced directories; otherwise EIO is returned,
+ * because the entry may exist on the backend.
+ */
+static Result<ino_t> lookup_cached(CacheTransactionRO &txn, ino_t parent,
+                                   std::string_view name)
+{
+    auto ino_result = txn.lookup(parent, name);
+    if (!ino_result && ino_result.error() == ENOENT) {
+        auto flag_result = txn.test_flag(parent, InodeFlag::SYNCED);
+        if (!flag_result || !*flag_result) {
+            return make_result(FAILED, EIO);
+        }
+    }
+    return ino_result;
+}
+
+static Result<bool> is_empty_dir(CacheTransactionRO &txn, ino_t dir)
+{
+    ino_t cursor = 0;
+    while (true) {
+        auto entry = txn.readdir(dir, cursor);
+        if (!entry) {
+            if (entry.error() == 0) {
+                return true;
+            }
+            return copy_error(entry);
+        }
+        if (entry->name != "." && entry->name != "..") {
+            return false;
+        }
+        cursor = entry->ino;
+    }
+}
+
+Filesystem::Filesystem(Cache &cache, Backend::Filesystem &backend,
+                       const WritebackOptions &writeback_options,
+                       const VerifyOptions &verify_options,
+                       const PrefetchOptions &prefetch_options,
+                       const DirPrefetchOptions &dir_prefetch_options,
+                       const RecoveryOptions &recovery_options,
+                       const HotTierOptions &hot_tier_options):
     m_cache(cache),
-    m_backend_fs(backend)
+    m_backend_fs(backend),
+    m_writeback(cache, backend, writeback_options),
+    m_verifier(cache, verify_options),
+    m_prefetcher(cache,
+                 [this](ino_t ino, RegularFileHandle &file, off_t off,
+                        std::size_t n, std::uint64_t file_size) {
+                     return fetch(ino, file, off, n, file_size);
+                 },
+                 prefetch_options),
+    m_dir_prefetcher([this](ino_t ino) { return sync_dir(ino); },
+                     dir_prefetch_options),
+    m_recovery(cache, recovery_options),
+    m_hot_tier(hot_tier_options),
+    m_reads_memory(0),
+    m_reads_disk(0),
+    m_reads_backend(0)
+{
+
+}
+
+ReadStats Filesystem::read_stats() const
+{
+    return ReadStats{
+        .memory = m_reads_memory.load(std::memory_order_relaxed),
+        .disk = m_reads_disk.load(std::memory_order_relaxed),
+        .backend = m_reads_backend.load(std::memory_order_relaxed),
+    };
+}
+
+Result<std::pmr::string> Filesystem::get_backend_path(CacheTransactionRO &txn, ino_t ino)
+{
+    auto path_result = txn.path(ino, request_memory());
+    if (!path_result) {
+        return copy_error(path_result);
+    }
+    if (path_result->empty()) {
+        path_result->assign("/");
+    }
+    return std::move(*path_result);
+}
+
+void Filesystem::init(fuse_conn_info *conn)
+{
+    // let the kernel splice written data, so that write_buf can pass it on
+    // to the cache without copying it through userspace
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+}
+
+void Filesystem::destroy()
+{
+    // whatever cannot be written back now is picked up on the next mount
+    (void)m_writeback.flush_all();
+}
+
+Result<void> Filesystem::fetch(ino_t ino, RegularFileHandle &file,
+                               off_t off, std::size_t n,
+                               std::uint64_t file_size)
+{
+    if (file.missing(off, n).empty()) {
+        return make_result();
+    }
+
+    std::string path;
+    bool pending;
+    std::size_t chunk_size;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = txn.path(ino);
+        if (!path_result) {
+            return copy_error(path_result);
+        }
+        path = std::move(*path_result);
+        pending = !txn.journal_empty();
+        auto chunk_result = txn.chunk_size(ino);
+        if (!chunk_result) {
+            return copy_error(chunk_result);
+        }
+        chunk_size = *chunk_result;
+    }
+
+    // fetch whole chunks, so that large files are not fetched in tiny pieces
+    const off_t chunk_off = off - off % chunk_size;
+    const std::uint64_t chunk_end = (off + n + chunk_size - 1) / chunk_size * chunk_size;
+    const auto missing = file.missing(chunk_off, chunk_end - chunk_off);
+
+    std::unique_ptr<Backend::File> backend_file;
+    std::vector<std::byte> buffer;
+    for (const auto &gap: missing) {
+        const std::uint64_t gap_off = gap.start * CACHE_PAGE_SIZE;
+        const std::uint64_t gap_end = std::min<std::uint64_t>(
+                    gap.end() * CACHE_PAGE_SIZE, file_size);
+        if (gap_off >= gap_end) {
+            continue;
+        }
+
+        if (!backend_file) {
+            if (pending) {
+                // the file may not exist on the backend yet or under a
+                // different name
+                return make_result(FAILED, ENOTCONN);
+            }
+            auto open_result = m_backend_fs.open(path, O_RDONLY, 0);
+            if (!open_result) {
+                return copy_error(open_result);
+            }
+            backend_file = std::move(*open_result);
+        }
+
+        const std::size_t len = gap_end - gap_off;
+        buffer.resize(len);
+        std::size_t done = 0;
+        while (done < len) {
+            auto read_result = backend_file->pread(buffer.data() + done,
+                                                   len - done, gap_off + done);
+            if (!read_result) {
+                return copy_error(read_result);
+            }
+            if (*read_result == 0) {
+                // the backend file is shorter than our idea of it
+                memset(buffer.data() + done, 0, len - done);
+                break;
+            }
+            done += *read_result;
+        }
+
+        auto fill_result = file.fill(gap_off, buffer.data(), len);
+        if (!fill_result) {
+            return fill_result;
+        }
+        m_cache.deduplicate(ino, file, gap_off, buffer.data(), len);
+        m_cache.compress(file, gap_off, len);
+    }
+
+    if (backend_file) {
+        (void)backend_file->close();
+    }
+
+    const std::int64_t delta = file.take_unaccounted_bytes();
+    if (delta != 0) {
+        auto txn = m_cache.begin_rw();
+        txn.account_file_bytes(ino, delta);
+        (void)txn.commit();
+    }
+    return make_result();
+}
+
+Result<void> Filesystem::prepare_write(ino_t ino, RegularFileHandle &file,
+                                       off_t off, std::size_t n)
+{
+    std::uint64_t file_size;
+    {
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        file_size = attr_result->attr.common.size;
+    }
+
+    const off_t end = off + n;
+    const off_t head = off - off % CACHE_PAGE_SIZE;
+    const bool head_partial = head != off;
+    if (head_partial) {
+        auto fetch_result = fetch(ino, file, head, CACHE_PAGE_SIZE, file_size);
+        if (!fetch_result) {
+            return fetch_result;
+        }
+    }
+    const off_t tail = end - end % CACHE_PAGE_SIZE;
+    if (tail != end && !(head_partial && tail == head)) {
+        auto fetch_result = fetch(ino, file, tail, CACHE_PAGE_SIZE, file_size);
+        if (!fetch_result) {
+            return fetch_result;
+        }
+    }
+    return make_result();
+}
+
+Result<void> Filesystem::finish_write(ino_t ino,
+                                      const std::shared_ptr<RegularFileHandle> &file,
+                                      off_t off, std::size_t n)
+{
+    const std::uint64_t end = off + n;
+    {
+        // every write changes mtime and ctime, not only those which extend
+        // the file
+        auto txn = m_cache.begin_rw();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        CommonFileAttributes attrs = attr_result->attr.common;
+        if (end > attrs.size) {
+            attrs.size = end;
+        }
+        attrs.mtime = now();
+        attrs.ctime = attrs.mtime;
+        auto setattr_result = txn.setattr(ino, attrs);
+        if (!setattr_result) {
+            return setattr_result;
+        }
+        txn.account_file_bytes(ino, file->take_unaccounted_bytes());
+        auto commit_result = txn.commit();
+        if (!commit_result) {
+            return commit_result;
+        }
+    }
+
+    return m_writeback.mark_dirty(file);
+}
+
+std::atomic<std::uint64_t> &Filesystem::dir_generation(ino_t dir)
+{
+    return m_dir_generations[dir % m_dir_generations.size()];
+}
+
+void Filesystem::touch_dir(ino_t dir)
+{
+    dir_generation(dir).fetch_add(1);
+}
+
+Result<std::vector<ino_t>> Filesystem::sync_dir(ino_t ino)
+{
+    std::pmr::string backend_path(request_memory());
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = get_backend_path(txn, ino);
+        if (!path_result) {
+            return copy_error(path_result);
+        }
+        if (!txn.journal_empty()) {
+            return make_result(FAILED, ENOTCONN);
+        }
+        backend_path = std::move(*path_result);
+    }
+
+    // talk to the backend before taking the write lock of the cache, so
+    // that syncs of different directories do not hold each other up
+    std::pmr::vector<std::pair<std::pmr::string, InodeAttributes>> entries(
+                request_memory());
+    std::pmr::string entry_path(request_memory());
+    std::vector<Backend::DirEntryRef> batch;
+    for (unsigned attempt = 1; ; ++attempt) {
+        // a local change committed after this point may be missing from the
+        // listing, and the rewrite would orphan (or resurrect) its entry
+        const std::uint64_t generation = dir_generation(ino).load();
+
+        auto dir = m_backend_fs.opendir(backend_path);
+        if (!dir) {
+            return copy_error(dir);
+        }
+
+        entries.clear();
+        while (true) {
+            // an incomplete listing must not replace the cached one
+            auto read_result = (*dir)->read_batch(batch);
+            if (!read_result) {
+                return copy_error(read_result);
+            }
+            if (batch.empty()) {
+                break;
+            }
+            for (const auto &entry: batch) {
+                entry_path = backend_path;
+                entry_path.reserve(entry_path.size() + entry.name.size() + 1);
+                if (entry_path.size() > 1) {
+                    // need to add a slash to the end
+                    entry_path += '/';
+                }
+                entry_path += entry.name;
+                auto stat_result = m_backend_fs.lstat(entry_path);
+                if (!stat_result) {
+                    continue;
+                }
+                entries.emplace_back(entry.name,
+                                     InodeAttributes::from_backend_stat(*stat_result));
+            }
+        }
+
+        auto txn = m_cache.begin_rw();
+        if (!txn.journal_empty()) {
+            // an offline change came in meanwhile; the listing would undo it
+            return make_result(FAILED, ENOTCONN);
+        }
+        if (dir_generation(ino).load() != generation) {
+            if (attempt < SYNC_DIR_ATTEMPTS) {
+                continue;
+            }
+            return make_result(FAILED, EAGAIN);
+        }
+        std::vector<ino_t> subdirs;
+        (void)txn.start_dir_rewrite(ino);
+        bool complete = true;
+        for (const auto &[name, info]: entries) {
+            auto emplace_result = txn.emplace(ino, name, info);
+            if (!emplace_result) {
+                // e.g. ENOSPC from the inode limit
+                complete = false;
+                continue;
+            }
+            if (S_ISDIR(info.mode)) {
+                subdirs.push_back(*emplace_result);
+            }
+        }
+        // while the backend is unreachable, lookup() takes a name missing from
+        // a synced directory as proof that it does not exist
+        if (complete) {
+            (void)txn.update_flags(ino, {InodeFlag::SYNCED});
+        } else {
+            (void)txn.update_flags(ino, {}, {InodeFlag::SYNCED});
+        }
+        (void)txn.finish_dir_rewrite();
+        if (!txn.commit()) {
+            return make_result(FAILED, EIO);
+        }
+        return subdirs;
+    }
+}
+
+Result<Stat> Filesystem::change_attributes(ino_t ino, JournalEntry change)
 {
+    bool pending;
+    std::uint32_t format;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = get_backend_path(txn, ino);
+        if (!path_result) {
+            return copy_error(path_result);
+        }
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        change.path.assign(*path_result);
+        format = attr_result->attr.mode & S_IFMT;
+        pending = !txn.journal_empty();
+    }
+
+    std::shared_ptr<RegularFileHandle> file;
+    if (change.fields & JournalEntry::SIZE) {
+        if (format == S_IFDIR) {
+            return make_result(FAILED, EISDIR);
+        }
+        auto file_result = m_cache.open_file(ino);
+        if (!file_result) {
+            return copy_error(file_result);
+        }
+        file = std::move(*file_result);
+    }
+
+    // once operations are journaled, everything else has to be journaled,
+    // too, to keep the order
+    Result<void> backend_result = make_result(FAILED, ENOTCONN);
+    if (!pending) {
+        backend_result = change.apply(m_backend_fs);
+        if (!backend_result && !Backend::is_not_connected(backend_result)) {
+            return copy_error(backend_result);
+        }
+    }
+
+    if (file) {
+        auto truncate_result = file->truncate(change.size);
+        m_hot_tier.invalidate(ino);
+        if (!truncate_result) {
+            return copy_error(truncate_result);
+        }
+    }
+
+    auto txn = m_cache.begin_rw();
+    auto attr_result = txn.getattr(ino);
+    if (!attr_result) {
+        return copy_error(attr_result);
+    }
+    CommonFileAttributes attrs = attr_result->attr.common;
+    const struct timespec timestamp = now();
+    if (change.fields & JournalEntry::SIZE) {
+        attrs.size = change.size;
+        attrs.mtime = timestamp;
+    }
+    if (change.fields & JournalEntry::ATIME) {
+        attrs.atime = change.atime;
+    }
+    if (change.fields & JournalEntry::MTIME) {
+        attrs.mtime = change.mtime;
+    }
+    attrs.ctime = timestamp;
+    auto setattr_result = txn.setattr(ino, attrs);
+    if (!setattr_result) {
+        return copy_error(setattr_result);
+    }
+    if (change.fields & JournalEntry::MODE) {
+        auto chmod_result = txn.chmod(ino, change.mode);
+        if (!chmod_result) {
+            return copy_error(chmod_result);
+        }
+    }
+    if (file) {
+        txn.account_file_bytes(ino, file->take_unaccounted_bytes());
+    }
+    if (!backend_result) {
+        txn.journal_append(change);
+    }
 
+    auto stat_result = txn.getattr(ino);
+    if (!stat_result) {
+        return stat_result;
+    }
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        return copy_error(commit_result);
+    }
+    return stat_result;
 }
 
 void Filesystem::lookup(Fuse::Request &&req, fuse_ino_t parent, std::string_view name)
@@ -44,19 +627,23 @@ void Filesystem::lookup(Fuse::Request &&req, fuse_ino_t parent, std::string_view
     e.attr_timeout = 1.0;
     e.entry_timeout = 1.0;
 
-    auto path_result = txn.path(parent);
+    auto path_result = txn.path(parent, request_memory());
     if (!path_result) {
         req.reply_err(path_result.error());
         return;
     }
 
-    std::string backend_path = *path_result;
+    std::pmr::string backend_path = std::move(*path_result);
     backend_path.reserve(backend_path.size() + name.size() + 1);
     backend_path += '/';
     backend_path += name;
     std::string_view backend_path_view(backend_path);
 
-    auto stat_result = m_backend_fs.lstat(backend_path_view);
+    // while journaled operations are pending, the cache is ahead of the
+    // backend and must not be refreshed from it
+    auto stat_result = txn.journal_empty()
+            ? m_backend_fs.lstat(backend_path_view)
+            : Result<Backend::Stat>(FAILED, ENOTCONN);
     if (stat_result) {
         auto cache_attrs = InodeAttributes::from_backend_stat(*stat_result);
 
@@ -127,6 +714,7 @@ void Filesystem::lookup(Fuse::Request &&req, fuse_ino_t parent, std::string_view
         req.reply_err(commit_result.error());
         return;
     }
+    m_cache.access_sketch().touch(e.ino);
     req.reply_entry(&e);
 }
 
@@ -151,10 +739,70 @@ void Filesystem::getattr(Fuse::Request &&req, fuse_ino_t ino, fuse_file_info *fi
         return;
     }
 
+    m_cache.access_sketch().touch(ino);
     struct stat stbuf = *getattr_result;
     req.reply_attr(stbuf, 1.0);
 }
 
+void Filesystem::setattr(Fuse::Request &&req, fuse_ino_t ino, struct stat &attr, int to_set, fuse_file_info *fi)
+{
+    if (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        // ownership cannot be changed, but chown to the current owner is
+        // fine
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        if (((to_set & FUSE_SET_ATTR_UID) && attr.st_uid != attr_result->attr.common.uid) ||
+                ((to_set & FUSE_SET_ATTR_GID) && attr.st_gid != attr_result->attr.common.gid)) {
+            req.reply_err(EPERM);
+            return;
+        }
+    }
+
+    JournalEntry change{
+        .op = JournalEntry::Op::SETATTR,
+        .fields = 0,
+    };
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        change.fields |= JournalEntry::MODE;
+        change.mode = attr.st_mode;
+    }
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        if (attr.st_size < 0) {
+            req.reply_err(EINVAL);
+            return;
+        }
+        change.fields |= JournalEntry::SIZE;
+        change.size = attr.st_size;
+    }
+    if (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_ATIME_NOW)) {
+        change.fields |= JournalEntry::ATIME;
+        change.atime = (to_set & FUSE_SET_ATTR_ATIME_NOW) ? now() : attr.st_atim;
+    }
+    if (to_set & (FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW)) {
+        change.fields |= JournalEntry::MTIME;
+        change.mtime = (to_set & FUSE_SET_ATTR_MTIME_NOW) ? now() : attr.st_mtim;
+    }
+
+    Result<Stat> stat_result = make_result(FAILED, EIO);
+    if (change.fields == 0) {
+        auto txn = m_cache.begin_ro();
+        stat_result = txn.getattr(ino);
+    } else {
+        stat_result = change_attributes(ino, std::move(change));
+    }
+    if (!stat_result) {
+        req.reply_err(stat_result.error());
+        return;
+    }
+
+    struct stat stbuf = *stat_result;
+    req.reply_attr(stbuf, 1.0);
+}
+
 void Filesystem::readlink(Fuse::Request &&req, fuse_ino_t ino)
 {
     auto txn = m_cache.begin_rw();
@@ -171,7 +819,9 @@ void Filesystem::readlink(Fuse::Request &&req, fuse_ino_t ino)
         backend_path = *path_result;
     }
 
-    auto link = m_backend_fs.readlink(backend_path);
+    auto link = txn.journal_empty()
+            ? m_backend_fs.readlink(backend_path)
+            : Result<std::string>(FAILED, ENOTCONN);
     if (link) {
         (void)txn.writelink(ino, *link);
         (void)txn.commit();
@@ -193,68 +843,516 @@ void Filesystem::readlink(Fuse::Request &&req, fuse_ino_t ino)
     req.reply_readlink(link->c_str());
 }
 
-void Filesystem::opendir(Fuse::Request &&req, fuse_ino_t ino, fuse_file_info *fi)
+void Filesystem::mkdir(Fuse::Request &&req, fuse_ino_t parent, std::string_view name, mode_t mode)
 {
-    auto txn = m_cache.begin_rw();
-    auto path_result = txn.path(ino);
-    if (!path_result) {
-        req.reply_err(path_result.error());
-        return;
+    std::string path;
+    bool pending;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = entry_path(txn, parent, name);
+        if (!path_result) {
+            req.reply_err(path_result.error());
+            return;
+        }
+        path = std::move(*path_result);
+        pending = !txn.journal_empty();
     }
-    std::string_view backend_path;
 
-    if (path_result->empty()) {
-        backend_path = "/";
+    InodeAttributes attrs = new_attributes(req, S_IFDIR | (mode & ~S_IFMT));
+    Result<void> backend_result = make_result(FAILED, ENOTCONN);
+    if (!pending) {
+        backend_result = m_backend_fs.mkdir(path, mode);
+        if (!backend_result && !Backend::is_not_connected(backend_result)) {
+            req.reply_err(backend_result.error());
+            return;
+        }
+        if (backend_result) {
+            auto stat_result = m_backend_fs.lstat(path);
+            if (stat_result) {
+                attrs = InodeAttributes::from_backend_stat(*stat_result);
+            }
+        }
+    }
+
+    auto txn = m_cache.begin_rw();
+    if (backend_result) {
+        // whatever we had cached under that name is gone
+        (void)txn.unlink(parent, name);
     } else {
-        backend_path = *path_result;
+        auto existing = lookup_cached(txn, parent, name);
+        if (existing || existing.error() != ENOENT) {
+            req.reply_err(existing ? EEXIST : existing.error());
+            return;
+        }
+        txn.journal_append(JournalEntry{
+                               .op = JournalEntry::Op::MKDIR,
+                               .mode = mode,
+                               .path = path,
+                           });
     }
 
-    auto dir = m_backend_fs.opendir(backend_path);
-    if (!dir && dir.error() != ENOTCONN) {
-        req.reply_err(dir.error());
+    auto ino_result = txn.emplace(parent, name, attrs);
+    if (!ino_result) {
+        req.reply_err(ino_result.error());
         return;
     }
+    // a new directory is empty, so we know all of its entries
+    (void)txn.update_flags(*ino_result, {InodeFlag::SYNCED});
 
-    if (dir) {
-        // if upstream is available, we can sync here; otherwise we go with what
-        // we have cached.
-        (void)txn.start_dir_rewrite(ino);
-        while (auto entry = (*dir)->readdir()) {
-            std::string entry_path(backend_path);
-            entry_path.reserve(entry_path.size() + entry->name.size() + 1);
-            if (entry_path.size() > 1) {
-                // need to add a slash to the end
-                entry_path += '/';
-            }
-            entry_path += entry->name;
-            auto stat_result = m_backend_fs.lstat(entry_path);
-            if (!stat_result) {
-                continue;
-            }
-            const auto info = InodeAttributes::from_backend_stat(*stat_result);
-            (void)txn.emplace(ino, entry->name, info);
-        }
-        (void)txn.update_flags(ino, {InodeFlag::SYNCED});
-        (void)txn.finish_dir_rewrite();
+    auto lock_result = txn.lock(*ino_result);
+    if (!lock_result) {
+        req.reply_err(lock_result.error());
+        return;
     }
-
-    fi->fh = 0;
-    fi->cache_readdir = 1;
-    if (!txn.commit()) {
-        req.reply_err(EIO);
+    touch_dir(parent);
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        req.reply_err(commit_result.error());
         return;
     }
 
-    req.reply_open(fi);
+    struct fuse_entry_param e{};
+    e.ino = *ino_result;
+    e.attr = Stat{attrs, *ino_result};
+    e.attr_timeout = 1.0;
+    e.entry_timeout = 1.0;
+    req.reply_entry(&e);
 }
 
-void Filesystem::readdir(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t off, fuse_file_info *fi)
+void Filesystem::unlink(Fuse::Request &&req, fuse_ino_t parent, std::string_view name)
 {
-    Fuse::DirBuffer buffer;
-    int error = 0;
-    off_t cursor = off;
+    std::string path;
+    bool pending;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = entry_path(txn, parent, name);
+        if (!path_result) {
+            req.reply_err(path_result.error());
+            return;
+        }
+        path = std::move(*path_result);
+        pending = !txn.journal_empty();
+    }
+
+    Result<void> backend_result = make_result(FAILED, ENOTCONN);
+    if (!pending) {
+        backend_result = m_backend_fs.unlink(path);
+        if (!backend_result && !Backend::is_not_connected(backend_result)) {
+            req.reply_err(backend_result.error());
+            return;
+        }
+    }
+
+    auto txn = m_cache.begin_rw();
+    if (!backend_result) {
+        auto ino_result = lookup_cached(txn, parent, name);
+        if (!ino_result) {
+            req.reply_err(ino_result.error());
+            return;
+        }
+        auto attr_result = txn.getattr(*ino_result);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        if ((attr_result->attr.mode & S_IFMT) == S_IFDIR) {
+            req.reply_err(EISDIR);
+            return;
+        }
+        txn.journal_append(JournalEntry{
+                               .op = JournalEntry::Op::UNLINK,
+                               .path = path,
+                           });
+    }
+
+    auto unlink_result = txn.unlink(parent, name);
+    if (!unlink_result && unlink_result.error() != ENOENT) {
+        req.reply_err(unlink_result.error());
+        return;
+    }
+    touch_dir(parent);
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        req.reply_err(commit_result.error());
+        return;
+    }
+    req.reply_err(0);
+}
+
+void Filesystem::rmdir(Fuse::Request &&req, fuse_ino_t parent, std::string_view name)
+{
+    std::string path;
+    bool pending;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = entry_path(txn, parent, name);
+        if (!path_result) {
+            req.reply_err(path_result.error());
+            return;
+        }
+        path = std::move(*path_result);
+        pending = !txn.journal_empty();
+    }
+
+    Result<void> backend_result = make_result(FAILED, ENOTCONN);
+    if (!pending) {
+        backend_result = m_backend_fs.rmdir(path);
+        if (!backend_result && !Backend::is_not_connected(backend_result)) {
+            req.reply_err(backend_result.error());
+            return;
+        }
+    }
+
+    auto txn = m_cache.begin_rw();
+    if (!backend_result) {
+        auto ino_result = lookup_cached(txn, parent, name);
+        if (!ino_result) {
+            req.reply_err(ino_result.error());
+            return;
+        }
+        auto attr_result = txn.getattr(*ino_result);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        if ((attr_result->attr.mode & S_IFMT) != S_IFDIR) {
+            req.reply_err(ENOTDIR);
+            return;
+        }
+        // without knowing all entries, the directory may not be empty on
+        // the backend
+        auto flag_result = txn.test_flag(*ino_result, InodeFlag::SYNCED);
+        if (!flag_result || !*flag_result) {
+            req.reply_err(EIO);
+            return;
+        }
+        auto empty_result = is_empty_dir(txn, *ino_result);
+        if (!empty_result || !*empty_result) {
+            req.reply_err(empty_result ? ENOTEMPTY : empty_result.error());
+            return;
+        }
+        txn.journal_append(JournalEntry{
+                               .op = JournalEntry::Op::RMDIR,
+                               .path = path,
+                           });
+    }
+
+    auto unlink_result = txn.unlink(parent, name);
+    if (!unlink_result && unlink_result.error() != ENOENT) {
+        req.reply_err(unlink_result.error());
+        return;
+    }
+    touch_dir(parent);
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        req.reply_err(commit_result.error());
+        return;
+    }
+    req.reply_err(0);
+}
+
+void Filesystem::rename(Fuse::Request &&req, fuse_ino_t parent, std::string_view name, fuse_ino_t newparent, std::string_view newname, unsigned int flags)
+{
+    if (flags != 0) {
+        // neither RENAME_EXCHANGE nor RENAME_NOREPLACE can be replayed
+        // reliably
+        req.reply_err(EINVAL);
+        return;
+    }
+
+    std::string path;
+    std::string new_path;
+    bool pending;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = entry_path(txn, parent, name);
+        if (!path_result) {
+            req.reply_err(path_result.error());
+            return;
+        }
+        auto new_path_result = entry_path(txn, newparent, newname);
+        if (!new_path_result) {
+            req.reply_err(new_path_result.error());
+            return;
+        }
+        path = std::move(*path_result);
+        new_path = std::move(*new_path_result);
+        pending = !txn.journal_empty();
+    }
+
+    Result<void> backend_result = make_result(FAILED, ENOTCONN);
+    if (!pending) {
+        backend_result = m_backend_fs.rename(path, new_path);
+        if (!backend_result && !Backend::is_not_connected(backend_result)) {
+            req.reply_err(backend_result.error());
+            return;
+        }
+    }
+
+    auto txn = m_cache.begin_rw();
+    if (!backend_result) {
+        auto ino_result = lookup_cached(txn, parent, name);
+        if (!ino_result) {
+            req.reply_err(ino_result.error());
+            return;
+        }
+        auto attr_result = txn.getattr(*ino_result);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        const bool is_dir = (attr_result->attr.mode & S_IFMT) == S_IFDIR;
+
+        // an unknown destination is simply replaced on replay
+        auto existing = txn.lookup(newparent, newname);
+        if (existing && *existing != *ino_result) {
+            auto existing_attr = txn.getattr(*existing);
+            if (!existing_attr) {
+                req.reply_err(existing_attr.error());
+                return;
+            }
+            const bool existing_is_dir = (existing_attr->attr.mode & S_IFMT) == S_IFDIR;
+            if (is_dir != existing_is_dir) {
+                req.reply_err(is_dir ? ENOTDIR : EISDIR);
+                return;
+            }
+            if (existing_is_dir) {
+                auto empty_result = is_empty_dir(txn, *existing);
+                if (!empty_result || !*empty_result) {
+                    req.reply_err(empty_result ? ENOTEMPTY : empty_result.error());
+                    return;
+                }
+            }
+        }
+
+        txn.journal_append(JournalEntry{
+                               .op = JournalEntry::Op::RENAME,
+                               .path = path,
+                               .new_path = new_path,
+                           });
+    }
+
+    auto rename_result = txn.rename(parent, name, newparent, newname);
+    if (!rename_result) {
+        if (!backend_result || rename_result.error() != ENOENT) {
+            req.reply_err(rename_result.error());
+            return;
+        }
+        // the source was not cached; drop what we had at the destination
+        (void)txn.unlink(newparent, newname);
+    }
+    touch_dir(parent);
+    touch_dir(newparent);
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        req.reply_err(commit_result.error());
+        return;
+    }
+    req.reply_err(0);
+}
+
+void Filesystem::open(Fuse::Request &&req, fuse_ino_t ino, fuse_file_info *fi)
+{
+    auto file = m_cache.open_file(ino);
+    if (!file) {
+        req.reply_err(file.error());
+        return;
+    }
+
+    if ((fi->flags & O_TRUNC) && (fi->flags & O_ACCMODE) != O_RDONLY) {
+        JournalEntry change{
+            .op = JournalEntry::Op::SETATTR,
+            .fields = JournalEntry::SIZE,
+            .size = 0,
+        };
+        auto truncate_result = change_attributes(ino, std::move(change));
+        if (!truncate_result) {
+            req.reply_err(truncate_result.error());
+            return;
+        }
+    }
+
+    if ((fi->flags & O_ACCMODE) != O_WRONLY) {
+        m_prefetcher.schedule(ino, *file);
+    }
+
+    fi->fh = reinterpret_cast<uint64_t>(
+                new std::shared_ptr<RegularFileHandle>(std::move(*file)));
+    req.reply_open(fi);
+}
+
+void Filesystem::read(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t off, fuse_file_info *fi)
+{
+    auto &file = open_file(fi);
+    m_cache.access_sketch().touch(ino);
+
+    std::uint64_t file_size;
+    {
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        file_size = attr_result->attr.common.size;
+    }
+
+    if (off < 0 || static_cast<std::uint64_t>(off) >= file_size) {
+        req.reply_buf(nullptr, 0);
+        return;
+    }
+    const std::size_t n = std::min<std::uint64_t>(size, file_size - off);
+    if (m_prefetcher.enabled()) {
+        file->record_access(off, n);
+    }
+
+    // data in the hot tier has been verified when it was admitted
+    const bool hot = m_hot_tier.admissible(file_size);
+    if (hot) {
+        auto hot_read = m_hot_tier.lookup(ino, off, n);
+        if (hot_read) {
+            m_reads_memory.fetch_add(1, std::memory_order_relaxed);
+            req.reply_iov(hot_read.iov(), hot_read.count());
+            return;
+        }
+    }
+
+    const bool resident = file->missing(off, n).empty();
+    (resident ? m_reads_disk : m_reads_backend).fetch_add(1, std::memory_order_relaxed);
+    auto fetch_result = resident ? make_result() : fetch(ino, *file, off, n, file_size);
+    if (fetch_result && m_verifier.should_verify()) {
+        auto verify_result = m_verifier.verify(*file, off, n);
+        if (!verify_result) {
+            req.reply_err(verify_result.error());
+            return;
+        }
+        if (*verify_result > 0) {
+            // corrupt blocks have been dropped; get them again
+            m_hot_tier.invalidate(ino);
+            fetch_result = fetch(ino, *file, off, n, file_size);
+        }
+    }
+    if (!fetch_result) {
+        // data which is not cached cannot be served while disconnected
+        req.reply_err(fetch_result.error() == ENOTCONN ? EIO : fetch_result.error());
+        return;
+    }
+
+    // taken before reading, so that a concurrent change keeps the data out
+    // of the hot tier
+    const std::uint64_t generation = m_hot_tier.generation();
+    std::vector<char> buffer(n);
+    auto read_result = file->pread(off, buffer.data(), n);
+    if (!read_result) {
+        req.reply_err(read_result.error());
+        return;
+    }
+    req.reply_buf(buffer.data(), *read_result);
+    if (hot) {
+        m_hot_tier.admit(ino, off, buffer.data(), *read_result, file_size,
+                         generation);
+    }
+}
+
+void Filesystem::write(Fuse::Request &&req, fuse_ino_t ino, std::string_view buf, off_t off, fuse_file_info *fi)
+{
+    auto &file = open_file(fi);
+    m_cache.access_sketch().touch(ino);
+
+    auto prepare_result = prepare_write(ino, *file, off, buf.size());
+    if (!prepare_result) {
+        req.reply_err(prepare_result.error() == ENOTCONN ? EIO : prepare_result.error());
+        return;
+    }
+
+    auto write_result = file->pwrite(off, buf.data(), buf.size());
+    m_hot_tier.invalidate(ino);
+    if (!write_result) {
+        req.reply_err(write_result.error());
+        return;
+    }
+
+    auto finish_result = finish_write(ino, file, off, *write_result);
+    if (!finish_result) {
+        req.reply_err(finish_result.error());
+        return;
+    }
+
+    m_writeback.throttle();
+    req.reply_write(*write_result);
+}
+
+void Filesystem::flush(Fuse::Request &&req, fuse_ino_t ino, fuse_file_info *fi)
+{
+    auto flush_result = m_writeback.flush(ino);
+    if (!flush_result && flush_result.error() != ENOTCONN) {
+        req.reply_err(flush_result.error());
+        return;
+    }
+    // while disconnected, the data is safe in the cache and written back
+    // once the backend is reachable again
+    req.reply_err(0);
+}
+
+void Filesystem::release(Fuse::Request &&req, fuse_ino_t ino, fuse_file_info *fi)
+{
+    // failing to keep the trace only costs the prefetch on the next open
+    (void)m_prefetcher.save(ino, *open_file(fi));
+    delete &open_file(fi);
+    fi->fh = 0;
+    req.reply_err(0);
+}
+
+void Filesystem::fsync(Fuse::Request &&req, fuse_ino_t ino, int datasync, fuse_file_info *fi)
+{
+    auto &file = open_file(fi);
+    auto local_result = file->fsync(datasync != 0);
+    if (!local_result) {
+        req.reply_err(local_result.error());
+        return;
+    }
+
+    auto flush_result = m_writeback.flush(ino, true);
+    if (!flush_result && flush_result.error() != ENOTCONN) {
+        req.reply_err(flush_result.error());
+        return;
+    }
+    req.reply_err(0);
+}
+
+void Filesystem::opendir(Fuse::Request &&req, fuse_ino_t ino, fuse_file_info *fi)
+{
+    auto prefetched = m_dir_prefetcher.take(ino);
+    if (prefetched) {
+        // synced in the background a moment ago
+        m_dir_prefetcher.schedule(*prefetched);
+    } else {
+        // if upstream is available, we can sync here; otherwise we go with
+        // what we have cached.
+        auto sync_result = sync_dir(ino);
+        if (!sync_result && sync_result.error() != ENOTCONN
+                && sync_result.error() != EAGAIN) {
+            req.reply_err(sync_result.error());
+            return;
+        }
+        if (sync_result) {
+            m_dir_prefetcher.schedule(*sync_result);
+        }
+    }
+
+    fi->fh = 0;
+    fi->cache_readdir = 1;
+    req.reply_open(fi);
+}
+
+void Filesystem::readdir(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t off, fuse_file_info *fi)
+{
+    Fuse::DirBuffer buffer;
+    int error = 0;
+    off_t cursor = off;
     std::size_t to_send = 0;
     bool at_eof = false;
+    m_cache.access_sketch().touch(ino);
     auto txn = m_cache.begin_ro();
     while (buffer.length() < size) {
         to_send = buffer.length();
@@ -296,7 +1394,7 @@ void Filesystem::readdir(Fuse::Request &&req, fuse_ino_t ino, size_t size, off_t
         }
     }
 
-    auto buf = buffer.get();
+    const auto &buf = buffer.get();
     req.reply_buf(buf.data(), to_send);
 }
 
@@ -311,6 +1409,7 @@ void Filesystem::readdirplus(Fuse::Request &&req, fuse_ino_t ino, size_t size, o
     int error = 0;
     off_t cursor = off;
     std::size_t to_send = 0;
+    m_cache.access_sketch().touch(ino);
     auto txn = m_cache.begin_ro();
     while (buffer.length() < size) {
         to_send = buffer.length();
@@ -359,7 +1458,7 @@ void Filesystem::readdirplus(Fuse::Request &&req, fuse_ino_t ino, size_t size, o
         return;
     }
 
-    auto buf = buffer.get();
+    const auto &buf = buffer.get();
     if (!txn.commit()) {
         // if the commit fails, we cannot hand out any locks -> we have to
         // return an error ... Question is if we may want to return ENOSYS
@@ -371,6 +1470,413 @@ void Filesystem::readdirplus(Fuse::Request &&req, fuse_ino_t ino, size_t size, o
     req.reply_buf(buf.data(), to_send);
 }
 
+void Filesystem::statfs(Fuse::Request &&req, fuse_ino_t ino)
+{
+    auto statfs_result = m_cache.statfs();
+    if (!statfs_result) {
+        req.reply_err(statfs_result.error());
+        return;
+    }
+    req.reply_statfs(&*statfs_result);
+}
+
+void Filesystem::setxattr(Fuse::Request &&req, fuse_ino_t ino, std::string_view name, std::string_view value, int flags)
+{
+    const bool pin = name == XATTR_PINNED;
+    if (!pin && (ino != ROOT_INO || name != XATTR_COMPACT)) {
+        req.reply_err(ENOTSUP);
+        return;
+    }
+    if (flags & XATTR_CREATE) {
+        // the attributes always exist, if only as a trigger
+        req.reply_err(EEXIST);
+        return;
+    }
+
+    if (pin) {
+        if (value != "0" && value != "1") {
+            req.reply_err(EINVAL);
+            return;
+        }
+        auto pin_result = m_cache.set_pinned(ino, value == "1");
+        req.reply_err(pin_result ? 0 : pin_result.error());
+        return;
+    }
+
+    auto compact_result = m_cache.compact();
+    if (!compact_result) {
+        req.reply_err(compact_result.error());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_compaction_mutex);
+        m_last_compaction = *compact_result;
+    }
+    req.reply_err(0);
+}
+
+void Filesystem::getxattr(Fuse::Request &&req, fuse_ino_t ino, std::string_view name, size_t size)
+{
+    if (ino == ROOT_INO && name == XATTR_COMPACT) {
+        std::string value;
+        {
+            std::lock_guard<std::mutex> lock(m_compaction_mutex);
+            if (!m_last_compaction) {
+                req.reply_err(ENODATA);
+                return;
+            }
+            value = std::to_string(m_last_compaction->size_before) + ' ' +
+                    std::to_string(m_last_compaction->size_after);
+        }
+        reply_xattr_value(req, value, size);
+        return;
+    }
+
+    if (name == XATTR_PINNED) {
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        if (!S_ISREG(attr_result->attr.mode)) {
+            req.reply_err(ENODATA);
+            return;
+        }
+        auto flag_result = txn.test_flag(ino, InodeFlag::PINNED);
+        if (!flag_result) {
+            req.reply_err(flag_result.error());
+            return;
+        }
+        reply_xattr_value(req, *flag_result ? "1" : "0", size);
+        return;
+    }
+
+    if (name != XATTR_RESIDENT && name != XATTR_DIRTY && name != XATTR_EXTENTS) {
+        req.reply_err(ENODATA);
+        return;
+    }
+
+    auto residency_result = m_cache.residency(ino, name == XATTR_EXTENTS);
+    if (!residency_result) {
+        // only regular files have these
+        const int error = residency_result.error();
+        req.reply_err(error == EISDIR || error == EINVAL ? ENODATA : error);
+        return;
+    }
+
+    std::string value;
+    if (name == XATTR_RESIDENT) {
+        value = std::to_string(residency_result->resident_bytes);
+    } else if (name == XATTR_DIRTY) {
+        value = std::to_string(residency_result->dirty_bytes);
+    } else {
+        for (const auto &range: residency_result->ranges) {
+            const std::uint64_t off = range.start * CACHE_PAGE_SIZE;
+            if (off >= residency_result->size) {
+                break;
+            }
+            const std::uint64_t len = std::min<std::uint64_t>(
+                        range.count * CACHE_PAGE_SIZE,
+                        residency_result->size - off);
+            value += std::to_string(off);
+            value += ' ';
+            value += std::to_string(len);
+            value += ' ';
+            value += state_name(range.state);
+            value += '\n';
+        }
+    }
+    reply_xattr_value(req, value, size);
+}
+
+void Filesystem::listxattr(Fuse::Request &&req, fuse_ino_t ino, size_t size)
+{
+    bool regular;
+    {
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        regular = S_ISREG(attr_result->attr.mode);
+    }
+
+    std::string names;
+    if (regular) {
+        for (const auto name: {XATTR_RESIDENT, XATTR_DIRTY, XATTR_EXTENTS,
+                               XATTR_PINNED}) {
+            names += name;
+            names += '\0';
+        }
+    }
+    reply_xattr_value(req, names, size);
+}
+
+void Filesystem::removexattr(Fuse::Request &&req, fuse_ino_t ino, std::string_view name)
+{
+    if (name != XATTR_PINNED) {
+        req.reply_err(ENOTSUP);
+        return;
+    }
+    auto pin_result = m_cache.set_pinned(ino, false);
+    req.reply_err(pin_result ? 0 : pin_result.error());
+}
+
+void Filesystem::create(Fuse::Request &&req, fuse_ino_t parent, std::string_view name, mode_t mode, fuse_file_info *fi)
+{
+    std::string path;
+    bool pending;
+    {
+        auto txn = m_cache.begin_ro();
+        auto path_result = entry_path(txn, parent, name);
+        if (!path_result) {
+            req.reply_err(path_result.error());
+            return;
+        }
+        path = std::move(*path_result);
+        pending = !txn.journal_empty();
+    }
+
+    InodeAttributes attrs = new_attributes(req, S_IFREG | (mode & ~S_IFMT));
+    Result<void> backend_result = make_result(FAILED, ENOTCONN);
+    if (!pending) {
+        auto backend_file = m_backend_fs.open(path, O_CREAT | O_EXCL | O_WRONLY, mode);
+        if (backend_file) {
+            backend_result = (*backend_file)->close();
+        } else {
+            backend_result = copy_error(backend_file);
+        }
+        if (!backend_result && !Backend::is_not_connected(backend_result)) {
+            req.reply_err(backend_result.error());
+            return;
+        }
+        if (backend_result) {
+            auto stat_result = m_backend_fs.lstat(path);
+            if (stat_result) {
+                attrs = InodeAttributes::from_backend_stat(*stat_result);
+            }
+        }
+    }
+
+    ino_t ino;
+    {
+        auto txn = m_cache.begin_rw();
+        if (backend_result) {
+            // whatever we had cached under that name is gone
+            (void)txn.unlink(parent, name);
+        } else {
+            auto existing = lookup_cached(txn, parent, name);
+            if (existing || existing.error() != ENOENT) {
+                req.reply_err(existing ? EEXIST : existing.error());
+                return;
+            }
+            txn.journal_append(JournalEntry{
+                                   .op = JournalEntry::Op::CREATE,
+                                   .mode = mode,
+                                   .path = path,
+                               });
+        }
+
+        auto ino_result = txn.emplace(parent, name, attrs);
+        if (!ino_result) {
+            req.reply_err(ino_result.error());
+            return;
+        }
+        ino = *ino_result;
+
+        auto lock_result = txn.lock(ino);
+        if (!lock_result) {
+            req.reply_err(lock_result.error());
+            return;
+        }
+        touch_dir(parent);
+        auto commit_result = txn.commit();
+        if (!commit_result) {
+            req.reply_err(commit_result.error());
+            return;
+        }
+    }
+
+    auto file = m_cache.open_file(ino);
+    if (!file) {
+        auto txn = m_cache.begin_ro();
+        (void)txn.release(ino);
+        (void)txn.commit();
+        req.reply_err(file.error());
+        return;
+    }
+
+    struct fuse_entry_param e{};
+    e.ino = ino;
+    e.attr = Stat{attrs, ino};
+    e.attr_timeout = 1.0;
+    e.entry_timeout = 1.0;
+    fi->fh = reinterpret_cast<uint64_t>(
+                new std::shared_ptr<RegularFileHandle>(std::move(*file)));
+    req.reply_create(&e, fi);
+}
+
+void Filesystem::write_buf(Fuse::Request &&req, fuse_ino_t ino, fuse_bufvec *bufv, off_t offset, fuse_file_info *fi)
+{
+    auto &file = open_file(fi);
+    m_cache.access_sketch().touch(ino);
+    const std::size_t size = fuse_buf_size(bufv);
+
+    auto prepare_result = prepare_write(ino, *file, offset, size);
+    if (!prepare_result) {
+        req.reply_err(prepare_result.error() == ENOTCONN ? EIO : prepare_result.error());
+        return;
+    }
+
+    // splice the data straight into the cached data file; inflate() keeps
+    // the range from being compressed until mark() or release_write(), as
+    // the blocks are only marked WRITTEN once the data has landed
+    auto inflate_result = file->inflate(offset, size);
+    if (!inflate_result) {
+        req.reply_err(inflate_result.error());
+        return;
+    }
+    struct fuse_bufvec dest = FUSE_BUFVEC_INIT(size);
+    dest.buf[0].flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    dest.buf[0].fd = file->fd();
+    dest.buf[0].pos = offset;
+    const ssize_t copied = fuse_buf_copy(&dest, bufv, static_cast<fuse_buf_copy_flags>(0));
+    m_hot_tier.invalidate(ino);
+    if (copied < 0) {
+        file->release_write(offset);
+        req.reply_err(-copied);
+        return;
+    }
+    file->mark(offset, copied, Blocklist::WRITTEN);
+
+    auto finish_result = finish_write(ino, file, offset, copied);
+    if (!finish_result) {
+        req.reply_err(finish_result.error());
+        return;
+    }
+
+    m_writeback.throttle();
+    req.reply_write(copied);
+}
+
+void Filesystem::fallocate(Fuse::Request &&req, fuse_ino_t ino, int mode, off_t offset, off_t length, fuse_file_info *fi)
+{
+    // punching a hole discards the cached data of the range, the file itself
+    // is left alone; preallocation is meaningless for a cache
+    if (mode != (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE)) {
+        req.reply_err(EOPNOTSUPP);
+        return;
+    }
+    if (offset < 0 || length <= 0) {
+        req.reply_err(EINVAL);
+        return;
+    }
+
+    auto &file = open_file(fi);
+    std::uint64_t file_size;
+    {
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        file_size = attr_result->attr.common.size;
+    }
+
+    // a range reaching the end of the file covers its last, partial block
+    std::uint64_t end = static_cast<std::uint64_t>(offset) + length;
+    if (end >= file_size) {
+        end = std::max<std::uint64_t>(end, (file_size + CACHE_PAGE_SIZE - 1)
+                                      / CACHE_PAGE_SIZE * CACHE_PAGE_SIZE);
+    }
+
+    {
+        // the write-back must not re-mark blocks which we drop
+        auto upload_guard = file->upload_lock();
+        auto discard_result = file->discard(offset, end - offset);
+        m_hot_tier.invalidate(ino);
+        if (!discard_result) {
+            req.reply_err(discard_result.error());
+            return;
+        }
+    }
+
+    const std::int64_t delta = file->take_unaccounted_bytes();
+    if (delta != 0) {
+        auto txn = m_cache.begin_rw();
+        txn.account_file_bytes(ino, delta);
+        auto commit_result = txn.commit();
+        if (!commit_result) {
+            req.reply_err(commit_result.error());
+            return;
+        }
+    }
+    req.reply_err(0);
+}
+
+void Filesystem::copy_file_range(Fuse::Request &&req, fuse_ino_t ino_in, off_t off_in, fuse_file_info *fi_in, fuse_ino_t ino_out, off_t off_out, fuse_file_info *fi_out, size_t len, int flags)
+{
+    if (flags != 0 || off_in < 0 || off_out < 0) {
+        req.reply_err(EINVAL);
+        return;
+    }
+
+    auto &src = open_file(fi_in);
+    auto &dest = open_file(fi_out);
+    m_cache.access_sketch().touch(ino_in);
+    m_cache.access_sketch().touch(ino_out);
+
+    std::uint64_t src_size;
+    {
+        auto txn = m_cache.begin_ro();
+        auto attr_result = txn.getattr(ino_in);
+        if (!attr_result) {
+            req.reply_err(attr_result.error());
+            return;
+        }
+        src_size = attr_result->attr.common.size;
+    }
+
+    if (static_cast<std::uint64_t>(off_in) >= src_size) {
+        req.reply_write(0);
+        return;
+    }
+    const std::size_t n = std::min<std::uint64_t>(len, src_size - off_in);
+
+    // only the parts of the source which are not cached yet have to go
+    // through the backend, the rest is cloned within the cache
+    auto fetch_result = fetch(ino_in, *src, off_in, n, src_size);
+    if (!fetch_result) {
+        req.reply_err(fetch_result.error() == ENOTCONN ? EIO : fetch_result.error());
+        return;
+    }
+
+    auto prepare_result = prepare_write(ino_out, *dest, off_out, n);
+    if (!prepare_result) {
+        req.reply_err(prepare_result.error() == ENOTCONN ? EIO : prepare_result.error());
+        return;
+    }
+
+    auto copy_result = dest->copy_from(*src, off_in, off_out, n);
+    m_hot_tier.invalidate(ino_out);
+    if (!copy_result) {
+        req.reply_err(copy_result.error());
+        return;
+    }
+
+    auto finish_result = finish_write(ino_out, dest, off_out, *copy_result);
+    if (!finish_result) {
+        req.reply_err(finish_result.error());
+        return;
+    }
+
+    m_writeback.throttle();
+    req.reply_write(*copy_result);
+}
+
 void Filesystem::forget_multi(Fuse::Request &&req, size_t count, fuse_forget_data *forgets)
 {
     auto txn = m_cache.begin_ro();
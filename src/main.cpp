@@ -27,14 +27,82 @@ authors named in the AUTHORS file.
 #include "dragonstash/fuse/interface.hpp"
 #include "dragonstash/fs.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+#include <pthread.h>
 
 #include "dragonstash/backend/local.hpp"
 #include "dragonstash/backend/in_memory.hpp"
+#include "dragonstash/backend/synthetic.hpp"
+#include "dragonstash/backend/tracing.hpp"
+#include "dragonstash/trace.hpp"
 
 #include <CLI/CLI.hpp>
 
+/**
+ * Write the trace buffers to a file whenever SIGUSR1 is received, and once
+ * more when destroyed.
+ *
+ * Must be constructed before any other thread is started, so that all
+ * threads inherit the blocked SIGUSR1.
+ */
+class TraceDumper
+{
+public:
+    explicit TraceDumper(std::string path):
+        m_path(std::move(path)),
+        m_stop(false)
+    {
+        sigemptyset(&m_signals);
+        sigaddset(&m_signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &m_signals, nullptr);
+        Dragonstash::set_tracing(true);
+        m_thread = std::thread(&TraceDumper::run, this);
+    }
+
+    TraceDumper(const TraceDumper &src) = delete;
+    TraceDumper &operator=(const TraceDumper &src) = delete;
+
+    ~TraceDumper() {
+        m_stop = true;
+        pthread_kill(m_thread.native_handle(), SIGUSR1);
+        m_thread.join();
+        dump();
+    }
+
+private:
+    std::string m_path;
+    sigset_t m_signals;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+
+    void run() {
+        while (true) {
+            int sig = 0;
+            if (sigwait(&m_signals, &sig) != 0 || m_stop) {
+                return;
+            }
+            dump();
+        }
+    }
+
+    void dump() {
+        std::ofstream out(m_path, std::ios::out | std::ios::trunc);
+        Dragonstash::write_chrome_trace(out);
+        if (!out) {
+            std::cerr << "failed to write trace to " << m_path << std::endl;
+        }
+    }
+};
+
 class MountCommand
 {
 public:
@@ -47,9 +115,21 @@ public:
         backend_group.add_flag("-N,--disconnected", "Mount without backend");
         backend_group.add_option("-L,--local", m_local_path, "Use a local directory as backend.")->type_name("PATH");
         backend_group.add_flag("-S,--sshfs,--sftp", m_sshfs_url, "Use libssh to connect to a server as backend.")->type_name("URL");
+        backend_group.add_option("--synthetic", m_synthetic_spec, "Use a generated read-only tree as backend, e.g. seed=1,dirs=8,files=64,depth=3,name=16,size=0-1m,content=random")->type_name("SPEC");
 
         m_cmd.add_flag("-d,--debug", "Enable FUSE debug output (implies -f)");
         m_cmd.add_flag("-f,--foreground", "Stay in foreground");
+        m_cmd.add_flag("--deduplicate", "Share the storage of identical blocks between cached files");
+        m_cmd.add_option("--compress", m_compress, "Compress cached data (disables --deduplicate)")->check(CLI::IsMember({"none", "lz4", "zstd"}));
+        m_cmd.add_flag("--prefetch", "Remember which parts of a file are read and fetch them in the background when it is opened again");
+        m_cmd.add_flag("--prefetch-dirs", "Sync the subdirectories of opened directories in the background, ahead of recursive walks");
+        m_cmd.add_option("--trace", m_trace_path, "Record request traces and write them in Chrome trace format to this file on SIGUSR1 and on exit")->type_name("PATH");
+        m_cmd.add_flag("--profile-locks", "Account contention of the internal locks and print it after unmounting");
+        m_cmd.add_option("--hot-tier", m_hot_tier_mib, "Keep hot blocks of small files in an in-memory tier of this size")->type_name("MiB");
+        m_cmd.add_option("--max-inodes", m_max_inodes, "Evict cold inodes to keep the number of cached inodes below this (0: no limit)")->type_name("COUNT");
+        m_cmd.add_option("--max-data", m_max_data_mib, "Drop the data of cold files to keep the cached file data below this size (0: no limit)")->type_name("MiB");
+        m_cmd.add_option("--directory-index", m_directory_index, "Index of directory entries for a new cache: by full name, or by a hash of the name without a limit on the name length")->check(CLI::IsMember({"name", "hashed"}));
+        m_cmd.add_option("--verify", m_verify, "Check cached data against its checksums: on every read, on a sample of reads or in the background")->check(CLI::IsMember({"none", "read", "sampled", "scrub"}));
 
         m_cmd.add_option("cachedir", m_cachedir, "Path to the cache directory")->mandatory()->type_name("PATH");
         m_cmd.add_option("mountpoint", m_mountpoint, "Path to the mountpoint")->mandatory()->type_name("PATH");
@@ -62,6 +142,14 @@ private:
     std::string m_mountpoint;
     std::string m_local_path;
     std::string m_sshfs_url;
+    std::string m_synthetic_spec;
+    std::string m_compress = "none";
+    std::string m_verify = "none";
+    std::string m_directory_index = "name";
+    std::string m_trace_path;
+    std::size_t m_hot_tier_mib = 0;
+    std::uint64_t m_max_inodes = 0;
+    std::uint64_t m_max_data_mib = 0;
 
 public:
     int execute() {
@@ -76,9 +164,58 @@ public:
             backend = std::move(in_memory);
         } else if (m_cmd.count("--local")) {
             backend = std::make_unique<Dragonstash::Backend::LocalFilesystem>(std::filesystem::path(m_local_path));
+        } else if (m_cmd.count("--synthetic")) {
+            auto options = Dragonstash::Backend::SyntheticOptions::parse(m_synthetic_spec);
+            if (!options) {
+                std::cerr << "invalid synthetic tree spec: " << m_synthetic_spec << std::endl;
+                return 1;
+            }
+            backend = std::make_unique<Dragonstash::Backend::SyntheticFilesystem>(*options);
         }
-        Dragonstash::Cache cache(m_cachedir);
-        Dragonstash::Filesystem fs(cache, *backend);
+        std::optional<TraceDumper> trace_dumper;
+        if (!m_trace_path.empty()) {
+            trace_dumper.emplace(m_trace_path);
+            backend = std::make_unique<Dragonstash::Backend::TracingFilesystem>(std::move(backend));
+        }
+        Dragonstash::CacheOptions cache_options;
+        cache_options.max_inodes = m_max_inodes;
+        cache_options.max_bytes = m_max_data_mib * 1024 * 1024;
+        cache_options.deduplicate = m_cmd.count("--deduplicate");
+        if (m_directory_index == "hashed") {
+            cache_options.directory_index = Dragonstash::DirectoryIndex::HASHED;
+        }
+        if (m_compress == "lz4") {
+            cache_options.compression = Dragonstash::Compression::LZ4;
+        } else if (m_compress == "zstd") {
+            cache_options.compression = Dragonstash::Compression::ZSTD;
+        }
+        if (!Dragonstash::compression_available(cache_options.compression)) {
+            std::cerr << "this build does not support " << m_compress << " compression" << std::endl;
+            return 1;
+        }
+        Dragonstash::set_lock_profiling(m_cmd.count("--profile-locks"));
+        Dragonstash::Cache cache(m_cachedir, cache_options);
+        Dragonstash::VerifyOptions verify_options;
+        if (m_verify == "read") {
+            verify_options.mode = Dragonstash::VerifyMode::ALWAYS;
+        } else if (m_verify == "sampled") {
+            verify_options.mode = Dragonstash::VerifyMode::SAMPLED;
+        } else if (m_verify == "scrub") {
+            verify_options.mode = Dragonstash::VerifyMode::SCRUB;
+        }
+        Dragonstash::PrefetchOptions prefetch_options;
+        prefetch_options.enabled = m_cmd.count("--prefetch");
+        Dragonstash::DirPrefetchOptions dir_prefetch_options;
+        dir_prefetch_options.enabled = m_cmd.count("--prefetch-dirs");
+        Dragonstash::HotTierOptions hot_tier_options;
+        hot_tier_options.capacity = m_hot_tier_mib * 1024 * 1024;
+        Dragonstash::Filesystem fs(cache, *backend,
+                                   Dragonstash::WritebackOptions(),
+                                   verify_options,
+                                   prefetch_options,
+                                   dir_prefetch_options,
+                                   Dragonstash::RecoveryOptions(),
+                                   hot_tier_options);
 
         // construct an argv array to trick fuse into setting the right options
         // ... this is a bit hacky, but it does what's needed.
@@ -117,6 +254,70 @@ public:
 
         session.unmount();
 
+        if (cache.compression() != Dragonstash::Compression::NONE) {
+            const auto stats = cache.compression_stats();
+            std::cerr << "compressed " << stats.compressed_bytes << " of "
+                      << stats.probed_bytes << " bytes (" << stats.skipped_bytes
+                      << " skipped as incompressible), ratio " << stats.ratio()
+                      << ", compression " << stats.compress_throughput() / 1e6
+                      << " MB/s, decompression " << stats.decompress_throughput() / 1e6
+                      << " MB/s" << std::endl;
+        }
+        if (fs.dir_prefetcher().enabled()) {
+            const auto stats = fs.dir_prefetcher().stats();
+            std::cerr << "synced " << stats.synced << " of " << stats.scheduled
+                      << " prefetched directories, " << stats.used
+                      << " used, " << stats.wasted << " expired unused"
+                      << std::endl;
+        }
+        {
+            const auto stats = fs.read_stats();
+            if (stats.total() > 0) {
+                std::cerr << "served " << stats.total() << " reads: "
+                          << stats.rate(stats.memory) * 100 << "% from memory, "
+                          << stats.rate(stats.disk) * 100 << "% from disk, "
+                          << stats.rate(stats.backend) * 100 << "% from the backend"
+                          << std::endl;
+            }
+        }
+        if (fs.hot_tier().enabled()) {
+            const auto stats = fs.hot_tier().stats();
+            std::cerr << "hot tier hit rate " << stats.hit_rate() * 100
+                      << "%, " << stats.resident << " blocks resident, "
+                      << stats.admitted << " admitted, " << stats.rejected
+                      << " rejected, " << stats.evicted << " evicted, "
+                      << stats.invalidated << " invalidated" << std::endl;
+        }
+        {
+            const auto stats = fs.recovery().stats();
+            if (stats.reaped_orphans > 0 || stats.checked_files > 0) {
+                std::cerr << "recovery reaped " << stats.reaped_orphans
+                          << " orphans and checked " << stats.checked_files
+                          << " files (" << stats.discarded_files
+                          << " discarded)";
+                if (stats.swept) {
+                    std::cerr << " in " << stats.sweep_duration.count() << " ms";
+                }
+                std::cerr << std::endl;
+            }
+        }
+        if (Dragonstash::lock_profiling()) {
+            using Dragonstash::LockProfile;
+            for (const auto &profile: Dragonstash::lock_profiles()) {
+                std::cerr << "lock " << profile.name << ": "
+                          << profile.acquisitions << " acquisitions, "
+                          << profile.contended << " contended, wait p99 "
+                          << LockProfile::quantile(profile.wait, 0.99) / 1e3
+                          << " us, total wait "
+                          << LockProfile::total(profile.wait) / 1e6
+                          << " ms, hold p99 "
+                          << LockProfile::quantile(profile.hold, 0.99) / 1e3
+                          << " us, total hold "
+                          << LockProfile::total(profile.hold) / 1e6
+                          << " ms" << std::endl;
+            }
+        }
+
 cleanup_signal:
         session.remove_signal_handlers();
 exit:
@@ -130,15 +331,186 @@ exit:
 };
 
 
+class CompactCommand
+{
+public:
+    explicit CompactCommand(CLI::App &app):
+        m_cmd(*app.add_subcommand("compact", "Compact the metadata database of a dragonstash cache"))
+    {
+        m_cmd.add_option("cachedir", m_cachedir, "Path to the cache directory")->mandatory()->type_name("PATH");
+    }
+
+private:
+    CLI::App &m_cmd;
+
+    std::string m_cachedir;
+
+public:
+    int execute() {
+        Dragonstash::Cache cache(m_cachedir);
+        auto result = cache.compact();
+        if (!result) {
+            std::cerr << "failed to compact: " << std::strerror(result.error()) << std::endl;
+            return 1;
+        }
+        std::cout << "compacted database from " << result->size_before
+                  << " to " << result->size_after << " bytes" << std::endl;
+        return 0;
+    }
+
+    explicit operator bool() const {
+        return bool(m_cmd);
+    }
+
+};
+
+
+class StatsCommand
+{
+public:
+    explicit StatsCommand(CLI::App &app):
+        m_cmd(*app.add_subcommand("stats", "Show usage statistics of a dragonstash cache"))
+    {
+        m_cmd.add_option("cachedir", m_cachedir, "Path to the cache directory")->mandatory()->type_name("PATH");
+    }
+
+private:
+    CLI::App &m_cmd;
+
+    std::string m_cachedir;
+
+public:
+    int execute() {
+        Dragonstash::Cache cache(m_cachedir);
+        auto usage = cache.usage();
+        if (!usage) {
+            std::cerr << "failed to read usage: " << std::strerror(usage.error()) << std::endl;
+            return 1;
+        }
+        std::cout << "inodes: " << usage->inodes << std::endl
+                  << "cached bytes: " << usage->cached_bytes << std::endl
+                  << "pinned bytes: " << usage->pinned_bytes << std::endl;
+
+        auto storage = cache.storage_usage();
+        if (!storage) {
+            std::cerr << "failed to measure storage: " << std::strerror(storage.error()) << std::endl;
+            return 1;
+        }
+        std::cout << "allocated bytes: " << storage->logical_bytes << std::endl
+                  << "allocated bytes on disk: " << storage->physical_bytes << std::endl
+                  << "dedup ratio: " << storage->dedup_ratio() << std::endl;
+        return 0;
+    }
+
+    explicit operator bool() const {
+        return bool(m_cmd);
+    }
+
+};
+
+
+class FsckCommand
+{
+public:
+    explicit FsckCommand(CLI::App &app):
+        m_cmd(*app.add_subcommand("fsck", "Check the consistency of a dragonstash cache which is not in use")),
+        m_threads(std::max(std::thread::hardware_concurrency(), 1u)),
+        m_repair(false)
+    {
+        m_cmd.add_option("cachedir", m_cachedir, "Path to the cache directory")->mandatory()->type_name("PATH");
+        m_cmd.add_option("--threads", m_threads, "Number of threads checking in parallel (default: number of CPUs)")->type_name("N");
+        m_cmd.add_flag("--repair", m_repair, "Repair the problems which are found");
+    }
+
+private:
+    CLI::App &m_cmd;
+
+    std::string m_cachedir;
+    unsigned m_threads;
+    bool m_repair;
+
+public:
+    /**
+     * Exit codes follow e2fsck: 0 if the cache is consistent, 1 if problems
+     * have been repaired, 4 if problems are left.
+     */
+    int execute() {
+        // a mere check must leave the cache as it is
+        Dragonstash::Cache cache(m_cachedir, Dragonstash::CacheOptions{
+                                     .read_only = !m_repair,
+                                 });
+        const auto t0 = std::chrono::steady_clock::now();
+        auto report = cache.fsck(Dragonstash::FsckOptions{
+                                     .threads = m_threads,
+                                     .repair = m_repair,
+                                 });
+        const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - t0);
+        if (!report) {
+            std::cerr << "failed to check cache: " << std::strerror(report.error()) << std::endl;
+            return 8;
+        }
+        std::cout << "checked " << report->inodes << " inodes, "
+                  << report->entries << " directory entries and "
+                  << report->files << " cached files in "
+                  << duration.count() << " ms" << std::endl;
+
+        const std::pair<const char*, std::uint64_t> problems[] = {
+            {"corrupt inodes", report->corrupt_inodes},
+            {"detached inodes", report->detached_inodes},
+            {"lost orphans", report->lost_orphans},
+            {"stale orphans", report->stale_orphans},
+            {"dangling directory entries", report->dangling_entries},
+            {"missing index entries", report->missing_index_entries},
+            {"stale index entries", report->stale_index_entries},
+            {"symlinks without destination", report->missing_links},
+            {"stale link and trace records", report->stale_records},
+            {"corrupt cached files", report->corrupt_files},
+            {"stray cached files", report->stray_files},
+            {"wrong usage counters", report->wrong_counters},
+        };
+        for (const auto &[what, count]: problems) {
+            if (count > 0) {
+                std::cout << what << ": " << count << std::endl;
+            }
+        }
+
+        if (report->problems() == 0) {
+            return 0;
+        }
+        if (report->repaired) {
+            std::cout << "all problems have been repaired" << std::endl;
+            return 1;
+        }
+        std::cout << "run with --repair to fix the problems" << std::endl;
+        return 4;
+    }
+
+    explicit operator bool() const {
+        return bool(m_cmd);
+    }
+
+};
+
+
 int main(int argc, char **argv) {
     CLI::App app{"Dragonstash"};
 
     MountCommand mount(app);
+    CompactCommand compact(app);
+    StatsCommand stats(app);
+    FsckCommand fsck(app);
 
     CLI11_PARSE(app, argc, argv);
 
     if (mount) {
         mount.execute();
+    } else if (compact) {
+        return compact.execute();
+    } else if (stats) {
+        return stats.execute();
+    } else if (fsck) {
+        return fsck.execute();
     }
     return 0;
 }
@@ -0,0 +1,203 @@
+/**********************************************************************
+File name: prefetch.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/prefetch.hpp"
+
+#include <algorithm>
+#include <ctime>
+
+namespace Dragonstash {
+
+Prefetcher::Prefetcher(Cache &cache, FetchFunc fetch,
+                       const PrefetchOptions &options):
+    m_cache(cache),
+    m_fetch(std::move(fetch)),
+    m_options(options),
+    m_scheduled(0),
+    m_prefetched_bytes(0),
+    m_expired_traces(0),
+    m_busy(false),
+    m_stop(false)
+{
+    if (m_options.enabled) {
+        m_thread = std::thread(&Prefetcher::run, this);
+    }
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_queue.clear();
+    }
+    m_wakeup.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void Prefetcher::schedule(ino_t ino, std::shared_ptr<RegularFileHandle> file)
+{
+    if (!m_options.enabled) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop || m_queue.size() >= m_options.max_queue) {
+            return;
+        }
+        m_queue.push_back(Job{ino, std::move(file)});
+    }
+    m_scheduled.fetch_add(1, std::memory_order_relaxed);
+    m_wakeup.notify_all();
+}
+
+Result<void> Prefetcher::prefetch(ino_t ino, RegularFileHandle &file)
+{
+    std::uint64_t file_size;
+    AccessTrace trace;
+    {
+        auto txn = m_cache.begin_ro();
+        auto trace_result = txn.get_trace(ino);
+        if (!trace_result) {
+            return copy_error(trace_result);
+        }
+        trace = std::move(*trace_result);
+        auto attr_result = txn.getattr(ino);
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        file_size = attr_result->attr.common.size;
+    }
+
+    if (trace.recorded_at() < std::time(nullptr) - m_options.max_age.count()) {
+        auto txn = m_cache.begin_rw();
+        txn.del_trace(ino);
+        auto commit_result = txn.commit();
+        if (!commit_result) {
+            return commit_result;
+        }
+        m_expired_traces.fetch_add(1, std::memory_order_relaxed);
+        return make_result(FAILED, ENOENT);
+    }
+
+    std::uint64_t budget = m_options.max_bytes;
+    for (const auto &range: trace.ranges()) {
+        const std::uint64_t off = range.start * CACHE_PAGE_SIZE;
+        if (off >= file_size || budget == 0) {
+            continue;
+        }
+        const std::size_t n = std::min({range.count * CACHE_PAGE_SIZE,
+                                         file_size - off, budget});
+        budget -= n;
+
+        std::uint64_t absent = 0;
+        for (const auto &gap: file.missing(off, n)) {
+            absent += gap.count * CACHE_PAGE_SIZE;
+        }
+        if (absent == 0) {
+            continue;
+        }
+
+        auto fetch_result = m_fetch(ino, file, off, n, file_size);
+        if (!fetch_result) {
+            return fetch_result;
+        }
+        m_prefetched_bytes.fetch_add(absent, std::memory_order_relaxed);
+    }
+    return make_result();
+}
+
+Result<void> Prefetcher::save(ino_t ino, RegularFileHandle &file)
+{
+    AccessTrace trace = file.take_access_trace();
+    if (!m_options.enabled || trace.empty()) {
+        return make_result();
+    }
+    trace.set_recorded_at(std::time(nullptr));
+
+    auto txn = m_cache.begin_rw();
+    txn.put_trace(ino, trace);
+    return txn.commit();
+}
+
+Result<std::size_t> Prefetcher::expire()
+{
+    auto txn = m_cache.begin_rw();
+    const std::size_t expired = txn.expire_traces(
+                std::time(nullptr) - m_options.max_age.count());
+    auto commit_result = txn.commit();
+    if (!commit_result) {
+        return copy_error(commit_result);
+    }
+    m_expired_traces.fetch_add(expired, std::memory_order_relaxed);
+    return make_result(expired);
+}
+
+void Prefetcher::drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this](){ return m_stop || (m_queue.empty() && !m_busy); });
+}
+
+void Prefetcher::run()
+{
+    (void)expire();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wakeup.wait(lock, [this](){ return m_stop || !m_queue.empty(); });
+        if (m_stop) {
+            break;
+        }
+        Job job = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_busy = true;
+
+        lock.unlock();
+        // errors are not worth reporting: the data is fetched again when the
+        // application actually reads it
+        (void)prefetch(job.ino, *job.file);
+        job.file = nullptr;
+        lock.lock();
+
+        m_busy = false;
+        if (m_queue.empty()) {
+            m_idle.notify_all();
+        }
+    }
+    m_idle.notify_all();
+}
+
+PrefetchStats Prefetcher::stats() const
+{
+    return PrefetchStats{
+        .scheduled = m_scheduled.load(std::memory_order_relaxed),
+        .prefetched_bytes = m_prefetched_bytes.load(std::memory_order_relaxed),
+        .expired_traces = m_expired_traces.load(std::memory_order_relaxed),
+    };
+}
+
+}
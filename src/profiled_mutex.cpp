@@ -0,0 +1,187 @@
+/**********************************************************************
+File name: profiled_mutex.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/profiled_mutex.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+
+namespace Dragonstash {
+
+namespace detail {
+
+std::atomic<bool> lock_profiling_enabled(false);
+
+}
+
+namespace {
+
+struct LockSiteRegistry {
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<LockSite>, std::less<>> sites;
+};
+
+LockSiteRegistry &registry()
+{
+    // constructed on first use, so that mutexes in static storage can
+    // register themselves safely
+    static LockSiteRegistry instance;
+    return instance;
+}
+
+}
+
+LockSite::LockSite(std::string name):
+    m_name(std::move(name)),
+    m_acquisitions(0),
+    m_contended(0)
+{
+    reset();
+}
+
+std::size_t LockSite::bucket(std::int64_t nsec)
+{
+    if (nsec <= 0) {
+        return 0;
+    }
+    const auto bits = std::size_t(64 - __builtin_clzll(std::uint64_t(nsec)));
+    return std::min(bits, LOCK_HISTOGRAM_BUCKETS - 1);
+}
+
+void LockSite::reset()
+{
+    m_acquisitions.store(0, std::memory_order_relaxed);
+    m_contended.store(0, std::memory_order_relaxed);
+    for (auto &bucket: m_wait) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    for (auto &bucket: m_hold) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+LockProfile::LockProfile(const LockSite &site):
+    name(site.m_name),
+    acquisitions(site.m_acquisitions.load(std::memory_order_relaxed)),
+    contended(site.m_contended.load(std::memory_order_relaxed))
+{
+    for (std::size_t i = 0; i < LOCK_HISTOGRAM_BUCKETS; ++i) {
+        wait[i] = site.m_wait[i].load(std::memory_order_relaxed);
+        hold[i] = site.m_hold[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t LockProfile::quantile(const LockHistogram &histogram, double q)
+{
+    std::uint64_t count = 0;
+    for (auto n: histogram) {
+        count += n;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<std::uint64_t>(
+                1, std::uint64_t(q * double(count) + 0.5));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < LOCK_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return i == 0 ? 0 : (std::uint64_t(1) << i) - 1;
+        }
+    }
+    return (std::uint64_t(1) << (LOCK_HISTOGRAM_BUCKETS - 1)) - 1;
+}
+
+std::uint64_t LockProfile::total(const LockHistogram &histogram)
+{
+    std::uint64_t result = 0;
+    for (std::size_t i = 1; i < LOCK_HISTOGRAM_BUCKETS; ++i) {
+        // midpoint of [2^(i-1), 2^i)
+        result += histogram[i] * ((std::uint64_t(3) << i) / 4);
+    }
+    return result;
+}
+
+LockSite &lock_site(const std::string &name)
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto iter = reg.sites.find(name);
+    if (iter == reg.sites.end()) {
+        iter = reg.sites.emplace(name, std::make_unique<LockSite>(name)).first;
+    }
+    return *iter->second;
+}
+
+std::vector<LockProfile> lock_profiles()
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    std::vector<LockProfile> result;
+    for (const auto &[name, site]: reg.sites) {
+        LockProfile profile(*site);
+        if (profile.acquisitions > 0) {
+            result.emplace_back(std::move(profile));
+        }
+    }
+    return result;
+}
+
+void reset_lock_profiles()
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto &[name, site]: reg.sites) {
+        site->reset();
+    }
+}
+
+void set_lock_profiling(bool enabled)
+{
+    detail::lock_profiling_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool lock_profiling()
+{
+    return detail::lock_profiling_enabled.load(std::memory_order_relaxed);
+}
+
+profiled_mutex::profiled_mutex(LockSite &site):
+    m_site(site),
+    m_locked_at(0)
+#ifndef NDEBUG
+    , m_current_owner(std::thread::id())
+#endif
+{
+
+}
+
+profiled_mutex::profiled_mutex(const std::string &site_name):
+    profiled_mutex(lock_site(site_name))
+{
+
+}
+
+}
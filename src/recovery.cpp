@@ -0,0 +1,155 @@
+/**********************************************************************
+File name: recovery.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/recovery.hpp"
+
+#include <algorithm>
+
+namespace Dragonstash {
+
+Recovery::Recovery(Cache &cache, const RecoveryOptions &options):
+    m_cache(cache),
+    m_options(options),
+    m_reaped_orphans(0),
+    m_checked_files(0),
+    m_discarded_files(0),
+    m_access_sketch_persists(0),
+    m_swept(false),
+    m_sweep_duration_ms(0),
+    m_stop(false)
+{
+    if (m_options.enabled) {
+        m_thread = std::thread(&Recovery::run, this);
+    }
+}
+
+Recovery::~Recovery()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool Recovery::stopped()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stop;
+}
+
+bool Recovery::sleep_until(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return !m_wakeup.wait_until(lock, deadline, [this](){ return m_stop; });
+}
+
+bool Recovery::reap()
+{
+    while (!stopped()) {
+        auto result = m_cache.reap_orphans(ORPHAN_REAP_BATCH);
+        if (!result || *result == 0) {
+            return true;
+        }
+        m_reaped_orphans.fetch_add(*result, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+bool Recovery::sweep_pass()
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    // reap first: the data of orphans does not need to be checked
+    if (!reap()) {
+        return false;
+    }
+
+    if (m_cache.recovery_pending()) {
+        for (const ino_t ino: m_cache.cached_files()) {
+            if (stopped()) {
+                return false;
+            }
+            auto result = m_cache.check_file(ino);
+            m_checked_files.fetch_add(1, std::memory_order_relaxed);
+            if (result && *result) {
+                m_discarded_files.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        m_cache.finish_recovery();
+    }
+
+    m_sweep_duration_ms.store(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - t0).count(),
+                std::memory_order_relaxed);
+    m_swept.store(true, std::memory_order_release);
+    return true;
+}
+
+void Recovery::sweep()
+{
+    (void)sweep_pass();
+}
+
+void Recovery::run()
+{
+    if (!sweep_pass()) {
+        return;
+    }
+    auto next_reap = std::chrono::steady_clock::now() + m_options.reap_interval;
+    auto next_persist = std::chrono::steady_clock::now() + m_options.access_sketch_interval;
+    while (sleep_until(std::min(next_reap, next_persist))) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= next_persist) {
+            if (m_cache.persist_access_sketch()) {
+                m_access_sketch_persists.fetch_add(1, std::memory_order_relaxed);
+            }
+            next_persist = now + m_options.access_sketch_interval;
+        }
+        if (now >= next_reap) {
+            if (!reap()) {
+                break;
+            }
+            next_reap = now + m_options.reap_interval;
+        }
+    }
+}
+
+RecoveryStats Recovery::stats() const
+{
+    return RecoveryStats{
+        .reaped_orphans = m_reaped_orphans.load(std::memory_order_relaxed),
+        .checked_files = m_checked_files.load(std::memory_order_relaxed),
+        .discarded_files = m_discarded_files.load(std::memory_order_relaxed),
+        .access_sketch_persists = m_access_sketch_persists.load(std::memory_order_relaxed),
+        .swept = m_swept.load(std::memory_order_acquire),
+        .sweep_duration = std::chrono::milliseconds(
+            m_sweep_duration_ms.load(std::memory_order_relaxed)),
+    };
+}
+
+}
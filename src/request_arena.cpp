@@ -0,0 +1,122 @@
+/**********************************************************************
+File name: request_arena.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/request_arena.hpp"
+
+#include <algorithm>
+#include <memory>
+
+namespace Dragonstash {
+
+static constexpr std::size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+
+namespace detail {
+
+std::atomic<bool> request_arenas_enabled(true);
+
+thread_local RequestArena *current_request_arena = nullptr;
+
+RequestArena &thread_request_arena()
+{
+    // only threads which actually serve requests get an arena
+    thread_local RequestArena arena;
+    return arena;
+}
+
+}
+
+void set_request_arenas(bool enabled)
+{
+    detail::request_arenas_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+RequestArena::RequestArena(std::size_t initial_size,
+                           std::pmr::memory_resource *upstream):
+    m_upstream(upstream),
+    m_block(static_cast<std::byte*>(upstream->allocate(initial_size,
+                                                       BLOCK_ALIGNMENT))),
+    m_capacity(initial_size),
+    m_used(0),
+    m_overflow(upstream),
+    m_overflow_bytes(0),
+    m_overflows(0)
+{
+
+}
+
+RequestArena::~RequestArena()
+{
+    m_upstream->deallocate(m_block, m_capacity, BLOCK_ALIGNMENT);
+}
+
+void *RequestArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    const auto base = reinterpret_cast<std::uintptr_t>(m_block);
+    const std::uintptr_t aligned = (base + m_used + alignment - 1) & ~(alignment - 1);
+    const std::size_t offset = aligned - base;
+    if (offset <= m_capacity && bytes <= m_capacity - offset) {
+        m_used = offset + bytes;
+        return m_block + offset;
+    }
+
+    m_overflow_bytes += bytes;
+    m_overflows += 1;
+    return m_overflow.allocate(bytes, alignment);
+}
+
+void RequestArena::do_deallocate(void *, std::size_t, std::size_t)
+{
+    // memory is only reclaimed by reset()
+}
+
+bool RequestArena::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
+
+void RequestArena::reset()
+{
+    if (m_overflow_bytes > 0) {
+        m_overflow.release();
+        if (m_capacity < REQUEST_ARENA_MAX_SIZE) {
+            // the block must hold the whole request next time, so that it
+            // does not overflow again
+            const std::size_t needed = m_used + m_overflow_bytes;
+            std::size_t new_capacity = std::max(m_capacity, BLOCK_ALIGNMENT);
+            while (new_capacity < needed && new_capacity < REQUEST_ARENA_MAX_SIZE) {
+                new_capacity *= 2;
+            }
+            new_capacity = std::min(new_capacity, REQUEST_ARENA_MAX_SIZE);
+            std::byte *new_block = static_cast<std::byte*>(
+                        m_upstream->allocate(new_capacity, BLOCK_ALIGNMENT));
+            m_upstream->deallocate(m_block, m_capacity, BLOCK_ALIGNMENT);
+            m_block = new_block;
+            m_capacity = new_capacity;
+        }
+    }
+    m_used = 0;
+    m_overflow_bytes = 0;
+}
+
+}
@@ -0,0 +1,237 @@
+/**********************************************************************
+File name: trace.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/trace.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace Dragonstash {
+
+namespace {
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+
+    void add(std::shared_ptr<TraceBuffer> buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        // drop the oldest buffers of exited threads
+        std::size_t retired = 0;
+        for (auto iter = buffers.rbegin(); iter != buffers.rend(); ++iter) {
+            if ((*iter)->retired()) {
+                ++retired;
+            }
+        }
+        auto iter = buffers.begin();
+        while (retired > TRACE_RETIRED_BUFFERS && iter != buffers.end()) {
+            if ((*iter)->retired()) {
+                iter = buffers.erase(iter);
+                --retired;
+            } else {
+                ++iter;
+            }
+        }
+        buffers.emplace_back(std::move(buffer));
+    }
+
+    std::vector<std::shared_ptr<TraceBuffer>> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return buffers;
+    }
+};
+
+TraceRegistry &registry()
+{
+    static TraceRegistry instance;
+    return instance;
+}
+
+/**
+ * @brief Owns the buffer of a thread and marks it retired on thread exit.
+ */
+struct ThreadTraceBuffer {
+    std::shared_ptr<TraceBuffer> buffer;
+
+    ThreadTraceBuffer():
+        buffer(std::make_shared<TraceBuffer>())
+    {
+        registry().add(buffer);
+    }
+
+    ~ThreadTraceBuffer() {
+        buffer->retire();
+    }
+};
+
+void write_json_string(std::ostream &out, const char *s)
+{
+    out << '"';
+    for (; *s; ++s) {
+        const char ch = *s;
+        if (ch == '"' || ch == '\\') {
+            out << '\\' << ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            out << ' ';
+        } else {
+            out << ch;
+        }
+    }
+    out << '"';
+}
+
+/**
+ * @brief Write nanoseconds as microseconds with three decimals, which is
+ * what the trace event format expects.
+ */
+void write_usec(std::ostream &out, std::int64_t nsec)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%" PRId64 ".%03" PRId64,
+                  nsec / 1000, nsec % 1000);
+    out << buf;
+}
+
+}
+
+namespace detail {
+
+std::atomic<bool> tracing_enabled(false);
+
+TraceBuffer &thread_trace_buffer()
+{
+    // buffers are only allocated for threads which actually record
+    thread_local ThreadTraceBuffer buffer;
+    return *buffer.buffer;
+}
+
+}
+
+TraceBuffer::TraceBuffer():
+    m_tid(static_cast<pid_t>(syscall(SYS_gettid))),
+    m_head(0),
+    m_retired(false)
+{
+    for (auto &slot: m_slots) {
+        slot.seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TraceBuffer::push(const char *category, const char *name,
+                       std::int64_t start, std::int64_t duration,
+                       std::uint64_t arg)
+{
+    const std::uint64_t pos = m_head.load(std::memory_order_relaxed);
+    Slot &slot = m_slots[pos % TRACE_BUFFER_EVENTS];
+    slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.category.store(category, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.seq.store(2 * pos + 2, std::memory_order_release);
+    m_head.store(pos + 1, std::memory_order_release);
+}
+
+void TraceBuffer::collect(std::vector<TraceEvent> &dest) const
+{
+    const std::uint64_t head = m_head.load(std::memory_order_acquire);
+    const std::uint64_t first = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+    for (std::uint64_t pos = first; pos < head; ++pos) {
+        const Slot &slot = m_slots[pos % TRACE_BUFFER_EVENTS];
+        const std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * pos + 2) {
+            // overwritten since we read the head
+            continue;
+        }
+        TraceEvent event{
+            slot.category.load(std::memory_order_relaxed),
+            slot.name.load(std::memory_order_relaxed),
+            slot.start.load(std::memory_order_relaxed),
+            slot.duration.load(std::memory_order_relaxed),
+            slot.arg.load(std::memory_order_relaxed),
+            m_tid,
+        };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+        dest.emplace_back(event);
+    }
+}
+
+void set_tracing(bool enabled)
+{
+    detail::tracing_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+std::vector<TraceEvent> collect_trace()
+{
+    std::vector<TraceEvent> result;
+    for (const auto &buffer: registry().snapshot()) {
+        buffer->collect(result);
+    }
+    std::stable_sort(result.begin(), result.end(),
+                     [](const TraceEvent &a, const TraceEvent &b) {
+        return a.start < b.start;
+    });
+    return result;
+}
+
+void write_chrome_trace(std::ostream &out)
+{
+    const auto events = collect_trace();
+    const pid_t pid = getpid();
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto &event: events) {
+        if (!first) {
+            out << ',';
+        }
+        first = false;
+        out << "\n{\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << event.tid
+            << ",\"cat\":";
+        write_json_string(out, event.category);
+        out << ",\"name\":";
+        write_json_string(out, event.name);
+        out << ",\"ts\":";
+        write_usec(out, event.start);
+        out << ",\"dur\":";
+        write_usec(out, event.duration);
+        if (event.arg != 0) {
+            out << ",\"args\":{\"ino\":" << event.arg << '}';
+        }
+        out << '}';
+    }
+    out << "\n]}\n";
+}
+
+}
@@ -0,0 +1,170 @@
+/**********************************************************************
+File name: verifier.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/verifier.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace Dragonstash {
+
+/**
+ * Number of blocks checked by the scrubber at once; the file is locked for
+ * the duration of a slice.
+ */
+static constexpr std::size_t SCRUB_SLICE_BLOCKS = 1024;
+
+Verifier::Verifier(Cache &cache, const VerifyOptions &options):
+    m_cache(cache),
+    m_options(options),
+    m_reads(0),
+    m_verified_bytes(0),
+    m_corrupt_blocks(0),
+    m_scrub_passes(0),
+    m_stop(false)
+{
+    if (m_options.mode == VerifyMode::SCRUB) {
+        m_thread = std::thread(&Verifier::run, this);
+    }
+}
+
+Verifier::~Verifier()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool Verifier::sleep_until(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return !m_wakeup.wait_until(lock, deadline, [this](){ return m_stop; });
+}
+
+bool Verifier::should_verify()
+{
+    switch (m_options.mode) {
+    case VerifyMode::ALWAYS:
+        return true;
+    case VerifyMode::SAMPLED:
+        return m_reads.fetch_add(1, std::memory_order_relaxed)
+                % std::max(1u, m_options.sample_interval) == 0;
+    case VerifyMode::NONE:
+    case VerifyMode::SCRUB:
+        break;
+    }
+    return false;
+}
+
+Result<std::uint64_t> Verifier::verify(RegularFileHandle &file,
+                                       off_t off, std::size_t n)
+{
+    auto result = file.verify(off, n);
+    m_verified_bytes.fetch_add(n, std::memory_order_relaxed);
+
+    const std::int64_t delta = file.take_unaccounted_bytes();
+    if (delta != 0) {
+        auto txn = m_cache.begin_rw();
+        txn.account_file_bytes(file.inode(), delta);
+        (void)txn.commit();
+    }
+
+    if (result) {
+        m_corrupt_blocks.fetch_add(*result, std::memory_order_relaxed);
+    } else {
+        m_corrupt_blocks.fetch_add(1, std::memory_order_relaxed);
+    }
+    return result;
+}
+
+bool Verifier::scrub_pass(bool rate_limited)
+{
+    const std::vector<ino_t> inodes = m_cache.cached_files();
+
+    auto budget_start = std::chrono::steady_clock::now();
+    std::uint64_t budget_used = 0;
+    for (const ino_t ino: inodes) {
+        std::uint64_t size;
+        {
+            auto txn = m_cache.begin_ro();
+            auto attr_result = txn.getattr(ino);
+            if (!attr_result) {
+                continue;
+            }
+            size = attr_result->attr.common.size;
+        }
+        auto file = m_cache.open_file(ino);
+        if (!file) {
+            continue;
+        }
+
+        const std::uint64_t slice = SCRUB_SLICE_BLOCKS * CACHE_PAGE_SIZE;
+        for (std::uint64_t off = 0; off < size; off += slice) {
+            const std::size_t n = std::min(slice, size - off);
+            (void)verify(**file, off, n);
+
+            if (!rate_limited) {
+                continue;
+            }
+            budget_used += n;
+            const auto due = budget_start + std::chrono::microseconds(
+                        budget_used * 1000000 / std::max<std::uint64_t>(1, m_options.scrub_rate));
+            if (!sleep_until(due)) {
+                return false;
+            }
+        }
+    }
+    m_scrub_passes.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Verifier::scrub()
+{
+    (void)scrub_pass(false);
+}
+
+void Verifier::run()
+{
+    while (scrub_pass(true)) {
+        if (!sleep_until(std::chrono::steady_clock::now() + m_options.scrub_interval)) {
+            break;
+        }
+    }
+}
+
+VerifyStats Verifier::stats() const
+{
+    return VerifyStats{
+        .verified_bytes = m_verified_bytes.load(std::memory_order_relaxed),
+        .corrupt_blocks = m_corrupt_blocks.load(std::memory_order_relaxed),
+        .scrub_passes = m_scrub_passes.load(std::memory_order_relaxed),
+    };
+}
+
+}
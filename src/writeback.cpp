@@ -0,0 +1,468 @@
+/**********************************************************************
+File name: writeback.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include "dragonstash/writeback.hpp"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace Dragonstash {
+
+Writeback::Writeback(Cache &cache, Backend::Filesystem &backend,
+                     const WritebackOptions &options):
+    m_cache(cache),
+    m_backend(backend),
+    m_options(options),
+    m_dirty_bytes(0),
+    m_rounds(0),
+    m_kick(false),
+    m_stop(false)
+{
+    // pick up the files which were still dirty when we last shut down
+    std::vector<ino_t> dirty_inodes;
+    {
+        auto txn = m_cache.begin_ro();
+        auto dirty_result = txn.inodes_with_flag(InodeFlag::DIRTY);
+        if (dirty_result) {
+            dirty_inodes = std::move(*dirty_result);
+        }
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    for (const ino_t ino: dirty_inodes) {
+        auto file = m_cache.open_file(ino);
+        if (!file) {
+            continue;
+        }
+        const std::uint64_t bytes = (*file)->blocks(Blocklist::WRITTEN) * CACHE_PAGE_SIZE;
+        m_dirty.emplace(ino, DirtyFile{*file, bytes, now});
+        m_dirty_bytes += bytes;
+    }
+
+    m_thread = std::thread(&Writeback::run, this);
+}
+
+Writeback::~Writeback()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    m_progress.notify_all();
+    m_thread.join();
+
+    // whatever fails here is picked up again on the next start
+    (void)flush_all();
+}
+
+Result<void> Writeback::upload(RegularFileHandle &file, bool sync)
+{
+    auto upload_guard = file.upload_lock();
+
+    const auto dirty = file.ranges(Blocklist::WRITTEN);
+    if (dirty.empty()) {
+        return make_result();
+    }
+
+    std::string path;
+    std::uint64_t size;
+    {
+        auto txn = m_cache.begin_ro();
+        if (!txn.journal_empty()) {
+            // the backend has not caught up with the metadata yet
+            return make_result(FAILED, ENOTCONN);
+        }
+        auto path_result = txn.path(file.inode());
+        if (!path_result) {
+            return copy_error(path_result);
+        }
+        auto attr_result = txn.getattr(file.inode());
+        if (!attr_result) {
+            return copy_error(attr_result);
+        }
+        path = std::move(*path_result);
+        size = attr_result->attr.common.size;
+    }
+
+    auto backend_file = m_backend.open(path, O_WRONLY, 0);
+    if (!backend_file) {
+        return copy_error(backend_file);
+    }
+
+    const std::uint64_t max_blocks = std::max<std::uint64_t>(
+                1, m_options.max_upload_size / CACHE_PAGE_SIZE);
+    std::vector<std::byte> buffer;
+
+    // chunks which have been written to the backend, with the write
+    // generation of the file from before they were read
+    std::vector<std::pair<Blocklist::Range, std::uint64_t>> uploaded;
+    file.log_writes(true);
+    struct StopLogging {
+        RegularFileHandle &file;
+        ~StopLogging() {
+            file.log_writes(false);
+        }
+    } stop_logging{file};
+
+    auto upload_chunk = [&](const Blocklist::Range &chunk) -> Result<void> {
+        // the blocks stay WRITTEN (also on disk) until the backend has the
+        // data; a crash in between only causes them to be uploaded again
+        uploaded.emplace_back(chunk, file.write_generation());
+
+        const std::uint64_t off = chunk.start * CACHE_PAGE_SIZE;
+        if (off >= size) {
+            // beyond the end of the file, nothing to upload
+            return make_result();
+        }
+        const std::size_t len = std::min<std::uint64_t>(
+                    chunk.count * CACHE_PAGE_SIZE, size - off);
+        buffer.resize(len);
+        auto read_result = file.pread(off, buffer.data(), len);
+        if (!read_result) {
+            return copy_error(read_result);
+        }
+
+        std::size_t done = 0;
+        while (done < *read_result) {
+            auto write_result = (*backend_file)->pwrite(
+                        buffer.data() + done, *read_result - done, off + done);
+            if (!write_result) {
+                return copy_error(write_result);
+            }
+            if (*write_result == 0) {
+                return make_result(FAILED, EIO);
+            }
+            done += *write_result;
+        }
+        return make_result();
+    };
+
+    for (const auto &range: dirty) {
+        for (std::uint64_t start = range.start; start < range.end(); start += max_blocks) {
+            const Blocklist::Range chunk{
+                .start = start,
+                .count = std::min(max_blocks, range.end() - start),
+                .state = Blocklist::WRITTEN,
+            };
+            auto chunk_result = upload_chunk(chunk);
+            if (!chunk_result) {
+                (void)(*backend_file)->close();
+                return chunk_result;
+            }
+        }
+    }
+
+    if (sync) {
+        auto sync_result = (*backend_file)->fsync();
+        if (!sync_result) {
+            (void)(*backend_file)->close();
+            return sync_result;
+        }
+    }
+
+    auto close_result = (*backend_file)->close();
+    if (!close_result) {
+        return close_result;
+    }
+
+    // a write which raced with the upload of a block may or may not have
+    // made it to the backend; such blocks are uploaded again in a later round
+    for (const auto &[chunk, generation]: uploaded) {
+        file.mark_uploaded(chunk, generation);
+    }
+    return make_result();
+}
+
+void Writeback::settle(const std::shared_ptr<RegularFileHandle> &file, int error)
+{
+    const ino_t ino = file->inode();
+    auto iter = m_dirty.find(ino);
+
+    auto forget = [this, &iter](){
+        if (iter != m_dirty.end()) {
+            m_dirty_bytes -= iter->second.bytes;
+            m_dirty.erase(iter);
+        }
+    };
+
+    if (error == ENOENT || error == ESTALE) {
+        // the inode is gone; there is nothing left to write the data to
+        forget();
+        return;
+    }
+
+    const std::uint64_t bytes = file->blocks(Blocklist::WRITTEN) * CACHE_PAGE_SIZE;
+    if (bytes == 0) {
+        // writers only mark blocks before calling mark_dirty(), which takes
+        // m_mutex; thus no write can slip in between this check and the
+        // flag being cleared.
+        auto txn = m_cache.begin_rw();
+        auto flag_result = txn.update_flags(ino, {}, {InodeFlag::DIRTY});
+        if (flag_result && !txn.commit()) {
+            // keep the file around to retry clearing the flag later
+            return;
+        }
+        forget();
+        return;
+    }
+
+    if (iter == m_dirty.end()) {
+        return;
+    }
+    m_dirty_bytes = m_dirty_bytes - iter->second.bytes + bytes;
+    iter->second.bytes = bytes;
+}
+
+Result<void> Writeback::write_back(const std::shared_ptr<RegularFileHandle> &file,
+                                   bool sync)
+{
+    auto result = upload(*file, sync);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        settle(file, result ? 0 : result.error());
+    }
+    m_progress.notify_all();
+    if (!result && (result.error() == ENOENT || result.error() == ESTALE)) {
+        // the file has been removed; its data does not need to go anywhere
+        return make_result();
+    }
+    return result;
+}
+
+void Writeback::run()
+{
+    using namespace std::chrono_literals;
+    const auto tick = std::clamp<std::chrono::milliseconds>(
+                m_options.expire / 4, 10ms, 1000ms);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    bool backoff = false;
+    while (!m_stop) {
+        m_wakeup.wait_for(lock, tick, [this, backoff](){
+            return m_stop || m_kick ||
+                    (!backoff && m_dirty_bytes >= m_options.background_bytes);
+        });
+        if (m_stop) {
+            break;
+        }
+
+        const bool everything = m_kick ||
+                m_dirty_bytes >= m_options.background_bytes;
+        m_kick = false;
+
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<std::pair<std::chrono::steady_clock::time_point,
+                              std::shared_ptr<RegularFileHandle>>> candidates;
+        for (const auto &[ino, dirty]: m_dirty) {
+            if (everything || dirty.since + m_options.expire <= now) {
+                candidates.emplace_back(dirty.since, dirty.file);
+            }
+        }
+        // oldest first
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const auto &a, const auto &b){ return a.first < b.first; });
+
+        const std::uint64_t dirty_before = m_dirty_bytes;
+        lock.unlock();
+        (void)replay_journal();
+        for (const auto &candidate: candidates) {
+            (void)write_back(candidate.second, false);
+        }
+        lock.lock();
+
+        // without progress (e.g. while the backend is unreachable), wait for
+        // a full tick before trying again
+        backoff = !candidates.empty() && m_dirty_bytes >= dirty_before;
+        ++m_rounds;
+        m_progress.notify_all();
+    }
+}
+
+Result<void> Writeback::mark_dirty(const std::shared_ptr<RegularFileHandle> &file)
+{
+    const ino_t ino = file->inode();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_dirty.find(ino);
+    if (iter == m_dirty.end()) {
+        auto txn = m_cache.begin_rw();
+        auto flag_result = txn.update_flags(ino, {InodeFlag::DIRTY});
+        if (!flag_result) {
+            return flag_result;
+        }
+        auto commit_result = txn.commit();
+        if (!commit_result) {
+            return commit_result;
+        }
+        iter = m_dirty.emplace(ino, DirtyFile{
+                                   file, 0, std::chrono::steady_clock::now()
+                               }).first;
+    }
+
+    const std::uint64_t bytes = file->blocks(Blocklist::WRITTEN) * CACHE_PAGE_SIZE;
+    m_dirty_bytes = m_dirty_bytes - iter->second.bytes + bytes;
+    iter->second.bytes = bytes;
+
+    if (m_dirty_bytes >= m_options.background_bytes) {
+        m_wakeup.notify_one();
+    }
+    return make_result();
+}
+
+void Writeback::throttle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_dirty_bytes < m_options.limit_bytes) {
+        return;
+    }
+
+    const std::uint64_t round = m_rounds;
+    m_kick = true;
+    m_wakeup.notify_one();
+    m_progress.wait(lock, [this, round](){
+        return m_stop || m_dirty_bytes < m_options.limit_bytes || m_rounds > round;
+    });
+}
+
+Result<void> Writeback::replay_journal()
+{
+    std::lock_guard<std::mutex> guard(m_replay_mutex);
+
+    {
+        auto txn = m_cache.begin_ro();
+        if (txn.journal_empty()) {
+            return make_result();
+        }
+    }
+
+    {
+        auto txn = m_cache.begin_rw();
+        auto compact_result = txn.compact_journal();
+        if (!compact_result) {
+            return copy_error(compact_result);
+        }
+        if (*compact_result > 0) {
+            auto commit_result = txn.commit();
+            if (!commit_result) {
+                return commit_result;
+            }
+        }
+    }
+
+    const std::size_t batch_size = std::max<std::size_t>(1, m_options.replay_batch);
+    while (true) {
+        std::vector<JournalRecord> batch;
+        {
+            auto txn = m_cache.begin_ro();
+            auto journal_result = txn.journal(batch_size);
+            if (!journal_result) {
+                return copy_error(journal_result);
+            }
+            batch = std::move(*journal_result);
+        }
+        if (batch.empty()) {
+            return make_result();
+        }
+
+        Result<void> result = make_result();
+        std::size_t replayed = 0;
+        for (const auto &record: batch) {
+            result = record.entry.apply(m_backend);
+            if (Backend::is_not_connected(result)) {
+                break;
+            }
+            // anything else is either done already or will never succeed
+            ++replayed;
+        }
+
+        if (replayed > 0) {
+            auto txn = m_cache.begin_rw();
+            for (std::size_t i = 0; i < replayed; ++i) {
+                txn.journal_remove(batch[i].seq);
+            }
+            auto commit_result = txn.commit();
+            if (!commit_result) {
+                return commit_result;
+            }
+        }
+
+        if (replayed < batch.size()) {
+            return result;
+        }
+    }
+}
+
+Result<void> Writeback::flush(ino_t ino, bool sync)
+{
+    auto replay_result = replay_journal();
+    if (!replay_result) {
+        return replay_result;
+    }
+
+    std::shared_ptr<RegularFileHandle> file;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_dirty.find(ino);
+        if (iter == m_dirty.end()) {
+            return make_result();
+        }
+        file = iter->second.file;
+    }
+    return write_back(file, sync);
+}
+
+Result<void> Writeback::flush_all()
+{
+    auto replay_result = replay_journal();
+    if (!replay_result) {
+        return replay_result;
+    }
+
+    std::vector<std::shared_ptr<RegularFileHandle>> files;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &[ino, dirty]: m_dirty) {
+            files.push_back(dirty.file);
+        }
+    }
+
+    Result<void> result = make_result();
+    for (const auto &file: files) {
+        auto flush_result = write_back(file, false);
+        if (!flush_result && result) {
+            result = flush_result;
+        }
+    }
+    return result;
+}
+
+std::uint64_t Writeback::dirty_bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dirty_bytes;
+}
+
+}
@@ -270,6 +270,31 @@ SCENARIO("Directory iteration") {
                 }
             }
         }
+
+        WHEN("Reading the root directory in batches") {
+            auto opendir_result = fs.opendir("/");
+            REQUIRE(opendir_result);
+            auto &handle = **opendir_result;
+
+            THEN("All entries come in one batch, followed by an empty one") {
+                std::vector<DirEntryRef> batch;
+                auto batch_result = handle.read_batch(batch);
+                CHECK(batch_result);
+                REQUIRE(batch.size() == 4);
+                CHECK(batch[0].name == ".");
+                CHECK(batch[1].name == "..");
+
+                std::vector<std::string> names{std::string(batch[2].name),
+                                               std::string(batch[3].name)};
+                std::sort(names.begin(), names.end());
+                CHECK(names[0] == "d1");
+                CHECK(names[1] == "f1");
+
+                batch_result = handle.read_batch(batch);
+                CHECK(batch_result);
+                CHECK(batch.empty());
+            }
+        }
     }
 }
 
@@ -568,3 +593,114 @@ SCENARIO("Entry removal") {
         }
     }
 }
+
+SCENARIO("Mutations through the Filesystem interface") {
+    GIVEN("A fs with a directory and two files") {
+        InMemoryFilesystem fs;
+        fs.emplace<InMemory::File>("f1");
+        fs.emplace<InMemory::Directory>("dir").emplace<InMemory::File>("f2");
+
+        WHEN("Creating a file with O_CREAT") {
+            auto result = fs.open("/dir/f3", O_CREAT | O_EXCL | O_WRONLY, 0640);
+
+            THEN("It succeeds") {
+                CHECK(result.error() == 0);
+                CHECK(result);
+            }
+
+            THEN("The file exists with the given mode") {
+                auto stat_result = fs.lstat("/dir/f3");
+                REQUIRE(stat_result);
+                CHECK(stat_result->mode == (S_IFREG | 0640));
+            }
+
+            AND_WHEN("Creating it again exclusively") {
+                auto again = fs.open("/dir/f3", O_CREAT | O_EXCL | O_WRONLY, 0640);
+
+                THEN("It fails with EEXIST") {
+                    CHECK(again.error() == EEXIST);
+                    CHECK(!again);
+                }
+            }
+        }
+
+        WHEN("Creating a directory") {
+            auto result = fs.mkdir("/dir/sub", 0750);
+
+            THEN("It succeeds and the directory exists") {
+                CHECK(result.error() == 0);
+                auto stat_result = fs.lstat("/dir/sub");
+                REQUIRE(stat_result);
+                CHECK(stat_result->mode == (S_IFDIR | 0750));
+            }
+        }
+
+        WHEN("Removing the non-empty directory with rmdir") {
+            auto result = fs.rmdir("/dir");
+
+            THEN("It fails with ENOTEMPTY") {
+                CHECK(result.error() == ENOTEMPTY);
+            }
+        }
+
+        WHEN("Unlinking a file") {
+            auto result = fs.unlink("/dir/f2");
+
+            THEN("It is gone") {
+                CHECK(result.error() == 0);
+                CHECK(fs.lstat("/dir/f2").error() == ENOENT);
+            }
+
+            AND_WHEN("Removing the now empty directory") {
+                auto rmdir_result = fs.rmdir("/dir");
+
+                THEN("It is gone") {
+                    CHECK(rmdir_result.error() == 0);
+                    CHECK(fs.lstat("/dir").error() == ENOENT);
+                }
+            }
+        }
+
+        WHEN("Moving a file into the directory") {
+            auto result = fs.rename("/f1", "/dir/f1");
+
+            THEN("It exists under the new name only") {
+                CHECK(result.error() == 0);
+                CHECK(fs.lstat("/f1").error() == ENOENT);
+                CHECK(fs.lstat("/dir/f1"));
+            }
+        }
+
+        WHEN("Moving a file over a directory") {
+            auto result = fs.rename("/f1", "/dir");
+
+            THEN("It fails with EISDIR") {
+                CHECK(result.error() == EISDIR);
+            }
+        }
+
+        WHEN("Truncating and changing the mode of a file") {
+            auto truncate_result = fs.truncate("/f1", 100);
+            auto chmod_result = fs.chmod("/f1", 0600);
+
+            THEN("The attributes change") {
+                CHECK(truncate_result.error() == 0);
+                CHECK(chmod_result.error() == 0);
+                auto stat_result = fs.lstat("/f1");
+                REQUIRE(stat_result);
+                CHECK(stat_result->size == 100);
+                CHECK(stat_result->mode == (S_IFREG | 0600));
+            }
+        }
+
+        WHEN("Disconnecting the fs") {
+            fs.set_connected(false);
+
+            THEN("Mutations fail with ENOTCONN") {
+                CHECK(fs.mkdir("/new", 0755).error() == ENOTCONN);
+                CHECK(fs.unlink("/f1").error() == ENOTCONN);
+                CHECK(fs.rename("/f1", "/f4").error() == ENOTCONN);
+            }
+        }
+    }
+}
@@ -0,0 +1,158 @@
+/**********************************************************************
+File name: local.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dragonstash/backend/local.hpp"
+
+#include "testutils/tempdir.hpp"
+
+using namespace Dragonstash::Backend;
+
+namespace {
+
+void touch(const std::filesystem::path &path)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    REQUIRE(fd >= 0);
+    ::close(fd);
+}
+
+int open_dir(const std::filesystem::path &path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    REQUIRE(fd >= 0);
+    return fd;
+}
+
+}
+
+SCENARIO("Local directory iteration") {
+    TemporaryDirectory dir;
+    static constexpr unsigned NFILES = 500;
+    std::set<std::string> expected{".", "..", "subdir"};
+    REQUIRE(::mkdir((dir.path() / "subdir").c_str(), 0755) == 0);
+    for (unsigned i = 0; i < NFILES; ++i) {
+        const std::string name = "a file with a longish name " + std::to_string(i);
+        touch(dir.path() / name);
+        expected.emplace(name);
+    }
+
+    GIVEN("A directory stream with a buffer smaller than the directory") {
+        LocalDir handle(open_dir(dir.path()), 1024);
+
+        WHEN("Reading it in batches") {
+            std::set<std::string> names;
+            std::size_t nbatches = 0;
+            std::vector<DirEntryRef> batch;
+            while (true) {
+                auto batch_result = handle.read_batch(batch);
+                REQUIRE(batch_result);
+                if (batch.empty()) {
+                    break;
+                }
+                nbatches += 1;
+                for (const auto &entry: batch) {
+                    names.emplace(entry.name);
+                    if (entry.name == "subdir") {
+                        CHECK((entry.mode & S_IFMT) == S_IFDIR);
+                    } else if (entry.name != "." && entry.name != "..") {
+                        CHECK((entry.mode & S_IFMT) == S_IFREG);
+                    }
+                    CHECK(entry.ino != 0);
+                    CHECK(!entry.complete);
+                }
+            }
+
+            THEN("Every entry is returned exactly once") {
+                CHECK(names == expected);
+            }
+
+            THEN("The entries are spread over several batches") {
+                CHECK(nbatches > 1);
+            }
+        }
+
+        WHEN("Mixing readdir and batches") {
+            std::multiset<std::string> names;
+            std::vector<DirEntryRef> batch;
+            bool at_eof = false;
+            while (!at_eof) {
+                auto readdir_result = handle.readdir();
+                if (!readdir_result) {
+                    CHECK(readdir_result.error() == 0);
+                    break;
+                }
+                names.emplace(readdir_result->name);
+
+                REQUIRE(handle.read_batch(batch));
+                at_eof = batch.empty();
+                for (const auto &entry: batch) {
+                    names.emplace(entry.name);
+                }
+            }
+
+            THEN("Every entry is returned exactly once") {
+                CHECK(names.size() == expected.size());
+                CHECK(std::set<std::string>(names.begin(), names.end()) == expected);
+            }
+        }
+    }
+
+    GIVEN("The local filesystem backend") {
+        LocalFilesystem fs(dir.path());
+
+        WHEN("Opening the root directory") {
+            auto opendir_result = fs.opendir("/");
+            REQUIRE(opendir_result);
+
+            THEN("The default batch holds the whole directory") {
+                std::vector<DirEntryRef> batch;
+                REQUIRE((*opendir_result)->read_batch(batch));
+                CHECK(batch.size() == expected.size());
+                REQUIRE((*opendir_result)->read_batch(batch));
+                CHECK(batch.empty());
+            }
+        }
+
+        WHEN("Opening a file as directory") {
+            auto opendir_result = fs.opendir("/a file with a longish name 0");
+
+            THEN("It fails with ENOTDIR") {
+                CHECK(!opendir_result);
+                CHECK(opendir_result.error() == ENOTDIR);
+            }
+        }
+    }
+}
@@ -0,0 +1,290 @@
+/**********************************************************************
+File name: synthetic.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dragonstash/backend/synthetic.hpp"
+
+using namespace Dragonstash::Backend;
+
+namespace {
+
+struct WalkStats {
+    std::uint64_t directories = 0;
+    std::uint64_t files = 0;
+};
+
+void walk(SyntheticFilesystem &fs, const std::string &path, WalkStats &stats)
+{
+    stats.directories += 1;
+    auto dir = fs.opendir(path);
+    REQUIRE(dir);
+
+    std::vector<std::string> subdirs;
+    std::set<std::string> names;
+    std::vector<DirEntryRef> batch;
+    while (true) {
+        REQUIRE((*dir)->read_batch(batch));
+        if (batch.empty()) {
+            break;
+        }
+        for (const auto &entry: batch) {
+            CHECK(names.emplace(entry.name).second);
+            if (entry.name == "." || entry.name == "..") {
+                continue;
+            }
+            const std::string child = (path == "/" ? path : path + "/") +
+                    std::string(entry.name);
+            auto stat_result = fs.lstat(child);
+            REQUIRE(stat_result);
+            CHECK((stat_result->mode & S_IFMT) == (entry.mode & S_IFMT));
+            CHECK(stat_result->ino == entry.ino);
+            if (S_ISDIR(entry.mode)) {
+                subdirs.emplace_back(child);
+            } else {
+                stats.files += 1;
+                CHECK(stat_result->size >= fs.options().min_file_size);
+                CHECK(stat_result->size <= fs.options().max_file_size);
+            }
+        }
+    }
+    for (const auto &subdir: subdirs) {
+        walk(fs, subdir, stats);
+    }
+}
+
+std::string entry_name(SyntheticFilesystem &fs, const std::string &path,
+                       std::size_t index)
+{
+    auto dir = fs.opendir(path);
+    REQUIRE(dir);
+    std::vector<DirEntryRef> batch;
+    REQUIRE((*dir)->read_batch(batch));
+    REQUIRE(batch.size() > index + 2);
+    return std::string(batch[index + 2].name);
+}
+
+std::vector<std::byte> read_all(SyntheticFilesystem &fs, const std::string &path)
+{
+    auto file = fs.open(path, O_RDONLY, 0);
+    REQUIRE(file);
+    auto stat_result = (*file)->fstat();
+    REQUIRE(stat_result);
+    std::vector<std::byte> data(stat_result->size);
+    auto read_result = (*file)->pread(data.data(), data.size() + 100, 0);
+    REQUIRE(read_result);
+    CHECK(static_cast<std::size_t>(*read_result) == data.size());
+    return data;
+}
+
+}
+
+TEST_CASE("Synthetic backend options are parsed from a spec", "[synthetic]")
+{
+    auto result = SyntheticOptions::parse(
+                "seed=42,dirs=10,files=100,depth=4,name=24,size=4k-16m,content=zeros");
+    REQUIRE(result);
+    CHECK(result->seed == 42);
+    CHECK(result->directories == 10);
+    CHECK(result->files == 100);
+    CHECK(result->depth == 4);
+    CHECK(result->name_length == 24);
+    CHECK(result->min_file_size == 4096);
+    CHECK(result->max_file_size == 16 << 20);
+    CHECK(result->content == SyntheticContent::ZEROS);
+    CHECK(result->total_directories() == 11111);
+    CHECK(result->total_files() == 1111100);
+
+    result = SyntheticOptions::parse("size=1M");
+    REQUIRE(result);
+    CHECK(result->min_file_size == 1 << 20);
+    CHECK(result->max_file_size == 1 << 20);
+    CHECK(result->files == SyntheticOptions().files);
+
+    CHECK(SyntheticOptions::parse("").error() == 0);
+    CHECK(SyntheticOptions::parse("bogus=1").error() == EINVAL);
+    CHECK(SyntheticOptions::parse("dirs").error() == EINVAL);
+    CHECK(SyntheticOptions::parse("dirs=x").error() == EINVAL);
+    CHECK(SyntheticOptions::parse("size=2k-1k").error() == EINVAL);
+    CHECK(SyntheticOptions::parse("content=ones").error() == EINVAL);
+}
+
+TEST_CASE("Synthetic backend generates the whole tree", "[synthetic]")
+{
+    SyntheticOptions options;
+    options.directories = 3;
+    options.files = 5;
+    options.depth = 2;
+    SyntheticFilesystem fs(options);
+
+    WalkStats stats;
+    walk(fs, "/", stats);
+    CHECK(stats.directories == options.total_directories());
+    CHECK(stats.files == options.total_files());
+}
+
+TEST_CASE("Synthetic backend is deterministic", "[synthetic]")
+{
+    SyntheticOptions options;
+    options.seed = 7;
+    options.min_file_size = 1;
+    options.max_file_size = 100000;
+    SyntheticFilesystem fs1(options);
+    SyntheticFilesystem fs2(options);
+
+    const std::string name = entry_name(fs1, "/", options.directories);
+    CHECK(name == entry_name(fs2, "/", options.directories));
+    CHECK(name.size() == options.name_length);
+    CHECK(name[0] == 'f');
+
+    const std::string path = "/" + name;
+    CHECK(fs1.lstat(path)->size == fs2.lstat(path)->size);
+    CHECK(read_all(fs1, path) == read_all(fs2, path));
+
+    options.seed = 8;
+    SyntheticFilesystem other(options);
+    CHECK(entry_name(other, "/", options.directories) != name);
+    CHECK(other.lstat(path).error() == ENOENT);
+}
+
+TEST_CASE("Synthetic file contents can be read at any offset", "[synthetic]")
+{
+    SyntheticOptions options;
+    options.min_file_size = 10000;
+    options.max_file_size = 10000;
+    SyntheticFilesystem fs(options);
+
+    const std::string path = "/" + entry_name(fs, "/", options.directories);
+    const auto data = read_all(fs, path);
+    REQUIRE(data.size() == 10000);
+    CHECK(data != std::vector<std::byte>(data.size()));
+
+    auto file = fs.open(path, O_RDONLY, 0);
+    REQUIRE(file);
+    for (off_t offset: {0, 1, 7, 8, 13, 4095, 9990}) {
+        std::vector<std::byte> buf(17);
+        auto read_result = (*file)->pread(buf.data(), buf.size(), offset);
+        REQUIRE(read_result);
+        const std::size_t n = std::min<std::size_t>(buf.size(), data.size() - offset);
+        REQUIRE(static_cast<std::size_t>(*read_result) == n);
+        CHECK(std::equal(buf.begin(), buf.begin() + n, data.begin() + offset));
+    }
+
+    std::byte byte;
+    auto read_result = (*file)->pread(&byte, 1, 10000);
+    REQUIRE(read_result);
+    CHECK(*read_result == 0);
+}
+
+TEST_CASE("Synthetic file contents can be zeros", "[synthetic]")
+{
+    SyntheticOptions options;
+    options.min_file_size = 1000;
+    options.max_file_size = 1000;
+    options.content = SyntheticContent::ZEROS;
+    SyntheticFilesystem fs(options);
+
+    const auto data = read_all(fs, "/" + entry_name(fs, "/", options.directories));
+    CHECK(data == std::vector<std::byte>(1000));
+}
+
+TEST_CASE("Synthetic backend resolves paths in a huge tree", "[synthetic]")
+{
+    SyntheticOptions options;
+    options.directories = 100;
+    options.files = 50;
+    options.depth = 3;
+    SyntheticFilesystem fs(options);
+    CHECK(options.total_files() == 50505050);
+
+    std::string path;
+    for (unsigned depth = 0; depth < options.depth; ++depth) {
+        path += "/" + entry_name(fs, path.empty() ? "/" : path, options.directories - 1);
+    }
+    // directories at the maximum depth only contain files
+    const std::string file_name = entry_name(fs, path, options.files - 1);
+    CHECK(file_name.substr(0, 3) == "f49");
+    const std::string file = path + "/" + file_name;
+
+    auto stat_result = fs.lstat(path);
+    REQUIRE(stat_result);
+    CHECK(S_ISDIR(stat_result->mode));
+    stat_result = fs.lstat(file);
+    REQUIRE(stat_result);
+    CHECK(S_ISREG(stat_result->mode));
+}
+
+TEST_CASE("Synthetic backend rejects paths which are not in the tree", "[synthetic]")
+{
+    SyntheticFilesystem fs;
+    const std::string file = "/" + entry_name(fs, "/", fs.options().directories);
+    const std::string dir = "/" + entry_name(fs, "/", 0);
+
+    CHECK(fs.lstat("").error() == EINVAL);
+    CHECK(fs.lstat("foo").error() == EINVAL);
+    CHECK(fs.lstat("/").error() == 0);
+    CHECK(fs.lstat("/foo").error() == ENOENT);
+    CHECK(fs.lstat("/d").error() == ENOENT);
+    CHECK(fs.lstat("/d0").error() == ENOENT);
+    CHECK(fs.lstat(dir + "x").error() == ENOENT);
+    CHECK(fs.lstat("/d" + std::to_string(fs.options().directories) +
+                   dir.substr(3)).error() == ENOENT);
+    CHECK(fs.lstat(file + "/foo").error() == ENOTDIR);
+    CHECK(fs.lstat(dir + "/").error() == 0);
+    CHECK(fs.opendir(file).error() == ENOTDIR);
+    CHECK(fs.open(dir, O_RDONLY, 0).error() == EISDIR);
+    CHECK(fs.readlink(file).error() == EINVAL);
+}
+
+TEST_CASE("Synthetic backend is read-only", "[synthetic]")
+{
+    SyntheticFilesystem fs;
+    const std::string file = "/" + entry_name(fs, "/", fs.options().directories);
+
+    CHECK(fs.open(file, O_WRONLY, 0).error() == EROFS);
+    CHECK(fs.open(file, O_RDONLY | O_TRUNC, 0).error() == EROFS);
+    CHECK(fs.open("/new", O_WRONLY | O_CREAT, 0644).error() == EROFS);
+    CHECK(fs.mkdir("/new", 0755).error() == EROFS);
+    CHECK(fs.unlink(file).error() == EROFS);
+    CHECK(fs.rename(file, "/new").error() == EROFS);
+    CHECK(fs.truncate(file, 0).error() == EROFS);
+}
+
+TEST_CASE("Synthetic backend can be disconnected", "[synthetic]")
+{
+    SyntheticFilesystem fs;
+    fs.set_connected(false);
+    CHECK(fs.lstat("/").error() == ENOTCONN);
+    CHECK(fs.opendir("/").error() == ENOTCONN);
+    CHECK(fs.mkdir("/new", 0755).error() == ENOTCONN);
+    fs.set_connected(true);
+    CHECK(fs.lstat("/").error() == 0);
+}
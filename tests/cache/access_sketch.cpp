@@ -0,0 +1,93 @@
+/**********************************************************************
+File name: access_sketch.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include "dragonstash/cache/access_sketch.hpp"
+
+
+TEST_CASE("Access sketch ages", "[access_sketch]")
+{
+    Dragonstash::AccessSketch sketch(1024);
+
+    CHECK(sketch.size() == 1024);
+    CHECK(sketch.age(42) == Dragonstash::AccessSketch::MAX_AGE);
+
+    sketch.touch(42);
+    CHECK(sketch.age(42) == 0);
+
+    sketch.advance();
+    CHECK(sketch.age(42) == 1);
+
+    sketch.advance();
+    sketch.touch(43);
+    CHECK(sketch.age(42) == 2);
+    CHECK(sketch.age(43) == 0);
+
+    sketch.touch(42);
+    CHECK(sketch.age(42) == 0);
+}
+
+TEST_CASE("Access sketch size is rounded up", "[access_sketch]")
+{
+    Dragonstash::AccessSketch sketch(1000);
+    CHECK(sketch.size() == 1024);
+}
+
+TEST_CASE("Access sketch epochs wrap around", "[access_sketch]")
+{
+    Dragonstash::AccessSketch sketch(16);
+    sketch.touch(1);
+    for (unsigned i = 0; i < Dragonstash::AccessSketch::MAX_AGE; ++i) {
+        sketch.advance();
+        CHECK(sketch.epoch() != Dragonstash::AccessSketch::NEVER);
+    }
+    sketch.touch(2);
+    sketch.advance();
+    CHECK(sketch.age(2) == 1);
+}
+
+TEST_CASE("Access sketch snapshot", "[access_sketch]")
+{
+    Dragonstash::AccessSketch sketch(64);
+    sketch.touch(1);
+    sketch.advance();
+    sketch.touch(2);
+    const auto snapshot = sketch.serialize();
+
+    SECTION("Restoring into a sketch of the same size") {
+        Dragonstash::AccessSketch restored(64);
+        REQUIRE(restored.load(snapshot));
+        CHECK(restored.epoch() == sketch.epoch());
+        CHECK(restored.age(1) == 1);
+        CHECK(restored.age(2) == 0);
+        CHECK(restored.age(3) == Dragonstash::AccessSketch::MAX_AGE);
+    }
+
+    SECTION("Restoring into a sketch of a different size") {
+        Dragonstash::AccessSketch restored(128);
+        CHECK_FALSE(restored.load(snapshot));
+        CHECK(restored.age(2) == Dragonstash::AccessSketch::MAX_AGE);
+    }
+}
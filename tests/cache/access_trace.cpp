@@ -0,0 +1,101 @@
+/**********************************************************************
+File name: access_trace.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include "dragonstash/cache/access_trace.hpp"
+#include "dragonstash/cache/common.hpp"
+
+using Dragonstash::AccessTrace;
+using Dragonstash::CACHE_PAGE_SIZE;
+
+TEST_CASE("Sequential reads make up a single range", "[access_trace]")
+{
+    AccessTrace trace;
+    CHECK(trace.record(0, 1000));
+    CHECK(trace.record(1000, CACHE_PAGE_SIZE * 2));
+    CHECK(trace.record(CACHE_PAGE_SIZE * 3, CACHE_PAGE_SIZE));
+
+    REQUIRE(trace.ranges().size() == 1);
+    CHECK(trace.ranges()[0].start == 0);
+    CHECK(trace.ranges()[0].count == 4);
+    CHECK(trace.blocks() == 4);
+}
+
+TEST_CASE("Ranges keep the order of the first access", "[access_trace]")
+{
+    AccessTrace trace;
+    CHECK(trace.record(CACHE_PAGE_SIZE * 100, CACHE_PAGE_SIZE));
+    CHECK(trace.record(0, CACHE_PAGE_SIZE));
+    CHECK(trace.record(CACHE_PAGE_SIZE * 50, CACHE_PAGE_SIZE));
+    // repeated and overlapping accesses do not add ranges
+    CHECK_FALSE(trace.record(10, 10));
+    CHECK(trace.record(CACHE_PAGE_SIZE * 99, CACHE_PAGE_SIZE * 2));
+
+    REQUIRE(trace.ranges().size() == 3);
+    CHECK(trace.ranges()[0].start == 99);
+    CHECK(trace.ranges()[0].count == 2);
+    CHECK(trace.ranges()[1].start == 0);
+    CHECK(trace.ranges()[2].start == 50);
+}
+
+TEST_CASE("Access traces are bounded", "[access_trace]")
+{
+    AccessTrace trace;
+    for (std::size_t i = 0; i < Dragonstash::ACCESS_TRACE_MAX_RANGES; ++i) {
+        CHECK(trace.record(i * 2 * CACHE_PAGE_SIZE, 1));
+    }
+    CHECK_FALSE(trace.record(CACHE_PAGE_SIZE * 1000, 1));
+    CHECK(trace.ranges().size() == Dragonstash::ACCESS_TRACE_MAX_RANGES);
+    // existing ranges can still grow
+    CHECK(trace.record(CACHE_PAGE_SIZE, 1));
+}
+
+TEST_CASE("Access traces survive serialisation", "[access_trace]")
+{
+    AccessTrace trace;
+    trace.record(CACHE_PAGE_SIZE * 7, CACHE_PAGE_SIZE * 3);
+    trace.record(0, 1);
+    trace.set_recorded_at(1234567890);
+
+    auto parsed = AccessTrace::parse(trace.serialize());
+    REQUIRE(parsed);
+    CHECK(parsed->recorded_at() == 1234567890);
+    REQUIRE(parsed->ranges().size() == 2);
+    CHECK(parsed->ranges()[0].start == 7);
+    CHECK(parsed->ranges()[0].count == 3);
+    CHECK(parsed->ranges()[1].start == 0);
+    CHECK(parsed->ranges()[1].count == 1);
+}
+
+TEST_CASE("Truncated access traces are rejected", "[access_trace]")
+{
+    AccessTrace trace;
+    trace.record(0, CACHE_PAGE_SIZE);
+    const std::string buf = trace.serialize();
+
+    CHECK_FALSE(AccessTrace::parse(std::string_view(buf).substr(0, buf.size() - 1)));
+    CHECK_FALSE(AccessTrace::parse(std::string_view(buf).substr(0, 4)));
+    CHECK_FALSE(AccessTrace::parse(""));
+}
@@ -1084,3 +1084,42 @@ TEST_CASE("fsck shrinks", "[blocklist]")
     CHECK(blist.nentries() <= initial_capacity);
     CHECK(blist.capacity() == initial_capacity);
 }
+
+TEST_CASE("List ranges of present blocks", "[blocklist]")
+{
+    TestBlocklist env;
+    Dragonstash::Blocklist &blist = env.blocklist();
+
+    blist.mark(2, 3, Dragonstash::Blocklist::READ);
+    blist.mark(5, 2, Dragonstash::Blocklist::WRITTEN);
+    blist.mark(10, (1<<17), Dragonstash::Blocklist::WRITTEN);
+
+    SECTION("full list merges split entries") {
+        auto ranges = blist.ranges();
+        REQUIRE(ranges.size() == 3);
+        CHECK(ranges[0].start == 2);
+        CHECK(ranges[0].count == 3);
+        CHECK(ranges[0].state == Dragonstash::Blocklist::READ);
+        CHECK(ranges[1].start == 5);
+        CHECK(ranges[1].count == 2);
+        CHECK(ranges[1].state == Dragonstash::Blocklist::WRITTEN);
+        CHECK(ranges[2].start == 10);
+        CHECK(ranges[2].count == (1<<17));
+        CHECK(ranges[2].state == Dragonstash::Blocklist::WRITTEN);
+    }
+
+    SECTION("ranges are clipped") {
+        auto ranges = blist.ranges(3, 8);
+        REQUIRE(ranges.size() == 3);
+        CHECK(ranges[0].start == 3);
+        CHECK(ranges[0].count == 2);
+        CHECK(ranges[1].start == 5);
+        CHECK(ranges[1].count == 2);
+        CHECK(ranges[2].start == 10);
+        CHECK(ranges[2].count == 1);
+    }
+
+    SECTION("gap yields no ranges") {
+        CHECK(blist.ranges(7, 3).empty());
+    }
+}
@@ -27,6 +27,7 @@ authors named in the AUTHORS file.
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -35,8 +36,12 @@ authors named in the AUTHORS file.
 #include <unistd.h>
 #include <ctime>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "dragonstash/cache/cache.hpp"
+#include "dragonstash/recovery.hpp"
 #include "testutils/tempdir.hpp"
 #include "testutils/result.hpp"
 
@@ -566,8 +571,11 @@ SCENARIO("Cross-process cache")
                 CHECK(*override_result != *emplace_result);
             }
 
-            THEN("The inode is gone after the cache has been restored") {
+            THEN("The inode is gone once the restored cache has reaped its orphans") {
                 Dragonstash::Cache cache(env.path());
+                auto reap_result = cache.reap_orphans(Dragonstash::ORPHAN_REAP_BATCH);
+                require_result_ok(reap_result);
+                CHECK(*reap_result == 1);
                 auto getattr_result = cache.getattr(locked_inode);
                 check_result_error(getattr_result, ENOENT);
             }
@@ -1086,7 +1094,7 @@ SCENARIO("Read-committed isolation level for locks") {
                 if (Dragonstash::Cache::deadlock_detection) {
                     // the behaviour of a normal mutex is undefined when a
                     // thread already owns the mutex
-                    // the debug_mutex supports an additional out-of-band check
+                    // the profiled_mutex supports an additional out-of-band check
                     // for mutex ownership, but only if compiled without NDEBUG
                     // The deadlock_detection flag indicates if the mutex used
                     // by libdragonstash was compiled without NDEBUG.
@@ -1806,3 +1814,954 @@ SCENARIO("Unlinking") {
         }
     }
 }
+
+SCENARIO("Online compaction") {
+    TestSetup setup;
+    Dragonstash::Cache &cache = setup.cache();
+    Dragonstash::InodeAttributes reg_attr{
+        .mode = S_IFREG
+    };
+
+    GIVEN("A cache from which many entries have been removed") {
+        std::vector<ino_t> kept_inos;
+        {
+            auto txn = cache.begin_rw();
+            for (int i = 0; i < 2000; ++i) {
+                auto emplace_result = txn.emplace(Dragonstash::ROOT_INO,
+                                                  "entry" + std::to_string(i),
+                                                  reg_attr);
+                require_result_ok(emplace_result);
+                if (i % 100 == 0) {
+                    kept_inos.emplace_back(*emplace_result);
+                }
+            }
+            check_result_ok(txn.commit());
+        }
+        {
+            auto txn = cache.begin_rw();
+            for (int i = 0; i < 2000; ++i) {
+                if (i % 100 == 0) {
+                    continue;
+                }
+                check_result_ok(txn.unlink(Dragonstash::ROOT_INO,
+                                           "entry" + std::to_string(i)));
+            }
+            check_result_ok(txn.clean_orphans());
+            check_result_ok(txn.commit());
+        }
+        check_result_ok(cache.lock(kept_inos[0]));
+
+        WHEN("Compacting the cache") {
+            auto compact_result = cache.compact();
+
+            THEN("It succeeds and reports a smaller database") {
+                require_result_ok(compact_result);
+                CHECK(compact_result->size_after < compact_result->size_before);
+                CHECK(std::filesystem::file_size(setup.env().path() / "db") ==
+                      compact_result->size_after);
+            }
+
+            THEN("No temporary file is left behind") {
+                require_result_ok(compact_result);
+                CHECK_FALSE(std::filesystem::exists(setup.env().path() / "db.compact"));
+            }
+
+            THEN("The remaining entries can still be looked up") {
+                require_result_ok(compact_result);
+                for (std::size_t i = 0; i < kept_inos.size(); ++i) {
+                    auto lookup_result = cache.lookup(
+                                Dragonstash::ROOT_INO,
+                                "entry" + std::to_string(i * 100));
+                    require_result_ok(lookup_result);
+                    CHECK(*lookup_result == kept_inos[i]);
+                }
+                check_result_error(cache.lookup(Dragonstash::ROOT_INO, "entry1"),
+                                   ENOENT);
+            }
+
+            THEN("In-memory locks are retained") {
+                require_result_ok(compact_result);
+                auto txn = cache.begin_rw();
+                check_result_ok(txn.unlink(kept_inos[0]));
+                check_result_ok(txn.clean_orphans());
+                check_result_ok(txn.commit());
+                check_result_ok(cache.getattr(kept_inos[0]));
+            }
+
+            THEN("New entries can be created") {
+                require_result_ok(compact_result);
+                auto emplace_result = cache.emplace(Dragonstash::ROOT_INO,
+                                                    "new", reg_attr);
+                require_result_ok(emplace_result);
+                CHECK(std::find(kept_inos.begin(), kept_inos.end(),
+                                *emplace_result) == kept_inos.end());
+            }
+        }
+
+        WHEN("Compacting while another thread reads") {
+            std::atomic_bool stop{false};
+            std::atomic_uint64_t failures{0};
+            std::thread reader([&cache, &kept_inos, &stop, &failures](){
+                while (!stop) {
+                    if (!cache.getattr(kept_inos[1])) {
+                        failures += 1;
+                    }
+                }
+            });
+            auto compact_result = cache.compact();
+            stop = true;
+            reader.join();
+
+            THEN("The reader never fails") {
+                require_result_ok(compact_result);
+                CHECK(failures == 0);
+            }
+        }
+    }
+}
+
+SCENARIO("Hashed directory index") {
+    TemporaryDirectory env;
+    Dragonstash::CacheOptions options;
+    options.directory_index = Dragonstash::DirectoryIndex::HASHED;
+    Dragonstash::InodeAttributes reg_attr{
+        .mode = S_IFREG
+    };
+    Dragonstash::InodeAttributes dir_attr{
+        .mode = S_IFDIR
+    };
+
+    GIVEN("A cache created with the hashed index") {
+        auto cache = std::make_unique<Dragonstash::Cache>(env.path(), options);
+
+        THEN("The cache reports the hashed index") {
+            CHECK(cache->directory_index() == Dragonstash::DirectoryIndex::HASHED);
+        }
+
+        WHEN("Emplacing entries in several directories") {
+            auto dir_result = cache->emplace(Dragonstash::ROOT_INO, "dir", dir_attr);
+            require_result_ok(dir_result);
+            auto file_result = cache->emplace(Dragonstash::ROOT_INO, "file", reg_attr);
+            require_result_ok(file_result);
+            auto nested_result = cache->emplace(*dir_result, "file", reg_attr);
+            require_result_ok(nested_result);
+
+            THEN("Each entry is found in its directory") {
+                auto lookup_result = cache->lookup(Dragonstash::ROOT_INO, "file");
+                require_result_ok(lookup_result);
+                CHECK(*lookup_result == *file_result);
+
+                lookup_result = cache->lookup(*dir_result, "file");
+                require_result_ok(lookup_result);
+                CHECK(*lookup_result == *nested_result);
+            }
+
+            THEN("Nonexistent entries are not found") {
+                check_result_error(cache->lookup(Dragonstash::ROOT_INO, "nope"), ENOENT);
+                check_result_error(cache->lookup(*dir_result, "dir"), ENOENT);
+            }
+
+            AND_WHEN("Replacing an entry with one of a different format") {
+                auto replace_result = cache->emplace(Dragonstash::ROOT_INO, "file", dir_attr);
+                require_result_ok(replace_result);
+
+                THEN("The lookup returns the new entry") {
+                    CHECK(*replace_result != *file_result);
+                    auto lookup_result = cache->lookup(Dragonstash::ROOT_INO, "file");
+                    require_result_ok(lookup_result);
+                    CHECK(*lookup_result == *replace_result);
+                }
+            }
+
+            AND_WHEN("Unlinking an entry by name") {
+                {
+                    auto txn = cache->begin_rw();
+                    check_result_ok(txn.unlink(Dragonstash::ROOT_INO, "file"));
+                    check_result_ok(txn.commit());
+                }
+
+                THEN("It can no longer be looked up") {
+                    check_result_error(cache->lookup(Dragonstash::ROOT_INO, "file"), ENOENT);
+                }
+
+                THEN("The entry with the same name in another directory is unaffected") {
+                    auto lookup_result = cache->lookup(*dir_result, "file");
+                    require_result_ok(lookup_result);
+                    CHECK(*lookup_result == *nested_result);
+                }
+            }
+        }
+
+        WHEN("Emplacing an entry with a name longer than the LMDB key size") {
+            const std::string long_name(2048, 'x');
+            auto emplace_result = cache->emplace(Dragonstash::ROOT_INO, long_name, reg_attr);
+
+            THEN("It succeeds and can be looked up") {
+                require_result_ok(emplace_result);
+                auto lookup_result = cache->lookup(Dragonstash::ROOT_INO, long_name);
+                require_result_ok(lookup_result);
+                CHECK(*lookup_result == *emplace_result);
+                auto name_result = cache->name(*emplace_result);
+                require_result_ok(name_result);
+                CHECK(*name_result == long_name);
+            }
+
+            AND_WHEN("The cache is reopened without options") {
+                cache = nullptr;
+                cache = std::make_unique<Dragonstash::Cache>(env.path());
+
+                THEN("It keeps using the hashed index") {
+                    CHECK(cache->directory_index() == Dragonstash::DirectoryIndex::HASHED);
+                    auto lookup_result = cache->lookup(Dragonstash::ROOT_INO, long_name);
+                    require_result_ok(lookup_result);
+                    CHECK(*lookup_result == *emplace_result);
+                }
+            }
+        }
+    }
+
+    GIVEN("A cache created with the default options") {
+        Dragonstash::Cache cache(env.path());
+
+        THEN("It uses the name index and limits names") {
+            CHECK(cache.directory_index() == Dragonstash::DirectoryIndex::NAME);
+            const std::string long_name(cache.max_name_length() + 1, 'x');
+            check_result_error(cache.emplace(Dragonstash::ROOT_INO, long_name, reg_attr),
+                               ENAMETOOLONG);
+        }
+    }
+}
+
+SCENARIO("Usage counters and inode limits") {
+    TemporaryDirectory env;
+    Dragonstash::InodeAttributes reg_attr{
+        .mode = S_IFREG
+    };
+    Dragonstash::InodeAttributes dir_attr{
+        .mode = S_IFDIR
+    };
+
+    GIVEN("A cache without limits") {
+        Dragonstash::Cache cache(env.path());
+
+        THEN("Only the root inode is counted") {
+            auto usage_result = cache.usage();
+            require_result_ok(usage_result);
+            CHECK(usage_result->inodes == 1);
+            CHECK(usage_result->cached_bytes == 0);
+            CHECK(usage_result->pinned_bytes == 0);
+        }
+
+        WHEN("Adding and removing entries") {
+            auto dir_result = cache.emplace(Dragonstash::ROOT_INO, "dir", dir_attr);
+            require_result_ok(dir_result);
+            require_result_ok(cache.emplace(*dir_result, "a", reg_attr));
+            require_result_ok(cache.emplace(*dir_result, "b", reg_attr));
+            require_result_ok(cache.emplace(Dragonstash::ROOT_INO, "c", reg_attr));
+
+            THEN("The counter follows") {
+                auto usage_result = cache.usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->inodes == 5);
+            }
+
+            AND_WHEN("Removing a directory") {
+                {
+                    auto txn = cache.begin_rw();
+                    check_result_ok(txn.unlink(*dir_result));
+                    check_result_ok(txn.commit());
+                }
+
+                THEN("Its children are no longer counted either") {
+                    auto usage_result = cache.usage();
+                    require_result_ok(usage_result);
+                    CHECK(usage_result->inodes == 2);
+                }
+            }
+
+            AND_WHEN("Aborting a transaction which adds entries") {
+                {
+                    auto txn = cache.begin_rw();
+                    require_result_ok(txn.emplace(Dragonstash::ROOT_INO, "d", reg_attr));
+                    txn.abort();
+                }
+
+                THEN("The counter is unchanged") {
+                    auto usage_result = cache.usage();
+                    require_result_ok(usage_result);
+                    CHECK(usage_result->inodes == 5);
+                }
+            }
+        }
+    }
+
+    GIVEN("A cache limited to more inodes than fit into one byte") {
+        Dragonstash::CacheOptions options;
+        options.max_inodes = 300;
+        Dragonstash::Cache cache(env.path(), options);
+
+        WHEN("Adding many more entries than the limit allows") {
+            // the inode keys are sorted bytewise, so the eviction hand must
+            // not assume numeric order when it moves on
+            for (int i = 0; i < 1500; ++i) {
+                require_result_ok(cache.emplace(Dragonstash::ROOT_INO,
+                                                "f" + std::to_string(i),
+                                                reg_attr));
+            }
+
+            THEN("The limit is honoured") {
+                auto usage_result = cache.usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->inodes <= 300);
+            }
+        }
+    }
+
+    GIVEN("A cache limited to two blocks of data") {
+        Dragonstash::CacheOptions options;
+        options.max_bytes = 2 * Dragonstash::CACHE_PAGE_SIZE;
+        Dragonstash::Cache cache(env.path(), options);
+        const std::vector<std::byte> data(Dragonstash::CACHE_PAGE_SIZE, std::byte{0x5a});
+
+        auto cache_data = [&cache, &data](ino_t ino) {
+            auto file = cache.open_file(ino);
+            require_result_ok(file);
+            auto write_result = (*file)->pwrite(0, data.data(), data.size(),
+                                                Dragonstash::Blocklist::READ);
+            require_result_ok(write_result);
+            auto txn = cache.begin_rw();
+            txn.account_file_bytes(ino, (*file)->take_unaccounted_bytes());
+            require_result_ok(txn.commit());
+        };
+
+        std::vector<ino_t> inos;
+        for (int i = 0; i < 4; ++i) {
+            auto emplace_result = cache.emplace(Dragonstash::ROOT_INO, "f" + std::to_string(i), reg_attr);
+            require_result_ok(emplace_result);
+            inos.emplace_back(*emplace_result);
+        }
+
+        WHEN("Caching more data than the limit allows") {
+            for (ino_t ino: inos) {
+                cache_data(ino);
+            }
+
+            THEN("The limit is honoured") {
+                auto usage_result = cache.usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->cached_bytes <= 2 * Dragonstash::CACHE_PAGE_SIZE);
+            }
+
+            THEN("The most recently cached data is kept") {
+                CHECK(Dragonstash::RegularFileHandle::cached_bytes(cache.data_path(), inos.back())
+                      == Dragonstash::CACHE_PAGE_SIZE);
+            }
+
+            THEN("The inodes are kept") {
+                auto usage_result = cache.usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->inodes == 5);
+                for (ino_t ino: inos) {
+                    check_result_ok(cache.getattr(ino));
+                }
+            }
+        }
+
+        WHEN("Adding inodes while the data exceeds the limit") {
+            {
+                auto txn = cache.begin_rw();
+                txn.account_bytes(4 * Dragonstash::CACHE_PAGE_SIZE, 0);
+                require_result_ok(txn.commit());
+            }
+
+            THEN("Creating an inode still succeeds") {
+                check_result_ok(cache.emplace(Dragonstash::ROOT_INO, "g", reg_attr));
+            }
+        }
+    }
+
+    GIVEN("A cache limited to eight inodes") {
+        Dragonstash::CacheOptions options;
+        options.max_inodes = 8;
+        Dragonstash::Cache cache(env.path(), options);
+
+        auto dir_result = cache.emplace(Dragonstash::ROOT_INO, "dir", dir_attr);
+        require_result_ok(dir_result);
+        {
+            auto txn = cache.begin_rw();
+            check_result_ok(txn.update_flags(*dir_result, {Dragonstash::InodeFlag::SYNCED}));
+            check_result_ok(txn.commit());
+        }
+        std::vector<ino_t> inos;
+        for (int i = 0; i < 6; ++i) {
+            auto emplace_result = cache.emplace(*dir_result, "f" + std::to_string(i), reg_attr);
+            require_result_ok(emplace_result);
+            inos.emplace_back(*emplace_result);
+        }
+
+        WHEN("Adding more entries than the limit allows") {
+            std::vector<ino_t> new_inos;
+            for (int i = 0; i < 4; ++i) {
+                auto emplace_result = cache.emplace(Dragonstash::ROOT_INO, "g" + std::to_string(i), reg_attr);
+                require_result_ok(emplace_result);
+                new_inos.emplace_back(*emplace_result);
+            }
+
+            THEN("The limit is honoured") {
+                auto usage_result = cache.usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->inodes <= 8);
+            }
+
+            THEN("The newly added entries are present") {
+                for (ino_t ino: new_inos) {
+                    check_result_ok(cache.getattr(ino));
+                }
+            }
+
+            THEN("The directory which lost entries is no longer marked as synced") {
+                auto txn = cache.begin_ro();
+                auto flag_result = txn.test_flag(*dir_result, Dragonstash::InodeFlag::SYNCED);
+                require_result_ok(flag_result);
+                CHECK_FALSE(*flag_result);
+            }
+        }
+
+        WHEN("All candidates are locked or pinned") {
+            for (std::size_t i = 0; i < inos.size(); ++i) {
+                check_result_ok(cache.lock(inos[i]));
+            }
+            {
+                auto txn = cache.begin_rw();
+                check_result_ok(txn.update_flags(*dir_result, {Dragonstash::InodeFlag::PINNED}));
+                check_result_ok(txn.commit());
+            }
+            check_result_ok(cache.release(inos[0]));
+
+            THEN("Adding another entry fails with ENOSPC") {
+                check_result_error(cache.emplace(Dragonstash::ROOT_INO, "h", reg_attr),
+                                   ENOSPC);
+            }
+
+            THEN("Entries below the pinned directory are retained") {
+                check_result_ok(cache.getattr(inos[0]));
+            }
+        }
+    }
+
+    GIVEN("A full cache with a batch of older orphans which are still locked") {
+        Dragonstash::CacheOptions options;
+        options.max_inodes = Dragonstash::ORPHAN_REAP_BATCH + 4;
+        Dragonstash::Cache cache(env.path(), options);
+
+        std::vector<ino_t> orphans;
+        for (std::size_t i = 0; i < Dragonstash::ORPHAN_REAP_BATCH; ++i) {
+            auto emplace_result = cache.emplace(Dragonstash::ROOT_INO, "o" + std::to_string(i), reg_attr);
+            require_result_ok(emplace_result);
+            check_result_ok(cache.lock(*emplace_result));
+            orphans.emplace_back(*emplace_result);
+        }
+        {
+            auto txn = cache.begin_rw();
+            for (ino_t ino: orphans) {
+                check_result_ok(txn.unlink(ino));
+            }
+            check_result_ok(txn.commit());
+        }
+        std::vector<ino_t> inos;
+        for (int i = 0; i < 3; ++i) {
+            auto emplace_result = cache.emplace(Dragonstash::ROOT_INO, "f" + std::to_string(i), reg_attr);
+            require_result_ok(emplace_result);
+            inos.emplace_back(*emplace_result);
+        }
+
+        WHEN("Adding another entry") {
+            auto emplace_result = cache.emplace(Dragonstash::ROOT_INO, "g", reg_attr);
+
+            THEN("The evicted inode is reaped and the limit is honoured") {
+                require_result_ok(emplace_result);
+                auto usage_result = cache.usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->inodes <= options.max_inodes);
+                std::size_t evicted = 0;
+                for (ino_t ino: inos) {
+                    evicted += !cache.getattr(ino);
+                }
+                CHECK(evicted == 1);
+            }
+
+            THEN("The locked orphans are kept") {
+                require_result_ok(emplace_result);
+                for (ino_t ino: orphans) {
+                    check_result_ok(cache.getattr(ino));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Access-driven eviction") {
+    TemporaryDirectory env;
+    Dragonstash::InodeAttributes reg_attr{
+        .mode = S_IFREG
+    };
+
+    GIVEN("A cache limited to five inodes with recently accessed entries") {
+        Dragonstash::CacheOptions options;
+        options.max_inodes = 5;
+        options.access_sketch_buckets = 4096;
+        auto cache = std::make_unique<Dragonstash::Cache>(env.path(), options);
+
+        std::vector<ino_t> inos;
+        for (int i = 0; i < 4; ++i) {
+            auto emplace_result = cache->emplace(Dragonstash::ROOT_INO, "f" + std::to_string(i), reg_attr);
+            require_result_ok(emplace_result);
+            inos.emplace_back(*emplace_result);
+        }
+        cache->access_sketch().touch(inos[0]);
+        cache->access_sketch().touch(inos[2]);
+
+        WHEN("Adding entries beyond the limit") {
+            auto first_result = cache->emplace(Dragonstash::ROOT_INO, "g0", reg_attr);
+            require_result_ok(first_result);
+            auto second_result = cache->emplace(Dragonstash::ROOT_INO, "g1", reg_attr);
+            require_result_ok(second_result);
+
+            THEN("The entries which have not been accessed are evicted first") {
+                check_result_ok(cache->getattr(inos[0]));
+                check_result_ok(cache->getattr(inos[2]));
+                check_result_error(cache->getattr(inos[1]), ENOENT);
+                check_result_error(cache->getattr(inos[3]), ENOENT);
+            }
+        }
+
+        WHEN("The cache is reopened") {
+            cache = nullptr;
+            cache = std::make_unique<Dragonstash::Cache>(env.path(), options);
+
+            THEN("The access information has been persisted") {
+                CHECK(cache->access_sketch().age(inos[0]) == 0);
+                CHECK(cache->access_sketch().age(inos[1]) == Dragonstash::AccessSketch::MAX_AGE);
+            }
+        }
+    }
+}
+
+SCENARIO("Chunk sizes") {
+    TemporaryDirectory env;
+    Dragonstash::Cache cache(env.path());
+
+    auto chunk_size = [&cache](ino_t ino) {
+        auto txn = cache.begin_ro();
+        auto chunk_result = txn.chunk_size(ino);
+        require_result_ok(chunk_result);
+        return *chunk_result;
+    };
+
+    Dragonstash::InodeAttributes attr{
+        .mode = S_IFREG
+    };
+
+    GIVEN("Files of different sizes") {
+        auto small_result = cache.emplace(Dragonstash::ROOT_INO, "small", attr);
+        require_result_ok(small_result);
+        attr.common.size = std::uint64_t(1) << 30;
+        auto large_result = cache.emplace(Dragonstash::ROOT_INO, "large", attr);
+        require_result_ok(large_result);
+        attr.common.size = std::uint64_t(1) << 40;
+        auto huge_result = cache.emplace(Dragonstash::ROOT_INO, "huge", attr);
+        require_result_ok(huge_result);
+
+        THEN("Small files are fetched block by block") {
+            CHECK(chunk_size(*small_result) == Dragonstash::CACHE_PAGE_SIZE);
+        }
+
+        THEN("Large files are fetched in large chunks") {
+            CHECK(chunk_size(*large_result) == (1 << 30) / Dragonstash::CHUNKS_PER_FILE);
+        }
+
+        THEN("The chunk size is bounded") {
+            CHECK(chunk_size(*huge_result) == Dragonstash::CacheOptions().max_chunk_size);
+        }
+
+        WHEN("A small file grows") {
+            auto txn = cache.begin_rw();
+            auto attr_result = txn.getattr(*small_result);
+            require_result_ok(attr_result);
+            auto common = attr_result->attr.common;
+            common.size = std::uint64_t(1) << 30;
+            require_result_ok(txn.setattr(*small_result, common));
+            require_result_ok(txn.commit());
+
+            THEN("Its chunk size grows as well") {
+                CHECK(chunk_size(*small_result) == (1 << 30) / Dragonstash::CHUNKS_PER_FILE);
+            }
+        }
+
+        WHEN("A large file is replaced by a small one") {
+            attr.common.size = 1;
+            auto emplace_result = cache.emplace(Dragonstash::ROOT_INO, "large", attr);
+            require_result_ok(emplace_result);
+
+            THEN("It keeps its chunk size") {
+                CHECK(*emplace_result == *large_result);
+                CHECK(chunk_size(*large_result) == (1 << 30) / Dragonstash::CHUNKS_PER_FILE);
+            }
+        }
+    }
+}
+
+SCENARIO("Deferred recovery") {
+    GIVEN("A cache which has not been shut down cleanly") {
+        TemporaryDirectory env;
+        // as long as this one is open, the cache counts as in use; opening
+        // it again looks like the first user has crashed
+        Dragonstash::Cache crashed(env.path());
+
+        Dragonstash::InodeAttributes attr{
+            .mode = S_IFREG
+        };
+        attr.common.size = Dragonstash::CACHE_PAGE_SIZE;
+        const std::vector<std::byte> data(Dragonstash::CACHE_PAGE_SIZE, std::byte{0x5a});
+
+        auto cache_data = [&crashed, &data](ino_t ino) {
+            auto file = crashed.open_file(ino);
+            require_result_ok(file);
+            auto write_result = (*file)->pwrite(0, data.data(), data.size(),
+                                                Dragonstash::Blocklist::READ);
+            require_result_ok(write_result);
+        };
+
+        auto good_result = crashed.emplace(Dragonstash::ROOT_INO, "good", attr);
+        require_result_ok(good_result);
+        cache_data(*good_result);
+        auto bad_result = crashed.emplace(Dragonstash::ROOT_INO, "bad", attr);
+        require_result_ok(bad_result);
+        cache_data(*bad_result);
+
+        // an orphan which cannot be reaped while the first user holds it
+        auto orphan_result = crashed.emplace(Dragonstash::ROOT_INO, "orphan", attr);
+        require_result_ok(orphan_result);
+        require_result_ok(crashed.lock(*orphan_result));
+        {
+            auto txn = crashed.begin_rw();
+            require_result_ok(txn.unlink(Dragonstash::ROOT_INO, "orphan"));
+            require_result_ok(txn.commit());
+        }
+
+        // break the blocklist of one file
+        {
+            const auto path = Dragonstash::RegularFileHandle::blocklist_path(
+                        crashed.data_path(), *bad_result);
+            const int fd = ::open(path.c_str(), O_WRONLY);
+            REQUIRE(fd >= 0);
+            const std::uint64_t garbage = 0;
+            REQUIRE(::pwrite(fd, &garbage, sizeof(garbage), 0) == sizeof(garbage));
+            ::close(fd);
+        }
+
+        WHEN("The cache is opened again") {
+            Dragonstash::Cache cache(env.path());
+
+            THEN("It is usable before recovery has completed") {
+                CHECK(cache.recovery_pending());
+                check_result_ok(cache.getattr(*good_result));
+            }
+
+            THEN("Files are checked when they are opened") {
+                std::vector<std::byte> buf(data.size());
+
+                auto good_file = cache.open_file(*good_result);
+                require_result_ok(good_file);
+                auto read_result = (*good_file)->pread(0, buf.data(), buf.size());
+                require_result_ok(read_result);
+                CHECK(*read_result == data.size());
+
+                auto bad_file = cache.open_file(*bad_result);
+                require_result_ok(bad_file);
+                read_result = (*bad_file)->pread(0, buf.data(), buf.size());
+                require_result_ok(read_result);
+                CHECK(*read_result == 0);
+            }
+
+            THEN("The sweep reaps the orphans and checks all files") {
+                Dragonstash::RecoveryOptions options;
+                options.enabled = false;
+                Dragonstash::Recovery recovery(cache, options);
+                recovery.sweep();
+
+                const auto stats = recovery.stats();
+                CHECK(stats.swept);
+                CHECK(stats.reaped_orphans == 1);
+                CHECK(stats.checked_files == 2);
+                CHECK(stats.discarded_files == 1);
+                CHECK_FALSE(cache.recovery_pending());
+                check_result_error(cache.getattr(*orphan_result), ENOENT);
+                CHECK_FALSE(std::filesystem::exists(
+                                Dragonstash::RegularFileHandle::data_path(
+                                    cache.data_path(), *bad_result)));
+            }
+        }
+
+        WHEN("The background thread runs with a short persistence interval") {
+            Dragonstash::Cache cache(env.path());
+            Dragonstash::RecoveryOptions options;
+            options.access_sketch_interval = std::chrono::milliseconds(10);
+            Dragonstash::Recovery recovery(cache, options);
+
+            THEN("The access sketch is persisted periodically") {
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                while (recovery.stats().access_sketch_persists < 2 &&
+                       std::chrono::steady_clock::now() < deadline) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                }
+                CHECK(recovery.stats().access_sketch_persists >= 2);
+            }
+        }
+
+        WHEN("The cache is opened again after a clean shutdown") {
+            {
+                Dragonstash::Cache cache(env.path());
+                cache.finish_recovery();
+            }
+            Dragonstash::Cache cache(env.path());
+
+            THEN("No recovery is pending") {
+                CHECK_FALSE(cache.recovery_pending());
+            }
+        }
+    }
+}
+
+SCENARIO("Offline consistency check") {
+    GIVEN("A cache with directories, files and a symlink") {
+        TemporaryDirectory env;
+        Dragonstash::Cache cache(env.path());
+
+        Dragonstash::InodeAttributes dir_attr{
+            .mode = S_IFDIR
+        };
+        Dragonstash::InodeAttributes file_attr{
+            .mode = S_IFREG
+        };
+        file_attr.common.size = Dragonstash::CACHE_PAGE_SIZE;
+        Dragonstash::InodeAttributes link_attr{
+            .mode = S_IFLNK
+        };
+        const std::vector<std::byte> data(Dragonstash::CACHE_PAGE_SIZE, std::byte{0x5a});
+
+        auto cache_data = [&cache, &data](ino_t ino) {
+            auto file = cache.open_file(ino);
+            require_result_ok(file);
+            auto write_result = (*file)->pwrite(0, data.data(), data.size(),
+                                                Dragonstash::Blocklist::READ);
+            require_result_ok(write_result);
+            auto txn = cache.begin_rw();
+            txn.account_bytes((*file)->take_unaccounted_bytes(), 0);
+            require_result_ok(txn.commit());
+        };
+
+        auto dir_result = cache.emplace(Dragonstash::ROOT_INO, "dir", dir_attr);
+        require_result_ok(dir_result);
+        auto nested_result = cache.emplace(*dir_result, "nested", file_attr);
+        require_result_ok(nested_result);
+        cache_data(*nested_result);
+        auto file_result = cache.emplace(Dragonstash::ROOT_INO, "file", file_attr);
+        require_result_ok(file_result);
+        cache_data(*file_result);
+        auto link_result = cache.emplace(Dragonstash::ROOT_INO, "link", link_attr);
+        require_result_ok(link_result);
+        require_result_ok(cache.writelink(*link_result, "file"));
+
+        Dragonstash::FsckOptions options;
+        options.threads = 4;
+
+        WHEN("The cache is checked") {
+            auto report = cache.fsck(options);
+            require_result_ok(report);
+
+            THEN("Everything has been looked at") {
+                CHECK(report->inodes == 5);
+                CHECK(report->entries == 4);
+                CHECK(report->files == 2);
+            }
+
+            THEN("No problems are found") {
+                CHECK(report->problems() == 0);
+                CHECK_FALSE(report->repaired);
+            }
+        }
+
+        WHEN("The cache is damaged") {
+            // drop the directory entry of the directory behind the cache's
+            // back, leaving it and its child unreachable
+            {
+                auto db_env = getMDBEnv((env.path() / "db").c_str(), MDB_NOSUBDIR, 0600);
+                auto txn = db_env->getRWTransaction();
+                auto treei = txn->openDB("treei", 0);
+                const std::array<std::uint64_t, 2> key{{Dragonstash::ROOT_INO, *dir_result}};
+                REQUIRE(txn->del(treei, std::string_view(reinterpret_cast<const char*>(key.data()),
+                                                         sizeof(key))) == 0);
+                txn->commit();
+            }
+
+            // break the blocklist of a file
+            const auto bad_path = Dragonstash::RegularFileHandle::blocklist_path(
+                        cache.data_path(), *file_result);
+            {
+                const int fd = ::open(bad_path.c_str(), O_WRONLY);
+                REQUIRE(fd >= 0);
+                const std::uint64_t garbage = 0;
+                REQUIRE(::pwrite(fd, &garbage, sizeof(garbage), 0) == sizeof(garbage));
+                ::close(fd);
+            }
+
+            // data of an inode which does not exist
+            const ino_t stray_ino = *link_result + 100;
+            const auto stray_path = Dragonstash::RegularFileHandle::data_path(
+                        cache.data_path(), stray_ino);
+            {
+                const int fd = ::open(stray_path.c_str(), O_WRONLY | O_CREAT, 0600);
+                REQUIRE(fd >= 0);
+                ::close(fd);
+            }
+
+            AND_WHEN("The cache is checked") {
+                auto report = cache.fsck(options);
+                require_result_ok(report);
+
+                THEN("The problems are found") {
+                    CHECK(report->detached_inodes == 1);
+                    CHECK(report->stale_index_entries == 1);
+                    CHECK(report->corrupt_files == 1);
+                    CHECK(report->stray_files == 1);
+                    CHECK(report->dangling_entries == 0);
+                    CHECK(report->lost_orphans == 0);
+                    CHECK(report->problems() == 4);
+                    CHECK_FALSE(report->repaired);
+                }
+
+                THEN("Nothing has been changed") {
+                    CHECK(std::filesystem::exists(bad_path));
+                    CHECK(std::filesystem::exists(stray_path));
+                    check_result_ok(cache.getattr(*dir_result));
+
+                    auto again = cache.fsck(options);
+                    require_result_ok(again);
+                    CHECK(again->problems() == report->problems());
+                }
+            }
+
+            AND_WHEN("The cache is repaired") {
+                options.repair = true;
+                auto report = cache.fsck(options);
+                require_result_ok(report);
+
+                THEN("The problems have been repaired") {
+                    CHECK(report->problems() == 4);
+                    CHECK(report->repaired);
+
+                    options.repair = false;
+                    auto again = cache.fsck(options);
+                    require_result_ok(again);
+                    CHECK(again->problems() == 0);
+                    CHECK(again->inodes == 3);
+                    CHECK(again->files == 0);
+                }
+
+                THEN("Unreachable inodes and broken data are gone") {
+                    check_result_error(cache.lookup(Dragonstash::ROOT_INO, "dir"), ENOENT);
+                    check_result_error(cache.getattr(*dir_result), ENOENT);
+                    check_result_error(cache.getattr(*nested_result), ENOENT);
+                    check_result_ok(cache.getattr(*file_result));
+                    CHECK_FALSE(std::filesystem::exists(bad_path));
+                    CHECK_FALSE(std::filesystem::exists(stray_path));
+
+                    auto usage = cache.usage();
+                    require_result_ok(usage);
+                    CHECK(usage->inodes == 3);
+                    CHECK(usage->cached_bytes == 0);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Consistency check of many inodes") {
+    GIVEN("A cache with a few thousand inodes") {
+        TemporaryDirectory env;
+        Dragonstash::Cache cache(env.path());
+        Dragonstash::InodeAttributes file_attr{
+            .mode = S_IFREG
+        };
+        constexpr unsigned nfiles = 3000;
+        {
+            auto txn = cache.begin_rw();
+            for (unsigned i = 0; i < nfiles; ++i) {
+                require_result_ok(txn.emplace(Dragonstash::ROOT_INO,
+                                              "file" + std::to_string(i),
+                                              file_attr));
+            }
+            require_result_ok(txn.commit());
+        }
+
+        WHEN("The cache is checked in parallel") {
+            Dragonstash::FsckOptions options;
+            options.threads = 4;
+            auto report = cache.fsck(options);
+            require_result_ok(report);
+
+            THEN("Every inode has been looked at") {
+                CHECK(report->inodes == nfiles + 1);
+                CHECK(report->entries == nfiles);
+            }
+
+            THEN("No problems are found") {
+                CHECK(report->wrong_counters == 0);
+                CHECK(report->problems() == 0);
+            }
+        }
+    }
+}
+
+SCENARIO("Read-only consistency check") {
+    GIVEN("A cache which has been shut down") {
+        TemporaryDirectory env;
+        {
+            Dragonstash::Cache cache(env.path());
+            Dragonstash::InodeAttributes file_attr{
+                .mode = S_IFREG
+            };
+            require_result_ok(cache.emplace(Dragonstash::ROOT_INO, "file", file_attr));
+        }
+
+        auto read_db = [&env]() {
+            std::ifstream in(env.path() / "db", std::ios::binary);
+            return std::string(std::istreambuf_iterator<char>(in),
+                               std::istreambuf_iterator<char>());
+        };
+        const std::string before = read_db();
+
+        WHEN("It is opened read-only and checked") {
+            {
+                Dragonstash::Cache cache(env.path(), Dragonstash::CacheOptions{
+                                             .read_only = true,
+                                         });
+                auto report = cache.fsck();
+                require_result_ok(report);
+                CHECK(report->inodes == 2);
+                CHECK(report->problems() == 0);
+
+                Dragonstash::FsckOptions options;
+                options.repair = true;
+                auto repair_result = cache.fsck(options);
+                REQUIRE(!repair_result);
+                CHECK(repair_result.error() == EROFS);
+            }
+
+            THEN("The database is unchanged") {
+                CHECK(read_db() == before);
+            }
+        }
+    }
+}
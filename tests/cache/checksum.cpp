@@ -0,0 +1,57 @@
+/**********************************************************************
+File name: checksum.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "dragonstash/cache/checksum.hpp"
+
+TEST_CASE("crc32c matches the reference check value") {
+    const std::string_view check = "123456789";
+    CHECK(Dragonstash::crc32c(0, check.data(), check.size()) == 0xe3069283U);
+    CHECK(Dragonstash::crc32c_portable(0, check.data(), check.size()) == 0xe3069283U);
+    CHECK(Dragonstash::crc32c(0, nullptr, 0) == 0);
+}
+
+TEST_CASE("crc32c implementations agree for all alignments and lengths") {
+    std::mt19937 rng(1);
+    std::vector<unsigned char> buf(3 * 4096 + 64);
+    for (auto &b: buf) {
+        b = static_cast<unsigned char>(rng());
+    }
+
+    for (std::size_t off = 0; off < 9; ++off) {
+        for (std::size_t n: {1, 7, 8, 9, 4080, 4095, 4096, 4097, 8160, 3 * 4096}) {
+            CAPTURE(off, n);
+            const auto expected = Dragonstash::crc32c_portable(0, buf.data() + off, n);
+            CHECK(Dragonstash::crc32c(0, buf.data() + off, n) == expected);
+            CHECK(Dragonstash::crc32c(Dragonstash::crc32c(0, buf.data() + off, n / 3),
+                                      buf.data() + off + n / 3,
+                                      n - n / 3) == expected);
+        }
+    }
+}
@@ -0,0 +1,269 @@
+/**********************************************************************
+File name: compression.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dragonstash/cache/compression.hpp"
+#include "dragonstash/cache/regular_file.hpp"
+#include "testutils/tempdir.hpp"
+#include "testutils/result.hpp"
+
+using Dragonstash::Compression;
+using Dragonstash::COMPRESSION_EXTENT_SIZE;
+
+static std::string text(std::size_t n)
+{
+    std::string result;
+    while (result.size() < n) {
+        result += "{\"path\": \"/srv/log/" + std::to_string(result.size() % 97)
+                + "\", \"offset\": " + std::to_string(result.size()) + "}\n";
+    }
+    result.resize(n);
+    return result;
+}
+
+static std::string noise(std::size_t n)
+{
+    std::mt19937 rng(1);
+    std::string result(n, '\0');
+    for (auto &ch: result) {
+        ch = static_cast<char>(rng());
+    }
+    return result;
+}
+
+static const std::byte *bytes(const std::string &s)
+{
+    return reinterpret_cast<const std::byte*>(s.data());
+}
+
+/**
+ * @brief The algorithms supported by this build.
+ */
+static std::vector<Compression> available_algorithms()
+{
+    std::vector<Compression> result;
+    for (auto algorithm: {Compression::LZ4, Compression::ZSTD}) {
+        if (Dragonstash::compression_available(algorithm)) {
+            result.push_back(algorithm);
+        }
+    }
+    return result;
+}
+
+TEST_CASE("sample_entropy tells text from noise", "[compression]")
+{
+    const std::string zeroes(COMPRESSION_EXTENT_SIZE, '\0');
+    CHECK(Dragonstash::sample_entropy(bytes(zeroes), zeroes.size()) == 0.0);
+
+    const auto data = text(COMPRESSION_EXTENT_SIZE);
+    CHECK(Dragonstash::sample_entropy(bytes(data), data.size()) < Dragonstash::COMPRESSION_ENTROPY_LIMIT);
+
+    const auto random = noise(COMPRESSION_EXTENT_SIZE);
+    CHECK(Dragonstash::sample_entropy(bytes(random), random.size()) > Dragonstash::COMPRESSION_ENTROPY_LIMIT);
+}
+
+TEST_CASE("Unsupported algorithms are rejected", "[compression]")
+{
+    const auto data = text(100);
+    std::vector<std::byte> buffer(100);
+    for (auto algorithm: {Compression::NONE, Compression::LZ4, Compression::ZSTD}) {
+        if (algorithm != Compression::NONE && Dragonstash::compression_available(algorithm)) {
+            continue;
+        }
+        auto result = Dragonstash::compress(algorithm, bytes(data), data.size(),
+                                            buffer.data(), buffer.size());
+        CHECK(!result);
+        CHECK(result.error() == EOPNOTSUPP);
+    }
+}
+
+TEST_CASE("Compressed data round-trips", "[compression]")
+{
+    for (auto algorithm: available_algorithms()) {
+        CAPTURE(static_cast<int>(algorithm));
+        const auto data = text(COMPRESSION_EXTENT_SIZE);
+        std::vector<std::byte> compressed(COMPRESSION_EXTENT_SIZE);
+        auto compress_result = Dragonstash::compress(algorithm, bytes(data), data.size(),
+                                                     compressed.data(), compressed.size());
+        require_result_ok(compress_result);
+        CHECK(*compress_result > 0);
+        CHECK(*compress_result < data.size() / 2);
+
+        std::string decompressed(COMPRESSION_EXTENT_SIZE, '\0');
+        auto decompress_result = Dragonstash::decompress(
+                    algorithm, compressed.data(), *compress_result,
+                    reinterpret_cast<std::byte*>(decompressed.data()),
+                    decompressed.size());
+        require_result_ok(decompress_result);
+        CHECK(*decompress_result == data.size());
+        CHECK(decompressed == data);
+
+        const auto random = noise(COMPRESSION_EXTENT_SIZE);
+        compress_result = Dragonstash::compress(algorithm, bytes(random), random.size(),
+                                                compressed.data(),
+                                                COMPRESSION_EXTENT_SIZE - Dragonstash::CACHE_PAGE_SIZE);
+        require_result_ok(compress_result);
+        CHECK(*compress_result == 0);
+    }
+}
+
+SCENARIO("Compressed extents of cached files")
+{
+    const auto algorithms = available_algorithms();
+    if (algorithms.empty()) {
+        return;
+    }
+    const Compression algorithm = algorithms.front();
+    TemporaryDirectory dir;
+    Dragonstash::CompressionCounters counters;
+    // three complete extents and a short tail
+    auto data = text(3 * COMPRESSION_EXTENT_SIZE + 5000);
+    Dragonstash::RegularFileHandle file(dir.path(), 2, &counters);
+    require_result_ok(file.fill(0, data.data(), data.size()));
+
+    auto read_all = [&file, &data]() {
+        std::string result(data.size(), '\0');
+        auto read_result = file.pread(0, result.data(), result.size());
+        require_result_ok(read_result);
+        CHECK(*read_result == data.size());
+        return result;
+    };
+
+    GIVEN("A compressed file") {
+        require_result_ok(file.compress(0, data.size(), algorithm));
+
+        THEN("All extents are compressed") {
+            CHECK(file.compressed_extents() == 4);
+            const auto stats = counters.load();
+            CHECK(stats.probed_bytes == data.size());
+            CHECK(stats.compressed_bytes == data.size());
+            CHECK(stats.ratio() > 2.0);
+        }
+
+        THEN("The data reads back unchanged") {
+            CHECK(read_all() == data);
+            CHECK(counters.load().decompressed_bytes == data.size());
+        }
+
+        THEN("The blocks are still present and accounted for") {
+            const std::uint64_t blocks = (data.size() + Dragonstash::CACHE_PAGE_SIZE - 1)
+                    / Dragonstash::CACHE_PAGE_SIZE;
+            CHECK(file.blocks(Dragonstash::Blocklist::READ) == blocks);
+            CHECK(file.take_unaccounted_bytes()
+                  == static_cast<std::int64_t>(blocks * Dragonstash::CACHE_PAGE_SIZE));
+        }
+
+        THEN("The checksums match") {
+            auto verify_result = file.verify(0, data.size());
+            require_result_ok(verify_result);
+            CHECK(*verify_result == 0);
+        }
+
+        WHEN("Writing into an extent") {
+            const off_t off = COMPRESSION_EXTENT_SIZE + 100;
+            auto write_result = file.pwrite(off, "Howdy", 5);
+            require_result_ok(write_result);
+            data.replace(off, 5, "Howdy");
+
+            THEN("The extent is stored uncompressed") {
+                CHECK(file.compressed_extents() == 3);
+                CHECK(read_all() == data);
+            }
+
+            THEN("It is not compressed again while it holds written data") {
+                require_result_ok(file.compress(0, data.size(), algorithm));
+                CHECK(file.compressed_extents() == 3);
+            }
+        }
+
+        WHEN("Preparing a write through the file descriptor") {
+            const off_t off = COMPRESSION_EXTENT_SIZE + 100;
+            require_result_ok(file.inflate(off, 5));
+
+            THEN("The extent is not compressed again before the write is done") {
+                CHECK(file.compressed_extents() == 3);
+                require_result_ok(file.compress(0, data.size(), algorithm));
+                CHECK(file.compressed_extents() == 3);
+            }
+
+            AND_WHEN("The write is abandoned") {
+                file.release_write(off);
+
+                THEN("The extent can be compressed again") {
+                    require_result_ok(file.compress(0, data.size(), algorithm));
+                    CHECK(file.compressed_extents() == 4);
+                    CHECK(read_all() == data);
+                }
+            }
+        }
+
+        WHEN("Truncating the file in the middle of an extent") {
+            const std::uint64_t size = 2 * COMPRESSION_EXTENT_SIZE + 100;
+            require_result_ok(file.truncate(size));
+            data.resize(size);
+
+            THEN("Only the extents before the cut stay compressed") {
+                CHECK(file.compressed_extents() == 2);
+                CHECK(read_all() == data);
+            }
+        }
+
+        WHEN("Discarding an extent") {
+            require_result_ok(file.discard(0, COMPRESSION_EXTENT_SIZE));
+
+            THEN("It is forgotten") {
+                CHECK(file.compressed_extents() == 3);
+                CHECK(file.missing(0, data.size()).size() == 1);
+            }
+        }
+
+        WHEN("The file is opened again") {
+            Dragonstash::RegularFileHandle other(dir.path(), 2);
+
+            THEN("The compressed extents are known") {
+                CHECK(other.compressed_extents() == 4);
+            }
+        }
+    }
+
+    GIVEN("Incompressible data") {
+        const auto random = noise(2 * COMPRESSION_EXTENT_SIZE);
+        Dragonstash::RegularFileHandle other(dir.path(), 3, &counters);
+        require_result_ok(other.fill(0, random.data(), random.size()));
+
+        WHEN("Compressing it") {
+            require_result_ok(other.compress(0, random.size(), algorithm));
+
+            THEN("It is skipped based on its entropy") {
+                CHECK(other.compressed_extents() == 0);
+                CHECK(counters.load().skipped_bytes == random.size());
+            }
+        }
+    }
+}
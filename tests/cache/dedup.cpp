@@ -0,0 +1,170 @@
+/**********************************************************************
+File name: dedup.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "dragonstash/cache/cache.hpp"
+#include "dragonstash/cache/dedup.hpp"
+#include "testutils/tempdir.hpp"
+#include "testutils/result.hpp"
+
+using Dragonstash::CACHE_PAGE_SIZE;
+
+static std::uint64_t hash_of(std::string_view s)
+{
+    return Dragonstash::chunk_hash(reinterpret_cast<const std::byte*>(s.data()),
+                                   s.size());
+}
+
+static std::vector<std::byte> pattern(std::size_t n, unsigned seed)
+{
+    std::vector<std::byte> result(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        result[i] = static_cast<std::byte>((i * 31 + seed) % 251);
+    }
+    return result;
+}
+
+TEST_CASE("chunk_hash is XXH64", "[dedup]")
+{
+    CHECK(hash_of("") == 0xef46db3751d8e999ULL);
+    CHECK(hash_of("a") == 0xd24ec4f1a98c6e5bULL);
+    CHECK(hash_of("abc") == 0x44bc2cf5ad770999ULL);
+    CHECK(hash_of("Nobody inspects the spammish repetition") == 0xfbcea83c8a378bf1ULL);
+}
+
+TEST_CASE("chunk_hash distinguishes blocks", "[dedup]")
+{
+    const auto a = pattern(CACHE_PAGE_SIZE, 1);
+    auto b = a;
+    b[CACHE_PAGE_SIZE - 1] ^= std::byte(1);
+    CHECK(Dragonstash::chunk_hash(a.data(), a.size()) ==
+          Dragonstash::chunk_hash(a.data(), a.size()));
+    CHECK(Dragonstash::chunk_hash(a.data(), a.size()) !=
+          Dragonstash::chunk_hash(b.data(), b.size()));
+}
+
+TEST_CASE("Storage of unshared files is measured", "[dedup]")
+{
+    TemporaryDirectory dir;
+    const auto data = pattern(4 * CACHE_PAGE_SIZE, 2);
+    for (const char *name: {"1", "2"}) {
+        const int fd = ::open((dir.path() / name).c_str(),
+                              O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+        REQUIRE(fd >= 0);
+        REQUIRE(::pwrite(fd, data.data(), data.size(), 0) == ssize_t(data.size()));
+        REQUIRE(::fsync(fd) == 0);
+        ::close(fd);
+    }
+
+    auto usage_result = Dragonstash::measure_storage(dir.path());
+    require_result_ok(usage_result);
+    CHECK(usage_result->logical_bytes >= 2 * data.size());
+    CHECK(usage_result->physical_bytes == usage_result->logical_bytes);
+    CHECK(usage_result->dedup_ratio() == 1.0);
+}
+
+SCENARIO("Deduplication of fetched blocks")
+{
+    TemporaryDirectory dir;
+    Dragonstash::CacheOptions options;
+    options.deduplicate = true;
+    Dragonstash::Cache cache(dir.path(), options);
+
+    Dragonstash::InodeAttributes attr{
+        .mode = S_IFREG,
+    };
+    auto first_result = cache.emplace(Dragonstash::ROOT_INO, "first", attr);
+    require_result_ok(first_result);
+    auto second_result = cache.emplace(Dragonstash::ROOT_INO, "second", attr);
+    require_result_ok(second_result);
+
+    auto first_file = cache.open_file(*first_result);
+    require_result_ok(first_file);
+    auto second_file = cache.open_file(*second_result);
+    require_result_ok(second_file);
+
+    const auto data = pattern(2 * CACHE_PAGE_SIZE + 100, 3);
+    const std::uint64_t hash = Dragonstash::chunk_hash(data.data(), CACHE_PAGE_SIZE);
+
+    GIVEN("A block fetched into one file") {
+        require_result_ok((*first_file)->fill(0, data.data(), data.size()));
+        cache.deduplicate(*first_result, **first_file, 0, data.data(), data.size());
+
+        THEN("Its whole blocks are hashed and indexed") {
+            CHECK(cache.dedup_stats().hashed_bytes == 2 * CACHE_PAGE_SIZE);
+            auto txn = cache.begin_ro();
+            auto chunk_result = txn.find_chunk(hash);
+            require_result_ok(chunk_result);
+            CHECK(chunk_result->ino == *first_result);
+            CHECK(chunk_result->block == 0);
+        }
+
+        WHEN("The same data is fetched into another file") {
+            require_result_ok((*second_file)->fill(0, data.data(), data.size()));
+            cache.deduplicate(*second_result, **second_file, 0, data.data(), data.size());
+
+            THEN("The data is shared, if the file system supports it") {
+                const auto stats = cache.dedup_stats();
+                if (cache.deduplication_enabled()) {
+                    CHECK(stats.shared_bytes == 2 * CACHE_PAGE_SIZE);
+                } else {
+                    CHECK(stats.shared_bytes == 0);
+                }
+            }
+
+            THEN("Both files still read the data") {
+                std::vector<std::byte> buf(data.size());
+                auto read_result = (*second_file)->pread(0, buf.data(), buf.size());
+                require_result_ok(read_result);
+                CHECK(*read_result == data.size());
+                CHECK(buf == data);
+            }
+        }
+
+        WHEN("The indexed block is changed and the old data is fetched elsewhere") {
+            const auto other = pattern(CACHE_PAGE_SIZE, 4);
+            require_result_ok((*first_file)->pwrite(0, other.data(), other.size()));
+            require_result_ok((*second_file)->fill(0, data.data(), data.size()));
+            cache.deduplicate(*second_result, **second_file, 0, data.data(), data.size());
+
+            THEN("The stale index entry is replaced") {
+                if (cache.deduplication_enabled()) {
+                    auto txn = cache.begin_ro();
+                    auto chunk_result = txn.find_chunk(hash);
+                    require_result_ok(chunk_result);
+                    CHECK(chunk_result->ino == *second_result);
+                    CHECK(cache.dedup_stats().stale_entries == 1);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,226 @@
+/**********************************************************************
+File name: hot_tier.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "dragonstash/cache/hot_tier.hpp"
+
+using Dragonstash::CACHE_PAGE_SIZE;
+
+static std::vector<std::byte> make_data(std::size_t n, std::uint8_t seed)
+{
+    std::vector<std::byte> result(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        result[i] = static_cast<std::byte>(seed + i * 7);
+    }
+    return result;
+}
+
+static std::vector<std::byte> gather(const Dragonstash::HotTier::Read &read)
+{
+    std::vector<std::byte> result;
+    for (int i = 0; i < read.count(); ++i) {
+        const auto *base = static_cast<const std::byte*>(read.iov()[i].iov_base);
+        result.insert(result.end(), base, base + read.iov()[i].iov_len);
+    }
+    return result;
+}
+
+TEST_CASE("Hot tier is disabled without capacity", "[hot_tier]")
+{
+    Dragonstash::HotTier tier;
+    CHECK_FALSE(tier.enabled());
+    CHECK_FALSE(tier.admissible(1));
+
+    const auto data = make_data(CACHE_PAGE_SIZE, 1);
+    tier.admit(2, 0, data.data(), data.size(), data.size(), tier.generation());
+    tier.admit(2, 0, data.data(), data.size(), data.size(), tier.generation());
+    CHECK_FALSE(tier.lookup(2, 0, data.size()));
+}
+
+TEST_CASE("Hot tier admits blocks which are read repeatedly", "[hot_tier]")
+{
+    Dragonstash::HotTier tier(Dragonstash::HotTierOptions{
+                                  .capacity = 16 * CACHE_PAGE_SIZE,
+                              });
+    const std::size_t file_size = 2 * CACHE_PAGE_SIZE + 100;
+    const auto data = make_data(file_size, 3);
+
+    CHECK_FALSE(tier.lookup(2, 0, file_size));
+    tier.admit(2, 0, data.data(), file_size, file_size, tier.generation());
+    CHECK_FALSE(tier.lookup(2, 0, file_size));
+    CHECK(tier.stats().rejected == 3);
+
+    tier.admit(2, 0, data.data(), file_size, file_size, tier.generation());
+    CHECK(tier.stats().admitted == 3);
+
+    SECTION("The whole file is served") {
+        auto read = tier.lookup(2, 0, file_size);
+        REQUIRE(read);
+        CHECK(read.count() == 3);
+        CHECK(read.size() == file_size);
+        CHECK(gather(read) == data);
+    }
+
+    SECTION("Unaligned ranges are served") {
+        const std::size_t off = CACHE_PAGE_SIZE - 10;
+        auto read = tier.lookup(2, off, CACHE_PAGE_SIZE + 50);
+        REQUIRE(read);
+        CHECK(read.count() == 3);
+        CHECK(gather(read) == std::vector<std::byte>(data.begin() + off,
+                                                     data.begin() + off + CACHE_PAGE_SIZE + 50));
+    }
+
+    SECTION("Other files miss") {
+        CHECK_FALSE(tier.lookup(3, 0, 1));
+    }
+
+    SECTION("Invalidation drops the file") {
+        tier.invalidate(2);
+        CHECK_FALSE(tier.lookup(2, 0, 1));
+        const auto stats = tier.stats();
+        CHECK(stats.invalidated == 3);
+        CHECK(stats.resident == 0);
+    }
+
+    SECTION("Hit rates are counted") {
+        (void)tier.lookup(2, 0, 1);
+        (void)tier.lookup(2, file_size, 1);
+        const auto stats = tier.stats();
+        CHECK(stats.hits == 1);
+        CHECK(stats.misses == 3);
+        CHECK(stats.hit_rate() == 0.25);
+    }
+}
+
+TEST_CASE("Hot tier does not admit partial blocks", "[hot_tier]")
+{
+    Dragonstash::HotTier tier(Dragonstash::HotTierOptions{
+                                  .capacity = 16 * CACHE_PAGE_SIZE,
+                                  .admission_threshold = 1,
+                              });
+    const std::size_t file_size = 4 * CACHE_PAGE_SIZE;
+    const auto data = make_data(file_size, 5);
+
+    // covers the second block only
+    tier.admit(2, 100, data.data() + 100, 2 * CACHE_PAGE_SIZE,
+               file_size, tier.generation());
+    CHECK(tier.stats().admitted == 1);
+    CHECK_FALSE(tier.lookup(2, 0, CACHE_PAGE_SIZE));
+    CHECK(tier.lookup(2, CACHE_PAGE_SIZE, CACHE_PAGE_SIZE));
+    CHECK_FALSE(tier.lookup(2, 2 * CACHE_PAGE_SIZE, CACHE_PAGE_SIZE));
+}
+
+TEST_CASE("Hot tier skips large files", "[hot_tier]")
+{
+    Dragonstash::HotTier tier(Dragonstash::HotTierOptions{
+                                  .capacity = 16 * CACHE_PAGE_SIZE,
+                                  .max_file_size = CACHE_PAGE_SIZE,
+                                  .admission_threshold = 1,
+                              });
+    CHECK(tier.admissible(CACHE_PAGE_SIZE));
+    CHECK_FALSE(tier.admissible(CACHE_PAGE_SIZE + 1));
+
+    const auto data = make_data(2 * CACHE_PAGE_SIZE, 7);
+    tier.admit(2, 0, data.data(), data.size(), data.size(), tier.generation());
+    CHECK(tier.stats().admitted == 0);
+}
+
+TEST_CASE("Hot tier refuses data read before an invalidation", "[hot_tier]")
+{
+    Dragonstash::HotTier tier(Dragonstash::HotTierOptions{
+                                  .capacity = 16 * CACHE_PAGE_SIZE,
+                                  .admission_threshold = 1,
+                              });
+    const auto data = make_data(CACHE_PAGE_SIZE, 9);
+    const auto generation = tier.generation();
+    tier.invalidate(2);
+    tier.admit(2, 0, data.data(), data.size(), data.size(), generation);
+    CHECK_FALSE(tier.lookup(2, 0, data.size()));
+}
+
+TEST_CASE("Hot tier keeps pinned blocks alive", "[hot_tier]")
+{
+    Dragonstash::HotTier tier(Dragonstash::HotTierOptions{
+                                  .capacity = CACHE_PAGE_SIZE,
+                                  .admission_threshold = 1,
+                              });
+    const auto first = make_data(CACHE_PAGE_SIZE, 11);
+    const auto second = make_data(CACHE_PAGE_SIZE, 13);
+    tier.admit(2, 0, first.data(), first.size(), first.size(), tier.generation());
+
+    auto read = tier.lookup(2, 0, first.size());
+    REQUIRE(read);
+
+    SECTION("Pinned blocks are not evicted") {
+        for (int i = 0; i < 20; ++i) {
+            tier.admit(3, 0, second.data(), second.size(), second.size(), tier.generation());
+        }
+        CHECK(tier.stats().evicted == 0);
+        CHECK(gather(read) == first);
+    }
+
+    SECTION("Invalidated pinned blocks stay readable until released") {
+        tier.invalidate(2);
+        CHECK(gather(read) == first);
+        CHECK_FALSE(tier.lookup(2, 0, first.size()));
+
+        // the slot only becomes available once it has been released
+        tier.admit(3, 0, second.data(), second.size(), second.size(), tier.generation());
+        CHECK_FALSE(tier.lookup(3, 0, second.size()));
+        read = Dragonstash::HotTier::Read();
+        tier.admit(3, 0, second.data(), second.size(), second.size(), tier.generation());
+        CHECK(tier.lookup(3, 0, second.size()));
+    }
+}
+
+TEST_CASE("Hot tier prefers hotter blocks when full", "[hot_tier]")
+{
+    Dragonstash::HotTier tier(Dragonstash::HotTierOptions{
+                                  .capacity = CACHE_PAGE_SIZE,
+                                  .admission_threshold = 1,
+                              });
+    const auto hot = make_data(CACHE_PAGE_SIZE, 15);
+    const auto cold = make_data(CACHE_PAGE_SIZE, 17);
+
+    tier.admit(2, 0, hot.data(), hot.size(), hot.size(), tier.generation());
+    for (int i = 0; i < 4; ++i) {
+        CHECK(tier.lookup(2, 0, hot.size()));
+    }
+
+    // a single read of another block does not displace the hot one
+    tier.admit(3, 0, cold.data(), cold.size(), cold.size(), tier.generation());
+    CHECK(tier.lookup(2, 0, hot.size()));
+    CHECK_FALSE(tier.lookup(3, 0, cold.size()));
+
+    // but one which is read more often eventually does
+    for (int i = 0; i < 10; ++i) {
+        tier.admit(3, 0, cold.data(), cold.size(), cold.size(), tier.generation());
+    }
+    CHECK(tier.lookup(3, 0, cold.size()));
+    CHECK(tier.stats().evicted == 1);
+}
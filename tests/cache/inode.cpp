@@ -25,6 +25,7 @@ authors named in the AUTHORS file.
 #include <catch2/catch.hpp>
 
 #include <sys/stat.h>
+#include <cstring>
 
 #include "dragonstash/cache/inode.hpp"
 
@@ -94,8 +95,8 @@ SCENARIO("Inode deserialization") {
             }
         }
 
-        WHEN("the buffer has the invalid version 0x02") {
-            std::array<std::uint8_t, 1> buf{{0x02}};
+        WHEN("the buffer has the invalid version 0x03") {
+            std::array<std::uint8_t, 1> buf{{0x03}};
             THEN("return -EINVAL") {
                 auto parse_result = Dragonstash::Inode::parse(std::basic_string_view<std::byte>(reinterpret_cast<std::byte*>(buf.data()), buf.size()));
                 CHECK(!parse_result);
@@ -113,6 +114,17 @@ SCENARIO("Inode deserialization") {
         }
     }
 
+    GIVEN("a version 2 buffer") {
+        WHEN("the buffer is empty after header") {
+            std::array<std::uint8_t, 1> buf{{0x02}};
+            THEN("return -EINVAL") {
+                auto parse_result = Dragonstash::Inode::parse(std::basic_string_view<std::byte>(reinterpret_cast<std::byte*>(buf.data()), buf.size()));
+                CHECK(!parse_result);
+                CHECK(parse_result.error() == EINVAL);
+            }
+        }
+    }
+
     GIVEN("a version 1 buffer") {
         WHEN("the buffer is empty after header") {
             std::array<std::uint8_t, 1> buf{{0x01}};
@@ -135,7 +147,7 @@ SCENARIO("Inode deserialization") {
         WHEN("the buffer contains a valid inode v1") {
             std::array<std::uint8_t, Dragonstash::INODE_SIZE> buf{{
                     0x01, // version
-                    0x00, // _reserved0
+                    0x00, // chunk_shift
                     0x00, 0x00, // _reserved1
                     0x00, 0x00, 0x00, 0x00, // _reserved2
                     0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, // parent
@@ -171,3 +183,154 @@ SCENARIO("Inode deserialization") {
         }
     }
 }
+
+SCENARIO("Compact inode encoding") {
+    GIVEN("an Inode with typical attributes") {
+        Dragonstash::Inode node = mkinode(
+            Dragonstash::InodeAttributes{
+                Dragonstash::CommonFileAttributes{
+                    .size = 12345,
+                    .nblocks = 4,
+                    .uid = 1000,
+                    .gid = 1000,
+                    .atime = timespec{1600000100, 123456789},
+                    .mtime = timespec{1600000000, 987654321},
+                    .ctime = timespec{1600000000, 987654321},
+                },
+                S_IFREG | 0644,
+            },
+            4711
+        );
+        node.set_flag(Dragonstash::InodeFlag::SYNCED);
+
+        WHEN("serialized") {
+            const auto buf = Dragonstash::serialize(node);
+
+            THEN("the record uses the current version") {
+                REQUIRE(!buf.empty());
+                CHECK(static_cast<std::uint8_t>(buf[0]) == Dragonstash::INODE_CURRENT_VERSION);
+            }
+
+            THEN("the record is less than half the size of a v1 record") {
+                CHECK(buf.size() * 2 < Dragonstash::INODE_SIZE);
+            }
+
+            THEN("the values survive the round-trip") {
+                auto parse_result = Dragonstash::Inode::parse(buf);
+                REQUIRE(parse_result);
+                CHECK(parse_result->test_flag(Dragonstash::InodeFlag::SYNCED));
+                CHECK(parse_result->parent == node.parent);
+                CHECK(parse_result->attr.mode == node.attr.mode);
+                CHECK(parse_result->attr.common.size == node.attr.common.size);
+                CHECK(parse_result->attr.common.nblocks == node.attr.common.nblocks);
+                CHECK(parse_result->attr.common.uid == node.attr.common.uid);
+                CHECK(parse_result->attr.common.gid == node.attr.common.gid);
+                CHECK(parse_result->attr.common.atime.tv_sec == node.attr.common.atime.tv_sec);
+                CHECK(parse_result->attr.common.atime.tv_nsec == node.attr.common.atime.tv_nsec);
+                CHECK(parse_result->attr.common.mtime.tv_sec == node.attr.common.mtime.tv_sec);
+                CHECK(parse_result->attr.common.mtime.tv_nsec == node.attr.common.mtime.tv_nsec);
+                CHECK(parse_result->attr.common.ctime.tv_sec == node.attr.common.ctime.tv_sec);
+                CHECK(parse_result->attr.common.ctime.tv_nsec == node.attr.common.ctime.tv_nsec);
+            }
+
+            THEN("a truncated record is rejected") {
+                auto truncated = buf;
+                truncated.pop_back();
+                auto parse_result = Dragonstash::Inode::parse(truncated);
+                CHECK(!parse_result);
+                CHECK(parse_result.error() == EINVAL);
+            }
+        }
+
+        WHEN("a chunk size has been chosen") {
+            node.chunk_shift = 20;
+            const auto buf = Dragonstash::serialize(node);
+            auto parse_result = Dragonstash::Inode::parse(buf);
+
+            THEN("it survives the round-trip") {
+                REQUIRE(parse_result);
+                CHECK(parse_result->chunk_size() == 1 << 20);
+                CHECK(parse_result->attr.common.size == node.attr.common.size);
+            }
+
+            THEN("a truncated record is rejected") {
+                auto truncated = buf;
+                truncated.pop_back();
+                auto truncated_result = Dragonstash::Inode::parse(truncated);
+                CHECK(!truncated_result);
+                CHECK(truncated_result.error() == EINVAL);
+            }
+        }
+
+        WHEN("no chunk size has been chosen") {
+            const auto buf = Dragonstash::serialize(node);
+            auto parse_result = Dragonstash::Inode::parse(buf);
+
+            THEN("the block size is used") {
+                REQUIRE(parse_result);
+                CHECK(parse_result->chunk_size() == Dragonstash::CACHE_PAGE_SIZE);
+            }
+        }
+
+        WHEN("a timestamp lies before the epoch") {
+            node.attr.common.atime = timespec{-10, 5};
+            const auto buf = Dragonstash::serialize(node);
+            auto parse_result = Dragonstash::Inode::parse(buf);
+
+            THEN("it survives the round-trip") {
+                REQUIRE(parse_result);
+                CHECK(parse_result->attr.common.atime.tv_sec == -10);
+                CHECK(parse_result->attr.common.atime.tv_nsec == 5);
+                CHECK(parse_result->attr.common.mtime.tv_sec == node.attr.common.mtime.tv_sec);
+                CHECK(parse_result->attr.common.mtime.tv_nsec == node.attr.common.mtime.tv_nsec);
+            }
+        }
+    }
+
+    GIVEN("a version 1 record") {
+        Dragonstash::Inode node = mkinode(
+            Dragonstash::InodeAttributes{
+                Dragonstash::CommonFileAttributes{
+                    .size = 1,
+                    .uid = 2,
+                    .gid = 3,
+                    .atime = timespec{4, 5},
+                    .mtime = timespec{6, 7},
+                    .ctime = timespec{8, 9},
+                },
+                S_IFLNK,
+            },
+            10
+        );
+        node.version = 1;
+        std::basic_string<std::byte> v1_buf;
+        v1_buf.resize(Dragonstash::INODE_SIZE);
+        memcpy(v1_buf.data(), &node, Dragonstash::INODE_SIZE);
+
+        WHEN("parsed and serialized again") {
+            auto parse_result = Dragonstash::Inode::parse(v1_buf);
+            REQUIRE(parse_result);
+            const auto buf = Dragonstash::serialize(*parse_result);
+
+            THEN("it is migrated to the current version") {
+                REQUIRE(!buf.empty());
+                CHECK(static_cast<std::uint8_t>(buf[0]) == Dragonstash::INODE_CURRENT_VERSION);
+                CHECK(buf.size() < v1_buf.size());
+            }
+
+            THEN("the values are retained") {
+                auto reparse_result = Dragonstash::Inode::parse(buf);
+                REQUIRE(reparse_result);
+                CHECK(reparse_result->parent == 10);
+                CHECK(reparse_result->attr.mode == S_IFLNK);
+                CHECK(reparse_result->attr.common.size == 1);
+                CHECK(reparse_result->attr.common.uid == 2);
+                CHECK(reparse_result->attr.common.gid == 3);
+                CHECK(reparse_result->attr.common.atime.tv_sec == 4);
+                CHECK(reparse_result->attr.common.atime.tv_nsec == 5);
+                CHECK(reparse_result->attr.common.ctime.tv_sec == 8);
+                CHECK(reparse_result->attr.common.ctime.tv_nsec == 9);
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/**********************************************************************
+File name: journal.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include "dragonstash/cache/journal.hpp"
+
+using Dragonstash::JournalEntry;
+using Dragonstash::JournalRecord;
+using Op = JournalEntry::Op;
+
+static std::vector<JournalRecord> make_journal(std::vector<JournalEntry> entries)
+{
+    std::vector<JournalRecord> result;
+    std::uint64_t seq = 1;
+    for (auto &entry: entries) {
+        result.push_back(JournalRecord{seq++, std::move(entry)});
+    }
+    return result;
+}
+
+static std::vector<std::uint64_t> seqs(const std::vector<JournalRecord> &records)
+{
+    std::vector<std::uint64_t> result;
+    for (const auto &record: records) {
+        result.push_back(record.seq);
+    }
+    return result;
+}
+
+TEST_CASE("Journal entries survive serialisation", "[journal]")
+{
+    JournalEntry entry{
+        .op = Op::RENAME,
+        .fields = JournalEntry::MODE | JournalEntry::MTIME,
+        .mode = 0644,
+        .size = 1234,
+        .atime = {1, 2},
+        .mtime = {3, 4},
+        .path = "/some/file",
+        .new_path = "/other/file",
+    };
+
+    auto parsed = JournalEntry::parse(entry.serialize());
+    REQUIRE(parsed);
+    CHECK(parsed->op == entry.op);
+    CHECK(parsed->fields == entry.fields);
+    CHECK(parsed->mode == entry.mode);
+    CHECK(parsed->size == entry.size);
+    CHECK(parsed->atime.tv_sec == 1);
+    CHECK(parsed->mtime.tv_nsec == 4);
+    CHECK(parsed->path == entry.path);
+    CHECK(parsed->new_path == entry.new_path);
+}
+
+TEST_CASE("Truncated journal entries are rejected", "[journal]")
+{
+    JournalEntry entry{.op = Op::UNLINK, .path = "/foo"};
+    const std::string buf = entry.serialize();
+    auto parsed = JournalEntry::parse(std::string_view(buf).substr(0, buf.size() - 1));
+    CHECK(!parsed);
+    CHECK(parsed.error() == EINVAL);
+}
+
+TEST_CASE("Creating and removing a file cancels out", "[journal]")
+{
+    auto records = make_journal({
+        {.op = Op::MKDIR, .path = "/keep"},
+        {.op = Op::CREATE, .path = "/tmp"},
+        {.op = Op::SETATTR, .fields = JournalEntry::SIZE, .path = "/tmp"},
+        {.op = Op::UNLINK, .path = "/tmp"},
+    });
+    CHECK(seqs(Dragonstash::compact_journal(std::move(records))) ==
+          std::vector<std::uint64_t>{1});
+}
+
+TEST_CASE("Creating and removing a directory tree cancels out", "[journal]")
+{
+    auto records = make_journal({
+        {.op = Op::MKDIR, .path = "/d"},
+        {.op = Op::CREATE, .path = "/d/f"},
+        {.op = Op::UNLINK, .path = "/d/f"},
+        {.op = Op::RMDIR, .path = "/d"},
+    });
+    CHECK(Dragonstash::compact_journal(std::move(records)).empty());
+}
+
+TEST_CASE("Renames prevent cancellation", "[journal]")
+{
+    auto records = make_journal({
+        {.op = Op::CREATE, .path = "/a"},
+        {.op = Op::RENAME, .path = "/a", .new_path = "/b"},
+        {.op = Op::CREATE, .path = "/a"},
+        {.op = Op::RENAME, .path = "/d", .new_path = "/c"},
+        {.op = Op::UNLINK, .path = "/b"},
+    });
+    // /b only came into existence through the rename
+    CHECK(seqs(Dragonstash::compact_journal(std::move(records))) ==
+          std::vector<std::uint64_t>{1, 2, 3, 4, 5});
+}
+
+TEST_CASE("Removal drops preceding attribute changes", "[journal]")
+{
+    auto records = make_journal({
+        {.op = Op::SETATTR, .fields = JournalEntry::MODE, .path = "/a"},
+        {.op = Op::SETATTR, .fields = JournalEntry::MODE, .path = "/b"},
+        {.op = Op::UNLINK, .path = "/a"},
+    });
+    CHECK(seqs(Dragonstash::compact_journal(std::move(records))) ==
+          std::vector<std::uint64_t>{2, 3});
+}
+
+TEST_CASE("Attribute changes are merged", "[journal]")
+{
+    auto records = make_journal({
+        {.op = Op::SETATTR, .fields = JournalEntry::MODE, .mode = 0600, .path = "/a"},
+        {.op = Op::SETATTR, .fields = JournalEntry::SIZE, .size = 10, .path = "/a"},
+        {.op = Op::SETATTR, .fields = JournalEntry::MODE, .mode = 0644, .path = "/b"},
+        {.op = Op::SETATTR, .fields = JournalEntry::MODE | JournalEntry::SIZE,
+         .mode = 0640, .size = 5, .path = "/a"},
+    });
+    auto result = Dragonstash::compact_journal(std::move(records));
+    REQUIRE(seqs(result) == std::vector<std::uint64_t>{3, 4});
+    const JournalEntry &merged = result[1].entry;
+    CHECK(merged.fields == (JournalEntry::MODE | JournalEntry::SIZE));
+    CHECK(merged.mode == 0640);
+    CHECK(merged.size == 5);
+}
+
+TEST_CASE("Growing after shrinking is not merged", "[journal]")
+{
+    auto records = make_journal({
+        {.op = Op::SETATTR, .fields = JournalEntry::SIZE, .size = 0, .path = "/a"},
+        {.op = Op::SETATTR, .fields = JournalEntry::SIZE, .size = 100, .path = "/a"},
+    });
+    CHECK(seqs(Dragonstash::compact_journal(std::move(records))) ==
+          std::vector<std::uint64_t>{1, 2});
+}
@@ -22,6 +22,12 @@ FEEDBACK & QUESTIONS
 For feedback and questions about DragonStash please e-mail one of the
 authors named in the AUTHORS file.
 **********************************************************************/
+#include <linux/falloc.h>
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+
 #include <catch2/catch.hpp>
 
 #include "dragonstash/backend/in_memory.hpp"
@@ -34,9 +40,15 @@ authors named in the AUTHORS file.
 
 class TestEnvironment {
 public:
-    TestEnvironment():
-        m_cache(m_cachedir.path()),
-        m_fs(m_cache, m_backend),
+    explicit TestEnvironment(const Dragonstash::VerifyOptions &verify_options = Dragonstash::VerifyOptions(),
+                             const Dragonstash::PrefetchOptions &prefetch_options = Dragonstash::PrefetchOptions(),
+                             const Dragonstash::DirPrefetchOptions &dir_prefetch_options = Dragonstash::DirPrefetchOptions(),
+                             const Dragonstash::HotTierOptions &hot_tier_options = Dragonstash::HotTierOptions(),
+                             const Dragonstash::CacheOptions &cache_options = Dragonstash::CacheOptions()):
+        m_cache(m_cachedir.path(), cache_options),
+        m_fs(m_cache, m_backend, Dragonstash::WritebackOptions(), verify_options,
+             prefetch_options, dir_prefetch_options,
+             Dragonstash::RecoveryOptions(), hot_tier_options),
         m_default_uid(getuid()),
         m_default_gid(getgid()),
         m_default_timestamp{.tv_sec = 1536390000, .tv_nsec = 20180908}
@@ -512,6 +524,46 @@ SCENARIO("opendir and readdir") {
     }
 }
 
+SCENARIO("Syncing a directory beyond the inode limit") {
+    Dragonstash::CacheOptions cache_options;
+    cache_options.max_inodes = 2;
+    TestEnvironment env(Dragonstash::VerifyOptions(),
+                        Dragonstash::PrefetchOptions(),
+                        Dragonstash::DirPrefetchOptions(),
+                        Dragonstash::HotTierOptions(),
+                        cache_options);
+    env.with_default_contents();
+
+    auto books_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "books");
+    require_result_ok(books_result);
+    const ino_t books = *books_result;
+
+    WHEN("Opening a directory whose entries do not fit into the cache") {
+        auto req = env.fuse().new_request();
+        struct fuse_file_info fi{};
+        env.fs().opendir(req.wrap(), books, &fi);
+
+        THEN("The call succeeds") {
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+
+        THEN("The directory is not marked as synced") {
+            auto flag_result = env.cache().begin_ro().test_flag(books, Dragonstash::InodeFlag::SYNCED);
+            require_result_ok(flag_result);
+            CHECK_FALSE(*flag_result);
+        }
+
+        AND_WHEN("Looking up a missing entry while disconnected") {
+            env.backend().set_connected(false);
+            auto lookup_result = lookup(env.fuse(), env.fs(), books, "The Elements of Style.epub");
+
+            THEN("Its existence is not denied") {
+                check_result_error(lookup_result, EIO);
+            }
+        }
+    }
+}
+
 SCENARIO("readlink") {
     TestEnvironment env;
 
@@ -594,3 +646,1359 @@ SCENARIO("readlink") {
         }
     }
 }
+
+SCENARIO("statfs") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    GIVEN("A filesystem with a few cached entries") {
+        auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(lookup_result);
+
+        WHEN("Calling statfs") {
+            auto req = env.fuse().new_request();
+            env.fs().statfs(req.wrap(), Dragonstash::ROOT_INO);
+
+            THEN("The inode counter of the cache is reported") {
+                check_reply_type(req, TestFuseReplyType::STATFS);
+                auto usage_result = env.cache().usage();
+                require_result_ok(usage_result);
+                auto st = std::get<TestFuseReplyStatfs>(req.reply_argv());
+                CHECK(st.f_files - st.f_ffree == usage_result->inodes);
+                CHECK(usage_result->inodes == 2);
+                CHECK(st.f_bsize == Dragonstash::CACHE_PAGE_SIZE);
+                CHECK(st.f_namemax > 0);
+            }
+        }
+    }
+}
+
+std::string read_file(TestFuseBackend &fuse,
+                      Dragonstash::Filesystem &fs,
+                      ino_t ino,
+                      struct fuse_file_info &fi,
+                      size_t size = 4096,
+                      off_t off = 0)
+{
+    auto req = fuse.new_request();
+    fs.read(req.wrap(), ino, size, off, &fi);
+    check_reply_type(req, TestFuseReplyType::BUF);
+    return std::get<TestFuseReplyBuf>(req.reply_argv());
+}
+
+void write_file(TestFuseBackend &fuse,
+                Dragonstash::Filesystem &fs,
+                ino_t ino,
+                struct fuse_file_info &fi,
+                std::string_view data,
+                off_t off)
+{
+    auto req = fuse.new_request();
+    fs.write(req.wrap(), ino, data, off, &fi);
+    check_reply_type(req, TestFuseReplyType::WRITE);
+    CHECK(std::get<TestFuseReplyWrite>(req.reply_argv()) == data.size());
+}
+
+SCENARIO("Write-back caching") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::string initial_contents = "Hello World";
+    backend_file.data().assign(reinterpret_cast<const std::byte*>(initial_contents.data()),
+                               initial_contents.size());
+    backend_file.attr().size = initial_contents.size();
+
+    auto backend_contents = [&backend_file](){
+        return std::string(reinterpret_cast<const char*>(backend_file.data().data()),
+                           backend_file.data().size());
+    };
+
+    GIVEN("An open file") {
+        auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(lookup_result);
+        const ino_t ino = *lookup_result;
+
+        struct fuse_file_info fi{};
+        fi.flags = O_RDWR;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), ino, &fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+
+        WHEN("Reading the file") {
+            auto contents = read_file(env.fuse(), env.fs(), ino, fi);
+
+            THEN("The contents of the backend are returned") {
+                CHECK(contents == initial_contents);
+            }
+
+            THEN("The data is accounted for") {
+                auto usage_result = env.cache().usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->cached_bytes == Dragonstash::CACHE_PAGE_SIZE);
+            }
+
+            AND_WHEN("The backend is disconnected") {
+                env.backend().set_connected(false);
+
+                THEN("The data is served from the cache") {
+                    CHECK(read_file(env.fuse(), env.fs(), ino, fi) == initial_contents);
+                }
+            }
+        }
+
+        WHEN("Reading the file while disconnected") {
+            env.backend().set_connected(false);
+
+            auto req = env.fuse().new_request();
+            env.fs().read(req.wrap(), ino, 4096, 0, &fi);
+
+            THEN("EIO is returned") {
+                check_reply_error(req, EIO);
+            }
+        }
+
+        WHEN("Overwriting part of the file") {
+            write_file(env.fuse(), env.fs(), ino, fi, "Howdy", 0);
+
+            THEN("The new data is visible immediately") {
+                CHECK(read_file(env.fuse(), env.fs(), ino, fi) == "Howdy World");
+            }
+
+            THEN("The inode is marked dirty") {
+                auto txn = env.cache().begin_ro();
+                auto flag_result = txn.test_flag(ino, Dragonstash::InodeFlag::DIRTY);
+                require_result_ok(flag_result);
+                CHECK(*flag_result);
+            }
+
+            THEN("The modification time is updated although the size is not") {
+                auto txn = env.cache().begin_ro();
+                auto attr_result = txn.getattr(ino);
+                require_result_ok(attr_result);
+                CHECK(attr_result->attr.common.size == initial_contents.size());
+                CHECK(attr_result->attr.common.mtime.tv_sec != env.default_timestamp().tv_sec);
+                CHECK(attr_result->attr.common.ctime.tv_sec == attr_result->attr.common.mtime.tv_sec);
+            }
+
+            AND_WHEN("Flushing the file") {
+                auto req = env.fuse().new_request();
+                env.fs().flush(req.wrap(), ino, &fi);
+                check_reply_error(req, 0);
+
+                THEN("The data has been written back") {
+                    CHECK(backend_contents() == "Howdy World");
+                }
+
+                THEN("The inode is clean again") {
+                    auto txn = env.cache().begin_ro();
+                    auto flag_result = txn.test_flag(ino, Dragonstash::InodeFlag::DIRTY);
+                    require_result_ok(flag_result);
+                    CHECK(!*flag_result);
+                }
+            }
+        }
+
+        WHEN("The file is written to while it is being uploaded") {
+            write_file(env.fuse(), env.fs(), ino, fi, "Howdy", 0);
+            auto file_result = env.cache().open_file(ino);
+            require_result_ok(file_result);
+            auto &file = **file_result;
+            const Dragonstash::Blocklist::Range block{0, 1, Dragonstash::Blocklist::WRITTEN};
+
+            auto upload_guard = file.upload_lock();
+            file.log_writes(true);
+            const auto generation = file.write_generation();
+            write_file(env.fuse(), env.fs(), ino, fi, "J", 0);
+            file.mark_uploaded(block, generation);
+            file.log_writes(false);
+
+            THEN("The block stays dirty") {
+                CHECK(file.blocks(Dragonstash::Blocklist::WRITTEN) == 1);
+            }
+
+            AND_WHEN("The upload is repeated without interference") {
+                file.log_writes(true);
+                file.mark_uploaded(block, file.write_generation());
+                file.log_writes(false);
+
+                THEN("The block is clean") {
+                    CHECK(file.blocks(Dragonstash::Blocklist::WRITTEN) == 0);
+                }
+            }
+        }
+
+        WHEN("Appending to the file") {
+            write_file(env.fuse(), env.fs(), ino, fi, "!", initial_contents.size());
+
+            THEN("The size is updated") {
+                auto txn = env.cache().begin_ro();
+                auto attr_result = txn.getattr(ino);
+                require_result_ok(attr_result);
+                CHECK(attr_result->attr.common.size == initial_contents.size() + 1);
+            }
+
+            AND_WHEN("Calling fsync") {
+                auto req = env.fuse().new_request();
+                env.fs().fsync(req.wrap(), ino, 0, &fi);
+                check_reply_error(req, 0);
+
+                THEN("The data has been written back") {
+                    CHECK(backend_contents() == "Hello World!");
+                }
+            }
+        }
+
+        WHEN("Writing while disconnected") {
+            (void)read_file(env.fuse(), env.fs(), ino, fi);
+            env.backend().set_connected(false);
+
+            write_file(env.fuse(), env.fs(), ino, fi, "J", 0);
+
+            AND_WHEN("Flushing the file") {
+                auto req = env.fuse().new_request();
+                env.fs().flush(req.wrap(), ino, &fi);
+
+                THEN("The flush succeeds, but the data is kept back") {
+                    check_reply_error(req, 0);
+                    CHECK(backend_contents() == initial_contents);
+                    CHECK(read_file(env.fuse(), env.fs(), ino, fi) == "Jello World");
+                }
+
+                AND_WHEN("Flushing again after reconnecting") {
+                    env.backend().set_connected(true);
+                    auto req = env.fuse().new_request();
+                    env.fs().flush(req.wrap(), ino, &fi);
+                    check_reply_error(req, 0);
+
+                    THEN("The data has been written back") {
+                        CHECK(backend_contents() == "Jello World");
+                    }
+                }
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), ino, &fi);
+            check_reply_error(req, 0);
+        }
+    }
+}
+
+SCENARIO("Discarding cached data") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::size_t page = Dragonstash::CACHE_PAGE_SIZE;
+    std::string initial_contents;
+    for (char c: {'a', 'b', 'c'}) {
+        initial_contents.append(page, c);
+    }
+    initial_contents.append(100, 'd');
+    backend_file.data().assign(reinterpret_cast<const std::byte*>(initial_contents.data()),
+                               initial_contents.size());
+    backend_file.attr().size = initial_contents.size();
+
+    auto cached_bytes = [&env](){
+        auto usage_result = env.cache().usage();
+        require_result_ok(usage_result);
+        return usage_result->cached_bytes;
+    };
+
+    GIVEN("An open and fully cached file") {
+        auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(lookup_result);
+        const ino_t ino = *lookup_result;
+
+        struct fuse_file_info fi{};
+        fi.flags = O_RDWR;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), ino, &fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+        CHECK(read_file(env.fuse(), env.fs(), ino, fi, initial_contents.size()) == initial_contents);
+        CHECK(cached_bytes() == 4 * page);
+
+        auto punch = [&](off_t off, off_t len){
+            auto req = env.fuse().new_request();
+            env.fs().fallocate(req.wrap(), ino,
+                               FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                               off, len, &fi);
+            check_reply_error(req, 0);
+        };
+
+        WHEN("Punching a hole over a whole block") {
+            punch(page, page);
+
+            THEN("The block is dropped from the cache") {
+                CHECK(cached_bytes() == 3 * page);
+            }
+
+            THEN("The file size is unchanged") {
+                auto txn = env.cache().begin_ro();
+                auto attr_result = txn.getattr(ino);
+                require_result_ok(attr_result);
+                CHECK(attr_result->attr.common.size == initial_contents.size());
+            }
+
+            THEN("The data is fetched again on access") {
+                CHECK(read_file(env.fuse(), env.fs(), ino, fi, page, page) == std::string(page, 'b'));
+                CHECK(cached_bytes() == 4 * page);
+            }
+
+            AND_WHEN("The backend is disconnected") {
+                env.backend().set_connected(false);
+
+                THEN("The other blocks are still served from the cache") {
+                    CHECK(read_file(env.fuse(), env.fs(), ino, fi, page, 0) == std::string(page, 'a'));
+                }
+
+                THEN("Reading the dropped block fails with EIO") {
+                    auto req = env.fuse().new_request();
+                    env.fs().read(req.wrap(), ino, page, page, &fi);
+                    check_reply_error(req, EIO);
+                }
+            }
+        }
+
+        WHEN("Punching a hole which covers no whole block") {
+            punch(100, page);
+
+            THEN("Nothing is dropped") {
+                CHECK(cached_bytes() == 4 * page);
+            }
+        }
+
+        WHEN("Punching a hole up to the end of the file") {
+            punch(3 * page, 100);
+
+            THEN("The last, partial block is dropped") {
+                CHECK(cached_bytes() == 3 * page);
+            }
+        }
+
+        WHEN("Punching a hole over locally written data") {
+            env.backend().set_connected(false);
+            write_file(env.fuse(), env.fs(), ino, fi, "X", 0);
+            punch(0, initial_contents.size());
+
+            THEN("Only the written block is kept") {
+                CHECK(cached_bytes() == page);
+                CHECK(read_file(env.fuse(), env.fs(), ino, fi, 2, 0) == "Xa");
+            }
+        }
+
+        WHEN("Calling fallocate to preallocate space") {
+            auto req = env.fuse().new_request();
+            env.fs().fallocate(req.wrap(), ino, 0, 0, page, &fi);
+
+            THEN("EOPNOTSUPP is returned") {
+                check_reply_error(req, EOPNOTSUPP);
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), ino, &fi);
+            check_reply_error(req, 0);
+        }
+    }
+}
+
+SCENARIO("Fetching large files in chunks") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    // large enough for chunks of two blocks
+    const std::size_t size = 2 * Dragonstash::CACHE_PAGE_SIZE * Dragonstash::CHUNKS_PER_FILE;
+    backend_file.data().assign(size, std::byte('c'));
+    backend_file.attr().size = size;
+
+    GIVEN("An opened large file") {
+        auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(lookup_result);
+        const ino_t ino = *lookup_result;
+
+        struct fuse_file_info fi{};
+        fi.flags = O_RDONLY;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), ino, &fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+
+        WHEN("Reading a single byte from the second chunk") {
+            CHECK(read_file(env.fuse(), env.fs(), ino, fi, 1, 3 * Dragonstash::CACHE_PAGE_SIZE + 5) == "c");
+
+            THEN("The whole chunk is cached") {
+                auto file = env.cache().open_file(ino);
+                require_result_ok(file);
+                const auto missing = (*file)->missing(0, 6 * Dragonstash::CACHE_PAGE_SIZE);
+                REQUIRE(missing.size() == 2);
+                CHECK(missing[0].start == 0);
+                CHECK(missing[0].count == 2);
+                CHECK(missing[1].start == 4);
+                CHECK(missing[1].count == 2);
+
+                auto usage_result = env.cache().usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->cached_bytes == 2 * Dragonstash::CACHE_PAGE_SIZE);
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), ino, &fi);
+            check_reply_error(req, 0);
+        }
+    }
+}
+
+SCENARIO("Prefetching from access traces") {
+    Dragonstash::PrefetchOptions prefetch_options;
+    prefetch_options.enabled = true;
+    TestEnvironment env(Dragonstash::VerifyOptions(), prefetch_options);
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::size_t page = Dragonstash::CACHE_PAGE_SIZE;
+    const std::size_t size = 64 * page;
+    backend_file.data().assign(size, std::byte('p'));
+    backend_file.attr().size = size;
+
+    auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+    require_result_ok(lookup_result);
+    const ino_t ino = *lookup_result;
+
+    auto open = [&](struct fuse_file_info &fi){
+        fi.flags = O_RDONLY;
+        auto req = env.fuse().new_request();
+        env.fs().open(req.wrap(), ino, &fi);
+        check_reply_type(req, TestFuseReplyType::OPEN);
+    };
+    auto release = [&](struct fuse_file_info &fi){
+        auto req = env.fuse().new_request();
+        env.fs().release(req.wrap(), ino, &fi);
+        check_reply_error(req, 0);
+    };
+
+    GIVEN("A file of which two distant blocks have been read") {
+        {
+            struct fuse_file_info fi{};
+            open(fi);
+            CHECK(read_file(env.fuse(), env.fs(), ino, fi, 1, 40 * page) == "p");
+            CHECK(read_file(env.fuse(), env.fs(), ino, fi, 1, 3 * page + 7) == "p");
+            release(fi);
+        }
+
+        THEN("The accesses are stored in order") {
+            auto txn = env.cache().begin_ro();
+            auto trace_result = txn.get_trace(ino);
+            require_result_ok(trace_result);
+            REQUIRE(trace_result->ranges().size() == 2);
+            CHECK(trace_result->ranges()[0].start == 40);
+            CHECK(trace_result->ranges()[1].start == 3);
+        }
+
+        WHEN("The data is dropped and the file is opened again") {
+            auto file = env.cache().open_file(ino);
+            require_result_ok(file);
+            require_result_ok((*file)->discard(0, size));
+
+            struct fuse_file_info fi{};
+            open(fi);
+            env.fs().prefetcher().drain();
+
+            THEN("The blocks are fetched in the background") {
+                const auto missing = (*file)->missing(0, size);
+                REQUIRE(missing.size() == 3);
+                CHECK(missing[0].start == 0);
+                CHECK(missing[0].count == 3);
+                CHECK(missing[1].start == 4);
+                CHECK(missing[1].count == 36);
+                CHECK(missing[2].start == 41);
+                CHECK(env.fs().prefetcher().stats().prefetched_bytes == 2 * page);
+            }
+
+            release(fi);
+        }
+
+        WHEN("The trace has grown old") {
+            {
+                auto txn = env.cache().begin_rw();
+                auto trace_result = txn.get_trace(ino);
+                require_result_ok(trace_result);
+                trace_result->set_recorded_at(1);
+                txn.put_trace(ino, *trace_result);
+                require_result_ok(txn.commit());
+            }
+            auto file = env.cache().open_file(ino);
+            require_result_ok(file);
+            require_result_ok((*file)->discard(0, size));
+
+            struct fuse_file_info fi{};
+            open(fi);
+            env.fs().prefetcher().drain();
+
+            THEN("Nothing is prefetched and the trace is dropped") {
+                CHECK((*file)->missing(0, size).size() == 1);
+                CHECK(env.fs().prefetcher().stats().prefetched_bytes == 0);
+                CHECK(env.fs().prefetcher().stats().expired_traces == 1);
+                auto txn = env.cache().begin_ro();
+                CHECK_FALSE(txn.get_trace(ino));
+            }
+
+            release(fi);
+        }
+    }
+}
+
+SCENARIO("Prefetching subdirectories") {
+    Dragonstash::DirPrefetchOptions dir_prefetch_options;
+    dir_prefetch_options.enabled = true;
+    dir_prefetch_options.max_depth = 1;
+    TestEnvironment env(Dragonstash::VerifyOptions(), Dragonstash::PrefetchOptions(),
+                        dir_prefetch_options);
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/books");
+    require_result_ok(find_result);
+    using namespace Dragonstash::Backend::InMemory;
+    dynamic_cast<Directory&>(**find_result).emplace<Directory>("nested");
+
+    auto opendir = [&](ino_t ino){
+        auto req = env.fuse().new_request();
+        struct fuse_file_info fi{};
+        env.fs().opendir(req.wrap(), ino, &fi);
+        check_reply_type(req, TestFuseReplyType::OPEN);
+    };
+    auto synced = [&](ino_t parent, std::string_view name){
+        auto txn = env.cache().begin_ro();
+        auto lookup_result = txn.lookup(parent, name);
+        require_result_ok(lookup_result);
+        auto flag_result = txn.test_flag(*lookup_result, Dragonstash::InodeFlag::SYNCED);
+        require_result_ok(flag_result);
+        return *flag_result;
+    };
+
+    GIVEN("An opened root directory") {
+        opendir(Dragonstash::ROOT_INO);
+        env.fs().dir_prefetcher().drain();
+
+        THEN("Its subdirectories are synced in the background") {
+            CHECK(synced(Dragonstash::ROOT_INO, "books"));
+            CHECK(env.fs().dir_prefetcher().stats().synced == 1);
+        }
+
+        THEN("Directories below the depth limit are not synced") {
+            auto books_result = env.cache().begin_ro().lookup(Dragonstash::ROOT_INO, "books");
+            require_result_ok(books_result);
+            CHECK_FALSE(synced(*books_result, "nested"));
+        }
+
+        WHEN("The walk continues into a subdirectory") {
+            auto books_result = env.cache().begin_ro().lookup(Dragonstash::ROOT_INO, "books");
+            require_result_ok(books_result);
+            opendir(*books_result);
+            env.fs().dir_prefetcher().drain();
+
+            THEN("The background sync is used") {
+                CHECK(env.fs().dir_prefetcher().stats().used == 1);
+            }
+
+            THEN("The prefetch moves on to the next level") {
+                CHECK(synced(*books_result, "nested"));
+                CHECK(env.fs().dir_prefetcher().stats().synced == 2);
+            }
+        }
+    }
+}
+
+SCENARIO("Querying the residency of files") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::size_t page = Dragonstash::CACHE_PAGE_SIZE;
+    const std::size_t size = 4 * page + 100;
+    backend_file.data().assign(size, std::byte('r'));
+    backend_file.attr().size = size;
+
+    auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+    require_result_ok(lookup_result);
+    const ino_t ino = *lookup_result;
+
+    auto getxattr = [&](std::string_view name){
+        auto req = env.fuse().new_request();
+        env.fs().getxattr(req.wrap(), ino, name, 4096);
+        check_reply_type(req, TestFuseReplyType::BUF);
+        return std::get<TestFuseReplyBuf>(req.reply_argv());
+    };
+
+    GIVEN("A file which has never been read") {
+        THEN("Nothing is resident") {
+            CHECK(getxattr("user.dragonstash.resident") == "0");
+            CHECK(getxattr("user.dragonstash.extents") == "");
+        }
+
+        THEN("No data files are created by the query") {
+            CHECK(getxattr("user.dragonstash.resident") == "0");
+            CHECK_FALSE(std::filesystem::exists(
+                            Dragonstash::RegularFileHandle::blocklist_path(
+                                env.cache().data_path(), ino)));
+        }
+    }
+
+    GIVEN("A file of which the head and the tail have been read and written") {
+        struct fuse_file_info fi{};
+        fi.flags = O_RDWR;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), ino, &fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+        CHECK(read_file(env.fuse(), env.fs(), ino, fi, 1, 0) == "r");
+        CHECK(read_file(env.fuse(), env.fs(), ino, fi, 1, 4 * page) == "r");
+        env.backend().set_connected(false);
+        write_file(env.fuse(), env.fs(), ino, fi, "w", 4 * page);
+
+        THEN("The resident bytes stop at the end of the file") {
+            CHECK(getxattr("user.dragonstash.resident") == std::to_string(page + 100));
+            CHECK(getxattr("user.dragonstash.dirty") == "100");
+        }
+
+        THEN("The extents list the present runs") {
+            CHECK(getxattr("user.dragonstash.extents") ==
+                  "0 4096 read\n16384 100 written\n");
+        }
+
+        WHEN("Asking for the size only") {
+            auto req = env.fuse().new_request();
+            env.fs().getxattr(req.wrap(), ino, "user.dragonstash.extents", 0);
+
+            THEN("The size of the value is returned") {
+                check_reply_type(req, TestFuseReplyType::XATTR);
+                CHECK(std::get<TestFuseReplyXattr>(req.reply_argv()) ==
+                      std::string("0 4096 read\n16384 100 written\n").size());
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), ino, &fi);
+            check_reply_error(req, 0);
+        }
+    }
+
+    GIVEN("A directory") {
+        auto req = env.fuse().new_request();
+        env.fs().getxattr(req.wrap(), Dragonstash::ROOT_INO, "user.dragonstash.resident", 4096);
+
+        THEN("The attributes do not exist") {
+            check_reply_error(req, ENODATA);
+        }
+    }
+
+    GIVEN("An unknown attribute") {
+        auto req = env.fuse().new_request();
+        env.fs().getxattr(req.wrap(), ino, "user.something", 4096);
+
+        THEN("It does not exist") {
+            check_reply_error(req, ENODATA);
+        }
+    }
+}
+
+SCENARIO("Pinning files") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::size_t page = Dragonstash::CACHE_PAGE_SIZE;
+    backend_file.data().assign(2 * page, std::byte('p'));
+    backend_file.attr().size = 2 * page;
+
+    auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+    require_result_ok(lookup_result);
+    const ino_t ino = *lookup_result;
+
+    struct fuse_file_info fi{};
+    fi.flags = O_RDWR;
+    {
+        auto req = env.fuse().new_request();
+        env.fs().open(req.wrap(), ino, &fi);
+        check_reply_type(req, TestFuseReplyType::OPEN);
+    }
+    CHECK(read_file(env.fuse(), env.fs(), ino, fi, 2 * page) == std::string(2 * page, 'p'));
+
+    auto pinned_bytes = [&env](){
+        auto usage_result = env.cache().usage();
+        require_result_ok(usage_result);
+        return usage_result->pinned_bytes;
+    };
+    auto set_pinned = [&](ino_t target, std::string_view value){
+        auto req = env.fuse().new_request();
+        env.fs().setxattr(req.wrap(), target, "user.dragonstash.pinned", value, 0);
+        return req;
+    };
+    auto get_pinned = [&](){
+        auto req = env.fuse().new_request();
+        env.fs().getxattr(req.wrap(), ino, "user.dragonstash.pinned", 4096);
+        check_reply_type(req, TestFuseReplyType::BUF);
+        return std::get<TestFuseReplyBuf>(req.reply_argv());
+    };
+
+    GIVEN("A cached file which is not pinned") {
+        THEN("It is reported as unpinned") {
+            CHECK(get_pinned() == "0");
+            CHECK(pinned_bytes() == 0);
+        }
+    }
+
+    WHEN("Pinning the file") {
+        auto req = set_pinned(ino, "1");
+
+        THEN("It is reported as pinned") {
+            check_reply_error(req, 0);
+            CHECK(get_pinned() == "1");
+        }
+
+        THEN("Its cached data counts as pinned") {
+            check_reply_error(req, 0);
+            CHECK(pinned_bytes() == 2 * page);
+        }
+
+        THEN("The pin survives a refresh of the attributes") {
+            check_reply_error(req, 0);
+            require_result_ok(lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md"));
+            CHECK(get_pinned() == "1");
+        }
+
+        AND_WHEN("Discarding part of its data") {
+            auto punch_req = env.fuse().new_request();
+            env.fs().fallocate(punch_req.wrap(), ino,
+                               FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                               0, page, &fi);
+            check_reply_error(punch_req, 0);
+
+            THEN("The pinned bytes follow") {
+                CHECK(pinned_bytes() == page);
+            }
+        }
+
+        AND_WHEN("Removing the attribute") {
+            auto remove_req = env.fuse().new_request();
+            env.fs().removexattr(remove_req.wrap(), ino, "user.dragonstash.pinned");
+
+            THEN("The file is no longer pinned") {
+                check_reply_error(remove_req, 0);
+                CHECK(get_pinned() == "0");
+                CHECK(pinned_bytes() == 0);
+            }
+        }
+    }
+
+    WHEN("Setting an invalid value") {
+        auto req = set_pinned(ino, "yes");
+
+        THEN("It is rejected") {
+            check_reply_error(req, EINVAL);
+        }
+    }
+
+    WHEN("Pinning a directory") {
+        auto req = set_pinned(Dragonstash::ROOT_INO, "1");
+
+        THEN("It is rejected") {
+            check_reply_error(req, EINVAL);
+        }
+    }
+
+    {
+        auto req = env.fuse().new_request();
+        env.fs().release(req.wrap(), ino, &fi);
+        check_reply_error(req, 0);
+    }
+}
+
+SCENARIO("Compacting the metadata database of a mount") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+    require_result_ok(lookup_result);
+    const ino_t ino = *lookup_result;
+
+    auto compact = [&](ino_t target){
+        auto req = env.fuse().new_request();
+        env.fs().setxattr(req.wrap(), target, "user.dragonstash.compact", "1", 0);
+        return req;
+    };
+
+    GIVEN("A mount which has not been compacted yet") {
+        auto req = env.fuse().new_request();
+        env.fs().getxattr(req.wrap(), Dragonstash::ROOT_INO,
+                          "user.dragonstash.compact", 4096);
+
+        THEN("There are no sizes to report") {
+            check_reply_error(req, ENODATA);
+        }
+    }
+
+    WHEN("Setting the control attribute on the root directory") {
+        auto req = compact(Dragonstash::ROOT_INO);
+
+        THEN("It succeeds") {
+            check_reply_error(req, 0);
+        }
+
+        THEN("The sizes before and after can be read back") {
+            check_reply_error(req, 0);
+            auto get_req = env.fuse().new_request();
+            env.fs().getxattr(get_req.wrap(), Dragonstash::ROOT_INO,
+                              "user.dragonstash.compact", 4096);
+            check_reply_type(get_req, TestFuseReplyType::BUF);
+            std::istringstream value(std::get<TestFuseReplyBuf>(get_req.reply_argv()));
+            std::uint64_t size_before = 0, size_after = 0;
+            value >> size_before >> size_after;
+            CHECK(size_after > 0);
+            CHECK(size_after <= size_before);
+        }
+
+        THEN("The cached entries are still there") {
+            check_reply_error(req, 0);
+            env.backend().set_connected(false);
+            auto lookup_result = lookup(env.fuse(), env.fs(),
+                                        Dragonstash::ROOT_INO, "README.md");
+            require_result_ok(lookup_result);
+            CHECK(*lookup_result == ino);
+        }
+    }
+
+    WHEN("Setting the control attribute on another inode") {
+        auto req = compact(ino);
+
+        THEN("It is not supported") {
+            check_reply_error(req, ENOTSUP);
+        }
+    }
+
+    WHEN("Compacting while another thread reads") {
+        std::atomic_bool stop{false};
+        std::atomic_uint64_t reads{0};
+        std::atomic_uint64_t failures{0};
+        std::thread reader([&env, ino, &stop, &reads, &failures](){
+            std::uint64_t id = 1000000;
+            while (!stop) {
+                TestFuseRequest req(id++);
+                env.fs().getattr(req.wrap(), ino, nullptr);
+                if (!req.has_reply() || req.reply_type() != TestFuseReplyType::ATTR) {
+                    failures += 1;
+                }
+                reads += 1;
+            }
+        });
+        while (reads == 0) {
+            std::this_thread::yield();
+        }
+        auto req = compact(Dragonstash::ROOT_INO);
+        stop = true;
+        reader.join();
+
+        THEN("The reader never fails") {
+            check_reply_error(req, 0);
+            CHECK(failures == 0);
+        }
+    }
+}
+
+SCENARIO("Verification of cached data") {
+    Dragonstash::VerifyOptions verify_options;
+    verify_options.mode = Dragonstash::VerifyMode::ALWAYS;
+    TestEnvironment env(verify_options);
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::string initial_contents(2 * Dragonstash::CACHE_PAGE_SIZE, 'x');
+    backend_file.data().assign(reinterpret_cast<const std::byte*>(initial_contents.data()),
+                               initial_contents.size());
+    backend_file.attr().size = initial_contents.size();
+
+    GIVEN("A cached file whose data gets corrupted on the cache disk") {
+        auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(lookup_result);
+        const ino_t ino = *lookup_result;
+
+        struct fuse_file_info fi{};
+        fi.flags = O_RDWR;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), ino, &fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+        CHECK(read_file(env.fuse(), env.fs(), ino, fi, initial_contents.size()) == initial_contents);
+
+        auto file = env.cache().open_file(ino);
+        require_result_ok(file);
+        REQUIRE(::pwrite((*file)->fd(), "rot", 3, Dragonstash::CACHE_PAGE_SIZE + 17) == 3);
+
+        WHEN("Reading the file") {
+            auto contents = read_file(env.fuse(), env.fs(), ino, fi, initial_contents.size());
+
+            THEN("The corrupt block is fetched again") {
+                CHECK(contents == initial_contents);
+                CHECK(env.fs().verifier().stats().corrupt_blocks == 1);
+            }
+        }
+
+        WHEN("Reading the file while disconnected") {
+            env.backend().set_connected(false);
+            auto req = env.fuse().new_request();
+            env.fs().read(req.wrap(), ino, initial_contents.size(), 0, &fi);
+
+            THEN("EIO is returned instead of the corrupt data") {
+                check_reply_error(req, EIO);
+            }
+        }
+
+        WHEN("Scrubbing the cache") {
+            env.fs().verifier().scrub();
+
+            THEN("The corrupt block is dropped") {
+                CHECK((*file)->blocks(Dragonstash::Blocklist::READ) == 1);
+                auto usage_result = env.cache().usage();
+                require_result_ok(usage_result);
+                CHECK(usage_result->cached_bytes == Dragonstash::CACHE_PAGE_SIZE);
+            }
+        }
+
+        WHEN("Writing to the file and corrupting the written block") {
+            write_file(env.fuse(), env.fs(), ino, fi, "y", 0);
+            REQUIRE(::pwrite((*file)->fd(), "rot", 3, 17) == 3);
+            auto req = env.fuse().new_request();
+            env.fs().read(req.wrap(), ino, 4096, 0, &fi);
+
+            THEN("EIO is returned, because the data cannot be fetched again") {
+                check_reply_error(req, EIO);
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), ino, &fi);
+            check_reply_error(req, 0);
+        }
+    }
+}
+
+SCENARIO("Copying file ranges") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::size_t page = Dragonstash::CACHE_PAGE_SIZE;
+    std::string initial_contents;
+    for (std::size_t i = 0; i < 2 * page + 100; ++i) {
+        initial_contents.push_back('a' + i % 26);
+    }
+    backend_file.data().assign(reinterpret_cast<const std::byte*>(initial_contents.data()),
+                               initial_contents.size());
+    backend_file.attr().size = initial_contents.size();
+
+    GIVEN("Two open files") {
+        auto src_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(src_result);
+        const ino_t src_ino = *src_result;
+        auto dir_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "books");
+        require_result_ok(dir_result);
+        auto dest_result = lookup(env.fuse(), env.fs(), *dir_result, "The Elements of Style.epub");
+        require_result_ok(dest_result);
+        const ino_t dest_ino = *dest_result;
+
+        struct fuse_file_info src_fi{};
+        src_fi.flags = O_RDONLY;
+        struct fuse_file_info dest_fi{};
+        dest_fi.flags = O_RDWR;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), src_ino, &src_fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), dest_ino, &dest_fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+
+        auto copy = [&](off_t off_in, off_t off_out, std::size_t len){
+            auto req = env.fuse().new_request();
+            env.fs().copy_file_range(req.wrap(), src_ino, off_in, &src_fi,
+                                     dest_ino, off_out, &dest_fi, len, 0);
+            check_reply_type(req, TestFuseReplyType::WRITE);
+            return std::get<TestFuseReplyWrite>(req.reply_argv());
+        };
+
+        WHEN("Copying the whole file") {
+            CHECK(copy(0, 0, 3 * page) == initial_contents.size());
+
+            THEN("The destination has the contents of the source") {
+                CHECK(read_file(env.fuse(), env.fs(), dest_ino, dest_fi, 3 * page) == initial_contents);
+            }
+
+            THEN("The destination is marked dirty") {
+                auto txn = env.cache().begin_ro();
+                auto flag_result = txn.test_flag(dest_ino, Dragonstash::InodeFlag::DIRTY);
+                require_result_ok(flag_result);
+                CHECK(*flag_result);
+            }
+
+            THEN("The source has been cached along the way") {
+                env.backend().set_connected(false);
+                CHECK(read_file(env.fuse(), env.fs(), src_ino, src_fi, 3 * page) == initial_contents);
+            }
+        }
+
+        WHEN("Copying an unaligned range of cached data while disconnected") {
+            (void)read_file(env.fuse(), env.fs(), src_ino, src_fi, 3 * page);
+            (void)read_file(env.fuse(), env.fs(), dest_ino, dest_fi);
+            env.backend().set_connected(false);
+
+            CHECK(copy(100, 10, page) == page);
+
+            THEN("The copied data is visible in the destination") {
+                CHECK(read_file(env.fuse(), env.fs(), dest_ino, dest_fi, page + 10) ==
+                      std::string(10, '\0') + initial_contents.substr(100, page));
+            }
+        }
+
+        WHEN("Copying uncached data while disconnected") {
+            env.backend().set_connected(false);
+
+            auto req = env.fuse().new_request();
+            env.fs().copy_file_range(req.wrap(), src_ino, 0, &src_fi,
+                                     dest_ino, 0, &dest_fi, page, 0);
+
+            THEN("EIO is returned") {
+                check_reply_error(req, EIO);
+            }
+        }
+
+        WHEN("Copying from beyond the end of the source") {
+            THEN("Nothing is copied") {
+                CHECK(copy(initial_contents.size(), 0, page) == 0);
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), src_ino, &src_fi);
+            check_reply_error(req, 0);
+        }
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), dest_ino, &dest_fi);
+            check_reply_error(req, 0);
+        }
+    }
+}
+
+SCENARIO("Offline changes") {
+    TestEnvironment env;
+    env.with_default_contents();
+
+    {
+        auto req = env.fuse().new_request();
+        struct fuse_file_info fi{};
+        env.fs().opendir(req.wrap(), Dragonstash::ROOT_INO, &fi);
+        check_reply_type(req, TestFuseReplyType::OPEN);
+    }
+    auto readme_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+    require_result_ok(readme_result);
+    const ino_t readme_ino = *readme_result;
+
+    auto reconnect_and_flush = [&env](ino_t ino){
+        env.backend().set_connected(true);
+        auto req = env.fuse().new_request();
+        struct fuse_file_info fi{};
+        env.fs().flush(req.wrap(), ino, &fi);
+        check_reply_error(req, 0);
+    };
+
+    auto journal_empty = [&env](){
+        auto txn = env.cache().begin_ro();
+        return txn.journal_empty();
+    };
+
+    GIVEN("A connected backend") {
+        WHEN("Creating a directory") {
+            auto req = env.fuse().new_request();
+            env.fs().mkdir(req.wrap(), Dragonstash::ROOT_INO, "new", 0750);
+            check_reply_type(req, TestFuseReplyType::ENTRY);
+
+            THEN("It is created on the backend right away") {
+                auto stat_result = env.backend().lstat("/new");
+                require_result_ok(stat_result);
+                CHECK(stat_result->mode == (S_IFDIR | 0750));
+                CHECK(journal_empty());
+            }
+        }
+    }
+
+    GIVEN("A disconnected backend") {
+        env.backend().set_connected(false);
+
+        WHEN("Creating a directory") {
+            auto req = env.fuse().new_request();
+            env.fs().mkdir(req.wrap(), Dragonstash::ROOT_INO, "new", 0750);
+            check_reply_type(req, TestFuseReplyType::ENTRY);
+            const ino_t ino = std::get<TestFuseReplyEntry>(req.reply_argv()).ino;
+
+            THEN("It can be looked up") {
+                auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "new");
+                require_result_ok(lookup_result);
+                CHECK(*lookup_result == ino);
+            }
+
+            THEN("The operation is journaled") {
+                CHECK(!journal_empty());
+            }
+
+            AND_WHEN("Creating it again") {
+                auto req = env.fuse().new_request();
+                env.fs().mkdir(req.wrap(), Dragonstash::ROOT_INO, "new", 0750);
+
+                THEN("EEXIST is returned") {
+                    check_reply_error(req, EEXIST);
+                }
+            }
+
+            AND_WHEN("Reconnecting and flushing") {
+                reconnect_and_flush(ino);
+
+                THEN("The directory exists on the backend") {
+                    auto stat_result = env.backend().lstat("/new");
+                    require_result_ok(stat_result);
+                    CHECK(stat_result->mode == (S_IFDIR | 0750));
+                    CHECK(journal_empty());
+                }
+            }
+        }
+
+        WHEN("Creating and writing a file") {
+            auto req = env.fuse().new_request();
+            struct fuse_file_info fi{};
+            fi.flags = O_RDWR;
+            env.fs().create(req.wrap(), Dragonstash::ROOT_INO, "notes.txt", 0640, &fi);
+            check_reply_type(req, TestFuseReplyType::CREATE);
+            const auto &[entry, created_fi] = std::get<TestFuseReplyCreate>(req.reply_argv());
+            const ino_t ino = entry.ino;
+            fi = created_fi;
+
+            write_file(env.fuse(), env.fs(), ino, fi, "offline", 0);
+
+            THEN("The data can be read back") {
+                CHECK(read_file(env.fuse(), env.fs(), ino, fi) == "offline");
+            }
+
+            AND_WHEN("Reconnecting and flushing") {
+                reconnect_and_flush(ino);
+
+                THEN("The file and its data exist on the backend") {
+                    auto find_result = env.backend().find("/notes.txt");
+                    require_result_ok(find_result);
+                    auto &file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+                    CHECK(std::string(reinterpret_cast<const char*>(file.data().data()),
+                                      file.data().size()) == "offline");
+                    CHECK(file.attr().mode == (S_IFREG | 0640));
+                }
+            }
+
+            AND_WHEN("Unlinking it again, reconnecting and flushing") {
+                auto req = env.fuse().new_request();
+                env.fs().unlink(req.wrap(), Dragonstash::ROOT_INO, "notes.txt");
+                check_reply_error(req, 0);
+
+                reconnect_and_flush(ino);
+
+                THEN("The backend never sees the file") {
+                    CHECK(env.backend().lstat("/notes.txt").error() == ENOENT);
+                    CHECK(journal_empty());
+                }
+            }
+
+            {
+                auto req = env.fuse().new_request();
+                env.fs().release(req.wrap(), ino, &fi);
+                check_reply_error(req, 0);
+            }
+        }
+
+        WHEN("Renaming a file") {
+            auto req = env.fuse().new_request();
+            env.fs().rename(req.wrap(), Dragonstash::ROOT_INO, "README.md",
+                            Dragonstash::ROOT_INO, "README.txt", 0);
+            check_reply_error(req, 0);
+
+            THEN("The inode is found under the new name only") {
+                auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.txt");
+                require_result_ok(lookup_result);
+                CHECK(*lookup_result == readme_ino);
+                check_result_error(lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md"),
+                                   ENOENT);
+            }
+
+            AND_WHEN("Reconnecting") {
+                env.backend().set_connected(true);
+
+                THEN("Lookups are served from the cache until the journal is replayed") {
+                    check_result_error(lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md"),
+                                       ENOENT);
+                }
+
+                AND_WHEN("Flushing") {
+                    reconnect_and_flush(readme_ino);
+
+                    THEN("The file has been renamed on the backend") {
+                        CHECK(env.backend().lstat("/README.md").error() == ENOENT);
+                        require_result_ok(env.backend().lstat("/README.txt"));
+                    }
+                }
+            }
+        }
+
+        WHEN("Changing the mode of a file") {
+            struct stat attr{};
+            attr.st_mode = S_IFREG | 0600;
+            auto req = env.fuse().new_request();
+            env.fs().setattr(req.wrap(), readme_ino, attr, FUSE_SET_ATTR_MODE, nullptr);
+            check_reply_type(req, TestFuseReplyType::ATTR);
+
+            THEN("The new mode is returned") {
+                CHECK(std::get<0>(std::get<TestFuseReplyAttr>(req.reply_argv())).st_mode ==
+                      (S_IFREG | 0600));
+            }
+
+            AND_WHEN("Reconnecting and flushing") {
+                reconnect_and_flush(readme_ino);
+
+                THEN("The mode has changed on the backend") {
+                    auto stat_result = env.backend().lstat("/README.md");
+                    require_result_ok(stat_result);
+                    CHECK(stat_result->mode == (S_IFREG | 0600));
+                }
+            }
+        }
+
+        WHEN("Removing a directory which is not synced") {
+            auto req = env.fuse().new_request();
+            env.fs().rmdir(req.wrap(), Dragonstash::ROOT_INO, "books");
+
+            THEN("EIO is returned") {
+                check_reply_error(req, EIO);
+            }
+        }
+    }
+}
+
+SCENARIO("In-memory hot tier") {
+    Dragonstash::HotTierOptions hot_tier_options;
+    hot_tier_options.capacity = 16 * Dragonstash::CACHE_PAGE_SIZE;
+    TestEnvironment env(Dragonstash::VerifyOptions(), Dragonstash::PrefetchOptions(),
+                        Dragonstash::DirPrefetchOptions(), hot_tier_options);
+    env.with_default_contents();
+
+    auto find_result = env.backend().find("/README.md");
+    require_result_ok(find_result);
+    auto &backend_file = dynamic_cast<Dragonstash::Backend::InMemory::File&>(**find_result);
+    const std::size_t page = Dragonstash::CACHE_PAGE_SIZE;
+    std::string contents(page, 'a');
+    contents.append(page, 'b');
+    contents.append(100, 'c');
+    backend_file.data().assign(reinterpret_cast<const std::byte*>(contents.data()),
+                               contents.size());
+    backend_file.attr().size = contents.size();
+
+    GIVEN("An open file") {
+        auto lookup_result = lookup(env.fuse(), env.fs(), Dragonstash::ROOT_INO, "README.md");
+        require_result_ok(lookup_result);
+        const ino_t ino = *lookup_result;
+
+        struct fuse_file_info fi{};
+        fi.flags = O_RDWR;
+        {
+            auto req = env.fuse().new_request();
+            env.fs().open(req.wrap(), ino, &fi);
+            check_reply_type(req, TestFuseReplyType::OPEN);
+        }
+
+        WHEN("The file is read repeatedly") {
+            for (int i = 0; i < 3; ++i) {
+                CHECK(read_file(env.fuse(), env.fs(), ino, fi, contents.size()) == contents);
+            }
+
+            THEN("Each tier has served one read") {
+                const auto stats = env.fs().read_stats();
+                CHECK(stats.backend == 1);
+                CHECK(stats.disk == 1);
+                CHECK(stats.memory == 1);
+            }
+
+            THEN("The blocks are resident in memory") {
+                CHECK(env.fs().hot_tier().stats().resident == 3);
+            }
+
+            AND_WHEN("The file is written") {
+                write_file(env.fuse(), env.fs(), ino, fi, "X", page);
+
+                THEN("The new data is read from disk") {
+                    std::string expected(contents);
+                    expected[page] = 'X';
+                    CHECK(read_file(env.fuse(), env.fs(), ino, fi, contents.size()) == expected);
+                    CHECK(env.fs().read_stats().memory == 1);
+                    CHECK(env.fs().hot_tier().stats().invalidated == 3);
+                }
+            }
+
+            AND_WHEN("The file is truncated") {
+                struct stat attr{};
+                attr.st_size = 10;
+                auto req = env.fuse().new_request();
+                env.fs().setattr(req.wrap(), ino, attr, FUSE_SET_ATTR_SIZE, &fi);
+                check_reply_type(req, TestFuseReplyType::ATTR);
+
+                THEN("The remaining data is read from disk") {
+                    CHECK(read_file(env.fuse(), env.fs(), ino, fi, contents.size()) == contents.substr(0, 10));
+                    CHECK(env.fs().read_stats().memory == 1);
+                }
+            }
+        }
+
+        {
+            auto req = env.fuse().new_request();
+            env.fs().release(req.wrap(), ino, &fi);
+            check_reply_error(req, 0);
+        }
+    }
+}
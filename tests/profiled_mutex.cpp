@@ -0,0 +1,163 @@
+/**********************************************************************
+File name: profiled_mutex.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <thread>
+
+#include "dragonstash/profiled_mutex.hpp"
+
+using Dragonstash::LockHistogram;
+using Dragonstash::LockProfile;
+using Dragonstash::LockSite;
+using Dragonstash::profiled_mutex;
+
+namespace {
+
+struct ProfilingEnabled {
+    ProfilingEnabled() {
+        Dragonstash::set_lock_profiling(true);
+    }
+
+    ~ProfilingEnabled() {
+        Dragonstash::set_lock_profiling(false);
+    }
+};
+
+}
+
+TEST_CASE("Profiled mutexes do not count while profiling is disabled", "[profiled_mutex]")
+{
+    LockSite site("test.disabled");
+    profiled_mutex mutex(site);
+    {
+        std::lock_guard<profiled_mutex> lock(mutex);
+    }
+    CHECK(mutex.try_lock());
+    mutex.unlock();
+
+    LockProfile profile(site);
+    CHECK(profile.acquisitions == 0);
+    CHECK(profile.contended == 0);
+    CHECK(LockProfile::quantile(profile.hold, 0.5) == 0);
+}
+
+TEST_CASE("Profiled mutexes count uncontended acquisitions", "[profiled_mutex]")
+{
+    ProfilingEnabled profiling;
+    LockSite site("test.uncontended");
+    profiled_mutex mutex(site);
+    for (int i = 0; i < 10; ++i) {
+        std::lock_guard<profiled_mutex> lock(mutex);
+    }
+    CHECK(mutex.try_lock());
+    mutex.unlock();
+
+    LockProfile profile(site);
+    CHECK(profile.acquisitions == 11);
+    CHECK(profile.contended == 0);
+    std::uint64_t holds = 0;
+    for (auto n: profile.hold) {
+        holds += n;
+    }
+    CHECK(holds == 11);
+    CHECK(LockProfile::quantile(profile.wait, 0.99) == 0);
+}
+
+TEST_CASE("Profiled mutexes account waiting for another holder", "[profiled_mutex]")
+{
+    ProfilingEnabled profiling;
+    LockSite site("test.contended");
+    profiled_mutex mutex(site);
+
+    std::atomic<bool> waiting(false);
+    mutex.lock();
+    std::thread other([&mutex, &waiting]() {
+        waiting = true;
+        std::lock_guard<profiled_mutex> lock(mutex);
+    });
+    while (!waiting) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    mutex.unlock();
+    other.join();
+
+    LockProfile profile(site);
+    CHECK(profile.acquisitions == 2);
+    CHECK(profile.contended == 1);
+    // the second thread waited for at least most of the sleep
+    CHECK(LockProfile::quantile(profile.wait, 1.0) >= 10'000'000);
+    CHECK(LockProfile::total(profile.hold) >= 10'000'000);
+}
+
+TEST_CASE("Profiled mutexes detect self-deadlock", "[profiled_mutex]")
+{
+    if (!profiled_mutex::is_safe) {
+        return;
+    }
+    LockSite site("test.deadlock");
+    profiled_mutex mutex(site);
+    std::lock_guard<profiled_mutex> lock(mutex);
+    CHECK_THROWS_AS(mutex.lock(), std::system_error);
+    CHECK_THROWS_AS(mutex.try_lock(), std::system_error);
+}
+
+TEST_CASE("Lock sites are shared by name", "[profiled_mutex]")
+{
+    ProfilingEnabled profiling;
+    profiled_mutex m1("test.shared");
+    profiled_mutex m2("test.shared");
+    CHECK(&m1.site() == &m2.site());
+
+    Dragonstash::reset_lock_profiles();
+    m1.lock();
+    m1.unlock();
+    m2.lock();
+    m2.unlock();
+
+    bool found = false;
+    for (const auto &profile: Dragonstash::lock_profiles()) {
+        if (profile.name == "test.shared") {
+            found = true;
+            CHECK(profile.acquisitions == 2);
+        }
+    }
+    CHECK(found);
+}
+
+TEST_CASE("Lock histogram quantiles return bucket upper bounds", "[profiled_mutex]")
+{
+    LockHistogram histogram{};
+    CHECK(LockProfile::quantile(histogram, 0.5) == 0);
+
+    // 90 durations in [512, 1024) ns, 10 in [2^20, 2^21) ns
+    histogram[10] = 90;
+    histogram[21] = 10;
+    CHECK(LockProfile::quantile(histogram, 0.5) == 1023);
+    CHECK(LockProfile::quantile(histogram, 0.9) == 1023);
+    CHECK(LockProfile::quantile(histogram, 0.99) == (1u << 21) - 1);
+    CHECK(LockProfile::total(histogram) == 90 * 768 + 10 * (3u << 19));
+}
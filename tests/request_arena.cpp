@@ -0,0 +1,186 @@
+/**********************************************************************
+File name: request_arena.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dragonstash/request_arena.hpp"
+
+using Dragonstash::RequestArena;
+using Dragonstash::RequestScope;
+
+namespace {
+
+/**
+ * Upstream resource which counts what the arena takes from it.
+ */
+class CountingResource: public std::pmr::memory_resource
+{
+public:
+    std::size_t allocations = 0;
+    std::size_t live = 0;
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        allocations += 1;
+        live += 1;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        live -= 1;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+}
+
+TEST_CASE("Request arena hands out memory from its block until reset", "[request_arena]")
+{
+    CountingResource upstream;
+    {
+        RequestArena arena(1024, &upstream);
+        CHECK(upstream.allocations == 1);
+        CHECK(arena.capacity() == 1024);
+
+        void *first = arena.allocate(100, 8);
+        void *second = arena.allocate(100, 8);
+        CHECK(first != second);
+        CHECK(arena.used() >= 200);
+        CHECK(upstream.allocations == 1);
+
+        // deallocation does not make the memory available again ...
+        arena.deallocate(second, 100, 8);
+        CHECK(arena.allocate(100, 8) != second);
+
+        // ... but reset does
+        arena.reset();
+        CHECK(arena.used() == 0);
+        CHECK(arena.allocate(100, 8) == first);
+        CHECK(upstream.allocations == 1);
+        CHECK(arena.overflows() == 0);
+    }
+    CHECK(upstream.live == 0);
+}
+
+TEST_CASE("Request arena respects the alignment of allocations", "[request_arena]")
+{
+    RequestArena arena(4096);
+    (void)arena.allocate(1, 1);
+    for (std::size_t alignment: {2, 8, 16, 64, 256}) {
+        void *p = arena.allocate(3, alignment);
+        CHECK(reinterpret_cast<std::uintptr_t>(p) % alignment == 0);
+    }
+    CHECK(arena.overflows() == 0);
+}
+
+TEST_CASE("Request arena grows its block after an overflow", "[request_arena]")
+{
+    CountingResource upstream;
+    {
+        RequestArena arena(1024, &upstream);
+        for (int i = 0; i < 10; ++i) {
+            (void)arena.allocate(512, 8);
+        }
+        CHECK(arena.overflows() > 0);
+        CHECK(arena.used() >= 5120);
+        CHECK(upstream.allocations > 1);
+
+        arena.reset();
+        CHECK(arena.capacity() >= 5120);
+        CHECK(upstream.live == 1);
+
+        // the same request fits into the block now
+        const std::uint64_t overflows = arena.overflows();
+        const std::size_t allocations = upstream.allocations;
+        for (int i = 0; i < 10; ++i) {
+            (void)arena.allocate(512, 8);
+        }
+        CHECK(arena.overflows() == overflows);
+        CHECK(upstream.allocations == allocations);
+    }
+    CHECK(upstream.live == 0);
+}
+
+TEST_CASE("Request arena does not grow beyond its maximum size", "[request_arena]")
+{
+    RequestArena arena(1024);
+    (void)arena.allocate(Dragonstash::REQUEST_ARENA_MAX_SIZE * 2, 8);
+    arena.reset();
+    CHECK(arena.capacity() == Dragonstash::REQUEST_ARENA_MAX_SIZE);
+    CHECK(arena.used() == 0);
+}
+
+TEST_CASE("Request scope routes request memory to the thread arena", "[request_arena]")
+{
+    CHECK(Dragonstash::request_memory() == std::pmr::get_default_resource());
+
+    std::pmr::memory_resource *outer_memory = nullptr;
+    {
+        RequestScope scope;
+        outer_memory = Dragonstash::request_memory();
+        CHECK(outer_memory != std::pmr::get_default_resource());
+
+        std::pmr::string name("a name which does not fit into the SSO buffer",
+                              Dragonstash::request_memory());
+        {
+            RequestScope nested;
+            CHECK(Dragonstash::request_memory() == outer_memory);
+        }
+        // the nested scope must not have reset the arena
+        CHECK(name == "a name which does not fit into the SSO buffer");
+
+        // other threads have their own arena, if any
+        std::pmr::memory_resource *unscoped_memory = nullptr;
+        std::pmr::memory_resource *scoped_memory = nullptr;
+        std::thread([&]() {
+            unscoped_memory = Dragonstash::request_memory();
+            RequestScope scope;
+            scoped_memory = Dragonstash::request_memory();
+        }).join();
+        CHECK(unscoped_memory == std::pmr::get_default_resource());
+        CHECK(scoped_memory != std::pmr::get_default_resource());
+        CHECK(scoped_memory != outer_memory);
+    }
+
+    CHECK(Dragonstash::request_memory() == std::pmr::get_default_resource());
+}
+
+TEST_CASE("Request scope uses the default resource while arenas are disabled", "[request_arena]")
+{
+    Dragonstash::set_request_arenas(false);
+    {
+        RequestScope scope;
+        CHECK(Dragonstash::request_memory() == std::pmr::get_default_resource());
+    }
+    Dragonstash::set_request_arenas(true);
+}
@@ -116,6 +116,17 @@ static int dummy_reply_buf(fuse_req_t req, const char *data, size_t sz)
     return 0;
 }
 
+static int dummy_reply_iov(fuse_req_t req, const iovec *iov, int count)
+{
+    // the client cannot tell the difference to reply_buf
+    std::string data;
+    for (int i = 0; i < count; ++i) {
+        data.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    get_impl(req).record_reply(TestFuseReplyType::BUF, std::move(data));
+    return 0;
+}
+
 static int dummy_reply_data(fuse_req_t req, struct fuse_bufvec *bv,
                             enum fuse_buf_copy_flags flags)
 {
@@ -123,6 +134,18 @@ static int dummy_reply_data(fuse_req_t req, struct fuse_bufvec *bv,
     return 0;
 }
 
+static int dummy_reply_statfs(fuse_req_t req, const struct statvfs *stbuf)
+{
+    get_impl(req).record_reply(TestFuseReplyType::STATFS, *stbuf);
+    return 0;
+}
+
+static int dummy_reply_xattr(fuse_req_t req, size_t count)
+{
+    get_impl(req).record_reply(TestFuseReplyType::XATTR, count);
+    return 0;
+}
+
 
 TestFuseRequest::TestFuseRequest(uint64_t id):
     m_id(id)
@@ -150,7 +173,10 @@ TestFuseBackend::TestFuseBackend():
     Fuse::backend.reply_open = &dummy_reply_open;
     Fuse::backend.reply_write = &dummy_reply_write;
     Fuse::backend.reply_buf = &dummy_reply_buf;
+    Fuse::backend.reply_iov = &dummy_reply_iov;
     Fuse::backend.reply_data = &dummy_reply_data;
+    Fuse::backend.reply_statfs = &dummy_reply_statfs;
+    Fuse::backend.reply_xattr = &dummy_reply_xattr;
 }
 
 TestFuseBackend::~TestFuseBackend()
@@ -308,4 +334,20 @@ TEST_CASE("Reply interception", "[selftest]")
         REQUIRE(std::holds_alternative<TestFuseReplyBuf>(req_wrap.reply_argv()));
         CHECK(std::get<TestFuseReplyBuf>(req_wrap.reply_argv()) == copy);
     }
+
+    SECTION("reply_iov") {
+        char first[] = "foo ";
+        char second[] = "bar";
+        const iovec iov[] = {
+            {.iov_base = first, .iov_len = 4},
+            {.iov_base = second, .iov_len = 3},
+        };
+
+        req.reply_iov(iov, 2);
+
+        REQUIRE(req_wrap.has_reply());
+        CHECK(req_wrap.reply_type() == TestFuseReplyType::BUF);
+        REQUIRE(std::holds_alternative<TestFuseReplyBuf>(req_wrap.reply_argv()));
+        CHECK(std::get<TestFuseReplyBuf>(req_wrap.reply_argv()) == "foo bar");
+    }
 }
@@ -30,6 +30,8 @@ authors named in the AUTHORS file.
 #include <variant>
 #include <tuple>
 
+#include <sys/statvfs.h>
+
 #include "dragonstash/fuse/request.hpp"
 
 
@@ -44,6 +46,8 @@ enum class TestFuseReplyType {
     WRITE,
     BUF,
     DATA,
+    STATFS,
+    XATTR,
 };
 
 
@@ -57,7 +61,9 @@ using TestFuseReplyOpen = fuse_file_info;
 using TestFuseReplyWrite = size_t;
 using TestFuseReplyBuf = TestFuseReplyReadlink;
 using TestFuseReplyData = std::tuple<fuse_bufvec, fuse_buf_copy_flags>;
-using TestFuseReplyVariant = std::variant<TestFuseReplyNone, TestFuseReplyErr, TestFuseReplyEntry, TestFuseReplyCreate, TestFuseReplyAttr, TestFuseReplyReadlink, TestFuseReplyOpen, TestFuseReplyWrite, TestFuseReplyData>;
+using TestFuseReplyStatfs = struct statvfs;
+using TestFuseReplyXattr = size_t;
+using TestFuseReplyVariant = std::variant<TestFuseReplyNone, TestFuseReplyErr, TestFuseReplyEntry, TestFuseReplyCreate, TestFuseReplyAttr, TestFuseReplyReadlink, TestFuseReplyOpen, TestFuseReplyWrite, TestFuseReplyData, TestFuseReplyStatfs>;
 using TestFuseReplyWrapper = std::tuple<TestFuseReplyType, TestFuseReplyVariant>;
 
 
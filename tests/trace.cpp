@@ -0,0 +1,158 @@
+/**********************************************************************
+File name: trace.cpp
+This file is part of: DragonStash
+
+LICENSE
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+FEEDBACK & QUESTIONS
+
+For feedback and questions about DragonStash please e-mail one of the
+authors named in the AUTHORS file.
+**********************************************************************/
+#include <catch2/catch.hpp>
+
+#include <fcntl.h>
+
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include "dragonstash/backend/in_memory.hpp"
+#include "dragonstash/backend/tracing.hpp"
+#include "dragonstash/trace.hpp"
+
+using Dragonstash::TraceEvent;
+using Dragonstash::TraceSpan;
+
+namespace {
+
+struct TracingEnabled {
+    TracingEnabled() {
+        Dragonstash::set_tracing(true);
+    }
+
+    ~TracingEnabled() {
+        Dragonstash::set_tracing(false);
+    }
+};
+
+std::vector<TraceEvent> events_in(const char *category)
+{
+    std::vector<TraceEvent> result;
+    for (const auto &event: Dragonstash::collect_trace()) {
+        if (std::strcmp(event.category, category) == 0) {
+            result.emplace_back(event);
+        }
+    }
+    return result;
+}
+
+}
+
+TEST_CASE("Trace spans are not recorded while tracing is disabled", "[trace]")
+{
+    {
+        const TraceSpan span("test.disabled", "span");
+    }
+    CHECK(events_in("test.disabled").empty());
+}
+
+TEST_CASE("Nested trace spans are recorded with their durations", "[trace]")
+{
+    TracingEnabled tracing;
+    {
+        const TraceSpan outer("test.nested", "outer", 42);
+        {
+            const TraceSpan inner("test.nested", "inner");
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    const auto events = events_in("test.nested");
+    REQUIRE(events.size() == 2);
+    // sorted by start time
+    CHECK(std::strcmp(events[0].name, "outer") == 0);
+    CHECK(events[0].arg == 42);
+    CHECK(std::strcmp(events[1].name, "inner") == 0);
+    CHECK(events[1].arg == 0);
+    CHECK(events[1].duration >= 1000000);
+    CHECK(events[0].start <= events[1].start);
+    CHECK(events[0].start + events[0].duration >=
+          events[1].start + events[1].duration);
+    CHECK(events[0].tid == events[1].tid);
+}
+
+TEST_CASE("Trace buffers keep the most recent events", "[trace]")
+{
+    TracingEnabled tracing;
+    std::thread thread([]() {
+        for (std::size_t i = 0; i < Dragonstash::TRACE_BUFFER_EVENTS + 10; ++i) {
+            const TraceSpan span("test.wrap", "span", i + 1);
+        }
+    });
+    thread.join();
+
+    // the buffer of the exited thread is still collected
+    const auto events = events_in("test.wrap");
+    REQUIRE(events.size() == Dragonstash::TRACE_BUFFER_EVENTS);
+    CHECK(events.front().arg == 11);
+    CHECK(events.back().arg == Dragonstash::TRACE_BUFFER_EVENTS + 10);
+}
+
+TEST_CASE("Traces are written in the Chrome trace event format", "[trace]")
+{
+    TracingEnabled tracing;
+    {
+        const TraceSpan span("test.chrome", "span \"quoted\"", 7);
+    }
+
+    std::ostringstream out;
+    Dragonstash::write_chrome_trace(out);
+    const std::string json = out.str();
+    CHECK(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+    CHECK(json.find("\"ph\":\"X\"") != std::string::npos);
+    CHECK(json.find("\"cat\":\"test.chrome\",\"name\":\"span \\\"quoted\\\"\"") != std::string::npos);
+    CHECK(json.find("\"args\":{\"ino\":7}") != std::string::npos);
+    CHECK(json.find("\n]}\n") != std::string::npos);
+}
+
+TEST_CASE("The tracing backend records every call", "[trace]")
+{
+    using namespace Dragonstash::Backend;
+
+    auto inner = std::make_unique<InMemoryFilesystem>();
+    inner->emplace<InMemory::File>("file");
+    TracingFilesystem fs(std::move(inner));
+
+    TracingEnabled tracing;
+    const auto before = events_in("backend").size();
+    REQUIRE(fs.lstat("/file"));
+    CHECK(fs.lstat("/missing").error() == ENOENT);
+    {
+        auto file = fs.open("/file", O_RDONLY, 0);
+        REQUIRE(file);
+        char buf[16];
+        CHECK((*file)->pread(buf, sizeof(buf), 0));
+        CHECK((*file)->close());
+    }
+
+    const auto events = events_in("backend");
+    REQUIRE(events.size() == before + 5);
+    const char *expected[] = {"lstat", "lstat", "open", "pread", "close"};
+    for (std::size_t i = 0; i < 5; ++i) {
+        CHECK(std::strcmp(events[before + i].name, expected[i]) == 0);
+    }
+}